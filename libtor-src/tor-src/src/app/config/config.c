@@ -101,6 +101,9 @@
 #include "feature/nodelist/nodelist.h"
 #include "feature/nodelist/routerlist.h"
 #include "feature/nodelist/routerset.h"
+#include "feature/payment/ln_rpc.h"
+#include "feature/payment/paid_circ_pool.h"
+#include "feature/payment/payment_util.h"
 #include "feature/relay/dns.h"
 #include "feature/relay/ext_orport.h"
 #include "feature/relay/routermode.h"
@@ -150,6 +153,7 @@
 #include "lib/process/process.h"
 #include "lib/net/gethostname.h"
 #include "lib/thread/numcpus.h"
+#include "lib/trace/trace_ring.h"
 
 #include "lib/encoding/keyval.h"
 #include "lib/fs/conffile.h"
@@ -418,12 +422,14 @@ static const config_var_t option_vars_[] = {
   V(PaymentBolt11Lnurl,                 STRING,   NULL),
   V(PaymentBolt11LightningAddress,      STRING,   NULL),
   V(PaymentRateMsats,                   INT,      NULL), 
-  V(PaymentInterval,                    POSINT,   NULL),
+  V_IMMUTABLE(PaymentInterval,          POSINT,   NULL),
   V(PaymentInvervalRounds,              POSINT,   NULL),
   V(PaymentHandshakeFee,                INT,      NULL),
   V(PaymentBandwidthQuota,              INT,      NULL),
+  V(PaymentTrace,                       BOOL,     "0"),
   // Client Settings
   V(PaymentCircuitMaxFee,               POSINT,   NULL),
+  V(PaymentCircuitPoolSize,             POSINT,   "0"),
   VAR("PaymentLightningNodeConfig",     LINELIST, PaymentLightningNodeConfigurations, NULL),
 
   VPORT(ControlPort),
@@ -2146,6 +2152,9 @@ options_act,(const or_options_t *old_options))
     set_protocol_warning_severity_level(warning_severity);
   }
 
+  trace_ring_set_enabled(options->PaymentTrace);
+  ln_rpc_set_node_config(options->PaymentLightningNodeConfigurations);
+
   if (consider_adding_dir_servers(options, old_options) < 0) {
     // XXXX This should get validated earlier, and committed here, to
     // XXXX lower opportunities for reaching an error case.
@@ -3619,6 +3628,14 @@ options_validate_cb(const void *old_options_, void *options_, char **msg)
   if (options_validate_single_onion(options, msg) < 0)
     return -1;
 
+  if (payment_util_options_validate(options, msg) < 0)
+    return -1;
+  if (paid_circ_pool_options_validate(options, msg) < 0)
+    return -1;
+  if (ln_rpc_node_config_validate(options->PaymentLightningNodeConfigurations,
+                                  msg) < 0)
+    return -1;
+
   if (options->CircuitsAvailableTimeout > MAX_CIRCS_AVAILABLE_TIME) {
     // options_t is immutable for new code (the above code is older),
     // so just make the user fix the value themselves rather than
@@ -4457,7 +4474,7 @@ load_torrc_from_stdin(void)
  *
  * Return the contents of the file on success, and NULL on failure.
  */
-char *
+static char *
 load_torrc_from_disk(const config_line_t *cmd_arg, int defaults_file)
 {
   char *fname=NULL;
@@ -1141,7 +1141,9 @@ struct or_options_t {
   int PaymentInvervalRounds;
   int PaymentHandshakeFee;
   int PaymentBandwidthQuota;
+  int PaymentTrace;
   int PaymentCircuitMaxFee;
+  int PaymentCircuitPoolSize;
   struct config_line_t *PaymentLightningNodeConfigurations;
 
 };
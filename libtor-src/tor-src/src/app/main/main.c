@@ -1301,6 +1301,9 @@ pubsub_connect(void)
      */
     tor_mainloop_set_delivery_strategy("orconn", DELIV_IMMEDIATE);
     tor_mainloop_set_delivery_strategy("ocirc", DELIV_IMMEDIATE);
+    /* Deliver once per mainloop pass, so that all the paid handshakes
+     * answered in one pass reach the controller together. */
+    tor_mainloop_set_delivery_strategy("payhash", DELIV_PROMPT);
   }
 }
 
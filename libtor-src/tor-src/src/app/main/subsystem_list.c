@@ -35,6 +35,7 @@
 #include "feature/dirauth/dirauth_sys.h"
 #include "feature/hs/hs_sys.h"
 #include "feature/metrics/metrics_sys.h"
+#include "feature/payment/payment_sys.h"
 #include "feature/relay/relay_sys.h"
 
 #include <stddef.h>
@@ -73,6 +74,7 @@ const subsys_fns_t *tor_subsystems[] = {
   &sys_hs,
 
   &sys_btrack,
+  &sys_payment,
 
   &sys_dirauth,
   &sys_metrics,
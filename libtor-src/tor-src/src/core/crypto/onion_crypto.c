@@ -50,8 +50,10 @@
 #include "feature/relay/router.h"
 #include "lib/crypt_ops/crypto_dh.h"
 #include "lib/crypt_ops/crypto_util.h"
+#include "lib/trace/trace_ring.h"
 #include "feature/relay/routerkeys.h"
 #include "core/or/congestion_control_common.h"
+#include "feature/payment/payment_util.h"
 
 #include "core/or/circuitbuild.h"
 
@@ -135,7 +137,9 @@ onion_handshake_state_release(onion_handshake_state_t *state)
 /** Perform the first step of a circuit-creation handshake of type <b>type</b>
  * (one of ONION_HANDSHAKE_TYPE_*): generate the initial "onion skin" in
  * <b>onion_skin_out</b> with length of up to <b>onion_skin_out_maxlen</b>,
- * and store any state information in <b>state_out</b>.
+ * and store any state information in <b>state_out</b>. For ntor_v3, also
+ * carry the <b>n_payhashes</b> payment values at <b>payhashes</b> to the
+ * hop.
  * Return -1 on failure, and the length of the onionskin on acceptance.
  */
 int
@@ -144,18 +148,11 @@ onion_skin_create(int type,
                   onion_handshake_state_t *state_out,
                   uint8_t *onion_skin_out,
                   size_t onion_skin_out_maxlen,
-                  const char *eltor_payhash)
+                  const uint8_t *payhashes,
+                  size_t n_payhashes)
 {
   int r = -1;
 
-  if (eltor_payhash) {
-    log_info(LD_GENERAL, "ELTOR onion_skin_create with payhash length: %zu", 
-            strlen(eltor_payhash));
-    log_debug(LD_GENERAL, "ELTOR payhash first 50 chars: %.50s...", eltor_payhash);
-  } else {
-    log_info(LD_GENERAL, "ELTOR onion_skin_create with NO payhash");
-  }
-
   switch (type) {
   case ONION_HANDSHAKE_TYPE_TAP:
     if (onion_skin_out_maxlen < TAP_ONIONSKIN_CHALLENGE_LEN)
@@ -201,39 +198,14 @@ onion_skin_create(int type,
     uint8_t *onion_skin = NULL;
     size_t onion_skin_len = 0;
 
-    // Now handle the payment hash
-    if (eltor_payhash && strlen(eltor_payhash) > 0) {
-      log_notice(LD_GENERAL, "ELTOR CLIENT: Adding payment hash to NTOR_V3 client message");
-      
-      // Create an extended message
-      uint8_t *extended_msg = NULL;
-      size_t extended_msg_len = 0;
-      
-      // The payment hash already contains the "eltor_payhash" prefix
-      // Just append it directly after the original message
-      extended_msg_len = msg_len + strlen(eltor_payhash);
-      extended_msg = tor_malloc(extended_msg_len);
-      
-      // Copy the original message first
-      memcpy(extended_msg, msg, msg_len);
-      
-      // Copy the payment hash with its built-in prefix
-      memcpy(extended_msg + msg_len, eltor_payhash, strlen(eltor_payhash));
-      
-      log_notice(LD_GENERAL, "ELTOR CLIENT: Extended message length: %zu (original: %zu, hash: %zu)", 
-                extended_msg_len, msg_len, strlen(eltor_payhash));
-      log_notice(LD_GENERAL, "ELTOR CLIENT: First 50 bytes of extended message: %s", 
-                hex_str((const char *)extended_msg, MIN(50, extended_msg_len)));
-      
-      // Free original message and replace with extended one
+    /* Carry this hop's payment material as binary extension fields. */
+    if (n_payhashes > 0 &&
+        payment_util_payhash_ext_append(&msg, &msg_len,
+                                        payhashes, n_payhashes) < 0) {
       tor_free(msg);
-      msg = extended_msg;
-      msg_len = extended_msg_len;
+      return -1;
     }
 
-    // Verify message size is reasonable for debug purposes
-    log_notice(LD_GENERAL, "ELTOR CLIENT: Creating NTOR3 handshake with message len=%zu", msg_len);
-
     int status = onion_skin_ntor3_create(
                           &node->ed_identity,
                           &node->curve25519_onion_key,
@@ -241,9 +213,6 @@ onion_skin_create(int type,
                           msg, msg_len,
                           &state_out->u.ntor3,
                           &onion_skin, &onion_skin_len);
-                            
-    log_notice(LD_GENERAL, "ELTOR CLIENT: NTOR3 create returned status=%d, onion_skin_len=%zu", status, onion_skin_len);
-              
     tor_free(msg);
     if (status < 0) {
       return -1;
@@ -257,6 +226,9 @@ onion_skin_create(int type,
     memcpy(onion_skin_out, onion_skin, onion_skin_len);
     tor_free(onion_skin);
     r = (int) onion_skin_len;
+    /* Record the handshake payment hash, the first value, if any. */
+    trace_ring_add("ntor3_create", n_payhashes, payhashes,
+                   n_payhashes ? PAYMENT_HASH_LEN : 0);
     break;
 
   default:
@@ -339,9 +311,7 @@ onion_skin_server_handshake(int type,
                       size_t reply_out_maxlen,
                       uint8_t *keys_out, size_t keys_out_len,
                       uint8_t *rend_nonce_out,
-                      circuit_params_t *params_out,
-                      uint64_t *p_circuit_id,
-                      uint64_t *n_circuit_id)
+                      circuit_params_t *params_out)
 {
   int r = -1;
   memset(params_out, 0, sizeof(*params_out));
@@ -413,7 +383,7 @@ onion_skin_server_handshake(int type,
                onion_skin, onionskin_len,
                NTOR3_VERIFICATION_ARGS,
                &client_msg, &client_msg_len,
-               &state, p_circuit_id, n_circuit_id) < 0) {
+               &state) < 0) {
       return -1;
     }
 
@@ -427,6 +397,26 @@ onion_skin_server_handshake(int type,
       tor_free(client_msg);
       return -1;
     }
+
+    /* Hand the El Tor payment material of this hop back to the main
+     * thread, which binds it to the circuit and tells the controller. */
+    {
+      int n_payhashes = payment_util_payhash_ext_parse(
+                                    client_msg, client_msg_len,
+                                    (uint8_t *) params_out->payhashes,
+                                    PAYMENT_HASHES_PER_HOP);
+      if (n_payhashes < 0) {
+        ntor3_server_handshake_state_free(state);
+        tor_free(client_msg);
+        tor_free(reply_msg);
+        return -1;
+      }
+      params_out->n_payhashes =
+        (uint8_t) MIN(n_payhashes, PAYMENT_HASHES_PER_HOP);
+      trace_ring_add("ntor3_server", params_out->n_payhashes,
+                     params_out->payhashes[0],
+                     params_out->n_payhashes ? PAYMENT_HASH_LEN : 0);
+    }
     tor_free(client_msg);
 
     uint8_t *server_handshake = NULL;
@@ -13,6 +13,7 @@
 #define TOR_ONION_CRYPTO_H
 
 #include "lib/crypt_ops/crypto_ed25519.h"
+#include "feature/payment/payment_util.h"
 
 typedef struct server_onion_keys_t {
   uint8_t my_identity[DIGEST_LEN];
@@ -34,6 +35,11 @@ typedef struct circuit_params_t {
   bool cc_enabled;
   /** The number of cells in a sendme increment. Only used if cc_enabled=1. */
   uint8_t sendme_inc_cells;
+  /** Number of El Tor payment hashes the client sent in this handshake. */
+  uint8_t n_payhashes;
+  /** The payment hashes themselves: the handshake payment hash first, then
+   * the payment id hashes. Only the first n_payhashes are meaningful. */
+  uint8_t payhashes[PAYMENT_HASHES_PER_HOP][PAYMENT_HASH_LEN];
 } circuit_params_t;
 
 int onion_skin_create(int type,
@@ -41,7 +47,8 @@ int onion_skin_create(int type,
                       onion_handshake_state_t *state_out,
                       uint8_t *onion_skin_out,
                       size_t onion_skin_out_maxlen,
-                      const char *eltor_payhash);
+                      const uint8_t *payhashes,
+                      size_t n_payhashes);
 int onion_skin_server_handshake(int type,
                       const uint8_t *onion_skin, size_t onionskin_len,
                       const server_onion_keys_t *keys,
@@ -50,9 +57,7 @@ int onion_skin_server_handshake(int type,
                       size_t reply_out_maxlen,
                       uint8_t *keys_out, size_t keys_out_len,
                       uint8_t *rend_nonce_out,
-                      circuit_params_t *params_out,
-                      uint64_t *p_circuit_id,
-                      uint64_t *n_circuit_id);
+                      circuit_params_t *params_out);
 int onion_skin_client_handshake(int type,
                       const onion_handshake_state_t *handshake_state,
                       const uint8_t *reply, size_t reply_len,
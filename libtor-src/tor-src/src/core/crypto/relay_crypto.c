@@ -24,22 +24,20 @@
 #include "core/or/or_circuit_st.h"
 #include "core/or/origin_circuit_st.h"
 
+/** Offset of the 4-byte integrity field in a relay cell payload. The
+ * digest functions below read and write it in place, rather than through a
+ * relay_header_t. */
+#define RELAY_INTEGRITY_OFFSET 5
+
 /** Update digest from the payload of cell. Assign integrity part to
  * cell.
  */
 void
 relay_set_digest(crypto_digest_t *digest, cell_t *cell)
 {
-  char integrity[4];
-  relay_header_t rh;
-
   crypto_digest_add_bytes(digest, (char*)cell->payload, CELL_PAYLOAD_SIZE);
-  crypto_digest_get_digest(digest, integrity, 4);
-//  log_fn(LOG_DEBUG,"Putting digest of %u %u %u %u into relay cell.",
-//    integrity[0], integrity[1], integrity[2], integrity[3]);
-  relay_header_unpack(&rh, cell->payload);
-  memcpy(rh.integrity, integrity, 4);
-  relay_header_pack(cell->payload, &rh);
+  crypto_digest_get_digest(digest,
+                           (char*)cell->payload + RELAY_INTEGRITY_OFFSET, 4);
 }
 
 /** Does the digest for this circuit indicate that this cell is for us?
@@ -52,15 +50,13 @@ static int
 relay_digest_matches(crypto_digest_t *digest, cell_t *cell)
 {
   uint32_t received_integrity, calculated_integrity;
-  relay_header_t rh;
+  uint8_t *integrity = cell->payload + RELAY_INTEGRITY_OFFSET;
   crypto_digest_checkpoint_t backup_digest;
 
   crypto_digest_checkpoint(&backup_digest, digest);
 
-  relay_header_unpack(&rh, cell->payload);
-  memcpy(&received_integrity, rh.integrity, 4);
-  memset(rh.integrity, 0, 4);
-  relay_header_pack(cell->payload, &rh);
+  memcpy(&received_integrity, integrity, 4);
+  memset(integrity, 0, 4);
 
 //  log_fn(LOG_DEBUG,"Reading digest of %u %u %u %u from relay cell.",
 //    received_integrity[0], received_integrity[1],
@@ -77,8 +73,7 @@ relay_digest_matches(crypto_digest_t *digest, cell_t *cell)
     /* restore digest to its old form */
     crypto_digest_restore(digest, &backup_digest);
     /* restore the relay header */
-    memcpy(rh.integrity, &received_integrity, 4);
-    relay_header_pack(cell->payload, &rh);
+    memcpy(integrity, &received_integrity, 4);
     rv = 0;
   }
 
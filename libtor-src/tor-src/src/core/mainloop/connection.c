@@ -92,6 +92,7 @@
 #include "feature/client/transports.h"
 #include "feature/control/control.h"
 #include "feature/control/control_events.h"
+#include "feature/control/control_logallcircuits.h"
 #include "feature/dirauth/authmode.h"
 #include "feature/dirauth/dirauth_config.h"
 #include "feature/dircache/dirserv.h"
@@ -917,6 +918,7 @@ connection_free_minimal(connection_t *conn)
     tor_free(control_conn->safecookie_client_hash);
     tor_free(control_conn->incoming_cmd);
     tor_free(control_conn->current_cmd);
+    circuit_listing_free(control_conn->circuit_listing);
     if (control_conn->ephemeral_onion_services) {
       SMARTLIST_FOREACH(control_conn->ephemeral_onion_services, char *, cp, {
         memwipe(cp, 0, strlen(cp));
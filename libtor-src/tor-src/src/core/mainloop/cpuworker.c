@@ -36,6 +36,10 @@
 #include "feature/nodelist/networkstatus.h"
 #include "lib/evloop/workqueue.h"
 #include "core/crypto/onion_crypto.h"
+#include "core/or/payhash_event.h"
+#include "feature/payment/payment_index.h"
+#include "feature/payment/payment_metrics.h"
+#include "feature/payment/payment_rounds.h"
 
 #include "core/or/or_circuit_st.h"
 
@@ -178,12 +182,6 @@ typedef struct cpuworker_request_t {
    * the circuit, for use in negotiation. */
   circuit_params_t circ_ns_params;
 
-  /** The circuit ID for this handshake. */
-  circid_t circuit_id;
-
-  /** The next circuit ID for this handshake (for multi-hop tracking). */
-  circid_t n_circuit_id;
-
   /* Turn the above into a tagged union if needed. */
 } cpuworker_request_t;
 
@@ -367,6 +365,23 @@ cpuworker_log_onionskin_overhead(int severity, int onionskin_type,
          onionskin_type_name, (unsigned)overhead, relative_overhead*100);
 }
 
+/** Publish the payment material that the worker extracted from the
+ * handshake for <b>circ</b>. Subscribers get it from the main loop once
+ * this batch of replies has been handled. */
+static void
+cpuworker_publish_payhashes(const or_circuit_t *circ,
+                            const circuit_params_t *params)
+{
+  payhash_received_msg_t *msg = tor_malloc_zero(sizeof(*msg));
+
+  msg->p_circ_id = circ->p_circ_id;
+  msg->n_circ_id = TO_CIRCUIT(circ)->n_circ_id;
+  msg->n_payhashes = params->n_payhashes;
+  memcpy(msg->payhashes, params->payhashes,
+         params->n_payhashes * PAYMENT_HASH_LEN);
+  payhash_received_publish(msg);
+}
+
 /** Handle a reply from the worker threads. */
 static void
 cpuworker_onion_handshake_replyfn(void *work_)
@@ -439,6 +454,26 @@ cpuworker_onion_handshake_replyfn(void *work_)
     goto done_processing;
   }
 
+  payment_metrics_create_cell(rpl.circ_params.n_payhashes > 0);
+
+  /* Remember which circuit this handshake payment hash pays for. A hash that
+   * is still bound to a live circuit is a replay: refuse it. */
+  if (rpl.circ_params.n_payhashes > 0 &&
+      payment_index_bind(rpl.circ_params.payhashes[0], circ) < 0) {
+    log_fn(LOG_PROTOCOL_WARN, LD_OR,
+           "Payment hash already in use by another circuit. Closing.");
+    circuit_mark_for_close(TO_CIRCUIT(circ), END_CIRC_REASON_TORPROTOCOL);
+    goto done_processing;
+  }
+  if (rpl.circ_params.n_payhashes > 0)
+    cpuworker_publish_payhashes(circ, &rpl.circ_params);
+  /* Payment ids follow the handshake hash and preimage: bill per round. */
+  if (rpl.circ_params.n_payhashes > 2) {
+    payment_rounds_set_id_hashes(circ, rpl.circ_params.payhashes[2],
+                                 rpl.circ_params.n_payhashes - 2);
+    payment_rounds_circuit_start(circ);
+  }
+
   /* If the client asked for congestion control, if our consensus parameter
    * allowed it to negotiate as enabled, allocate a congestion control obj. */
   if (rpl.circ_params.cc_enabled) {
@@ -495,8 +530,6 @@ cpuworker_onion_handshake_threadfn(void *state_, void *work_)
   rpl.handshake_type = cc->handshake_type;
   if (req.timed)
     tor_gettimeofday(&tv_start);
-  uint64_t circuit_id_64 = req.circuit_id;
-  uint64_t n_circuit_id_64 = req.n_circuit_id;
   n = onion_skin_server_handshake(cc->handshake_type,
                                   cc->onionskin, cc->handshake_len,
                                   onion_keys,
@@ -505,9 +538,7 @@ cpuworker_onion_handshake_threadfn(void *state_, void *work_)
                                   sizeof(cell_out->reply),
                                   rpl.keys, CPATH_KEY_MATERIAL_LEN,
                                   rpl.rend_auth_material,
-                                  &rpl.circ_params,
-                                  &circuit_id_64,
-                                  &n_circuit_id_64);
+                                  &rpl.circ_params);
   if (n < 0) {
     /* failure */
     log_debug(LD_OR,"onion_skin_server_handshake failed.");
@@ -636,10 +667,6 @@ assign_onionskin_to_cpuworker(or_circuit_t *circ,
   req.circ_ns_params.cc_enabled = congestion_control_enabled();
   req.circ_ns_params.sendme_inc_cells = congestion_control_sendme_inc();
 
-  /* Copy the circuit ID for payment processing */
-  req.circuit_id = circ->p_circ_id;
-  req.n_circuit_id = TO_CIRCUIT(circ)->n_circ_id;
-
   job = tor_malloc_zero(sizeof(cpuworker_job_t));
   job->circ = circ;
   memcpy(&job->u.request, &req, sizeof(req));
@@ -0,0 +1,270 @@
+/* Copyright (c) 2007-2021, The Tor Project, Inc. */
+/* See LICENSE for licensing information */
+
+/**
+ * \file cell_pool.c
+ * \brief Slab allocator for fixed-size cell objects
+ *
+ * A relay allocates and frees a packed_cell_t for nearly every cell it
+ * queues: millions per second on a busy relay. A pool hands those objects
+ * out of slabs of CELL_POOL_SLAB_SIZE bytes instead, so the common case
+ * is a freelist pop and push.
+ *
+ * Each slab is carved into chunks of the object size, rounded up to a
+ * cache line, and the first chunk is cache-line aligned. A word after the
+ * object in every chunk points back to its slab, so releasing an object
+ * finds its slab in O(1). A slab is on one of three lists: full, partial
+ * (objects are taken from here first) or empty. At most
+ * CELL_POOL_MAX_EMPTY_SLABS empty slabs are kept, and cell_pool_reclaim()
+ * releases all of them, so the memory a pool holds without using is
+ * bounded, and the OOM handler can give whole slabs back.
+ **/
+
+#include "core/or/or.h"
+#include "core/or/cell_pool.h"
+
+#include "tor_queue.h"
+
+/** A slab of objects. */
+typedef struct cell_pool_slab_t {
+  /** Link in one of the pool's slab lists. */
+  TOR_LIST_ENTRY(cell_pool_slab_t) node;
+  /** The pool this slab belongs to. */
+  cell_pool_t *pool;
+  /** The memory as allocated, and its first aligned chunk. */
+  char *mem;
+  char *base;
+  /** Released chunks; each one holds the next in its first word. */
+  void *free_list;
+  /** Objects in use. */
+  int n_used;
+  /** Chunks handed out at least once since the slab was last empty: the
+   * ones after those have never been used, and are not on free_list. */
+  int n_carved;
+} cell_pool_slab_t;
+
+/** A list of slabs. */
+TOR_LIST_HEAD(cell_pool_slab_list_t, cell_pool_slab_t);
+
+struct cell_pool_t {
+  /** Name of the pool, for logging. */
+  const char *name;
+  /** Size of an object, and offset of the slab pointer in a chunk. */
+  size_t obj_size;
+  size_t slab_ptr_offset;
+  /** Size of a chunk: an object and a slab pointer, aligned. */
+  size_t chunk_size;
+  /** Chunks in a slab. */
+  int chunks_per_slab;
+  /** Slabs with no free chunk, with some, and with no object in use. */
+  struct cell_pool_slab_list_t full;
+  struct cell_pool_slab_list_t partial;
+  struct cell_pool_slab_list_t empty;
+  /** Number of slabs in all lists, and in the empty list. */
+  size_t n_slabs;
+  size_t n_empty_slabs;
+  /** Objects in use. */
+  size_t n_used;
+};
+
+/** Return a pointer to the slab pointer of <b>chunk</b> in <b>pool</b>. */
+static inline cell_pool_slab_t **
+chunk_slab_ptr(const cell_pool_t *pool, void *chunk)
+{
+  return (cell_pool_slab_t **) ((char *) chunk + pool->slab_ptr_offset);
+}
+
+/** Return the number of bytes allocated for each slab of <b>pool</b>. */
+static inline size_t
+slab_alloc_size(const cell_pool_t *pool)
+{
+  return pool->chunks_per_slab * pool->chunk_size + CELL_POOL_ALIGN - 1;
+}
+
+/** Return a new, empty pool of objects of <b>obj_size</b> bytes. The
+ * <b>name</b> is only used in logs and is not copied. */
+cell_pool_t *
+cell_pool_new(const char *name, size_t obj_size)
+{
+  cell_pool_t *pool = tor_malloc_zero(sizeof(cell_pool_t));
+
+  tor_assert(obj_size > 0);
+  pool->name = name;
+  pool->obj_size = MAX(obj_size, sizeof(void *));
+  pool->slab_ptr_offset = (pool->obj_size + sizeof(void *) - 1) &
+    ~(sizeof(void *) - 1);
+  pool->chunk_size = (pool->slab_ptr_offset + sizeof(void *) +
+                      CELL_POOL_ALIGN - 1) & ~(size_t)(CELL_POOL_ALIGN - 1);
+  pool->chunks_per_slab = (int) (CELL_POOL_SLAB_SIZE / pool->chunk_size);
+  tor_assert(pool->chunks_per_slab >= 2);
+  TOR_LIST_INIT(&pool->full);
+  TOR_LIST_INIT(&pool->partial);
+  TOR_LIST_INIT(&pool->empty);
+  return pool;
+}
+
+/** Release <b>slab</b>, which is on none of its pool's lists. */
+static void
+cell_pool_slab_free(cell_pool_slab_t *slab)
+{
+  --slab->pool->n_slabs;
+  tor_free(slab->mem);
+  tor_free(slab);
+}
+
+/** Release every slab in <b>list</b>. Return how many there were. */
+static size_t
+cell_pool_slab_list_free(struct cell_pool_slab_list_t *list)
+{
+  cell_pool_slab_t *slab;
+  size_t n = 0;
+
+  while ((slab = TOR_LIST_FIRST(list))) {
+    TOR_LIST_REMOVE(slab, node);
+    cell_pool_slab_free(slab);
+    ++n;
+  }
+  return n;
+}
+
+/** Release <b>pool</b> and all of its slabs. Objects still in use become
+ * invalid. */
+void
+cell_pool_free_(cell_pool_t *pool)
+{
+  if (!pool)
+    return;
+  if (pool->n_used)
+    log_info(LD_MM, "Freeing the %s pool with %"TOR_PRIuSZ" objects still "
+             "in use.", pool->name, pool->n_used);
+  cell_pool_slab_list_free(&pool->full);
+  cell_pool_slab_list_free(&pool->partial);
+  cell_pool_slab_list_free(&pool->empty);
+  tor_free(pool);
+}
+
+/** Return a new slab for <b>pool</b>, on none of its lists. */
+static cell_pool_slab_t *
+cell_pool_slab_new(cell_pool_t *pool)
+{
+  cell_pool_slab_t *slab = tor_malloc_zero(sizeof(cell_pool_slab_t));
+  uintptr_t base;
+
+  slab->pool = pool;
+  slab->mem = tor_malloc(slab_alloc_size(pool));
+  base = ((uintptr_t) slab->mem + CELL_POOL_ALIGN - 1) &
+    ~(uintptr_t) (CELL_POOL_ALIGN - 1);
+  slab->base = (char *) base;
+  ++pool->n_slabs;
+  return slab;
+}
+
+/** Return a new zeroed object from <b>pool</b>. */
+void *
+cell_pool_alloc(cell_pool_t *pool)
+{
+  cell_pool_slab_t *slab = TOR_LIST_FIRST(&pool->partial);
+  void *chunk;
+
+  if (PREDICT_UNLIKELY(!slab)) {
+    slab = TOR_LIST_FIRST(&pool->empty);
+    if (slab) {
+      TOR_LIST_REMOVE(slab, node);
+      --pool->n_empty_slabs;
+    } else {
+      slab = cell_pool_slab_new(pool);
+    }
+    TOR_LIST_INSERT_HEAD(&pool->partial, slab, node);
+  }
+
+  if (slab->free_list) {
+    chunk = slab->free_list;
+    slab->free_list = *(void **) chunk;
+  } else {
+    chunk = slab->base + (size_t) slab->n_carved++ * pool->chunk_size;
+    *chunk_slab_ptr(pool, chunk) = slab;
+  }
+  ++pool->n_used;
+  if (++slab->n_used == pool->chunks_per_slab) {
+    TOR_LIST_REMOVE(slab, node);
+    TOR_LIST_INSERT_HEAD(&pool->full, slab, node);
+  }
+
+  memset(chunk, 0, pool->obj_size);
+  return chunk;
+}
+
+/** Give <b>obj</b>, which came from cell_pool_alloc(<b>pool</b>), back to
+ * its pool. */
+void
+cell_pool_release(cell_pool_t *pool, void *obj)
+{
+  cell_pool_slab_t *slab = *chunk_slab_ptr(pool, obj);
+
+  tor_assert(slab->pool == pool);
+  if (slab->n_used == pool->chunks_per_slab) {
+    TOR_LIST_REMOVE(slab, node);
+    TOR_LIST_INSERT_HEAD(&pool->partial, slab, node);
+  }
+  *(void **) obj = slab->free_list;
+  slab->free_list = obj;
+  --pool->n_used;
+  if (--slab->n_used > 0)
+    return;
+
+  /* The slab is empty: keep it for reuse, carved afresh, or free it. */
+  TOR_LIST_REMOVE(slab, node);
+  if (pool->n_empty_slabs < CELL_POOL_MAX_EMPTY_SLABS) {
+    slab->free_list = NULL;
+    slab->n_carved = 0;
+    TOR_LIST_INSERT_HEAD(&pool->empty, slab, node);
+    ++pool->n_empty_slabs;
+  } else {
+    cell_pool_slab_free(slab);
+  }
+}
+
+/** Release every empty slab <b>pool</b> keeps for reuse. Return the number
+ * of bytes freed. */
+size_t
+cell_pool_reclaim(cell_pool_t *pool)
+{
+  size_t n;
+
+  if (!pool)
+    return 0;
+  n = cell_pool_slab_list_free(&pool->empty);
+  pool->n_empty_slabs = 0;
+  return n * slab_alloc_size(pool);
+}
+
+/** Fill <b>out</b> with the usage of <b>pool</b>, which may be NULL. */
+void
+cell_pool_get_stats(const cell_pool_t *pool, cell_pool_stats_t *out)
+{
+  memset(out, 0, sizeof(*out));
+  if (!pool)
+    return;
+  out->n_slabs = pool->n_slabs;
+  out->n_empty_slabs = pool->n_empty_slabs;
+  out->n_used = pool->n_used;
+  out->n_capacity = pool->n_slabs * pool->chunks_per_slab;
+  out->n_bytes = pool->n_slabs * slab_alloc_size(pool);
+}
+
+/** Log the usage of <b>pool</b>, which may be NULL, at log level
+ * <b>severity</b>. */
+void
+cell_pool_log_usage(const cell_pool_t *pool, int severity)
+{
+  cell_pool_stats_t stats;
+
+  if (!pool)
+    return;
+  cell_pool_get_stats(pool, &stats);
+  tor_log(severity, LD_MM,
+          "%s pool: %"TOR_PRIuSZ"/%"TOR_PRIuSZ" objects in use, in "
+          "%"TOR_PRIuSZ" slabs (%"TOR_PRIuSZ" empty) of %"TOR_PRIuSZ
+          " bytes.", pool->name, stats.n_used, stats.n_capacity,
+          stats.n_slabs, stats.n_empty_slabs, slab_alloc_size(pool));
+}
@@ -0,0 +1,48 @@
+/* Copyright (c) 2007-2021, The Tor Project, Inc. */
+/* See LICENSE for licensing information */
+
+/**
+ * \file cell_pool.h
+ * \brief Header file for cell_pool.c.
+ **/
+
+#ifndef TOR_CELL_POOL_H
+#define TOR_CELL_POOL_H
+
+/** Every chunk of a pool, and the first chunk of each slab, starts on a
+ * boundary of this many bytes: one cache line. */
+#define CELL_POOL_ALIGN 64
+/** Bytes of objects in one slab. */
+#define CELL_POOL_SLAB_SIZE (64*1024)
+/** Most empty slabs a pool keeps for reuse. Past that, a slab that becomes
+ * empty is freed at once. */
+#define CELL_POOL_MAX_EMPTY_SLABS 4
+
+typedef struct cell_pool_t cell_pool_t;
+
+/** Usage of one cell pool. */
+typedef struct cell_pool_stats_t {
+  /** Slabs allocated, empty or not. */
+  size_t n_slabs;
+  /** Slabs kept with no object in use. */
+  size_t n_empty_slabs;
+  /** Objects in use. */
+  size_t n_used;
+  /** Objects the slabs can hold. */
+  size_t n_capacity;
+  /** Bytes allocated for the slabs. */
+  size_t n_bytes;
+} cell_pool_stats_t;
+
+cell_pool_t *cell_pool_new(const char *name, size_t obj_size);
+void cell_pool_free_(cell_pool_t *pool);
+#define cell_pool_free(pool) \
+  FREE_AND_NULL(cell_pool_t, cell_pool_free_, (pool))
+
+void *cell_pool_alloc(cell_pool_t *pool);
+void cell_pool_release(cell_pool_t *pool, void *obj);
+size_t cell_pool_reclaim(cell_pool_t *pool);
+void cell_pool_get_stats(const cell_pool_t *pool, cell_pool_stats_t *out);
+void cell_pool_log_usage(const cell_pool_t *pool, int severity);
+
+#endif /* !defined(TOR_CELL_POOL_H) */
@@ -475,7 +475,6 @@ origin_circuit_init(uint8_t purpose, int flags)
   circ->build_state->need_conflux =
     ((flags & CIRCLAUNCH_NEED_CONFLUX) ? 1 : 0);
   circ->base_.purpose = purpose;
-  circ->payhashes = NULL;
   circ->relay_payments = NULL;
   return circ;
 }
@@ -1028,13 +1027,11 @@ circuit_send_first_onion_skin(origin_circuit_t *circ)
   create_cell_t cc;
   memset(&cc, 0, sizeof(cc));
 
-  log_debug(LD_CIRC, "First skin; sending create cell. payhashes: %s", circ->payhashes ? "present" : "absent");
+  const relay_payment_item_t *payment;
+  const uint8_t *payhashes = NULL;
+  size_t n_payhashes = 0;
 
-  // Add debug log for PayHash if present
-  if (circ->payhashes) {
-    log_info(LD_GENERAL, "ELTOR first hop with PayHash length: %zu", 
-             strlen(circ->payhashes));
-  }
+  log_debug(LD_CIRC, "First skin; sending create cell.");
 
   if (circ->build_state->onehop_tunnel) {
     control_event_bootstrap(BOOTSTRAP_STATUS_ONEHOP_CREATE, 0);
@@ -1062,19 +1059,19 @@ circuit_send_first_onion_skin(origin_circuit_t *circ)
     cc.handshake_type = ONION_HANDSHAKE_TYPE_FAST;
   }
   
-  char hop_payhash_buf[PAYMENT_PAYHASH_SIZE] = {0};
-  const char *tmp = payment_util_get_first_hop_payhash(circ);
-  if (tmp) {
-    strlcpy(hop_payhash_buf, tmp, sizeof(hop_payhash_buf));
+  payment = payment_util_get_hop_payment(circ, circ->cpath);
+  if (payment) {
+    payhashes = relay_payment_item_get_material(payment, &n_payhashes);
+    log_info(LD_GENERAL, "ELTOR first hop with %zu payment values",
+             n_payhashes);
   }
-  const char *hop_payhash = (*hop_payhash_buf) ? hop_payhash_buf : NULL;
 
   len = onion_skin_create(cc.handshake_type,
                           circ->cpath->extend_info,
                           &circ->cpath->handshake_state,
                           cc.onionskin,
                           sizeof(cc.onionskin),
-                          hop_payhash);
+                          payhashes, n_payhashes);
   if (len < 0) {
     log_warn(LD_CIRC,"onion_skin_create (first hop) failed.");
     return - END_CIRC_REASON_INTERNAL;
@@ -1186,12 +1183,7 @@ circuit_send_intermediate_onion_skin(origin_circuit_t *circ,
   tor_addr_make_unspec(&ec.orport_ipv4.addr);
   tor_addr_make_unspec(&ec.orport_ipv6.addr);
 
-  log_debug(LD_CIRC, "Starting to send subsequent skin. payhashes: %s", circ->payhashes ? "present" : "absent");
-
-  // Add debug log for PayHash if present
-  if (circ->payhashes) {
-    log_debug(LD_CIRC, "ELTOR intermediate hop with payhashes length: %zu", strlen(circ->payhashes));
-  }
+  log_debug(LD_CIRC, "Starting to send subsequent skin.");
 
   circuit_pick_extend_handshake(&ec.cell_type,
                                 &ec.create_cell.cell_type,
@@ -1223,28 +1215,14 @@ circuit_send_intermediate_onion_skin(origin_circuit_t *circ,
    * in the extend2 cell if we're configured to use it, though. */
   ed25519_pubkey_copy(&ec.ed_pubkey, &hop->extend_info->ed_identity);
 
-  // Find the hop number
-  int hop_num = 0;
-  for (crypt_path_t *cur = circ->cpath; cur != NULL; cur = cur->next) {
-    hop_num++;
-    if (cur == hop) {
-      break;
-    }
-    if (cur->next == circ->cpath) {
-      break; // We have looped through the entire circular list without finding the hop
-    }
-  }
-
-  const relay_payment_item_t *payment = relay_payments_find_by_hop_num(circ->relay_payments, hop_num);
-  const char *hop_payhash = NULL;
-  if (payment && payment->wire_format) {
-    hop_payhash = payment->wire_format;
-  }
-
-  // Add debugging to show we have the payment hash
-  if (hop_payhash) {
-    log_info(LD_GENERAL, "ELTOR intermediate hop with PayHash length: %zu", 
-             strlen(hop_payhash));
+  const relay_payment_item_t *payment =
+    payment_util_get_hop_payment(circ, hop);
+  const uint8_t *payhashes = NULL;
+  size_t n_payhashes = 0;
+  if (payment) {
+    payhashes = relay_payment_item_get_material(payment, &n_payhashes);
+    log_info(LD_GENERAL, "ELTOR intermediate hop with %zu payment values",
+             n_payhashes);
   } else {
     log_info(LD_GENERAL, "ELTOR intermediate hop with NO PayHash");
   }
@@ -1253,8 +1231,8 @@ circuit_send_intermediate_onion_skin(origin_circuit_t *circ,
                           hop->extend_info,
                           &hop->handshake_state,
                           ec.create_cell.onionskin,
-                          sizeof(ec.create_cell.onionskin), 
-                          hop_payhash);
+                          sizeof(ec.create_cell.onionskin),
+                          payhashes, n_payhashes);
   if (len < 0) {
     log_warn(LD_CIRC,"onion_skin_create failed.");
     return - END_CIRC_REASON_INTERNAL;
@@ -1262,12 +1240,13 @@ circuit_send_intermediate_onion_skin(origin_circuit_t *circ,
   ec.create_cell.handshake_len = len;
 
 
-  log_info(LD_CIRC,"Sending extend relay cell with eltor. payhash: %s", hop_payhash);
+  log_info(LD_CIRC,"Sending extend relay cell with eltor.");
   {
     uint8_t command = 0;
     uint16_t payload_len=0;
     uint8_t payload[RELAY_PAYLOAD_SIZE];
-    if (extend_cell_format(&command, &payload_len, payload, &ec, hop_payhash)<0) {
+    if (extend_cell_format(&command, &payload_len, payload, &ec,
+                           payhashes, n_payhashes)<0) {
       log_warn(LD_CIRC,"Couldn't format extend cell");
       return -END_CIRC_REASON_INTERNAL;
     }
@@ -49,6 +49,9 @@
  * This module is also the entry point for our out-of-memory handler
  * logic, which was originally circuit-focused.
  **/
+#include "feature/payment/paid_circ_pool.h"
+#include "feature/payment/payment_index.h"
+#include "feature/payment/payment_rounds.h"
 #include "feature/payment/relay_payments.h"
 #define CIRCUITLIST_PRIVATE
 #define OCIRC_EVENT_PRIVATE
@@ -247,6 +250,38 @@ HT_GENERATE2(chan_circid_map, chan_circid_circuit_map_t, node,
  */
 static chan_circid_circuit_map_t *_last_circid_chan_ent = NULL;
 
+/** Map from global_identifier to origin circuit, so that the controller
+ * can find a circuit by ID without walking the global circuit list. */
+static HT_HEAD(origin_circuit_gid_map, origin_circuit_t)
+     origin_circuit_gid_map = HT_INITIALIZER();
+
+static inline unsigned
+origin_circuit_gid_hash(const origin_circuit_t *circ)
+{
+  return (unsigned) circ->global_identifier;
+}
+static inline int
+origin_circuit_gid_eq(const origin_circuit_t *a, const origin_circuit_t *b)
+{
+  return a->global_identifier == b->global_identifier;
+}
+HT_PROTOTYPE(origin_circuit_gid_map, origin_circuit_t, gidmap_node,
+             origin_circuit_gid_hash, origin_circuit_gid_eq);
+HT_GENERATE2(origin_circuit_gid_map, origin_circuit_t, gidmap_node,
+             origin_circuit_gid_hash, origin_circuit_gid_eq, 0.6,
+             tor_reallocarray_, tor_free_);
+
+/** Remove <b>circ</b> from the global identifier map, unless a newer
+ * circuit has since taken its (wrapped around) identifier. */
+static void
+origin_circuit_gid_map_remove(origin_circuit_t *circ)
+{
+  origin_circuit_t *found = HT_FIND(origin_circuit_gid_map,
+                                    &origin_circuit_gid_map, circ);
+  if (found == circ)
+    HT_REMOVE(origin_circuit_gid_map, &origin_circuit_gid_map, circ);
+}
+
 /** Implementation helper for circuit_set_{p,n}_circid_channel: A circuit ID
  * and/or channel for circ has just changed from <b>old_chan, old_id</b>
  * to <b>chan, id</b>.  Adjust the chan,circid map as appropriate, removing
@@ -515,9 +550,9 @@ circuit_set_n_circid_chan(circuit_t *circ, circid_t id,
  * Publishes a message to subscribers of origin circuit events, and
  * sends the control event.
  **/
-int
-circuit_event_status(origin_circuit_t *circ, circuit_status_event_t tp,
-                     int reason_code)
+MOCK_IMPL(int,
+circuit_event_status,(origin_circuit_t *circ, circuit_status_event_t tp,
+                      int reason_code))
 {
   ocirc_cevent_msg_t *msg = tor_malloc(sizeof(*msg));
 
@@ -1060,6 +1095,9 @@ origin_circuit_new(void)
 
   circ->next_stream_id = crypto_rand_int(1<<16);
   circ->global_identifier = n_circuits_allocated++;
+  /* After 2**32 circuits an identifier can be reused: the newest circuit
+   * wins. */
+  HT_REPLACE(origin_circuit_gid_map, &origin_circuit_gid_map, circ);
   circ->remaining_relay_early_cells = MAX_RELAY_EARLY_CELLS_PER_CIRCUIT;
   circ->remaining_relay_early_cells -= crypto_rand_int(2);
 
@@ -1185,15 +1223,13 @@ circuit_free_(circuit_t *circ)
       relay_payments_free(ocirc->relay_payments);
       ocirc->relay_payments = NULL;
     }
-    if (ocirc->payhashes) {
-      tor_free(ocirc->payhashes);
-      ocirc->payhashes = NULL;
-    }
+    paid_circ_pool_circuit_left(ocirc);
     mem = ocirc;
     memlen = sizeof(origin_circuit_t);
     tor_assert(circ->magic == ORIGIN_CIRCUIT_MAGIC);
 
     circuit_remove_from_origin_circuit_list(ocirc);
+    origin_circuit_gid_map_remove(ocirc);
 
     if (ocirc->half_streams) {
       SMARTLIST_FOREACH_BEGIN(ocirc->half_streams, half_edge_t *,
@@ -1232,11 +1268,6 @@ circuit_free_(circuit_t *circ)
       memwipe(ocirc->socks_password, 0x06, ocirc->socks_password_len);
       tor_free(ocirc->socks_password);
     }
-    
-    // Free payhash if allocated
-    if (ocirc->payhashes) {
-      tor_free(ocirc->payhashes);
-    }
 
     addr_policy_list_free(ocirc->prepend_policy);
   } else {
@@ -1260,6 +1291,9 @@ circuit_free_(circuit_t *circ)
 
     /* remove from map. */
     circuit_set_p_circid_chan(ocirc, 0, NULL);
+    payment_index_unbind(ocirc);
+    payment_rounds_circuit_stop(ocirc);
+    tor_free(ocirc->payment_id_hashes);
 
     /* Clear cell queue _after_ removing it from the map.  Otherwise our
      * "active" checks will be violated. */
@@ -1384,6 +1418,8 @@ circuit_free_all(void)
   smartlist_free(circuits_pending_other_guards);
   circuits_pending_other_guards = NULL;
 
+  payment_index_free_all();
+
   {
     chan_circid_circuit_map_t **elt, **next, *c;
     for (elt = HT_START(chan_circid_map, &chan_circid_map);
@@ -1397,6 +1433,7 @@ circuit_free_all(void)
     }
   }
   HT_CLEAR(chan_circid_map, &chan_circid_map);
+  HT_CLEAR(origin_circuit_gid_map, &origin_circuit_gid_map);
 }
 
 /** A helper function for circuit_dump_by_conn() below. Log a bunch
@@ -1467,17 +1504,21 @@ circuit_dump_by_conn(connection_t *conn, int severity)
 origin_circuit_t *
 circuit_get_by_global_id(uint32_t id)
 {
-  SMARTLIST_FOREACH_BEGIN(circuit_get_global_list(), circuit_t *, circ) {
-    if (CIRCUIT_IS_ORIGIN(circ) &&
-        TO_ORIGIN_CIRCUIT(circ)->global_identifier == id) {
-      if (circ->marked_for_close)
-        return NULL;
-      else
-        return TO_ORIGIN_CIRCUIT(circ);
-    }
-  }
-  SMARTLIST_FOREACH_END(circ);
-  return NULL;
+  origin_circuit_t *found = circuit_get_by_global_id_even_if_marked(id);
+  if (!found || TO_CIRCUIT(found)->marked_for_close)
+    return NULL;
+  return found;
+}
+
+/** Return the circuit whose global ID is <b>id</b>, marked for close or
+ * not, or NULL if no such circuit exists. */
+origin_circuit_t *
+circuit_get_by_global_id_even_if_marked(uint32_t id)
+{
+  origin_circuit_t search;
+
+  search.global_identifier = id;
+  return HT_FIND(origin_circuit_gid_map, &origin_circuit_gid_map, &search);
 }
 
 /** Return a circ such that:
@@ -2249,6 +2290,7 @@ circuit_mark_for_close_, (circuit_t *circ, int reason, int line,
 
     /* We don't send reasons when closing circuits at the origin. */
     reason = END_CIRC_REASON_NONE;
+    paid_circ_pool_circuit_left(TO_ORIGIN_CIRCUIT(circ));
   }
 
   circuit_synchronize_written_or_bandwidth(circ, CIRCUIT_N_CHAN);
@@ -2342,6 +2384,9 @@ circuit_about_to_free_atexit(circuit_t *circ)
   if (! CIRCUIT_IS_ORIGIN(circ)) {
     or_circuit_t *or_circ = TO_OR_CIRCUIT(circ);
 
+    payment_index_unbind(or_circ);
+    payment_rounds_circuit_stop(or_circ);
+
     if (or_circ->p_chan) {
       circuit_clear_cell_queue(circ, or_circ->p_chan);
       circuitmux_detach_circuit(or_circ->p_chan->cmux, circ);
@@ -2382,13 +2427,6 @@ circuit_about_to_free(circuit_t *circ)
         relay_payments_free(ocirc->relay_payments);
         ocirc->relay_payments = NULL;
       }
-      // Cleanup for payhashes
-      if (ocirc->payhashes) {
-        log_debug(LD_MM, "Freeing payhashes for circuit %lu",
-                (unsigned long)ocirc->global_identifier);
-        tor_free(ocirc->payhashes);
-        ocirc->payhashes = NULL;
-      }
       circuit_build_failed(ocirc); /* take actions if necessary */
     }
   }
@@ -2421,6 +2459,10 @@ circuit_about_to_free(circuit_t *circ)
     or_circuit_t *or_circ = TO_OR_CIRCUIT(circ);
     edge_connection_t *conn;
 
+    /* Release this circuit's payment hash so it can't be found any more. */
+    payment_index_unbind(or_circ);
+    payment_rounds_circuit_stop(or_circ);
+
     for (conn=or_circ->n_streams; conn; conn=conn->next_stream)
       connection_edge_destroy(or_circ->p_circ_id, conn);
     or_circ->n_streams = NULL;
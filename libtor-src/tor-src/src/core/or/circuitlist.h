@@ -202,8 +202,9 @@ void channel_mark_circid_unusable(channel_t *chan, circid_t id);
 void channel_mark_circid_usable(channel_t *chan, circid_t id);
 time_t circuit_id_when_marked_unusable_on_channel(circid_t circ_id,
                                                   channel_t *chan);
-int circuit_event_status(origin_circuit_t *circ, circuit_status_event_t tp,
-                         int reason_code);
+MOCK_DECL(int, circuit_event_status, (origin_circuit_t *circ,
+                                      circuit_status_event_t tp,
+                                      int reason_code));
 void circuit_set_state(circuit_t *circ, uint8_t state);
 void circuit_close_all_marked(void);
 int32_t circuit_initial_package_window(void);
@@ -218,6 +219,7 @@ int circuit_id_in_use_on_channel(circid_t circ_id, channel_t *chan);
 circuit_t *circuit_get_by_edge_conn(edge_connection_t *conn);
 void circuit_unlink_all_from_channel(channel_t *chan, int reason);
 origin_circuit_t *circuit_get_by_global_id(uint32_t id);
+origin_circuit_t *circuit_get_by_global_id_even_if_marked(uint32_t id);
 origin_circuit_t *circuit_get_next_by_purpose(origin_circuit_t *start,
                                               uint8_t purpose);
 origin_circuit_t *circuit_get_next_intro_circ(const origin_circuit_t *start,
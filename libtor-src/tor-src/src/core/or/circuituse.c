@@ -58,6 +58,8 @@
 #include "feature/nodelist/networkstatus.h"
 #include "feature/nodelist/nodelist.h"
 #include "feature/nodelist/routerlist.h"
+#include "feature/payment/paid_circ_pool.h"
+#include "feature/payment/payment_metrics.h"
 #include "feature/relay/routermode.h"
 #include "feature/relay/selftest.h"
 #include "feature/stats/predict_ports.h"
@@ -1310,6 +1312,8 @@ circuit_build_needed_circs(time_t now)
 
   if (!options->DisablePredictedCircuits)
     circuit_predict_and_launch_new();
+
+  paid_circ_pool_refill();
 }
 
 /**
@@ -1666,6 +1670,13 @@ circuit_has_opened(origin_circuit_t *circ)
    * to consider its build time. */
   circ->has_opened = 1;
 
+  if (circ->relay_payments) {
+    struct timeval now;
+    tor_gettimeofday(&now);
+    payment_metrics_circ_build_time(
+                     tv_mdiff(&TO_CIRCUIT(circ)->timestamp_began, &now));
+  }
+
   switch (TO_CIRCUIT(circ)->purpose) {
     case CIRCUIT_PURPOSE_C_ESTABLISH_REND:
       hs_client_circuit_has_opened(circ);
@@ -2774,6 +2785,7 @@ connection_ap_handshake_attach_chosen_circuit(entry_connection_t *conn,
     }
   }
 
+  paid_circ_pool_circuit_left(circ);
   pathbias_count_use_attempt(circ);
 
   /* Now, actually link the connection. */
@@ -3161,6 +3173,7 @@ mark_circuit_unusable_for_new_conns(origin_circuit_t *circ)
     circ->base_.timestamp_dirty -= options->MaxCircuitDirtiness;
 
   circ->unusable_for_new_conns = 1;
+  paid_circ_pool_circuit_left(circ);
 
   if (TO_CIRCUIT(circ)->conflux) {
     conflux_sync_circ_fields(TO_CIRCUIT(circ)->conflux, circ);
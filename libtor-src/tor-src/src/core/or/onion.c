@@ -47,6 +47,7 @@
 #include "core/crypto/onion_tap.h"
 #include "core/or/onion.h"
 #include "feature/nodelist/networkstatus.h"
+#include "feature/payment/payment_util.h"
 
 #include "core/or/cell_st.h"
 
@@ -399,6 +400,7 @@ extend_cell_parse,(extend_cell_t *cell_out,
                    const uint8_t *payload,
                    size_t payload_length))
 {
+  ssize_t parsed;
 
   tor_assert(cell_out);
   tor_assert(payload);
@@ -410,8 +412,8 @@ extend_cell_parse,(extend_cell_t *cell_out,
   case RELAY_COMMAND_EXTEND:
     {
       extend1_cell_body_t *cell = NULL;
-      if (extend1_cell_body_parse(&cell, payload, payload_length)<0 ||
-          cell == NULL) {
+      parsed = extend1_cell_body_parse(&cell, payload, payload_length);
+      if (parsed < 0 || cell == NULL) {
         if (cell)
           extend1_cell_body_free(cell);
         return -1;
@@ -425,8 +427,8 @@ extend_cell_parse,(extend_cell_t *cell_out,
   case RELAY_COMMAND_EXTEND2:
     {
       extend2_cell_body_t *cell = NULL;
-      if (extend2_cell_body_parse(&cell, payload, payload_length) < 0 ||
-          cell == NULL) {
+      parsed = extend2_cell_body_parse(&cell, payload, payload_length);
+      if (parsed < 0 || cell == NULL) {
         if (cell)
           extend2_cell_body_free(cell);
         return -1;
@@ -441,6 +443,16 @@ extend_cell_parse,(extend_cell_t *cell_out,
     return -1;
   }
 
+  /* El Tor payment material, if any, trails the cell body. */
+  if ((size_t) parsed < payload_length) {
+    int n_payhashes = payment_util_payhash_ext_parse(payload + parsed,
+                                                     payload_length - parsed,
+                                                     NULL, 0);
+    if (n_payhashes < 0)
+      return -1;
+    cell_out->n_payhashes = (uint8_t) MIN(n_payhashes, UINT8_MAX);
+  }
+
   return check_extend_cell(cell_out);
 }
 
@@ -612,11 +624,13 @@ should_include_ed25519_id_extend_cells(const networkstatus_t *ns,
 /** Format the EXTEND{,2} cell in <b>cell_in</b>, storing its relay payload in
  * <b>payload_out</b>, the number of bytes used in *<b>len_out</b>, and the
  * relay command in *<b>command_out</b>. The <b>payload_out</b> must have
- * RELAY_PAYLOAD_SIZE bytes available.  Return 0 on success, -1 on failure. */
+ * RELAY_PAYLOAD_SIZE bytes available. Trail the cell with the
+ * <b>n_payhashes</b> payment values at <b>payhashes</b>, if there are any.
+ * Return 0 on success, -1 on failure. */
 int
 extend_cell_format(uint8_t *command_out, uint16_t *len_out,
-                   uint8_t *payload_out, const extend_cell_t *cell_in, 
-                   const char *eltor_payhash)
+                   uint8_t *payload_out, const extend_cell_t *cell_in,
+                   const uint8_t *payhashes, size_t n_payhashes)
 {
   uint8_t *p;
   if (check_extend_cell(cell_in) < 0)
@@ -718,18 +732,15 @@ extend_cell_format(uint8_t *command_out, uint16_t *len_out,
     return -1;
   }
 
-  // Check if eltor_payhash exists before using it
-  if (eltor_payhash) {
-    size_t eltor_payhash_len = strlen(eltor_payhash);
-    
-    // Add eltor_payhash to the payload
-    if (*len_out + eltor_payhash_len <= RELAY_PAYLOAD_SIZE) {
-      memcpy(payload_out + *len_out, eltor_payhash, eltor_payhash_len);
-      *len_out += eltor_payhash_len;
-    } else {
-      log_warn(LD_BUG, "eltor_payhash is too large to fit in the payload");
+  /* Trail the cell body with this hop's payment material, if any. */
+  if (n_payhashes > 0) {
+    ssize_t ext_len = payment_util_payhash_ext_encode(
+                                    payload_out + *len_out,
+                                    RELAY_PAYLOAD_SIZE - *len_out,
+                                    payhashes, n_payhashes);
+    if (ext_len < 0)
       return -1;
-    }
+    *len_out += ext_len;
   }
 
   return 0;
@@ -58,6 +58,9 @@ typedef struct extend_cell_t {
    * create cells we generate ourselves, this create cell can have a handshake
    * type we don't recognize. */
   create_cell_t create_cell;
+  /** Number of El Tor payment hashes in the extension that trails the
+   * EXTEND2 cell body. */
+  uint8_t n_payhashes;
 } extend_cell_t;
 
 /** A parsed RELAY_EXTEND or RELAY_EXTEND2 cell */
@@ -85,7 +88,7 @@ int create_cell_format_relayed(cell_t *cell_out, const create_cell_t *cell_in);
 int created_cell_format(cell_t *cell_out, const created_cell_t *cell_in);
 int extend_cell_format(uint8_t *command_out, uint16_t *len_out,
                        uint8_t *payload_out, const extend_cell_t *cell_in,
-                       const char *eltor_payhash);
+                       const uint8_t *payhashes, size_t n_payhashes);
 int extended_cell_format(uint8_t *command_out, uint16_t *len_out,
                          uint8_t *payload_out, const extended_cell_t *cell_in);
 
@@ -13,6 +13,7 @@
 #include "core/or/crypt_path_st.h"
 
 #include "lib/evloop/token_bucket.h"
+#include "ext/tor_queue.h"
 
 struct onion_queue_t;
 
@@ -107,8 +108,34 @@ struct or_circuit_t {
    * this circuit. Only used if this is the end of a circuit on an exit node.*/
   token_bucket_ctr_t stream_limiter;
 
-  /** Payment hash received during handshake for ElTor paid circuits. */
-  char *handshake_payment_hash;
+  /** Handshake payment hash received in the ntor_v3 payment extension for
+   * ElTor paid circuits. Only meaningful if has_payment_hash is set; while
+   * set, this circuit is bound to the hash in the payment index. */
+  uint8_t payment_hash[DIGEST256_LEN];
+  /** True iff payment_hash holds a hash bound in the payment index. */
+  unsigned int has_payment_hash : 1;
+
+  /** Current payment round of this circuit, counting from 1, or 0 if it is
+   * not in the payment round queue. See payment_rounds.c. */
+  uint8_t payment_round;
+  /** Bitmask of the payment rounds the controller confirmed as paid. */
+  uint16_t payment_rounds_paid;
+  /** When the current payment round ends, in coarse monotonic msec. */
+  uint64_t payment_round_deadline_msec;
+  /** Cells this circuit has carried in the current payment round. */
+  uint32_t payment_cells;
+  /** Cells this circuit may carry in the current payment round before the
+   * round ends early, or 0 if the circuit is not metered. */
+  uint32_t payment_cell_quota;
+  /** Link in the payment round queue. */
+  TOR_TAILQ_ENTRY(or_circuit_t) payment_round_entry;
+  /** The payment id hashes the client sent for the paid rounds,
+   * PAYMENT_HASH_LEN bytes each, the first one for round 2: round 1 is
+   * free. Only kept if we check payments with our Lightning node; see
+   * payment_rounds.c. */
+  uint8_t *payment_id_hashes;
+  /** Number of hashes in payment_id_hashes. */
+  uint8_t n_payment_id_hashes;
 };
 
 #endif /* !defined(OR_CIRCUIT_ST_H) */
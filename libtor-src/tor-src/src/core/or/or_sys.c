@@ -42,6 +42,8 @@ subsys_or_add_pubsub(struct pubsub_connector_t *connector)
     rv = -1;
   if (ocirc_add_pubsub(connector) < 0)
     rv = -1;
+  if (payhash_add_pubsub(connector) < 0)
+    rv = -1;
   return rv;
 }
 
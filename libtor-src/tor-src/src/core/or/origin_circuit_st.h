@@ -15,7 +15,8 @@
 #include "core/or/or.h"
 
 #include "core/or/circuit_st.h"
-#include "feature/payment/relay_payments_st.h" 
+#include "ht.h"
+#include "feature/payment/relay_payments.h"
 
 
 struct onion_queue_t;
@@ -252,6 +253,8 @@ struct origin_circuit_t {
   /** Quasi-global identifier for this circuit; used for control.c */
   /* XXXX NM This can get re-used after 2**32 circuits. */
   uint32_t global_identifier;
+  /** Entry in the map from global_identifier to circuit. */
+  HT_ENTRY(origin_circuit_t) gidmap_node;
 
   /** True if we have associated one stream to this circuit, thereby setting
    * the isolation parameters for this circuit.  Note that this doesn't
@@ -312,10 +315,14 @@ struct origin_circuit_t {
    * to 2*CircuitsAvailableTimoeut. */
   int circuit_idle_timeout;
 
-  char *payhashes;
-
+  /** Payment material this circuit sends each of its paid hops, or NULL if
+   * it is not a paid circuit. */
   relay_payments_t *relay_payments;
 
+  /** True iff this circuit is in the paid circuit pool: it was launched to
+   * fill it, and has not left it yet. */
+  unsigned int is_pooled_paid : 1;
+
 };
 
 #endif /* !defined(ORIGIN_CIRCUIT_ST_H) */
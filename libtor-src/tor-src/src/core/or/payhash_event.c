@@ -0,0 +1,61 @@
+/* Copyright (c) 2007-2021, The Tor Project, Inc. */
+/* See LICENSE for licensing information */
+
+/**
+ * \file payhash_event.c
+ * \brief Publish messages about payment material seen in handshakes
+ *
+ * The cpuworker reply handler publishes one message per paid circuit
+ * handshake.  Messages on this channel are delivered from the main loop
+ * after the current batch of work, so every handshake answered in one
+ * pass over the reply queue reaches subscribers (and the control port)
+ * together, instead of each worker thread flushing on its own.
+ **/
+
+#include "core/or/or.h"
+
+#include "core/or/or_sys.h"
+#include "core/or/payhash_event.h"
+#include "lib/subsys/subsys.h"
+
+DECLARE_PUBLISH(payhash_received);
+
+static void
+payhash_event_free(msg_aux_data_t u)
+{
+  tor_free_(u.ptr);
+}
+
+static char *
+payhash_received_fmt(msg_aux_data_t u)
+{
+  payhash_received_msg_t *msg = (payhash_received_msg_t *)u.ptr;
+  char *s = NULL;
+
+  tor_asprintf(&s, "<p_circ_id=%"PRIu32" n_circ_id=%"PRIu32
+               " n_payhashes=%d>",
+               msg->p_circ_id, msg->n_circ_id, msg->n_payhashes);
+  return s;
+}
+
+static dispatch_typefns_t payhash_received_fns = {
+  .free_fn = payhash_event_free,
+  .fmt_fn = payhash_received_fmt,
+};
+
+int
+payhash_add_pubsub(struct pubsub_connector_t *connector)
+{
+  if (DISPATCH_REGISTER_TYPE(connector, payhash_received,
+                             &payhash_received_fns))
+    return -1;
+  if (DISPATCH_ADD_PUB(connector, payhash, payhash_received))
+    return -1;
+  return 0;
+}
+
+void
+payhash_received_publish(payhash_received_msg_t *msg)
+{
+  PUBLISH(payhash_received, msg);
+}
@@ -0,0 +1,35 @@
+/* Copyright (c) 2007-2021, The Tor Project, Inc. */
+/* See LICENSE for licensing information */
+
+/**
+ * \file payhash_event.h
+ * \brief Header file for payhash_event.c
+ **/
+
+#ifndef TOR_PAYHASH_EVENT_H
+#define TOR_PAYHASH_EVENT_H
+
+#include "lib/cc/torint.h"
+#include "lib/pubsub/pubsub.h"
+#include "feature/payment/payment_util.h"
+
+/**
+ * Message when a relay has accepted a paid circuit's handshake.
+ *
+ * This carries the payment material the client sent in its ntor_v3
+ * handshake, and ends up in EVENT_PAYMENT_ID_HASH_RECEIVED control events.
+ */
+typedef struct payhash_received_msg_t {
+  uint32_t p_circ_id;           /**< circuit ID towards the client */
+  uint32_t n_circ_id;           /**< circuit ID away from the client */
+  uint8_t n_payhashes;          /**< number of entries in payhashes */
+  /** The handshake payment hash, then the payment id hashes. */
+  uint8_t payhashes[PAYMENT_HASHES_PER_HOP][PAYMENT_HASH_LEN];
+} payhash_received_msg_t;
+
+DECLARE_MESSAGE(payhash_received, payhash_received,
+                payhash_received_msg_t *);
+
+void payhash_received_publish(payhash_received_msg_t *msg);
+
+#endif /* !defined(TOR_PAYHASH_EVENT_H) */
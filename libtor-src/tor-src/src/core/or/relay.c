@@ -84,6 +84,7 @@
 #include "core/or/scheduler.h"
 #include "feature/hs/hs_metrics.h"
 #include "feature/stats/rephist.h"
+#include "feature/payment/payment_rounds.h"
 
 #include "core/or/cell_st.h"
 #include "core/or/cell_queue_st.h"
@@ -217,6 +218,19 @@ circuit_update_channel_usage(circuit_t *circ, cell_t *cell)
   }
 }
 
+/** Count one cell against the payment bandwidth quota of <b>circ</b>.
+ * Return 1 if that used up the quota and the circuit was closed for it,
+ * 0 otherwise. Unmetered circuits cost a single compare. */
+static inline int
+circuit_note_payment_cell(or_circuit_t *circ)
+{
+  if (PREDICT_LIKELY(circ->payment_cell_quota == 0))
+    return 0;
+  if (PREDICT_LIKELY(++circ->payment_cells < circ->payment_cell_quota))
+    return 0;
+  return payment_rounds_quota_reached(circ);
+}
+
 /** Receive a relay cell:
  *  - Crypt it (encrypt if headed toward the origin or if we <b>are</b> the
  *    origin; decrypt if we're headed toward the exit).
@@ -261,6 +275,13 @@ circuit_receive_relay_cell(cell_t *cell, circuit_t *circ,
      * the SENDME if need be. */
     sendme_record_received_cell_digest(circ, layer_hint);
 
+    /* Cells delivered to us here are never queued onward, so this is where
+     * they count against the payment quota. */
+    if (CIRCUIT_IS_ORCIRC(circ) &&
+        circuit_note_payment_cell(TO_OR_CIRCUIT(circ))) {
+      return 0;
+    }
+
     if (circ->purpose == CIRCUIT_PURPOSE_PATH_BIAS_TESTING) {
       if (pathbias_check_probe_response(circ, cell) == -1) {
         pathbias_count_valid_cells(circ, cell);
@@ -2701,20 +2722,27 @@ circuit_consider_stop_edge_reading(circuit_t *circ, crypt_path_t *layer_hint)
 /** The total number of cells we have allocated. */
 static size_t total_cells_allocated = 0;
 
+/** Pools that packed_cell_t and destroy_cell_t objects come from, or NULL
+ * before the first one is allocated. */
+static cell_pool_t *packed_cell_pool = NULL;
+static cell_pool_t *destroy_cell_pool = NULL;
+
 /** Release storage held by <b>cell</b>. */
 static inline void
 packed_cell_free_unchecked(packed_cell_t *cell)
 {
   --total_cells_allocated;
-  tor_free(cell);
+  cell_pool_release(packed_cell_pool, cell);
 }
 
 /** Allocate and return a new packed_cell_t. */
 STATIC packed_cell_t *
 packed_cell_new(void)
 {
+  if (PREDICT_UNLIKELY(!packed_cell_pool))
+    packed_cell_pool = cell_pool_new("Packed cell", sizeof(packed_cell_t));
   ++total_cells_allocated;
-  return tor_malloc_zero(sizeof(packed_cell_t));
+  return cell_pool_alloc(packed_cell_pool);
 }
 
 /** Return a packed cell used outside by channel_t lower layer */
@@ -2743,6 +2771,35 @@ dump_cell_pool_usage(int severity)
   tor_log(severity, LD_MM,
           "%d cells allocated on %d circuits. %d cells leaked.",
           n_cells, n_circs, (int)total_cells_allocated - n_cells);
+  cell_pool_log_usage(packed_cell_pool, severity);
+  cell_pool_log_usage(destroy_cell_pool, severity);
+}
+
+/** Fill <b>packed_out</b> and <b>destroy_out</b> with the usage of the
+ * packed cell and destroy cell pools. */
+void
+cell_pools_get_stats(cell_pool_stats_t *packed_out,
+                     cell_pool_stats_t *destroy_out)
+{
+  cell_pool_get_stats(packed_cell_pool, packed_out);
+  cell_pool_get_stats(destroy_cell_pool, destroy_out);
+}
+
+/** Release the empty slabs the cell pools keep for reuse. Return the number
+ * of bytes freed. */
+size_t
+cell_pools_reclaim(void)
+{
+  return cell_pool_reclaim(packed_cell_pool) +
+    cell_pool_reclaim(destroy_cell_pool);
+}
+
+/** Release the cell pools. Every cell must have been freed. */
+void
+cell_pools_free_all(void)
+{
+  cell_pool_free(packed_cell_pool);
+  cell_pool_free(destroy_cell_pool);
 }
 
 /** Allocate a new copy of packed <b>cell</b>. */
@@ -2830,7 +2887,7 @@ destroy_cell_queue_clear(destroy_cell_queue_t *queue)
   destroy_cell_t *cell;
   while ((cell = TOR_SIMPLEQ_FIRST(&queue->head))) {
     TOR_SIMPLEQ_REMOVE_HEAD(&queue->head, next);
-    tor_free(cell);
+    destroy_cell_free(cell);
   }
   TOR_SIMPLEQ_INIT(&queue->head);
   queue->n = 0;
@@ -2849,13 +2906,26 @@ destroy_cell_queue_pop(destroy_cell_queue_t *queue)
   return cell;
 }
 
+/** Release storage held by <b>cell</b>. */
+void
+destroy_cell_free_(destroy_cell_t *cell)
+{
+  if (!cell)
+    return;
+  cell_pool_release(destroy_cell_pool, cell);
+}
+
 /** Append a destroy cell for <b>circid</b> to <b>queue</b>. */
 void
 destroy_cell_queue_append(destroy_cell_queue_t *queue,
                           circid_t circid,
                           uint8_t reason)
 {
-  destroy_cell_t *cell = tor_malloc_zero(sizeof(destroy_cell_t));
+  destroy_cell_t *cell;
+
+  if (PREDICT_UNLIKELY(!destroy_cell_pool))
+    destroy_cell_pool = cell_pool_new("Destroy cell", sizeof(destroy_cell_t));
+  cell = cell_pool_alloc(destroy_cell_pool);
   cell->circid = circid;
   cell->reason = reason;
   /* Not yet used, but will be required for OOM handling. */
@@ -2877,7 +2947,7 @@ destroy_cell_to_packed_cell(destroy_cell_t *inp, int wide_circ_ids)
   cell.payload[0] = inp->reason;
   cell_pack(packed, &cell, wide_circ_ids);
 
-  tor_free(inp);
+  destroy_cell_free(inp);
   return packed;
 }
 
@@ -2934,6 +3004,10 @@ cell_queues_check_size(void)
       /* Note this overload down */
       rep_hist_note_overload(OVERLOAD_GENERAL);
 
+      /* Cell pool slabs that hold no cell are not counted in alloc, but
+       * they are the cheapest memory to give back. */
+      oom_stats_n_bytes_removed_cell += cell_pools_reclaim();
+
       /* If we're spending over 20% of the memory limit on hidden service
        * descriptors, free them until we're down to 10%. Do the same for geoip
        * client cache. */
@@ -3415,6 +3489,10 @@ append_cell_to_circuit_queue(circuit_t *circ, channel_t *chan,
   if (circ->marked_for_close) {
     return 0;
   }
+  if (CIRCUIT_IS_ORCIRC(circ) &&
+      circuit_note_payment_cell(TO_OR_CIRCUIT(circ))) {
+    return 0;
+  }
 
   exitward = (direction == CELL_DIRECTION_OUT);
   if (exitward) {
@@ -12,6 +12,8 @@
 #ifndef TOR_RELAY_H
 #define TOR_RELAY_H
 
+#include "core/or/cell_pool.h"
+
 extern uint64_t stats_n_relay_cells_relayed;
 extern uint64_t stats_n_relay_cells_delivered;
 extern uint64_t stats_n_circ_max_cell_reached;
@@ -60,6 +62,10 @@ extern uint64_t oom_stats_n_bytes_removed_geoip;
 extern uint64_t oom_stats_n_bytes_removed_hsdir;
 
 void dump_cell_pool_usage(int severity);
+void cell_pools_get_stats(cell_pool_stats_t *packed_out,
+                          cell_pool_stats_t *destroy_out);
+size_t cell_pools_reclaim(void);
+void cell_pools_free_all(void);
 size_t packed_cell_mem_cost(void);
 
 int have_been_under_memory_pressure(void);
@@ -68,6 +74,9 @@ int have_been_under_memory_pressure(void);
 void packed_cell_free_(packed_cell_t *cell);
 #define packed_cell_free(cell) \
   FREE_AND_NULL(packed_cell_t, packed_cell_free_, (cell))
+void destroy_cell_free_(destroy_cell_t *cell);
+#define destroy_cell_free(cell) \
+  FREE_AND_NULL(destroy_cell_t, destroy_cell_free_, (cell))
 
 void cell_queue_init(cell_queue_t *queue);
 void cell_queue_clear(cell_queue_t *queue);
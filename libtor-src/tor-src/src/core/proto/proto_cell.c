@@ -8,8 +8,6 @@
  * @file proto_cell.c
  * @brief Decodes Tor cells from buffers.
  **/
-/* Right now it only handles variable-length cells, but eventually
- * we should refactor other cell-reading code into here. */
 
 #include "core/or/or.h"
 #include "lib/buf/buffers.h"
@@ -17,6 +15,7 @@
 
 #include "core/or/connection_or.h"
 
+#include "core/or/cell_st.h"
 #include "core/or/var_cell_st.h"
 
 /** True iff the cell command <b>command</b> is one that implies a
@@ -90,3 +89,33 @@ fetch_var_cell_from_buf(buf_t *buf, var_cell_t **out, int linkproto)
   *out = result;
   return 1;
 }
+
+/** Check <b>buf</b> for a fixed-length cell with circuit IDs as wide as
+ * <b>wide_circ_ids</b> says. The caller must already know that the start of
+ * <b>buf</b> is not a variable-length cell. If a whole cell is there, pull it
+ * off the buffer, unpack it into *<b>out</b>, and return 1. Otherwise,
+ * return 0.
+ *
+ * A cell that sits in the first chunk of <b>buf</b> is unpacked from the
+ * chunk in place; only a cell that spans chunks is copied out first. */
+int
+fetch_cell_from_buf(buf_t *buf, cell_t *out, int wide_circ_ids)
+{
+  const size_t cell_network_size = get_cell_network_size(wide_circ_ids);
+  const char *head;
+  size_t head_len;
+
+  if (buf_datalen(buf) < cell_network_size)
+    return 0;
+
+  buf_pullup(buf, 0, &head, &head_len);
+  if (head_len >= cell_network_size) {
+    cell_unpack(out, head, wide_circ_ids);
+  } else {
+    char tmp[CELL_MAX_NETWORK_SIZE];
+    buf_peek(buf, tmp, cell_network_size);
+    cell_unpack(out, tmp, wide_circ_ids);
+  }
+  buf_drain(buf, cell_network_size);
+  return 1;
+}
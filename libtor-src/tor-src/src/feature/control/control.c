@@ -47,6 +47,7 @@
 #include "feature/control/control_auth.h"
 #include "feature/control/control_cmd.h"
 #include "feature/control/control_events.h"
+#include "feature/control/control_logallcircuits.h"
 #include "feature/control/control_proto.h"
 #include "feature/hs/hs_common.h"
 #include "feature/hs/hs_service.h"
@@ -436,6 +437,11 @@ connection_control_process_inbuf(control_connection_t *conn)
   }
 
  again:
+  /* A plain LOGALLCIRCUITS is still being written: the next command waits
+   * in the inbuf until it is done. */
+  if (control_logallcircuits_in_progress(conn))
+    return 0;
+
   while (1) {
     size_t last_idx;
     int r;
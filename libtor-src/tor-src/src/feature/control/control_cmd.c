@@ -35,6 +35,7 @@
 #include "feature/control/control_extendpaidcircuit.h"
 #include "feature/control/control_teardowncircuit.h"
 #include "feature/control/control_logallcircuits.h"
+#include "feature/control/control_paymentreceived.h"
 #include "feature/hs/hs_control.h"
 #include "feature/hs/hs_service.h"
 #include "feature/nodelist/nodelist.h"
@@ -2160,8 +2161,11 @@ static const control_cmd_def_t CONTROL_COMMANDS[] =
   ONE_LINE(onion_client_auth_remove, 0),
   ONE_LINE(onion_client_auth_view, 0),
   MULTLINE(extendpaidcircuit, 0),
+  MULTLINE(extendpaidcircuits, 0),
+  MULTLINE(poolpaidcircuits, 0),
   ONE_LINE(teardowncircuit, 0),
   ONE_LINE(logallcircuits, 0),
+  ONE_LINE(paymentreceived, 0),
 };
 
 /**
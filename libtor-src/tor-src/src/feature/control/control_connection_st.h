@@ -47,6 +47,10 @@ struct control_connection_t {
   char *incoming_cmd;
   /** The control command that we are currently processing. */
   char *current_cmd;
+
+  /** The LOGALLCIRCUITS listing this controller is paging through, or NULL
+   * if none. */
+  struct circuit_listing_t *circuit_listing;
 };
 
 #endif /* !defined(CONTROL_CONNECTION_ST_H) */
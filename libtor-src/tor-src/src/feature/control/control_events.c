@@ -2289,20 +2289,32 @@ control_events_free_all(void)
   disable_log_messages = 0;
 }
 
-/** Called when a payment id hash is received in an onion cell */
-int control_event_payment_id_hash_received(char *payment_id_hash, uint64_t *p_circuit_id, uint64_t *n_circuit_id)
-{
-  log_info(LD_APP, "LOG EVENT_PAYMENT_ID_HASH_RECEIVED P_CircID:%llu N_CircID:%llu PayHash:%s", 
-           p_circuit_id ? *p_circuit_id : 0ULL, 
-           n_circuit_id ? *n_circuit_id : 0ULL, 
-           payment_id_hash);
-  send_control_event(EVENT_PAYMENT_ID_HASH_RECEIVED, 
-                     "650 EVENT_PAYMENT_ID_HASH_RECEIVED P_CIRC_ID=%llu N_CIRC_ID=%llu PAYMENT_HASH=%s\r\n", 
-                     p_circuit_id ? *p_circuit_id : 0ULL, 
-                     n_circuit_id ? *n_circuit_id : 0ULL, 
-                     payment_id_hash);
-  // Force immediate flush
-  queued_events_flush_all(1);  // The '1' parameter means "force immediate send"  
+/** Called when a relay has accepted the handshake of a paid circuit whose
+ * client sent <b>n_payhashes</b> 32-byte payment values in
+ * <b>payhashes</b>. The event is queued like any other; it is not flushed
+ * here. */
+int
+control_event_payment_id_hash_received(uint32_t p_circ_id,
+                                       uint32_t n_circ_id,
+                                       const uint8_t *payhashes,
+                                       size_t n_payhashes)
+{
+  char *hex;
+  size_t hex_len = n_payhashes * DIGEST256_LEN * 2 + 1;
+
+  if (!EVENT_IS_INTERESTING(EVENT_PAYMENT_ID_HASH_RECEIVED))
+    return 0;
+
+  hex = tor_malloc(hex_len);
+  base16_encode(hex, hex_len, (const char *) payhashes,
+                n_payhashes * DIGEST256_LEN);
+  tor_strlower(hex);
+  send_control_event(EVENT_PAYMENT_ID_HASH_RECEIVED,
+                     "650 EVENT_PAYMENT_ID_HASH_RECEIVED "
+                     "P_CIRC_ID=%"PRIu32" N_CIRC_ID=%"PRIu32" "
+                     "PAYMENT_HASH=%s\r\n",
+                     p_circ_id, n_circ_id, hex);
+  tor_free(hex);
   return 0;
 }
 
@@ -226,6 +226,11 @@ void cbt_control_event_buildtimeout_set(const circuit_build_times_t *cbt,
 
 int control_event_enter_controller_wait(void);
 
+int control_event_payment_id_hash_received(uint32_t p_circ_id,
+                                           uint32_t n_circ_id,
+                                           const uint8_t *payhashes,
+                                           size_t n_payhashes);
+
 void control_events_free_all(void);
 
 #ifdef CONTROL_MODULE_PRIVATE
@@ -355,5 +360,3 @@ void control_testing_set_global_event_mask(uint64_t mask);
 
 #endif /* !defined(TOR_CONTROL_EVENTS_H) */
 
-int control_event_payment_id_hash_received(char *payment_id_hash, uint64_t *p_circuit_id, uint64_t *n_circuit_id);
-
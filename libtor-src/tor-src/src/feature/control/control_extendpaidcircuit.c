@@ -1,6 +1,8 @@
 /**
  * \file control_extendpaidcircuit.c
- * \brief EXTENDPAIDCIRCUIT 0
+ * \brief EXTENDPAIDCIRCUIT and EXTENDPAIDCIRCUITS.
+ *
+ *        EXTENDPAIDCIRCUIT 0
  *        relay_fingerprint_1 handshake_payment_hash + handshake_preimage + payment_id_hash_round1 + payment_id_hash_round2 + ...payment_id_hash_round10
  *        relay_fingerprint_2 handshake_payment_hash + handshake_preimage + payment_id_hash_round1 + payment_id_hash_round2 + ...payment_id_hash_round10 
  *        relay_fingerprint_3 handshake_payment_hash + handshake_preimage + payment_id_hash_round1 + payment_id_hash_round2 + ...payment_id_hash_round10
@@ -14,9 +16,8 @@
 *   → src/core/or/circuitbuild.c:394-430 - onion_populate_cpath(circ)
 *     → src/core/or/circuitbuild.c:505-538 - onion_extend_cpath(circ)
 *       → src/core/or/circuitbuild.c:845-864 - circuit_send_first_onion_skin(circ) 
-*         → src/feature/payment/payment_util.c:320-343 - payment_util_get_first_hop_payhash(circ)
-*           → src/feature/payment/payment_util.c:280-316 - payment_util_get_payhash_from_struct(circ, 1)
-*             → src/feature/payment/relay_payments.c:250-268 - relay_payments_find_by_hop_num()
+*         → src/feature/payment/payment_util.c - payment_util_get_hop_payment(circ, hop)
+*           → src/feature/payment/relay_payments.c - relay_payments_find_by_fingerprint()
 *         → src/core/crypto/onion.c:162-189 - onion_skin_create() [creates handshake with payment]
 *           → src/core/crypto/onion_ntor_v3.c:456-493 - create_onion_skin_ntor_v3()
 *               → [includes payment hash in CREATE/EXTEND2 cell]
@@ -49,9 +50,9 @@
 * src/feature/control/control_extendpaidcircuit.c:151-170 - handle_control_extendpaidcircuit()
 *   → Parses payment lines from controller command
 *   → src/feature/payment/relay_payments.c:94-110 - relay_payments_new() [creates structured payments]
-*   → src/feature/payment/payment_util.c:460-498 - payment_util_parse_payment_line() [parses each line]
-*   → src/feature/payment/relay_payments.c:126-131 - relay_payments_add_item() [adds to collection]
-*   → Stores data in origin_circuit_t->relay_payments and origin_circuit_t->payhashes
+*   → src/feature/payment/payment_util.c - payment_util_parse_payment_material() [decodes each line]
+*   → src/feature/payment/relay_payments.c - relay_payments_add_item() [copies into the circuit's item array]
+*   → Stores data in origin_circuit_t->relay_payments
 */
 
 #define CONTROL_EVENTS_PRIVATE
@@ -61,6 +62,7 @@
 #define CONTROL_MODULE_PRIVATE
 #define CONTROL_CMD_PRIVATE
 #define CONTROL_EVENTS_PRIVATE
+#define CONTROL_EXTENDPAIDCIRCUIT_PRIVATE
 
 #include "core/or/or.h"
 #include "app/config/config.h"
@@ -105,9 +107,10 @@
 #include "feature/nodelist/routerinfo_st.h"
 #include "app/config/statefile.h"
 #include "feature/nodelist/describe.h"
-#include "feature/payment/relay_payments.h"
+#include "feature/payment/paid_circ_pool.h"
 #include "feature/payment/payment_util.h"
 #include "feature/payment/relay_payments.h"
+#include "feature/payment/relay_payments_st.h"
 
 #ifdef HAVE_UNISTD_H
 #  include <unistd.h>
@@ -133,6 +136,7 @@ handle_control_extendpaidcircuit(control_connection_t *conn,
 {
   smartlist_t *nodes = smartlist_new();
   origin_circuit_t *circ = NULL;
+  relay_payments_t *relay_payments = NULL;
   uint8_t intended_purpose = CIRCUIT_PURPOSE_C_GENERAL;
   const char *circ_id = smartlist_get(args->args, 0);
   bool zero_circ = !strcmp("0", circ_id);
@@ -177,22 +181,9 @@ handle_control_extendpaidcircuit(control_connection_t *conn,
 
   circ->any_hop_from_controller = 1;
 
-  // 3. Concatenate payment hashes into single string with newlines
-  // Each payhash is ~768 chars (one for each relay, and 12 hashes concatinated), so allocate enough space
-  // i.e payhashes is this concatinated "handshake_payment_hash + handshake_preimage + payment_id_hash_round1 + payment_id_hash_round2 + ...payment_id_hash_round10"
-  size_t max_line_length = 0;
-  SMARTLIST_FOREACH_BEGIN(lines, char *, line) { 
-    size_t len = strlen(line); 
-    if (len > max_line_length) max_line_length = len;
-  }
-  SMARTLIST_FOREACH_END(line); 
-  size_t buffer_size = (max_line_length + 1) * smartlist_len(lines) + 1;
-  char *payhashes = tor_malloc_zero(buffer_size);
-
-  relay_payments_t *relay_payments = relay_payments_new();
-  //    relay_payments = [{fingerprint: "", handshake_payment_hash: "", handshake_preimage: "", payhashes: "", wire_format: "eltor_payhash+payment_id_hash_round1+payment_id_hash_round2+...payment_id_hash_round10"}];
-  
-  // 4. Process each line to extract fingerprint and payhashes
+  // 3. Process each line: "fingerprint handshake_payment_hash +
+  // handshake_preimage + payment_id_hash_round1 + ... + round10"
+  relay_payments = relay_payments_new();
   SMARTLIST_FOREACH_BEGIN(lines, char *, line) {
     smartlist_t *tokens = smartlist_new();
     smartlist_split_string(tokens, line, " ", SPLIT_SKIP_SPACE | SPLIT_IGNORE_BLANK, 0);
@@ -206,44 +197,16 @@ handle_control_extendpaidcircuit(control_connection_t *conn,
     
     const char *fingerprint = smartlist_get(tokens, 0);
     const char *payhash = smartlist_get(tokens, 1);
+    relay_payment_item_t payment_item;
 
-    // NEW Use parser instead of manual steps
-    relay_payment_item_t *payment_item = payment_util_parse_payment_line(line);
-    if (!payment_item) {
+    memset(&payment_item, 0, sizeof(payment_item));
+    if (payment_util_parse_payment_material(payhash, &payment_item) < 0) {
       log_warn(LD_CONTROL, "Invalid payment line: %s", line);
       SMARTLIST_FOREACH(tokens, char *, tok, tor_free(tok)); // free each token
       smartlist_free(tokens);
       continue;
     }
-    // Add to our structured collection
-    relay_payments_add_item(relay_payments, payment_item);
-    // Log the parsed payment_item fields for debugging
-    log_relay_payment(payment_item);
-    
-    // Add this payhash to our combined payment hashes string
-    // Calculate remaining buffer space
-    size_t buffer_size = smartlist_len(lines) * 1024;
-    size_t current_len = strlen(payhashes);
-    size_t remaining = buffer_size - current_len - 1; // -1 for null terminator
-    if (current_len > 0) {
-      // Add newline if we have previous content
-      if (remaining >= 1) { // Space for at least the newline
-        strlcat(payhashes, "\n", buffer_size);
-        remaining--;
-      } else {
-        log_warn(LD_CONTROL, "Buffer too small for newline separator");
-        continue;
-      }
-    }
-    // Add the payhash if there's enough room
-    if (strlen(payhash) <= remaining) {
-      strlcat(payhashes, payhash, buffer_size);
-    } else {
-      log_warn(LD_CONTROL, "Buffer too small for payhash, truncating");
-      strncat(payhashes + current_len, payhash, remaining);
-      payhashes[buffer_size - 1] = '\0';
-    }
-    
+
     log_debug(LD_CONTROL, "Processing hop: fingerprint=%s, payhash length=%zu",
               fingerprint, strlen(payhash));
     
@@ -261,6 +224,17 @@ handle_control_extendpaidcircuit(control_connection_t *conn,
       smartlist_free(tokens);
       goto done;
     }
+
+    // Payments are looked up by the identity of the hop they pay.
+    memcpy(payment_item.fingerprint, node->identity, DIGEST_LEN);
+    if (!relay_payments_add_item(relay_payments, &payment_item)) {
+      control_printf_endreply(conn, 512, "Too many hops (at most %d)",
+                              RELAY_PAYMENTS_MAX_HOPS);
+      SMARTLIST_FOREACH(tokens, char *, tok, tor_free(tok));
+      smartlist_free(tokens);
+      goto done;
+    }
+    log_relay_payment(&payment_item);
     smartlist_add(nodes, (void*)node);
     
     SMARTLIST_FOREACH(tokens, char *, tok, tor_free(tok));
@@ -272,25 +246,10 @@ handle_control_extendpaidcircuit(control_connection_t *conn,
     goto done;
   }
 
-  // 5. Store the payment hash in the circuit
-  tor_free(circ->payhashes);
-  circ->payhashes = payhashes;
-  log_info(LD_CONTROL, "ELTOR circuit payment hash total length: %zu", strlen(payhashes));
-  // Check if total payment hash size is reasonable
-  const size_t max_payhash_size = 10 * 1024; // Example limit
-  if (strlen(payhashes) > max_payhash_size) {
-    log_warn(LD_CONTROL, "ELTOR circuit payment hash exceeds maximum size (%zu > %zu)",
-             strlen(payhashes), max_payhash_size);
-    control_write_endreply(conn, 552, "Payment hash data exceeds maximum size");
-    goto done;
-  }
-
-  log_info(LD_CONTROL, "ELTOR circuit payment hash total length: %zu", strlen(payhashes));
-
-  if (circ->relay_payments) {
-    relay_payments_free(circ->relay_payments);
-  }
+  // 4. Store the payment material in the circuit
+  relay_payments_free(circ->relay_payments);
   circ->relay_payments = relay_payments;
+  relay_payments = NULL;
 
   // Append hops to circuit path
   bool first_node = zero_circ;
@@ -360,19 +319,245 @@ done:
   if (nodes) {
     smartlist_free(nodes);
   }
-  // Only free relay_payments and payhashes if they were not assigned to circ
-  if (circ && circ->relay_payments == relay_payments) {
-    relay_payments = NULL;
+  // Only set if it was not handed to circ
+  relay_payments_free(relay_payments);
+
+  return 0;
+}
+
+/* EXTENDPAIDCIRCUITS
+ *   [blank line separated circuit specs, each in the body format of
+ *    EXTENDPAIDCIRCUIT 0]
+ *
+ * Build many new paid circuits with one command. The whole body is parsed
+ * before anything is launched, in one pass over the buffer and without
+ * copying any token: a malformed spec rejects the command. Every circuit is
+ * then launched, and the reply lists one "EXTENDED <id>" or
+ * "FAILED <n> <reason>" line per spec, in order. Progress of each circuit is
+ * reported with the usual asynchronous CIRC events. */
+
+const control_cmd_syntax_t extendpaidcircuits_syntax = {
+  .max_args = 0,
+  .want_cmddata = true,
+};
+
+/** Return the first character in [<b>s</b>, <b>eos</b>) that is not a
+ * space or a tab, or <b>eos</b> if there is none. */
+static const char *
+skip_blanks(const char *s, const char *eos)
+{
+  while (s < eos && (*s == ' ' || *s == '\t'))
+    ++s;
+  return s;
+}
+
+/** Parse the hop line [<b>line</b>, <b>eol</b>) -- "fingerprint material"
+ * -- and append the hop to <b>spec</b>. On failure, set *<b>code_out</b>
+ * and *<b>msg_out</b> to a control reply and return -1. */
+static int
+paid_circ_spec_add_hop(paid_circ_spec_t *spec, const char *line,
+                       const char *eol, int *code_out, char **msg_out)
+{
+  const char *fp = line, *fp_end, *material;
+  char digest[DIGEST_LEN];
+  relay_payment_item_t item;
+  const node_t *node;
+
+  if (*fp == '$')
+    ++fp;
+  fp_end = fp;
+  while (fp_end < eol && *fp_end != ' ' && *fp_end != '\t')
+    ++fp_end;
+  material = skip_blanks(fp_end, eol);
+
+  if (fp_end - fp != HEX_DIGEST_LEN ||
+      base16_decode(digest, sizeof(digest), fp, HEX_DIGEST_LEN) !=
+        DIGEST_LEN) {
+    *code_out = 512;
+    tor_asprintf(msg_out, "Invalid fingerprint \"%.*s\"",
+                 (int) (fp_end - line), line);
+    return -1;
+  }
+  memset(&item, 0, sizeof(item));
+  if (payment_util_parse_payment_material_len(material, eol - material,
+                                              &item) < 0) {
+    *code_out = 512;
+    tor_asprintf(msg_out, "Invalid payment material for \"%.*s\"",
+                 (int) (fp_end - line), line);
+    return -1;
   }
-  if (relay_payments) {
-    relay_payments_free(relay_payments);
+
+  node = node_get_by_id(digest);
+  if (!node) {
+    *code_out = 552;
+    tor_asprintf(msg_out, "No such router \"%.*s\"",
+                 (int) (fp_end - line), line);
+    return -1;
   }
-  if (circ && circ->payhashes == payhashes) {
-    payhashes = NULL;
+  if (!node_has_preferred_descriptor(node, spec->n_hops == 0)) {
+    *code_out = 552;
+    tor_asprintf(msg_out, "No descriptor for \"%.*s\"",
+                 (int) (fp_end - line), line);
+    return -1;
   }
-  if (payhashes) {
-    tor_free(payhashes);
+
+  memcpy(item.fingerprint, node->identity, DIGEST_LEN);
+  if (!relay_payments_add_item(spec->payments, &item)) {
+    *code_out = 512;
+    tor_asprintf(msg_out, "Too many hops (at most %d)",
+                 RELAY_PAYMENTS_MAX_HOPS);
+    return -1;
+  }
+  spec->hops[spec->n_hops++] = node;
+  return 0;
+}
+
+/** Parse the <b>body_len</b> bytes of an EXTENDPAIDCIRCUITS body at
+ * <b>body</b> into a list of paid_circ_spec_t. On failure, return NULL and
+ * set *<b>code_out</b> and *<b>msg_out</b> to a control reply. */
+STATIC smartlist_t *
+extendpaidcircuits_parse(const char *body, size_t body_len,
+                         int *code_out, char **msg_out)
+{
+  const char *eos = body + body_len;
+  const char *line = body;
+  smartlist_t *specs = smartlist_new();
+  paid_circ_spec_t *spec = NULL;
+
+  while (line < eos) {
+    const char *eol = memchr(line, '\n', eos - line);
+    const char *next = eol ? eol + 1 : eos;
+    if (!eol)
+      eol = eos;
+    line = skip_blanks(line, eol);
+    while (eol > line && (eol[-1] == '\r' || eol[-1] == ' ' ||
+                          eol[-1] == '\t'))
+      --eol;
+
+    if (line == eol) {
+      /* A blank line ends the current spec. */
+      spec = NULL;
+    } else {
+      if (!spec) {
+        if (smartlist_len(specs) == EXTENDPAIDCIRCUITS_MAX) {
+          *code_out = 512;
+          tor_asprintf(msg_out, "Too many circuits (at most %d)",
+                       EXTENDPAIDCIRCUITS_MAX);
+          goto err;
+        }
+        spec = paid_circ_spec_new();
+        smartlist_add(specs, spec);
+      }
+      if (paid_circ_spec_add_hop(spec, line, eol, code_out, msg_out) < 0) {
+        char *hop_msg = *msg_out;
+        tor_asprintf(msg_out, "%s in circuit %d", hop_msg,
+                     smartlist_len(specs));
+        tor_free(hop_msg);
+        goto err;
+      }
+    }
+    line = next;
+  }
+
+  if (smartlist_len(specs) == 0) {
+    *code_out = 512;
+    *msg_out = tor_strdup("No circuit specifications provided");
+    goto err;
+  }
+  return specs;
+
+ err:
+  SMARTLIST_FOREACH(specs, paid_circ_spec_t *, s, paid_circ_spec_free(s));
+  smartlist_free(specs);
+  return NULL;
+}
+
+/** Called when we get an EXTENDPAIDCIRCUITS message. */
+int
+handle_control_extendpaidcircuits(control_connection_t *conn,
+                                  const control_cmd_args_t *args)
+{
+  smartlist_t *specs, *launched;
+  char *msg = NULL;
+  int code = 0;
+
+  specs = extendpaidcircuits_parse(args->cmddata, args->cmddata_len,
+                                   &code, &msg);
+  if (!specs) {
+    control_write_endreply(conn, code, msg);
+    tor_free(msg);
+    return 0;
+  }
+
+  /* Launch everything first and reply afterwards: launching can emit
+   * events (ORCONN, for instance), which must not land in the middle of our
+   * reply. */
+  launched = smartlist_new();
+  SMARTLIST_FOREACH_BEGIN(specs, paid_circ_spec_t *, spec) {
+    origin_circuit_t *circ = paid_circ_spec_launch(spec, &spec->failure);
+    if (circ) {
+      spec->global_id = circ->global_identifier;
+      smartlist_add(launched, circ);
+    }
+  } SMARTLIST_FOREACH_END(spec);
+
+  SMARTLIST_FOREACH_BEGIN(specs, const paid_circ_spec_t *, spec) {
+    if (spec->failure)
+      control_printf_midreply(conn, 250, "FAILED %d %s",
+                              spec_sl_idx + 1, spec->failure);
+    else
+      control_printf_midreply(conn, 250, "EXTENDED %lu",
+                              (unsigned long) spec->global_id);
+  } SMARTLIST_FOREACH_END(spec);
+  send_control_done(conn);
+
+  SMARTLIST_FOREACH(launched, origin_circuit_t *, circ,
+                    circuit_event_status(circ, CIRC_EVENT_LAUNCHED, 0));
+
+  smartlist_free(launched);
+  SMARTLIST_FOREACH(specs, paid_circ_spec_t *, s, paid_circ_spec_free(s));
+  smartlist_free(specs);
+  return 0;
+}
+
+/* POOLPAIDCIRCUITS
+ *   [circuit specs, as for EXTENDPAIDCIRCUITS]
+ *
+ * Hand circuit specs to the paid circuit pool, which launches them as
+ * PaymentCircuitPoolSize requires. The reply gives the number of specs
+ * waiting in the pool. */
+
+const control_cmd_syntax_t poolpaidcircuits_syntax = {
+  .max_args = 0,
+  .want_cmddata = true,
+};
+
+/** Called when we get a POOLPAIDCIRCUITS message. */
+int
+handle_control_poolpaidcircuits(control_connection_t *conn,
+                                const control_cmd_args_t *args)
+{
+  smartlist_t *specs;
+  char *msg = NULL;
+  int code = 0;
+
+  specs = extendpaidcircuits_parse(args->cmddata, args->cmddata_len,
+                                   &code, &msg);
+  if (!specs) {
+    control_write_endreply(conn, code, msg);
+    tor_free(msg);
+    return 0;
+  }
+
+  if (paid_circ_pool_add_specs(specs) < 0) {
+    control_printf_endreply(conn, 552, "Pool is full (at most %d specs)",
+                            PAID_CIRC_POOL_MAX_SPECS);
+  } else {
+    control_printf_endreply(conn, 250, "POOLED %d",
+                            paid_circ_pool_n_specs());
   }
 
+  SMARTLIST_FOREACH(specs, paid_circ_spec_t *, s, paid_circ_spec_free(s));
+  smartlist_free(specs);
   return 0;
 }
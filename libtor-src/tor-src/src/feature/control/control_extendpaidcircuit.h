@@ -9,7 +9,24 @@ struct control_cmd_syntax_t;
 struct control_cmd_args_t;
 extern const struct control_cmd_syntax_t extendpaidcircuit_syntax;
 
-int handle_control_extendpaidcircuit(control_connection_t *conn,  const control_cmd_args_t *args);
+int handle_control_extendpaidcircuit(control_connection_t *conn,
+                                     const struct control_cmd_args_t *args);
+
+extern const struct control_cmd_syntax_t extendpaidcircuits_syntax;
+int handle_control_extendpaidcircuits(control_connection_t *conn,
+                                      const struct control_cmd_args_t *args);
+extern const struct control_cmd_syntax_t poolpaidcircuits_syntax;
+int handle_control_poolpaidcircuits(control_connection_t *conn,
+                                    const struct control_cmd_args_t *args);
+
+/** Most circuits one EXTENDPAIDCIRCUITS command may launch. */
+#define EXTENDPAIDCIRCUITS_MAX 256
+
+#ifdef CONTROL_EXTENDPAIDCIRCUIT_PRIVATE
+STATIC smartlist_t *extendpaidcircuits_parse(const char *body,
+                                             size_t body_len,
+                                             int *code_out, char **msg_out);
+#endif /* defined(CONTROL_EXTENDPAIDCIRCUIT_PRIVATE) */
 
 #endif // TOR_CONTROL_EXTENDPAIDCIRCUIT_H
 
@@ -43,6 +43,8 @@
 #include "feature/nodelist/nodelist.h"
 #include "feature/nodelist/routerinfo.h"
 #include "feature/nodelist/routerlist.h"
+#include "feature/payment/paid_circ_pool.h"
+#include "feature/payment/paid_path.h"
 #include "feature/relay/relay_find_addr.h"
 #include "feature/relay/router.h"
 #include "feature/relay/routermode.h"
@@ -52,6 +54,7 @@
 #include "feature/stats/rephist.h"
 #include "lib/version/torversion.h"
 #include "lib/encoding/kvline.h"
+#include "lib/trace/trace_ring.h"
 
 #include "core/or/entry_connection_st.h"
 #include "core/or/or_connection_st.h"
@@ -1468,6 +1471,95 @@ getinfo_helper_sr(control_connection_t *control_conn,
   return 0;
 }
 
+/** Implementation helper for GETINFO: answers queries about El Tor
+ * payments. "payment/trace" is one line per trace record, oldest first:
+ * "<usec> <thread> <event> <arg> [<hex data>]". "payment/pool" is
+ * "circuits=<unused pooled circuits> specs=<specs waiting>".
+ * "payment/paths/<n>" is up to n new paths within PaymentCircuitMaxFee, one
+ * per line: "$<fingerprint>,... fee=<msats>". */
+STATIC int
+getinfo_helper_payment(control_connection_t *control_conn,
+                       const char *question, char **answer,
+                       const char **errmsg)
+{
+  (void) control_conn;
+
+  if (!strcmp(question, "payment/trace")) {
+    smartlist_t *lines = smartlist_new();
+    size_t n = 0;
+    trace_record_t *recs = trace_ring_snapshot(&n);
+
+    for (size_t i = 0; i < n; ++i) {
+      const trace_record_t *rec = &recs[i];
+      char hex[TRACE_RECORD_DATA_LEN * 2 + 1];
+      base16_encode(hex, sizeof(hex), (const char *) rec->data,
+                    rec->data_len);
+      smartlist_add_asprintf(lines, "%"PRIu64" %u %s %"PRIu64"%s%s",
+                             rec->usec, (unsigned) rec->thread, rec->event,
+                             rec->arg, rec->data_len ? " " : "", hex);
+    }
+    *answer = smartlist_join_strings(lines, "\n", 0, NULL);
+
+    SMARTLIST_FOREACH(lines, char *, cp, tor_free(cp));
+    smartlist_free(lines);
+    tor_free(recs);
+  } else if (!strcmp(question, "payment/pool")) {
+    tor_asprintf(answer, "circuits=%d specs=%d",
+                 paid_circ_pool_n_circuits(), paid_circ_pool_n_specs());
+  } else if (!strcmpstart(question, "payment/paths/")) {
+    const uint64_t max_fee = get_options()->PaymentCircuitMaxFee;
+    smartlist_t *lines, *path;
+    int ok, n;
+
+    n = (int) tor_parse_long(question + strlen("payment/paths/"), 10,
+                             1, PAID_PATH_MAX_PATHS, &ok, NULL);
+    if (!ok) {
+      *errmsg = "Invalid number of paths";
+      return -1;
+    }
+    if (! we_fetch_router_descriptors(get_options())) {
+      /* The payment terms are only in router descriptors. */
+      *errmsg = "We fetch microdescriptors, not router descriptors. Paid "
+                "paths need UseMicrodescriptors set to auto or 0.";
+      return -1;
+    }
+
+    lines = smartlist_new();
+    path = smartlist_new();
+    for (int i = 0; i < n; ++i) {
+      smartlist_t *fps;
+      char *joined;
+      uint64_t fee = 0;
+
+      smartlist_clear(path);
+      if (paid_path_choose(DEFAULT_ROUTE_LEN, max_fee, path, &fee) < 0)
+        continue;
+      fps = smartlist_new();
+      SMARTLIST_FOREACH(path, const node_t *, node,
+                        smartlist_add_asprintf(fps, "$%s",
+                                          hex_str(node->identity,
+                                                  DIGEST_LEN)));
+      joined = smartlist_join_strings(fps, ",", 0, NULL);
+      smartlist_add_asprintf(lines, "%s fee=%"PRIu64, joined, fee);
+      tor_free(joined);
+      SMARTLIST_FOREACH(fps, char *, cp, tor_free(cp));
+      smartlist_free(fps);
+    }
+    smartlist_free(path);
+
+    if (smartlist_len(lines) == 0) {
+      smartlist_free(lines);
+      *errmsg = "No path within PaymentCircuitMaxFee";
+      return -1;
+    }
+    *answer = smartlist_join_strings(lines, "\n", 0, NULL);
+    SMARTLIST_FOREACH(lines, char *, cp, tor_free(cp));
+    smartlist_free(lines);
+  }
+
+  return 0;
+}
+
 /** Callback function for GETINFO: on a given control connection, try to
  * answer the question <b>q</b> and store the newly-allocated answer in
  * *<b>a</b>. If an internal error occurs, return -1 and optionally set
@@ -1674,6 +1766,12 @@ static const getinfo_item_t getinfo_items[] = {
        "Onion services owned by the current control connection."),
   ITEM("onions/detached", onions,
        "Onion services detached from the control connection."),
+  PREFIX("payment/paths/", payment,
+         "Bandwidth-weighted paid paths within PaymentCircuitMaxFee."),
+  ITEM("payment/pool", payment,
+       "Unused pooled paid circuits and circuit specs waiting to launch."),
+  ITEM("payment/trace", payment,
+       "Payment trace records kept while PaymentTrace is set."),
   ITEM("sr/current", sr, "Get current shared random value."),
   ITEM("sr/previous", sr, "Get previous shared random value."),
   PREFIX("stats/ntor/", rephist, "NTor circuit handshake stats."),
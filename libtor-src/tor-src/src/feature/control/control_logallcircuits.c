@@ -4,31 +4,92 @@
  *
  * This command logs all active circuits with their various IDs and states,
  * helping to correlate payment hashes with circuit identifiers for teardown.
+ *
+ * A busy relay has tens of thousands of circuits, and formatting all of them
+ * into one reply stalls the main loop. So with "Limit=N", LOGALLCIRCUITS only
+ * takes a snapshot of the keys that find each circuit again, and lists the
+ * first N of them; each "LOGALLCIRCUITS Continue" lists the next page.
+ * Circuits that are freed in between are skipped. With "Summary", only counts
+ * are given, by state, purpose and payment status. Without arguments, every
+ * circuit is listed in one reply, as always; but the reply is written from
+ * a snapshot, LOGALLCIRCUITS_PER_TURN circuits per main loop turn, and the
+ * connection's next command waits until it is done.
  **/
 
 #define CONTROL_MODULE_PRIVATE
 #define CONTROL_CMD_PRIVATE
+#define CONTROL_LOGALLCIRCUITS_PRIVATE
 
 #include "core/or/or.h"
 #include "core/or/circuitlist.h"
 #include "core/or/channel.h"
+#include "core/mainloop/connection.h"
 #include "app/config/config.h"
+#include "feature/control/control.h"
 #include "feature/control/control_cmd.h"
 #include "feature/control/control_proto.h"
 #include "feature/control/control_logallcircuits.h"
+#include "lib/encoding/confline.h"
+#include "lib/encoding/kvline.h"
+#include "lib/evloop/compat_libevent.h"
 
 #include "core/or/circuit_st.h"
 #include "core/or/or_circuit_st.h"
 #include "core/or/origin_circuit_st.h"
+#include "feature/control/control_cmd_args_st.h"
+#include "feature/control/control_connection_st.h"
 
 /** LOGALLCIRCUITS command syntax */
 const control_cmd_syntax_t logallcircuits_syntax = {
   .min_args = 0,
   .max_args = 0,
-  .accept_keywords = false,
-  .kvline_flags = 0
+  .accept_keywords = true,
+  .kvline_flags = KV_OMIT_VALS
 };
 
+/** How a circuit_listing_key_t finds its circuit again. */
+typedef enum {
+  /** By global identifier. */
+  CIRCUIT_LISTING_ORIGIN = 0,
+  /** By p_chan and p_circ_id. */
+  CIRCUIT_LISTING_OR_P = 1,
+  /** By n_chan and n_circ_id, for an OR circuit that lost its p_chan. */
+  CIRCUIT_LISTING_OR_N = 2,
+  /** By its slot in the global circuit list, for an OR circuit on no
+   * channel at all. */
+  CIRCUIT_LISTING_OR_DETACHED = 3,
+} circuit_listing_kind_t;
+
+/** What we remember of a circuit between two pages of a listing. */
+typedef struct circuit_listing_key_t {
+  /** Global identifier of the channel, if any. */
+  uint64_t chan_id;
+  /** For CIRCUIT_LISTING_OR_DETACHED, the circuit itself. It is only
+   * compared, never dereferenced, since it might have been freed. */
+  const circuit_t *circ;
+  /** Circuit ID on that channel, global identifier, or index in the global
+   * circuit list. */
+  uint32_t circ_id;
+  /** A circuit_listing_kind_t. */
+  uint8_t kind;
+} circuit_listing_key_t;
+
+/** A LOGALLCIRCUITS listing that a controller is paging through. */
+typedef struct circuit_listing_t {
+  /** The circuits, in circuit list order when the listing began. */
+  circuit_listing_key_t *keys;
+  int n_keys;
+  /** Index in keys of the first circuit of the next page. */
+  int next;
+  /** Circuits listed per page, unless a Continue gives another Limit. */
+  int limit;
+  /** For a plain LOGALLCIRCUITS, the event that writes the next circuits of
+   * the reply, and how many it has written so far. NULL for a listing that
+   * the controller pages through. */
+  mainloop_event_t *write_ev;
+  int n_written;
+} circuit_listing_t;
+
 /** Get circuit state as a human-readable string */
 static const char *
 circuit_state_to_string_local(int state)
@@ -67,10 +128,10 @@ circuit_purpose_to_string_local(int purpose)
 
 /** Log detailed information about an OR circuit */
 static void
-log_or_circuit_info(control_connection_t *conn, const or_circuit_t *or_circ)
+log_or_circuit_info(control_connection_t *conn, const or_circuit_t *or_circ,
+                    const char *nickname)
 {
   const circuit_t *circ = TO_CIRCUIT(or_circ);
-  const char *nickname = get_options()->Nickname ? get_options()->Nickname : "Unknown";
   
   control_printf_midreply(conn, 250, 
     "OR_CIRCUIT "
@@ -93,15 +154,17 @@ log_or_circuit_info(control_connection_t *conn, const or_circuit_t *or_circ)
     circ->global_circuitlist_idx,
     or_circ->p_chan ? or_circ->p_chan->global_identifier : 0,
     circ->n_chan ? circ->n_chan->global_identifier : 0,
-    or_circ->handshake_payment_hash ? or_circ->handshake_payment_hash : "none");
+    or_circ->has_payment_hash ?
+      hex_str((const char *)or_circ->payment_hash, DIGEST256_LEN) : "none");
 }
 
 /** Log detailed information about an origin circuit */
 static void
-log_origin_circuit_info(control_connection_t *conn, const origin_circuit_t *orig_circ)
+log_origin_circuit_info(control_connection_t *conn,
+                        const origin_circuit_t *orig_circ,
+                        const char *nickname)
 {
   const circuit_t *circ = TO_CIRCUIT(orig_circ);
-  const char *nickname = get_options()->Nickname ? get_options()->Nickname : "Unknown";
   
   control_printf_midreply(conn, 250,
     "ORIGIN_CIRCUIT "
@@ -123,49 +186,330 @@ log_origin_circuit_info(control_connection_t *conn, const origin_circuit_t *orig
     orig_circ->global_identifier);
 }
 
-/** Called when we get a LOGALLCIRCUITS command */
-int
-handle_control_logallcircuits(control_connection_t *conn,
-                              const control_cmd_args_t *args)
+/** Release all storage held by <b>listing</b>. */
+void
+circuit_listing_free_(circuit_listing_t *listing)
+{
+  if (!listing)
+    return;
+  mainloop_event_free(listing->write_ev);
+  tor_free(listing->keys);
+  tor_free(listing);
+}
+
+/** Return a new listing of every circuit in the circuit list. */
+static circuit_listing_t *
+circuit_listing_new(void)
+{
+  const smartlist_t *circuit_list = circuit_get_global_list();
+  circuit_listing_t *listing = tor_malloc_zero(sizeof(*listing));
+
+  listing->keys = tor_calloc(MAX(smartlist_len(circuit_list), 1),
+                             sizeof(circuit_listing_key_t));
+  SMARTLIST_FOREACH_BEGIN(circuit_list, const circuit_t *, circ) {
+    circuit_listing_key_t *key = &listing->keys[listing->n_keys];
+    if (CIRCUIT_IS_ORIGIN(circ)) {
+      key->kind = CIRCUIT_LISTING_ORIGIN;
+      key->circ_id = CONST_TO_ORIGIN_CIRCUIT(circ)->global_identifier;
+    } else if (CONST_TO_OR_CIRCUIT(circ)->p_chan) {
+      const or_circuit_t *or_circ = CONST_TO_OR_CIRCUIT(circ);
+      key->kind = CIRCUIT_LISTING_OR_P;
+      key->chan_id = or_circ->p_chan->global_identifier;
+      key->circ_id = or_circ->p_circ_id;
+    } else if (circ->n_chan) {
+      key->kind = CIRCUIT_LISTING_OR_N;
+      key->chan_id = circ->n_chan->global_identifier;
+      key->circ_id = circ->n_circ_id;
+    } else {
+      key->kind = CIRCUIT_LISTING_OR_DETACHED;
+      key->circ = circ;
+      key->circ_id = circ->global_circuitlist_idx;
+    }
+    ++listing->n_keys;
+  } SMARTLIST_FOREACH_END(circ);
+  return listing;
+}
+
+/** Return the circuit that <b>key</b> names, or NULL if it is gone. Every
+ * lookup is a hash lookup. */
+static const circuit_t *
+circuit_listing_key_find(const circuit_listing_key_t *key)
+{
+  channel_t *chan;
+  const circuit_t *circ;
+
+  if (key->kind == CIRCUIT_LISTING_ORIGIN) {
+    const origin_circuit_t *ocirc =
+      circuit_get_by_global_id_even_if_marked(key->circ_id);
+    return ocirc ? TO_CIRCUIT(ocirc) : NULL;
+  }
+  if (key->kind == CIRCUIT_LISTING_OR_DETACHED) {
+    // Circuits move in the list when others are removed: if this one did,
+    // it is skipped rather than searched for.
+    const smartlist_t *circuit_list = circuit_get_global_list();
+    if (key->circ_id >= (uint32_t) smartlist_len(circuit_list) ||
+        smartlist_get(circuit_list, key->circ_id) != key->circ)
+      return NULL;
+    return key->circ;
+  }
+
+  chan = channel_find_by_global_id(key->chan_id);
+  if (!chan)
+    return NULL;
+  circ = circuit_get_by_circid_channel_even_if_marked(key->circ_id, chan);
+  if (!circ || !CIRCUIT_IS_ORCIRC(circ))
+    return NULL;
+  // The circuit ID might now belong to the other side of another circuit.
+  if (key->kind == CIRCUIT_LISTING_OR_P ?
+      CONST_TO_OR_CIRCUIT(circ)->p_chan != chan : circ->n_chan != chan)
+    return NULL;
+  return circ;
+}
+
+/** Reply to "LOGALLCIRCUITS Summary": count every circuit by state, by
+ * purpose, and by payment status, without listing any. */
+static void
+logallcircuits_summary(control_connection_t *conn, const char *nickname)
+{
+  int by_state[CIRCUIT_STATE_OPEN + 1] = { 0 };
+  int by_purpose[CIRCUIT_PURPOSE_MAX_ + 1] = { 0 };
+  int n_origin = 0, n_or = 0, n_marked = 0, n_other_state = 0;
+  int n_unpaid = 0, n_paid = 0, n_in_rounds = 0, n_paid_origin = 0;
+  int n_other_purpose = 0;
+  smartlist_t *parts = smartlist_new();
+  char *joined = NULL;
+
+  SMARTLIST_FOREACH_BEGIN(circuit_get_global_list(), const circuit_t *, circ) {
+    if (circ->marked_for_close)
+      ++n_marked;
+    if (circ->state <= CIRCUIT_STATE_OPEN)
+      ++by_state[circ->state];
+    else
+      ++n_other_state;
+    if (circ->purpose <= CIRCUIT_PURPOSE_MAX_ &&
+        strcmp(circuit_purpose_to_string_local(circ->purpose), "UNKNOWN"))
+      ++by_purpose[circ->purpose];
+    else
+      ++n_other_purpose;
+
+    if (CIRCUIT_IS_ORIGIN(circ)) {
+      ++n_origin;
+      if (CONST_TO_ORIGIN_CIRCUIT(circ)->relay_payments)
+        ++n_paid_origin;
+    } else {
+      const or_circuit_t *or_circ = CONST_TO_OR_CIRCUIT(circ);
+      ++n_or;
+      if (!or_circ->has_payment_hash)
+        ++n_unpaid;
+      else if (or_circ->payment_round)
+        ++n_in_rounds;
+      else
+        ++n_paid;
+    }
+  } SMARTLIST_FOREACH_END(circ);
+
+  control_printf_midreply(conn, 250, "SUMMARY Nickname=%s Total=%d "
+                          "Origin=%d OR=%d MarkedForClose=%d", nickname,
+                          n_origin + n_or, n_origin, n_or, n_marked);
+
+  for (int state = 0; state <= CIRCUIT_STATE_OPEN; ++state)
+    smartlist_add_asprintf(parts, "%s=%d",
+                           circuit_state_to_string_local(state),
+                           by_state[state]);
+  smartlist_add_asprintf(parts, "UNKNOWN=%d", n_other_state);
+  joined = smartlist_join_strings(parts, " ", 0, NULL);
+  control_printf_midreply(conn, 250, "STATE %s", joined);
+  tor_free(joined);
+  SMARTLIST_FOREACH(parts, char *, cp, tor_free(cp));
+  smartlist_clear(parts);
+
+  // Only purposes that have circuits: there are many.
+  for (int purpose = 0; purpose <= CIRCUIT_PURPOSE_MAX_; ++purpose) {
+    if (by_purpose[purpose])
+      smartlist_add_asprintf(parts, "%s=%d",
+                             circuit_purpose_to_string_local(purpose),
+                             by_purpose[purpose]);
+  }
+  if (n_other_purpose)
+    smartlist_add_asprintf(parts, "UNKNOWN=%d", n_other_purpose);
+  joined = smartlist_join_strings(parts, " ", 0, NULL);
+  control_printf_midreply(conn, 250, "PURPOSE %s", joined);
+  tor_free(joined);
+  SMARTLIST_FOREACH(parts, char *, cp, tor_free(cp));
+  smartlist_free(parts);
+
+  control_printf_midreply(conn, 250, "PAYMENT Unpaid=%d Paid=%d "
+                          "InRounds=%d PaidOrigin=%d",
+                          n_unpaid, n_paid, n_in_rounds, n_paid_origin);
+  send_control_done(conn);
+}
+
+/** Helper to check if keyword flags are present */
+static bool
+logallcircuits_config_lines_contain_flag(const config_line_t *lines,
+                                         const char *flag)
+{
+  const config_line_t *line = config_line_find_case(lines, flag);
+  return line && !strcmp(line->value, "");
+}
+
+/** Write the next circuits of <b>listing</b>, up to <b>limit</b> of them,
+ * to <b>conn</b>, and return how many were written. */
+static int
+circuit_listing_write(control_connection_t *conn, circuit_listing_t *listing,
+                      int limit, const char *nickname)
 {
-  (void)args; // Unused since we take no arguments
-  
   int circuit_count = 0;
-  smartlist_t *circuit_list = circuit_get_global_list();
-  const char *nickname = get_options()->Nickname ? get_options()->Nickname : "Unknown";
-  
-  control_printf_midreply(conn, 250, "LOGALLCIRCUITS: Starting circuit enumeration for relay %s", nickname);
-  
-  // Iterate through all circuits using smartlist
-  SMARTLIST_FOREACH_BEGIN(circuit_list, circuit_t *, circ) {
+
+  while (circuit_count < limit && listing->next < listing->n_keys) {
+    const circuit_t *circ =
+      circuit_listing_key_find(&listing->keys[listing->next++]);
+    if (!circ)
+      continue;
     circuit_count++;
-    
+
     if (CIRCUIT_IS_ORCIRC(circ)) {
-      const or_circuit_t *or_circ = CONST_TO_OR_CIRCUIT(circ);
-      log_or_circuit_info(conn, or_circ);
-    } else if (CIRCUIT_IS_ORIGIN(circ)) {
-      const origin_circuit_t *orig_circ = CONST_TO_ORIGIN_CIRCUIT(circ);
-      log_origin_circuit_info(conn, orig_circ);
+      log_or_circuit_info(conn, CONST_TO_OR_CIRCUIT(circ), nickname);
     } else {
-      // Unknown circuit type
-      control_printf_midreply(conn, 250,
-        "UNKNOWN_CIRCUIT "
-        "Nickname=%s "
-        "N_CircuitID=%u "
-        "State=%s "
-        "Purpose=%s "
-        "MarkedForClose=%s "
-        "GlobalListIdx=%d",
-        get_options()->Nickname ? get_options()->Nickname : "Unknown",
-        circ->n_circ_id,
-        circuit_state_to_string_local(circ->state),
-        circuit_purpose_to_string_local(circ->purpose),
-        circ->marked_for_close ? "true" : "false",
-        circ->global_circuitlist_idx);
+      log_origin_circuit_info(conn, CONST_TO_ORIGIN_CIRCUIT(circ), nickname);
     }
-  } SMARTLIST_FOREACH_END(circ);
-  
-  control_printf_endreply(conn, 250, "LOGALLCIRCUITS: Enumerated %d circuits for relay %s", circuit_count, nickname);
+  }
+  return circuit_count;
+}
+
+/** Return the nickname that LOGALLCIRCUITS replies name. */
+static const char *
+logallcircuits_nickname(void)
+{
+  return get_options()->Nickname ? get_options()->Nickname : "Unknown";
+}
+
+/** Main loop callback: write the next LOGALLCIRCUITS_PER_TURN circuits of
+ * the plain LOGALLCIRCUITS reply on the control connection <b>arg</b>, or
+ * end the reply if none are left. Then run any command that waited. */
+STATIC void
+logallcircuits_write_cb(mainloop_event_t *ev, void *arg)
+{
+  control_connection_t *conn = arg;
+  circuit_listing_t *listing = conn->circuit_listing;
+  const char *nickname = logallcircuits_nickname();
+  (void) ev;
+
+  if (BUG(!listing || !listing->write_ev))
+    return;
+  if (TO_CONN(conn)->marked_for_close) {
+    circuit_listing_free(conn->circuit_listing);
+    return;
+  }
+
+  listing->n_written += circuit_listing_write(conn, listing,
+                                              LOGALLCIRCUITS_PER_TURN,
+                                              nickname);
+  if (listing->next < listing->n_keys) {
+    mainloop_event_activate(listing->write_ev);
+    return;
+  }
+
+  control_printf_endreply(conn, 250, "LOGALLCIRCUITS: Enumerated %d circuits "
+                          "for relay %s", listing->n_written, nickname);
+  circuit_listing_free(conn->circuit_listing);
+
+  if (connection_get_inbuf_len(TO_CONN(conn)) &&
+      connection_control_process_inbuf(conn) < 0)
+    connection_mark_for_close(TO_CONN(conn));
+}
+
+/** Return true iff <b>conn</b> is still writing the reply to a plain
+ * LOGALLCIRCUITS, so that its next command must wait. */
+bool
+control_logallcircuits_in_progress(const control_connection_t *conn)
+{
+  return conn->circuit_listing && conn->circuit_listing->write_ev;
+}
+
+/** Reply to a plain LOGALLCIRCUITS: begin the reply, and let
+ * logallcircuits_write_cb() write the circuits, a few per turn. */
+static void
+logallcircuits_all(control_connection_t *conn, const char *nickname)
+{
+  circuit_listing_t *listing;
+
+  control_printf_midreply(conn, 250, "LOGALLCIRCUITS: Starting circuit "
+                          "enumeration for relay %s", nickname);
+  circuit_listing_free(conn->circuit_listing);
+  listing = conn->circuit_listing = circuit_listing_new();
+  listing->write_ev = mainloop_event_new(logallcircuits_write_cb, conn);
+  mainloop_event_activate(listing->write_ev);
+}
+
+/** Called when we get a LOGALLCIRCUITS command.
+ *
+ * Without arguments, list every circuit, over several main loop turns.
+ * "Limit=N" begins a new listing and
+ * lists its first N circuits; "Continue" lists the next page of the current
+ * listing, and the last line of a page says how many circuits remain.
+ * "Summary" gives counts instead. */
+int
+handle_control_logallcircuits(control_connection_t *conn,
+                              const control_cmd_args_t *args)
+{
+  const char *nickname = logallcircuits_nickname();
+  const config_line_t *limit_line =
+    config_line_find_case(args->kwargs, "Limit");
+  bool resume = logallcircuits_config_lines_contain_flag(args->kwargs,
+                                                         "Continue");
+  int limit = 0;
+  int circuit_count;
+  circuit_listing_t *listing;
+
+  if (logallcircuits_config_lines_contain_flag(args->kwargs, "Summary")) {
+    logallcircuits_summary(conn, nickname);
+    return 0;
+  }
+
+  if (limit_line) {
+    int ok;
+    limit = (int) tor_parse_long(limit_line->value, 10, 1,
+                                 LOGALLCIRCUITS_MAX_LIMIT, &ok, NULL);
+    if (!ok) {
+      control_printf_endreply(conn, 552, "Invalid Limit \"%s\"",
+                              limit_line->value);
+      return 0;
+    }
+  }
+
+  if (!limit_line && !resume) {
+    logallcircuits_all(conn, nickname);
+    return 0;
+  }
+
+  if (resume) {
+    if (!conn->circuit_listing) {
+      control_write_endreply(conn, 552, "No circuit listing in progress");
+      return 0;
+    }
+    control_printf_midreply(conn, 250, "LOGALLCIRCUITS: Continuing circuit "
+                            "enumeration for relay %s", nickname);
+  } else {
+    circuit_listing_free(conn->circuit_listing);
+    conn->circuit_listing = circuit_listing_new();
+    conn->circuit_listing->limit = limit;
+    control_printf_midreply(conn, 250, "LOGALLCIRCUITS: Starting circuit "
+                            "enumeration for relay %s", nickname);
+  }
+  listing = conn->circuit_listing;
+  if (!limit)
+    limit = listing->limit;
+
+  circuit_count = circuit_listing_write(conn, listing, limit, nickname);
+
+  const int remaining = listing->n_keys - listing->next;
+  if (!remaining)
+    circuit_listing_free(conn->circuit_listing);
+
+  control_printf_endreply(conn, 250, "LOGALLCIRCUITS: Enumerated %d circuits "
+                          "for relay %s Remaining=%d", circuit_count,
+                          nickname, remaining);
   
   return 0;
 }
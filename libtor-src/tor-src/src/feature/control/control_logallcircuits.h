@@ -9,6 +9,12 @@
 struct control_connection_t;
 struct control_cmd_args_t;
 struct control_cmd_syntax_t;
+struct circuit_listing_t;
+
+/** Most circuits LOGALLCIRCUITS lists in one reply. */
+#define LOGALLCIRCUITS_MAX_LIMIT 65536
+/** Circuits a plain LOGALLCIRCUITS writes per main loop turn. */
+#define LOGALLCIRCUITS_PER_TURN 256
 
 /** Syntax object for the LOGALLCIRCUITS command. */
 extern const struct control_cmd_syntax_t logallcircuits_syntax;
@@ -17,4 +23,16 @@ extern const struct control_cmd_syntax_t logallcircuits_syntax;
 int handle_control_logallcircuits(struct control_connection_t *conn,
                                   const struct control_cmd_args_t *args);
 
+bool control_logallcircuits_in_progress(
+                                  const struct control_connection_t *conn);
+
+void circuit_listing_free_(struct circuit_listing_t *listing);
+#define circuit_listing_free(l) \
+  FREE_AND_NULL(struct circuit_listing_t, circuit_listing_free_, (l))
+
+#ifdef CONTROL_LOGALLCIRCUITS_PRIVATE
+struct mainloop_event_t;
+STATIC void logallcircuits_write_cb(struct mainloop_event_t *ev, void *arg);
+#endif
+
 #endif /* !defined(TOR_CONTROL_LOGALLCIRCUITS_H) */
@@ -0,0 +1,89 @@
+/**
+ * \file control_paymentreceived.c
+ * \brief Implementation of the PAYMENTRECEIVED control command.
+ *
+ * The relay's payment daemon sends
+ *
+ *   "PAYMENTRECEIVED" SP "PaymentHash=" HexHandshakeHash SP "Round=" Round
+ *
+ * once it has seen the Lightning payment for round Round of the paid
+ * circuit built with handshake payment hash HexHandshakeHash. Circuits
+ * whose payment for a round is not confirmed in time are closed by the
+ * payment round scheduler.
+ **/
+
+#include "core/or/or.h"
+#include "lib/encoding/confline.h"
+#include "lib/encoding/kvline.h"
+#include "feature/control/control_cmd.h"
+#include "feature/control/control_proto.h"
+#include "feature/control/control_paymentreceived.h"
+#include "feature/payment/payment_index.h"
+#include "feature/payment/payment_metrics.h"
+#include "feature/payment/payment_rounds.h"
+
+#include "core/or/circuit_st.h"
+#include "core/or/or_circuit_st.h"
+#include "feature/control/control_cmd_args_st.h"
+
+static const char *paymentreceived_keywords[] = {
+  "PaymentHash", "Round", NULL
+};
+
+const control_cmd_syntax_t paymentreceived_syntax = {
+  .max_args = 0,
+  .accept_keywords = true,
+  .allowed_keywords = paymentreceived_keywords,
+};
+
+/** Called when we get a PAYMENTRECEIVED command. */
+int
+handle_control_paymentreceived(control_connection_t *conn,
+                               const control_cmd_args_t *args)
+{
+  const config_line_t *hash_line, *round_line;
+  uint8_t payhash[DIGEST256_LEN];
+  or_circuit_t *circ;
+  int round, ok;
+
+  hash_line = config_line_find_case(args->kwargs, "PaymentHash");
+  round_line = config_line_find_case(args->kwargs, "Round");
+  if (!hash_line || !round_line) {
+    control_write_endreply(conn, 512, "Need PaymentHash and Round");
+    return 0;
+  }
+
+  if (strlen(hash_line->value) != HEX_DIGEST256_LEN ||
+      base16_decode((char *) payhash, sizeof(payhash), hash_line->value,
+                    HEX_DIGEST256_LEN) != sizeof(payhash)) {
+    control_printf_endreply(conn, 512, "Invalid PaymentHash \"%s\"",
+                            hash_line->value);
+    return 0;
+  }
+
+  round = (int) tor_parse_long(round_line->value, 10, 0, INT_MAX, &ok, NULL);
+  if (!ok) {
+    control_printf_endreply(conn, 512, "Invalid Round \"%s\"",
+                            round_line->value);
+    return 0;
+  }
+
+  circ = payment_index_get_circuit(payhash);
+  if (!circ || TO_CIRCUIT(circ)->marked_for_close) {
+    payment_metrics_verification(0);
+    control_printf_endreply(conn, 552, "Unknown PaymentHash \"%s\"",
+                            hash_line->value);
+    return 0;
+  }
+
+  if (payment_rounds_mark_paid(circ, round) < 0) {
+    payment_metrics_verification(0);
+    control_printf_endreply(conn, 552, "Round %d is not a paid round",
+                            round);
+    return 0;
+  }
+
+  payment_metrics_verification(1);
+  send_control_done(conn);
+  return 0;
+}
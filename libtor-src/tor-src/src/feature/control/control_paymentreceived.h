@@ -0,0 +1,20 @@
+/**
+ * \file control_paymentreceived.h
+ * \brief Header for PAYMENTRECEIVED control command.
+ **/
+
+#ifndef TOR_CONTROL_PAYMENTRECEIVED_H
+#define TOR_CONTROL_PAYMENTRECEIVED_H
+
+struct control_connection_t;
+struct control_cmd_args_t;
+struct control_cmd_syntax_t;
+
+/** Syntax object for the PAYMENTRECEIVED command. */
+extern const struct control_cmd_syntax_t paymentreceived_syntax;
+
+/** Implementation for the PAYMENTRECEIVED command. */
+int handle_control_paymentreceived(struct control_connection_t *conn,
+                                   const struct control_cmd_args_t *args);
+
+#endif /* !defined(TOR_CONTROL_PAYMENTRECEIVED_H) */
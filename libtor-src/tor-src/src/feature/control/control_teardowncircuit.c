@@ -24,6 +24,8 @@
 #include "feature/control/control_events.h"
 #include "feature/control/control_proto.h"
 #include "feature/control/control_teardowncircuit.h"
+#include "feature/payment/payment_index.h"
+#include "feature/payment/teardown_journal.h"
 
 #include "core/or/circuit_st.h"
 #include "core/or/or_circuit_st.h"
@@ -141,38 +143,39 @@ extract_circuit_teardown_info(const circuit_t *circ,
   }
 }
 
-/** Log circuit teardown request to file */
+/** Record a circuit teardown request in the teardown journal. */
 static void
 log_circuit_teardown_to_file(const circuit_teardown_info_t *info)
 {
-  FILE *teardown_log = fopen("circuit_teardown.log", "a");
-  if (!teardown_log) {
-    log_warn(LD_CONTROL, "Failed to open circuit teardown log file");
-    return;
-  }
-  
   char unique_id[128];
+  char identity_hex[HEX_DIGEST_LEN + 1];
+  char ed25519_hex[ED25519_PUBKEY_LEN * 2 + 1];
+  char *record = NULL;
+
   tor_snprintf(unique_id, sizeof(unique_id), "circ_%u_%s_%ld",
-               info->circuit_id, 
+               info->circuit_id,
                info->is_origin ? "origin" : "or",
                (long)info->timestamp);
-  
-  fprintf(teardown_log, 
-          "TEARDOWN_REQUESTED|%s|%u|%s|%s|%s|%u|%s|%ld|%d\n",
-          unique_id,
-          info->circuit_id,
-          hex_str(info->peer_identity, DIGEST_LEN),
-          hex_str(info->peer_ed25519, ED25519_PUBKEY_LEN),
-          info->peer_address,
-          info->peer_port,
-          info->reason,
-          (long)info->timestamp,
-          info->is_origin);
-  
-  fclose(teardown_log);
-  
-  log_notice(LD_CONTROL, "ELTOR TEARDOWN: Logged circuit %s for teardown: %s",
-             unique_id, info->reason);
+  base16_encode(identity_hex, sizeof(identity_hex), info->peer_identity,
+                DIGEST_LEN);
+  base16_encode(ed25519_hex, sizeof(ed25519_hex), info->peer_ed25519,
+                ED25519_PUBKEY_LEN);
+
+  tor_asprintf(&record, "TEARDOWN_REQUESTED|%s|%u|%s|%s|%s|%u|%s|%ld|%d",
+               unique_id,
+               info->circuit_id,
+               identity_hex,
+               ed25519_hex,
+               info->peer_address,
+               info->peer_port,
+               info->reason,
+               (long)info->timestamp,
+               info->is_origin);
+  teardown_journal_add(record);
+  tor_free(record);
+
+  log_info(LD_CONTROL, "ELTOR TEARDOWN: Logged circuit %s for teardown: %s",
+           unique_id, info->reason);
 }
 
 /** Create JSON RPC payload for circuit teardown request */
@@ -260,65 +263,286 @@ eltor_force_immediate_circuit_destruction(circuit_t *circ, int reason)
   force_immediate_circuit_destruction(circ, reason);
 }
 
-/** Find circuit for teardown by ID and optional peer identity */
+/** Prefix of a TEARDOWNCIRCUIT circuit argument that names an OR circuit by
+ * the handshake payment hash it was built with, instead of by ID. */
+#define TEARDOWN_PAYMENT_HASH_PREFIX "PaymentHash="
+
+/** Find the OR circuit bound to the hex handshake payment hash
+ * <b>payhash_hex</b> in the payment index. Return NULL if the hash is
+ * malformed, unknown, or its circuit is already closing. */
 static circuit_t *
-find_circuit_for_teardown(const char *circuit_id_str, const char *peer_identity_fingerprint)
+find_circuit_for_teardown_by_payment_hash(const char *payhash_hex)
 {
-  uint32_t circuit_id;
-  int ok;
-  
-  circuit_id = (uint32_t) tor_parse_ulong(circuit_id_str, 10, 0, UINT32_MAX, &ok, NULL);
-  if (!ok)
+  uint8_t payhash[DIGEST256_LEN];
+
+  if (strlen(payhash_hex) != HEX_DIGEST256_LEN ||
+      base16_decode((char *) payhash, sizeof(payhash),
+                    payhash_hex, HEX_DIGEST256_LEN) != sizeof(payhash))
     return NULL;
-  
-  log_notice(LD_CONTROL, "TEARDOWN DEBUG: Parsed circuit_id=%u from string '%s'", 
-            circuit_id, circuit_id_str);
-  
-  // If peer identity is provided, decode it
-  char peer_identity[DIGEST_LEN];
-  int have_peer_identity = 0;
-    // Decode peer identity if provided
-  if (peer_identity_fingerprint && strlen(peer_identity_fingerprint) == (size_t)(DIGEST_LEN * 2)) {
-    if (base16_decode(peer_identity, DIGEST_LEN, peer_identity_fingerprint,
-                      strlen(peer_identity_fingerprint)) == DIGEST_LEN) {      have_peer_identity = 1;
-    }
+
+  or_circuit_t *or_circ = payment_index_get_circuit(payhash);
+  if (!or_circ || TO_CIRCUIT(or_circ)->marked_for_close)
+    return NULL;
+  return TO_CIRCUIT(or_circ);
+}
+
+/** How a TEARDOWNCIRCUIT request for one circuit ended. */
+typedef enum {
+  TEARDOWN_RESULT_UNKNOWN = 0,   /**< No such circuit */
+  TEARDOWN_RESULT_INACTIVE = 1,  /**< Circuit not open/active, not logged */
+  TEARDOWN_RESULT_LOGGED = 2,    /**< Logged for later processing only */
+  TEARDOWN_RESULT_DESTROYED = 3, /**< DESTROY cells sent, marked for close */
+  TEARDOWN_RESULT_FORCED = 4     /**< Destroyed at once (FORCE_IMMEDIATE) */
+} teardown_result_t;
+
+/** Names of each teardown_result_t, as given in multi-circuit replies. */
+static const char *teardown_result_names[] = {
+  "UNKNOWN", "INACTIVE", "LOGGED", "DESTROYED", "FORCED"
+};
+
+/** One circuit named in a TEARDOWNCIRCUIT command. */
+typedef struct teardown_target_t {
+  const char *id_str;  /**< The circuit as named in the command */
+  uint32_t circ_id;    /**< The numeric ID in id_str, if any */
+  circuit_t *circ;     /**< The circuit, or NULL if not found (yet) */
+} teardown_target_t;
+
+/** Find an OR circuit with circuit ID <b>circ_id</b> on any channel to the
+ * relay with RSA identity <b>peer_identity</b>, through the (channel,
+ * circuit ID) map. */
+static circuit_t *
+find_or_circuit_on_peer(uint32_t circ_id, const char *peer_identity)
+{
+  for (channel_t *chan = channel_find_by_remote_identity(peer_identity, NULL);
+       chan; chan = channel_next_with_rsa_identity(chan)) {
+    circuit_t *circ = circuit_get_by_circid_channel(circ_id, chan);
+    if (circ && CIRCUIT_IS_ORCIRC(circ))
+      return circ;
   }
-  
+  return NULL;
+}
+
+/** Find the circuit that <b>target</b> names. <b>peer_identity</b> is the
+ * decoded PeerIdentity, or NULL if none was given.
+ *
+ * Return true if the lookup is over, whether or not a circuit was found.
+ * Return false if the ID might still name an OR circuit on an unknown
+ * channel: only a walk over the circuit list can find those. */
+static bool
+teardown_target_resolve(teardown_target_t *target, const char *peer_identity)
+{
+  int ok;
+
+  if (!strcmpstart(target->id_str, TEARDOWN_PAYMENT_HASH_PREFIX)) {
+    target->circ = find_circuit_for_teardown_by_payment_hash(
+                     target->id_str + strlen(TEARDOWN_PAYMENT_HASH_PREFIX));
+    return true;
+  }
+
+  target->circ_id = (uint32_t) tor_parse_ulong(target->id_str, 10, 0,
+                                               UINT32_MAX, &ok, NULL);
+  if (!ok || target->circ_id == 0)
+    return true;
+
   // First try to find as origin circuit
-  origin_circuit_t *origin_circ = circuit_get_by_global_id(circuit_id);
+  origin_circuit_t *origin_circ = circuit_get_by_global_id(target->circ_id);
   if (origin_circ) {
-    log_notice(LD_CONTROL, "TEARDOWN DEBUG: Found origin circuit with global_id=%u", circuit_id);
-    return TO_CIRCUIT(origin_circ);
+    target->circ = TO_CIRCUIT(origin_circ);
+    return true;
   }
-  
-  log_notice(LD_CONTROL, "TEARDOWN DEBUG: No origin circuit found, searching OR circuits");
-  
-  // Search for OR circuits
+
+  if (peer_identity) {
+    target->circ = find_or_circuit_on_peer(target->circ_id, peer_identity);
+    return true;
+  }
+  return false;
+}
+
+/** Helper for smartlist_sort: order teardown targets by circuit ID. */
+static int
+teardown_target_compare(const void **a_, const void **b_)
+{
+  const teardown_target_t *a = *a_, *b = *b_;
+  if (a->circ_id != b->circ_id)
+    return a->circ_id < b->circ_id ? -1 : 1;
+  return 0;
+}
+
+/** Helper for smartlist_bsearch_idx: compare a circuit ID to a target. */
+static int
+teardown_target_compare_key(const void *key, const void **member)
+{
+  const uint32_t circ_id = *(const uint32_t *) key;
+  const teardown_target_t *target = *member;
+  if (circ_id != target->circ_id)
+    return circ_id < target->circ_id ? -1 : 1;
+  return 0;
+}
+
+/** Give <b>circ</b> to every target in the sorted list <b>pending</b> that
+ * names <b>circ_id</b> and has no circuit yet. */
+static void
+teardown_targets_claim(smartlist_t *pending, uint32_t circ_id,
+                       circuit_t *circ)
+{
+  int found, idx;
+
+  if (!circ_id)
+    return;
+  idx = smartlist_bsearch_idx(pending, &circ_id, teardown_target_compare_key,
+                              &found);
+  if (!found)
+    return;
+  while (idx > 0 &&
+         ((teardown_target_t *) smartlist_get(pending, idx - 1))->circ_id
+         == circ_id)
+    --idx;
+  for (; idx < smartlist_len(pending); ++idx) {
+    teardown_target_t *target = smartlist_get(pending, idx);
+    if (target->circ_id != circ_id)
+      break;
+    if (!target->circ)
+      target->circ = circ;
+  }
+}
+
+/** Find, in a single walk over the circuit list, the first OR circuit whose
+ * p_circ_id or n_circ_id matches each target in <b>pending</b>. This is
+ * what an ID without a PeerIdentity costs, however many IDs there are. */
+static void
+teardown_targets_resolve_by_walk(smartlist_t *pending)
+{
+  if (smartlist_len(pending) == 0)
+    return;
+
+  smartlist_sort(pending, teardown_target_compare);
   SMARTLIST_FOREACH_BEGIN(circuit_get_global_list(), circuit_t *, circ) {
-    if (!CIRCUIT_IS_ORIGIN(circ) && !circ->marked_for_close) {
-      or_circuit_t *or_circ = TO_OR_CIRCUIT(circ);
-      
-      log_notice(LD_CONTROL, "TEARDOWN DEBUG: Checking OR circuit p_circ_id=%u, n_circ_id=%u against target=%u", 
-                or_circ->p_circ_id, circ->n_circ_id, circuit_id);
-      
-      if (or_circ->p_circ_id == circuit_id || circ->n_circ_id == circuit_id) {
-        // If peer identity is specified, verify it matches
-        if (have_peer_identity && or_circ->p_chan) {
-          if (tor_memeq(or_circ->p_chan->identity_digest, peer_identity, DIGEST_LEN)) {
-            return circ;
-          }
-        } else if (!have_peer_identity) {
-          // No peer identity specified, return first match
-          return circ;
-        }
-      }
-    }
+    if (CIRCUIT_IS_ORIGIN(circ) || circ->marked_for_close)
+      continue;
+    teardown_targets_claim(pending, TO_OR_CIRCUIT(circ)->p_circ_id, circ);
+    teardown_targets_claim(pending, circ->n_circ_id, circ);
   } SMARTLIST_FOREACH_END(circ);
-  
-  return NULL;
 }
 
-/** Called when we get a TEARDOWNCIRCUIT command */
+/** Log <b>circ</b>, named <b>circuit_id_str</b>, for teardown with
+ * <b>reason</b>, and unless <b>log_only</b> is set, tear it down. */
+static teardown_result_t
+teardown_circuit(circuit_t *circ, const char *circuit_id_str,
+                 const char *reason, bool log_only, bool force_immediate)
+{
+  circuit_teardown_info_t teardown_info = { 0 };
+
+  // Only log if circuit is open/active
+  if (!circuit_is_open_and_active(circ)) {
+    log_info(LD_CONTROL, "TEARDOWNCIRCUIT: Circuit %s is not open/active, "
+             "skipping log.", circuit_id_str);
+    return TEARDOWN_RESULT_INACTIVE;
+  }
+
+  extract_circuit_teardown_info(circ, &teardown_info, reason);
+  log_circuit_teardown_to_file(&teardown_info);
+  if (debug_logging_enabled()) {
+    char *rpc_payload = create_teardown_rpc_payload(&teardown_info);
+    log_debug(LD_CONTROL, "ELTOR RPC TEARDOWN: %s", rpc_payload);
+    tor_free(rpc_payload);
+  }
+  if (log_only)
+    return TEARDOWN_RESULT_LOGGED;
+
+  log_info(LD_CONTROL, "SPEC-COMPLIANT TEARDOWN: Properly destroying "
+           "circuit %s", circuit_id_str);
+
+  // STEP 1: SEND PROPER DESTROY CELLS ACCORDING TO TOR SPEC
+  // "To tear down a circuit completely, a relay or client sends a DESTROY
+  //  cell to the adjacent nodes on that circuit, using the appropriate
+  //  direction's circID."
+
+  if (CIRCUIT_IS_ORCIRC(circ)) {
+    or_circuit_t *or_circ = TO_OR_CIRCUIT(circ);
+
+    // Send DESTROY cell towards the previous hop (P direction)
+    if (or_circ->p_chan && or_circ->p_circ_id) {
+      log_debug(LD_CONTROL, "SPEC TEARDOWN: Sending DESTROY to P-channel "
+                "%"PRIu64" for circuit_id=%u",
+                or_circ->p_chan->global_identifier, or_circ->p_circ_id);
+      channel_send_destroy(or_circ->p_circ_id, or_circ->p_chan,
+                           END_CIRC_REASON_REQUESTED);
+    }
+
+    // Send DESTROY cell towards the next hop (N direction)
+    if (circ->n_chan && circ->n_circ_id) {
+      log_debug(LD_CONTROL, "SPEC TEARDOWN: Sending DESTROY to N-channel "
+                "%"PRIu64" for circuit_id=%u",
+                circ->n_chan->global_identifier, circ->n_circ_id);
+      channel_send_destroy(circ->n_circ_id, circ->n_chan,
+                           END_CIRC_REASON_REQUESTED);
+    }
+  } else {
+    // Origin circuit - only send DESTROY towards the first hop
+    if (circ->n_chan && circ->n_circ_id) {
+      log_debug(LD_CONTROL, "SPEC TEARDOWN: Sending DESTROY for origin "
+                "circuit to N-channel %"PRIu64" for circuit_id=%u",
+                circ->n_chan->global_identifier, circ->n_circ_id);
+      channel_send_destroy(circ->n_circ_id, circ->n_chan,
+                           END_CIRC_REASON_REQUESTED);
+    }
+  }
+
+  // STEP 2: MARK CIRCUIT FOR CLOSE USING TOR'S STANDARD MECHANISM
+  // "Upon receiving an outgoing DESTROY cell, a relay frees resources
+  //  associated with the corresponding circuit."
+
+  if (!circ->marked_for_close)
+    circuit_mark_for_close(circ, END_CIRC_REASON_REQUESTED);
+
+  // STEP 3: LET TOR'S EVENT LOOP HANDLE THE CLEANUP (unless FORCE_IMMEDIATE
+  // is requested)
+  if (force_immediate) {
+    log_info(LD_CONTROL, "FORCE IMMEDIATE TEARDOWN: Bypassing normal "
+             "cleanup delays");
+    force_immediate_circuit_destruction(circ, END_CIRC_REASON_REQUESTED);
+    return TEARDOWN_RESULT_FORCED;
+  }
+  return TEARDOWN_RESULT_DESTROYED;
+}
+
+/** Send the reply for a TEARDOWNCIRCUIT command that named the single
+ * circuit <b>circuit_id_str</b>, with outcome <b>result</b>. */
+static void
+teardown_reply_one(control_connection_t *conn, const char *circuit_id_str,
+                   teardown_result_t result)
+{
+  switch (result) {
+    case TEARDOWN_RESULT_UNKNOWN:
+      control_printf_endreply(conn, 552, "Unknown circuit \"%s\"",
+                              circuit_id_str);
+      break;
+    case TEARDOWN_RESULT_INACTIVE:
+      control_printf_endreply(conn, 250, "OK Circuit %s is not open/active, "
+                              "not logged.", circuit_id_str);
+      break;
+    case TEARDOWN_RESULT_LOGGED:
+      control_printf_endreply(conn, 250, "OK Circuit %s teardown logged for "
+                              "processing", circuit_id_str);
+      break;
+    case TEARDOWN_RESULT_DESTROYED:
+      control_printf_endreply(conn, 250, "OK SPEC-COMPLIANT TEARDOWN: DESTROY "
+                              "cells sent for circuit %s", circuit_id_str);
+      break;
+    case TEARDOWN_RESULT_FORCED:
+      control_printf_endreply(conn, 250, "OK FORCE IMMEDIATE TEARDOWN: "
+                              "Circuit %s destroyed immediately",
+                              circuit_id_str);
+      break;
+  }
+}
+
+/** Called when we get a TEARDOWNCIRCUIT command.
+ *
+ * The first argument is a circuit, or a comma-separated list of circuits,
+ * each given by ID or as PaymentHash=<hex>. For a list, the reply has one
+ * "<circuit>=<outcome>" line per circuit, in order, and unknown circuits
+ * don't fail the command. */
 int
 handle_control_teardowncircuit(control_connection_t *conn,
                                const control_cmd_args_t *args)
@@ -330,7 +554,6 @@ handle_control_teardowncircuit(control_connection_t *conn,
   if (smartlist_len(args->args) >= 2) {
     reason = smartlist_get(args->args, 1);
   }
-  
   // SPECIAL NUCLEAR OPTION: "ALL" destroys everything
   if (!strcasecmp(circuit_id_str, "ALL")) {
     log_notice(LD_CONTROL, "SPEC-COMPLIANT DOOMSDAY: Destroying all circuits according to Tor protocol");
@@ -352,7 +575,7 @@ handle_control_teardowncircuit(control_connection_t *conn,
       if (circ->marked_for_close) continue; // Skip already closing circuits
       
       destroy_count++;
-      log_notice(LD_CONTROL, "DOOMSDAY: Destroying circuit %d/%d", destroy_count, total_circuits);
+      log_info(LD_CONTROL, "DOOMSDAY: Destroying circuit %d/%d", destroy_count, total_circuits);
       
       // Send DESTROY cells according to circuit type
       if (CIRCUIT_IS_ORCIRC(circ)) {
@@ -391,116 +614,85 @@ handle_control_teardowncircuit(control_connection_t *conn,
   }
   
   // Optional peer identity for OR circuits
-  const char *peer_identity = NULL;
+  const char *peer_identity_hex = NULL;
+  char peer_identity[DIGEST_LEN];
+  const char *peer_identity_digest = NULL;
   if (args->kwargs) {
     for (config_line_t *line = args->kwargs; line; line = line->next) {
       if (!strcasecmp(line->key, "PeerIdentity")) {
-        peer_identity = line->value;
+        peer_identity_hex = line->value;
         break;
       }
     }
   }
-  
-  log_debug(LD_CONTROL, "TEARDOWNCIRCUIT: circuit_id=%s, reason=%s, peer_identity=%s",
-            circuit_id_str, reason, peer_identity ? peer_identity : "none");
-  
-  // Debug: Print all kwargs
-  if (args->kwargs) {
-    log_notice(LD_CONTROL, "TEARDOWN DEBUG: Processing kwargs...");
-    for (config_line_t *line = args->kwargs; line; line = line->next) {
-      log_notice(LD_CONTROL, "TEARDOWN DEBUG: kwargs - key='%s', value='%s'", 
-                line->key ? line->key : "NULL", 
-                line->value ? line->value : "NULL");
+  if (peer_identity_hex) {
+    // Falling back to the whole circuit list could tear down a circuit on
+    // some other peer.
+    if (strlen(peer_identity_hex) != HEX_DIGEST_LEN ||
+        base16_decode(peer_identity, DIGEST_LEN, peer_identity_hex,
+                      HEX_DIGEST_LEN) != DIGEST_LEN) {
+      control_write_endreply(conn, 552, "Invalid PeerIdentity");
+      return 0;
     }
-  } else {
-    log_notice(LD_CONTROL, "TEARDOWN DEBUG: No kwargs provided");
+    peer_identity_digest = peer_identity;
   }
-  
+
+  log_debug(LD_CONTROL, "TEARDOWNCIRCUIT: circuit_id=%s, reason=%s, "
+            "peer_identity=%s", circuit_id_str, reason,
+            peer_identity_hex ? peer_identity_hex : "none");
+
   // Check teardown mode options
-  bool immediate = true;  // Always use immediate mode for aggressive teardown
   bool log_only = teardown_config_lines_contain_flag(args->kwargs, "LogOnly");
-  bool force_immediate = teardown_config_lines_contain_flag(args->kwargs, "FORCE_IMMEDIATE");
-  
-  log_notice(LD_CONTROL, "TEARDOWN DEBUG: immediate=%s (forced), log_only=%s, force_immediate=%s", 
-            immediate ? "true" : "false", log_only ? "true" : "false", 
-            force_immediate ? "true" : "false");
-  
-  circuit_t *circ = find_circuit_for_teardown(circuit_id_str, peer_identity);
-  
-  log_notice(LD_CONTROL, "TEARDOWNCIRCUIT DEBUG: Looking for circuit %s, found: %s", 
-            circuit_id_str, circ ? "YES" : "NO");
-  
-  if (!circ) {
-    control_printf_endreply(conn, 552, "Unknown circuit \"%s\"", circuit_id_str);
-    return 0;
+  bool force_immediate = teardown_config_lines_contain_flag(args->kwargs,
+                                                          "FORCE_IMMEDIATE");
+
+  smartlist_t *ids = smartlist_new();
+  smartlist_split_string(ids, circuit_id_str, ",",
+                         SPLIT_SKIP_SPACE|SPLIT_IGNORE_BLANK, 0);
+  const int n_targets = smartlist_len(ids);
+  teardown_target_t *targets = tor_calloc(MAX(n_targets, 1),
+                                          sizeof(teardown_target_t));
+  smartlist_t *pending = smartlist_new();
+
+  // Resolve every circuit before tearing any down, so that one walk over
+  // the circuit list covers all the IDs that need it.
+  for (int i = 0; i < n_targets; ++i) {
+    targets[i].id_str = smartlist_get(ids, i);
+    if (!teardown_target_resolve(&targets[i], peer_identity_digest))
+      smartlist_add(pending, &targets[i]);
   }
-  
-  // Only log if circuit is open/active
-  if (circuit_is_open_and_active(circ)) {
-    circuit_teardown_info_t teardown_info;
-    extract_circuit_teardown_info(circ, &teardown_info, reason);
-    log_circuit_teardown_to_file(&teardown_info);
-    char *rpc_payload = create_teardown_rpc_payload(&teardown_info);
-    log_notice(LD_CONTROL, "ELTOR RPC TEARDOWN: %s", rpc_payload);
-    tor_free(rpc_payload);
-    if (immediate && !log_only) {
-      log_notice(LD_CONTROL, "SPEC-COMPLIANT TEARDOWN: Properly destroying circuit %s", circuit_id_str);
-      
-      // STEP 1: SEND PROPER DESTROY CELLS ACCORDING TO TOR SPEC
-      // "To tear down a circuit completely, a relay or client sends a DESTROY cell to the
-      //  adjacent nodes on that circuit, using the appropriate direction's circID."
-      
-      if (CIRCUIT_IS_ORCIRC(circ)) {
-        or_circuit_t *or_circ = TO_OR_CIRCUIT(circ);
-        
-        // Send DESTROY cell towards the previous hop (P direction)
-        if (or_circ->p_chan && or_circ->p_circ_id) {
-          log_notice(LD_CONTROL, "SPEC TEARDOWN: Sending DESTROY to P-channel %"PRIu64" for circuit_id=%u", 
-                    or_circ->p_chan->global_identifier, or_circ->p_circ_id);
-          channel_send_destroy(or_circ->p_circ_id, or_circ->p_chan, END_CIRC_REASON_REQUESTED);
-        }
-        
-        // Send DESTROY cell towards the next hop (N direction)  
-        if (circ->n_chan && circ->n_circ_id) {
-          log_notice(LD_CONTROL, "SPEC TEARDOWN: Sending DESTROY to N-channel %"PRIu64" for circuit_id=%u", 
-                    circ->n_chan->global_identifier, circ->n_circ_id);
-          channel_send_destroy(circ->n_circ_id, circ->n_chan, END_CIRC_REASON_REQUESTED);
-        }
-      } else {
-        // Origin circuit - only send DESTROY towards the first hop
-        if (circ->n_chan && circ->n_circ_id) {
-          log_notice(LD_CONTROL, "SPEC TEARDOWN: Sending DESTROY for origin circuit to N-channel %"PRIu64" for circuit_id=%u", 
-                    circ->n_chan->global_identifier, circ->n_circ_id);
-          channel_send_destroy(circ->n_circ_id, circ->n_chan, END_CIRC_REASON_REQUESTED);
-        }
-      }
-      
-      // STEP 2: MARK CIRCUIT FOR CLOSE USING TOR'S STANDARD MECHANISM
-      // "Upon receiving an outgoing DESTROY cell, a relay frees resources associated with
-      //  the corresponding circuit."
-      
-      if (!circ->marked_for_close) {
-        log_notice(LD_CONTROL, "SPEC TEARDOWN: Marking circuit for close via circuit_mark_for_close()");
-        circuit_mark_for_close(circ, END_CIRC_REASON_REQUESTED);
-      }
-      
-      // STEP 3: LET TOR'S EVENT LOOP HANDLE THE CLEANUP (unless FORCE_IMMEDIATE is requested)
-      if (force_immediate) {
-        log_notice(LD_CONTROL, "FORCE IMMEDIATE TEARDOWN: Bypassing normal cleanup delays");
-        force_immediate_circuit_destruction(circ, END_CIRC_REASON_REQUESTED);
-        control_printf_endreply(conn, 250, "OK FORCE IMMEDIATE TEARDOWN: Circuit %s destroyed immediately", circuit_id_str);
-      } else {
-        // Don't force anything - let Tor process the DESTROY cells and clean up naturally
-        log_notice(LD_CONTROL, "SPEC TEARDOWN: Circuit teardown initiated according to Tor specification");
-        control_printf_endreply(conn, 250, "OK SPEC-COMPLIANT TEARDOWN: DESTROY cells sent for circuit %s", circuit_id_str);
-      }
-    } else {
-      control_printf_endreply(conn, 250, "OK Circuit %s teardown logged for processing", circuit_id_str);
-    }
+  teardown_targets_resolve_by_walk(pending);
+
+  if (n_targets == 1) {
+    teardown_result_t result = TEARDOWN_RESULT_UNKNOWN;
+    if (targets[0].circ)
+      result = teardown_circuit(targets[0].circ, targets[0].id_str, reason,
+                                log_only, force_immediate);
+    teardown_reply_one(conn, targets[0].id_str, result);
+  } else if (n_targets == 0) {
+    control_printf_endreply(conn, 552, "Unknown circuit \"%s\"",
+                            circuit_id_str);
   } else {
-    log_info(LD_CONTROL, "TEARDOWNCIRCUIT: Circuit %s is not open/active, skipping log.", circuit_id_str);
-    control_printf_endreply(conn, 250, "OK Circuit %s is not open/active, not logged.", circuit_id_str);
+    int n_done = 0;
+    for (int i = 0; i < n_targets; ++i) {
+      teardown_result_t result = TEARDOWN_RESULT_UNKNOWN;
+      if (targets[i].circ)
+        result = teardown_circuit(targets[i].circ, targets[i].id_str, reason,
+                                  log_only, force_immediate);
+      if (result != TEARDOWN_RESULT_UNKNOWN &&
+          result != TEARDOWN_RESULT_INACTIVE)
+        ++n_done;
+      control_printf_midreply(conn, 250, "%s=%s", targets[i].id_str,
+                              teardown_result_names[result]);
+    }
+    log_info(LD_CONTROL, "TEARDOWNCIRCUIT: %d of %d circuits torn down or "
+             "logged", n_done, n_targets);
+    send_control_done(conn);
   }
-  
+
+  smartlist_free(pending);
+  tor_free(targets);
+  SMARTLIST_FOREACH(ids, char *, cp, tor_free(cp));
+  smartlist_free(ids);
   return 0;
 }
@@ -114,6 +114,16 @@ typedef enum {
   K_DIR_ADDRESS,
   K_DIR_TUNNELLED,
 
+  K_PAYMENT_BOLT12_OFFER,
+  K_PAYMENT_BIP353,
+  K_PAYMENT_BOLT11_LNURL,
+  K_PAYMENT_BOLT11_LIGHTNING_ADDRESS,
+  K_PAYMENT_RATE_MSATS,
+  K_PAYMENT_INTERVAL,
+  K_PAYMENT_INTERVAL_ROUNDS,
+  K_PAYMENT_HANDSHAKE_FEE,
+  K_PAYMENT_BANDWIDTH_QUOTA,
+
   K_VOTE_STATUS,
   K_VALID_AFTER,
   K_FRESH_UNTIL,
@@ -66,6 +66,7 @@
 #include "feature/nodelist/routerinfo.h"
 #include "feature/nodelist/routerlist.h"
 #include "feature/nodelist/torcert.h"
+#include "feature/payment/payment_intern.h"
 #include "feature/relay/router.h"
 #include "lib/crypt_ops/crypto_curve25519.h"
 #include "lib/crypt_ops/crypto_ed25519.h"
@@ -122,6 +123,17 @@ const token_rule_t routerdesc_token_table[] = {
   A01("@purpose",            A_PURPOSE,             GE(1),   NO_OBJ ),
   T01("tunnelled-dir-server",K_DIR_TUNNELLED,       NO_ARGS, NO_OBJ ),
 
+  T01("PaymentBolt12Offer",  K_PAYMENT_BOLT12_OFFER, CONCAT_ARGS, NO_OBJ ),
+  T01("PaymentBip353",       K_PAYMENT_BIP353,  CONCAT_ARGS, NO_OBJ ),
+  T01("PaymentBolt11Lnurl",  K_PAYMENT_BOLT11_LNURL, CONCAT_ARGS, NO_OBJ ),
+  T01("PaymentBolt11LightningAddress", K_PAYMENT_BOLT11_LIGHTNING_ADDRESS,
+                                                   CONCAT_ARGS, NO_OBJ ),
+  T01("PaymentRateMsats",    K_PAYMENT_RATE_MSATS,  GE(1),   NO_OBJ ),
+  T01("PaymentInterval",     K_PAYMENT_INTERVAL,    GE(1),   NO_OBJ ),
+  T01("PaymentInvervalRounds", K_PAYMENT_INTERVAL_ROUNDS, GE(1), NO_OBJ ),
+  T01("PaymentHandshakeFee", K_PAYMENT_HANDSHAKE_FEE, GE(1), NO_OBJ ),
+  T01("PaymentBandwidthQuota", K_PAYMENT_BANDWIDTH_QUOTA, GE(1), NO_OBJ ),
+
   END_OF_TABLE
 };
 // clang-format on
@@ -369,6 +381,45 @@ find_single_ipv6_orport(const smartlist_t *list,
   return ret;
 }
 
+/** Return a shared copy of the El Tor payment line <b>keyword</b> in
+ * <b>tokens</b>, or NULL if there is none. Descriptors cached by a client
+ * repeat the same payment details over and over, so we keep one copy of
+ * each; see payment_intern.c. */
+static const char *
+router_parse_payment_string(const smartlist_t *tokens,
+                            directory_keyword keyword)
+{
+  const directory_token_t *tok = find_opt_by_keyword(tokens, keyword);
+
+  if (!tok)
+    return NULL;
+  tor_assert(tok->n_args == 1);
+  return payment_intern_string(tok->args[0]);
+}
+
+/** Return the value of the El Tor payment line <b>keyword</b> in
+ * <b>tokens</b>, or 0 if there is none. A value that is not a non-negative
+ * int is ignored rather than rejecting the descriptor: payment terms are
+ * advisory, and only paying clients look at them. */
+static int
+router_parse_payment_int(const smartlist_t *tokens, directory_keyword keyword)
+{
+  const directory_token_t *tok = find_opt_by_keyword(tokens, keyword);
+  int ok;
+  long v;
+
+  if (!tok)
+    return 0;
+  tor_assert(tok->n_args >= 1);
+  v = tor_parse_long(tok->args[0], 10, 0, INT_MAX, &ok, NULL);
+  if (!ok) {
+    log_info(LD_DIR, "Ignoring invalid payment value %s",
+             escaped(tok->args[0]));
+    return 0;
+  }
+  return (int) v;
+}
+
 /** Helper function: reads a single router entry from *<b>s</b> ...
  * *<b>end</b>.  Mallocs a new router and returns it if all goes well, else
  * returns NULL.  If <b>cache_copy</b> is true, duplicate the contents of
@@ -830,6 +881,25 @@ router_parse_entry_from_string(const char *s, const char *end,
     router->contact_info = tor_strdup(tok->args[0]);
   }
 
+  router->PaymentBolt12Offer =
+    router_parse_payment_string(tokens, K_PAYMENT_BOLT12_OFFER);
+  router->PaymentBip353 =
+    router_parse_payment_string(tokens, K_PAYMENT_BIP353);
+  router->PaymentBolt11Lnurl =
+    router_parse_payment_string(tokens, K_PAYMENT_BOLT11_LNURL);
+  router->PaymentBolt11LightningAddress =
+    router_parse_payment_string(tokens, K_PAYMENT_BOLT11_LIGHTNING_ADDRESS);
+  router->PaymentRateMsats =
+    router_parse_payment_int(tokens, K_PAYMENT_RATE_MSATS);
+  router->PaymentInterval =
+    router_parse_payment_int(tokens, K_PAYMENT_INTERVAL);
+  router->PaymentInvervalRounds =
+    router_parse_payment_int(tokens, K_PAYMENT_INTERVAL_ROUNDS);
+  router->PaymentHandshakeFee =
+    router_parse_payment_int(tokens, K_PAYMENT_HANDSHAKE_FEE);
+  router->PaymentBandwithQuota =
+    router_parse_payment_int(tokens, K_PAYMENT_BANDWIDTH_QUOTA);
+
   if (find_opt_by_keyword(tokens, K_REJECT6) ||
       find_opt_by_keyword(tokens, K_ACCEPT6)) {
     log_warn(LD_DIR, "Rejecting router with reject6/accept6 line: they crash "
@@ -1056,7 +1056,10 @@ we_use_microdescriptors_for_circuits(const or_options_t *options)
 {
   if (options->UseMicrodescriptors == 0)
     return 0; /* the user explicitly picked no */
-  return 1; /* yes and auto both mean yes */
+  if (options->UseMicrodescriptors == -1 && options->PaymentCircuitMaxFee > 0)
+    return 0; /* paid path selection needs relays' payment terms, which are
+               * only in router descriptors */
+  return 1; /* otherwise, yes and auto both mean yes */
 }
 
 /** Return true iff we should try to download microdescriptors at all. */
@@ -859,6 +859,27 @@ node_sl_choose_by_bandwidth(const smartlist_t *sl,
   return smartlist_choose_node_by_bandwidth_weights(sl, rule);
 }
 
+/** Return a newly allocated array holding the weight of each node in
+ * <b>sl</b>, in order, for choosing one by <b>rule</b>. The weights are
+ * those node_sl_choose_by_bandwidth() uses, scaled to integers whose sum
+ * fits in an int64_t. Return NULL on failure. */
+uint64_t *
+node_sl_get_bandwidth_weights(const smartlist_t *sl,
+                              bandwidth_weight_rule_t rule)
+{
+  double *bandwidths_dbl = NULL;
+  uint64_t *bandwidths_u64;
+
+  if (compute_weighted_bandwidths(sl, rule, &bandwidths_dbl, NULL) < 0)
+    return NULL;
+
+  bandwidths_u64 = tor_calloc(smartlist_len(sl), sizeof(uint64_t));
+  scale_array_elements_to_u64(bandwidths_u64, bandwidths_dbl,
+                              smartlist_len(sl), NULL);
+  tor_free(bandwidths_dbl);
+  return bandwidths_u64;
+}
+
 /** Given a <b>router</b>, add every node_t in its family (including the
  * node itself!) to <b>sl</b>.
  *
@@ -81,6 +81,8 @@ int router_get_my_share_of_directory_requests(double *v3_share_out);
 
 const node_t *node_sl_choose_by_bandwidth(const smartlist_t *sl,
                                           bandwidth_weight_rule_t rule);
+uint64_t *node_sl_get_bandwidth_weights(const smartlist_t *sl,
+                                        bandwidth_weight_rule_t rule);
 double frac_nodes_with_descriptors(const smartlist_t *sl,
                                    bandwidth_weight_rule_t rule,
                                    int for_direct_conn);
@@ -64,6 +64,7 @@
 #include "feature/nodelist/routerlist.h"
 #include "feature/nodelist/routerset.h"
 #include "feature/nodelist/torcert.h"
+#include "feature/payment/paid_path.h"
 #include "lib/encoding/binascii.h"
 #include "lib/err/backtrace.h"
 #include "lib/geoip/geoip.h"
@@ -2198,6 +2199,24 @@ node_lookup_declared_family(smartlist_t *out, const node_t *node)
   }
 }
 
+/** Return true iff node1 and node2 have IPv4 addresses in the same /16, or
+ * IPv6 addresses in the same /32. Callers decide whether
+ * EnforceDistinctSubnets applies. */
+int
+nodes_in_same_network(const node_t *node1, const node_t *node2)
+{
+  tor_addr_t a1, a2;
+  node_get_addr(node1, &a1);
+  node_get_addr(node2, &a2);
+
+  tor_addr_port_t ap6_1, ap6_2;
+  node_get_pref_ipv6_orport(node1, &ap6_1);
+  node_get_pref_ipv6_orport(node2, &ap6_2);
+
+  return router_addrs_in_same_network(&a1, &a2) ||
+    router_addrs_in_same_network(&ap6_1.addr, &ap6_2.addr);
+}
+
 /** Return true iff r1 and r2 are in the same family, but not the same
  * router. */
 int
@@ -2206,19 +2225,9 @@ nodes_in_same_family(const node_t *node1, const node_t *node2)
   const or_options_t *options = get_options();
 
   /* Are they in the same family because of their addresses? */
-  if (options->EnforceDistinctSubnets) {
-    tor_addr_t a1, a2;
-    node_get_addr(node1, &a1);
-    node_get_addr(node2, &a2);
-
-    tor_addr_port_t ap6_1, ap6_2;
-    node_get_pref_ipv6_orport(node1, &ap6_1);
-    node_get_pref_ipv6_orport(node2, &ap6_2);
-
-    if (router_addrs_in_same_network(&a1, &a2) ||
-        router_addrs_in_same_network(&ap6_1.addr, &ap6_2.addr))
-      return 1;
-  }
+  if (options->EnforceDistinctSubnets &&
+      nodes_in_same_network(node1, node2))
+    return 1;
 
   /* Are they in the same family because the agree they are? */
   if (node_family_contains(node1, node2) &&
@@ -2479,6 +2488,7 @@ void
 router_dir_info_changed(void)
 {
   need_to_update_have_min_dir_info = 1;
+  paid_path_tables_mark_dirty();
   hs_service_dir_info_changed();
   hs_client_dir_info_changed();
 }
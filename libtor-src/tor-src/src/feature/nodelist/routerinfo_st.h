@@ -114,10 +114,13 @@ struct routerinfo_t {
    */
   uint8_t purpose;
 
-  char *PaymentBolt12Offer; /**< Payment Bolt12 offer for this router. */
-  char *PaymentBip353;
-  char *PaymentBolt11Lnurl;
-  char *PaymentBolt11LightningAddress;
+  /** Payment details for this router. These are shared copies from
+   * payment_intern_string(), so two routerinfos with the same details hold
+   * the same pointers. */
+  const char *PaymentBolt12Offer; /**< Payment Bolt12 offer. */
+  const char *PaymentBip353;
+  const char *PaymentBolt11Lnurl;
+  const char *PaymentBolt11LightningAddress;
   int PaymentRateMsats;
   int PaymentInterval;
   int PaymentInvervalRounds;
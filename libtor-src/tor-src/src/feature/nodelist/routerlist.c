@@ -91,6 +91,7 @@
 #include "feature/dirparse/routerparse.h"
 #include "feature/nodelist/routerset.h"
 #include "feature/nodelist/torcert.h"
+#include "feature/payment/payment_intern.h"
 #include "feature/relay/routermode.h"
 #include "feature/relay/relay_find_addr.h"
 #include "feature/stats/rephist.h"
@@ -931,10 +932,10 @@ routerinfo_free_(routerinfo_t *router)
   tor_free(router->protocol_list);
   tor_free(router->contact_info);
   
-  tor_free(router->PaymentBolt12Offer);
-  tor_free(router->PaymentBip353);
-  tor_free(router->PaymentBolt11Lnurl);
-  tor_free(router->PaymentBolt11LightningAddress);
+  payment_intern_release(router->PaymentBolt12Offer);
+  payment_intern_release(router->PaymentBip353);
+  payment_intern_release(router->PaymentBolt11Lnurl);
+  payment_intern_release(router->PaymentBolt11LightningAddress);
 
   if (router->onion_pkey)
     tor_free(router->onion_pkey);
@@ -2997,25 +2998,12 @@ router_differences_are_cosmetic(const routerinfo_t *r1, const routerinfo_t *r2)
       (r1->contact_info && r2->contact_info &&
        strcasecmp(r1->contact_info, r2->contact_info)) ||
       
-      (r1->PaymentBolt12Offer && !r2->PaymentBolt12Offer) || /* PaymentBolt12Offer is optional */
-      (!r1->PaymentBolt12Offer && r2->PaymentBolt12Offer) ||
-      (r1->PaymentBolt12Offer && r2->PaymentBolt12Offer &&
-      strcasecmp(r1->PaymentBolt12Offer, r2->PaymentBolt12Offer)) ||
-
-      (r1->PaymentBip353 && !r2->PaymentBip353) || /* PaymentBip353 is optional */
-      (!r1->PaymentBip353 && r2->PaymentBip353) ||
-      (r1->PaymentBip353 && r2->PaymentBip353 &&
-      strcasecmp(r1->PaymentBip353, r2->PaymentBip353)) ||
-
-      (r1->PaymentBolt11Lnurl && !r2->PaymentBolt11Lnurl) || /* PaymentBolt11Lnurl is optional */
-      (!r1->PaymentBolt11Lnurl && r2->PaymentBolt11Lnurl) ||
-      (r1->PaymentBolt11Lnurl && r2->PaymentBolt11Lnurl &&
-      strcasecmp(r1->PaymentBolt11Lnurl, r2->PaymentBolt11Lnurl)) ||
-
-      (r1->PaymentBolt11LightningAddress && !r2->PaymentBolt11LightningAddress) || /* PaymentBolt11LightningAddress is optional */
-      (!r1->PaymentBolt11LightningAddress && r2->PaymentBolt11LightningAddress) ||
-      (r1->PaymentBolt11LightningAddress && r2->PaymentBolt11LightningAddress &&
-      strcasecmp(r1->PaymentBolt11LightningAddress, r2->PaymentBolt11LightningAddress)) ||
+      /* Payment details are interned: equal strings are the same pointer. */
+      r1->PaymentBolt12Offer != r2->PaymentBolt12Offer ||
+      r1->PaymentBip353 != r2->PaymentBip353 ||
+      r1->PaymentBolt11Lnurl != r2->PaymentBolt11Lnurl ||
+      r1->PaymentBolt11LightningAddress !=
+        r2->PaymentBolt11LightningAddress ||
 
       (r1->PaymentRateMsats != r2->PaymentRateMsats) ||
       (r1->PaymentInterval != r2->PaymentInterval) ||
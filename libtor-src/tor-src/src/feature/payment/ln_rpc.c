@@ -0,0 +1,733 @@
+/**
+ * @file ln_rpc.c
+ * @brief Asynchronous HTTP client for the relay's Lightning node
+ *
+ * A relay that sets PaymentLightningNodeConfig can check the payments for
+ * its paid circuits with its Lightning node itself, instead of waiting for
+ * the controller to send PAYMENTRECEIVED. A line looks like
+ *
+ *   PaymentLightningNodeConfig type=phoenixd url=http://127.0.0.1:9740
+ *                              password=secret default=true
+ *
+ * and we talk to the "default=true" node, or to the first one if none is
+ * marked. The url must name the node by address: a hostname would need a
+ * blocking lookup. We speak plain HTTP, so the node should be local.
+ *
+ * "type=" says which API the node serves, and each lookup asks for one
+ * payment, by payment hash, in that API:
+ *
+ *   phoenixd: GET /payments/incoming/<hash>, authenticated with
+ *     "password=" (the node's http-password); paid iff "isPaid" is true.
+ *   cln: POST /v1/listinvoices {"payment_hash":"<hash>"} to the clnrest
+ *     plugin, with "rune=" in a Rune header; paid iff the invoice's
+ *     "status" is "paid".
+ *   lnd: GET /v1/invoice/<hash> on the REST proxy (which must run with
+ *     no-rest-tls), with the hex "macaroon=" in a Grpc-Metadata-macaroon
+ *     header; paid iff the invoice's "state" is "SETTLED".
+ *
+ * The url's path, if any, is put in front of these. A node that doesn't
+ * know the hash (HTTP 404, or no matching invoice) has not been paid.
+ *
+ * None of these APIs take more than one payment hash per request, so every
+ * lookup is its own HTTP request. Lookups are never sent as they are made,
+ * though: they wait in a queue until the end of the current main loop
+ * turn, and are then spread over LN_RPC_N_CONNECTIONS keep-alive
+ * connections to the node, all on the main libevent loop, each lookup on
+ * the connection with the fewest outstanding. libevent sends the requests
+ * queued on a connection back to back without closing it, and reconnects
+ * it if the node drops it. Once every connection has LN_RPC_MAX_IN_FLIGHT
+ * lookups outstanding, further lookups stay in our queue until one
+ * completes, so a node that stops answering cannot make us queue without
+ * bound in libevent.
+ *
+ * Nothing here ever blocks: every callback runs from the main loop.
+ **/
+
+#define LN_RPC_PRIVATE
+
+#include "core/or/or.h"
+#include "feature/payment/ln_rpc.h"
+#include "lib/encoding/confline.h"
+#include "lib/crypt_ops/crypto_util.h"
+#include "lib/encoding/kvline.h"
+#include "lib/evloop/compat_libevent.h"
+#include "lib/log/ratelim.h"
+
+#include <event2/buffer.h>
+#include <event2/http.h>
+
+/** Deepest JSON nesting we parse in a reply. */
+#define JSON_MAX_DEPTH 16
+
+/** How we talk to each kind of node. */
+static const struct {
+  /** The "type=" that selects it. */
+  const char *type;
+  /** The key of its credential in a PaymentLightningNodeConfig line. */
+  const char *credential_key;
+  /** The HTTP header the credential goes in. */
+  const char *credential_header;
+} backends[LN_RPC_N_BACKENDS] = {
+  [LN_RPC_PHOENIXD] = { "phoenixd", "password", "Authorization" },
+  [LN_RPC_CLN] = { "cln", "rune", "Rune" },
+  [LN_RPC_LND] = { "lnd", "macaroon", "Grpc-Metadata-macaroon" },
+};
+
+/** The node we talk to, or NULL if none is configured. */
+static ln_rpc_node_t *the_node = NULL;
+/** Lookups not yet sent to the node, oldest first. */
+static smartlist_t *pending_lookups = NULL;
+/** Event that sends the pending lookups at the end of the loop turn. */
+static mainloop_event_t *flush_event = NULL;
+
+static void ln_rpc_lookup_done(struct evhttp_request *req, void *arg);
+
+/** Wipe the values of <b>kvs</b>, which may hold credentials, and free
+ * them. */
+static void
+ln_rpc_kvs_free(config_line_t *kvs)
+{
+  for (config_line_t *cl = kvs; cl; cl = cl->next) {
+    if (cl->value)
+      memwipe(cl->value, 0, strlen(cl->value));
+  }
+  config_free_lines(kvs);
+}
+
+/** Parse one PaymentLightningNodeConfig value in <b>line</b>. Return a new
+ * node, or NULL and set *<b>msg</b> on failure. */
+STATIC ln_rpc_node_t *
+ln_rpc_node_parse(const char *line, char **msg)
+{
+  config_line_t *kvs = kvline_parse(line, KV_QUOTED);
+  ln_rpc_node_t *node = NULL;
+  const config_line_t *type, *url, *credential, *dflt;
+  const char *hostport, *slash;
+  char *hostport_copy = NULL;
+  int backend = -1;
+  size_t path_len;
+
+  if (!kvs) {
+    tor_asprintf(msg, "Could not parse PaymentLightningNodeConfig %s",
+                 escaped(line));
+    goto err;
+  }
+  type = config_line_find_case(kvs, "type");
+  url = config_line_find_case(kvs, "url");
+  dflt = config_line_find_case(kvs, "default");
+
+  for (int i = 0; type && i < LN_RPC_N_BACKENDS; ++i) {
+    if (!strcasecmp(type->value, backends[i].type))
+      backend = i;
+  }
+  if (backend < 0) {
+    tor_asprintf(msg, "PaymentLightningNodeConfig type must be phoenixd, "
+                 "cln or lnd.");
+    goto err;
+  }
+  if (!url || strcmpstart(url->value, "http://")) {
+    tor_asprintf(msg, "PaymentLightningNodeConfig needs an http:// url.");
+    goto err;
+  }
+  node = tor_malloc_zero(sizeof(*node));
+  node->backend = backend;
+  hostport = url->value + strlen("http://");
+  slash = strchr(hostport, '/');
+  hostport_copy = slash ? tor_strndup(hostport, slash - hostport) :
+                          tor_strdup(hostport);
+  if (tor_addr_port_parse(LOG_INFO, hostport_copy, &node->addr, &node->port,
+                          -1) < 0) {
+    tor_asprintf(msg, "PaymentLightningNodeConfig url %s must give an "
+                 "address and a port.", escaped(url->value));
+    goto err;
+  }
+  path_len = slash ? strlen(slash) : 0;
+  while (path_len && slash[path_len - 1] == '/')
+    --path_len;
+  node->path = tor_strndup(slash ? slash : "", path_len);
+
+  if (dflt && !strcasecmp(dflt->value, "true")) {
+    node->is_default = 1;
+  } else if (dflt && strcasecmp(dflt->value, "false")) {
+    tor_asprintf(msg, "PaymentLightningNodeConfig default must be true or "
+                 "false.");
+    goto err;
+  }
+
+  credential = config_line_find_case(kvs, backends[backend].credential_key);
+  if (credential && strlen(credential->value)) {
+    const char *value = credential->value;
+    if (backend == LN_RPC_PHOENIXD) {
+      /* HTTP basic authentication with an empty user name. */
+      char *userpass = NULL, *b64;
+      size_t b64_len;
+      tor_asprintf(&userpass, ":%s", value);
+      b64_len = base64_encode_size(strlen(userpass), 0) + 1;
+      b64 = tor_malloc_zero(b64_len);
+      base64_encode(b64, b64_len, userpass, strlen(userpass), 0);
+      tor_asprintf(&node->credential, "Basic %s", b64);
+      memwipe(userpass, 0, strlen(userpass));
+      memwipe(b64, 0, b64_len);
+      tor_free(userpass);
+      tor_free(b64);
+    } else if (backend == LN_RPC_LND &&
+               (strlen(value) % 2 || strspn(value, HEX_CHARACTERS) !=
+                strlen(value))) {
+      tor_asprintf(msg, "PaymentLightningNodeConfig macaroon must be "
+                   "hexadecimal.");
+      goto err;
+    } else {
+      node->credential = tor_strdup(value);
+    }
+  }
+
+  tor_free(hostport_copy);
+  ln_rpc_kvs_free(kvs);
+  return node;
+
+ err:
+  tor_free(hostport_copy);
+  ln_rpc_kvs_free(kvs);
+  ln_rpc_node_free(node);
+  return NULL;
+}
+
+/** Tell the callback of every lookup in <b>lookups</b> that it ended with
+ * <b>status</b>, and free the lookups. */
+static void
+ln_rpc_lookups_finish(smartlist_t *lookups, ln_rpc_status_t status)
+{
+  SMARTLIST_FOREACH_BEGIN(lookups, ln_rpc_lookup_t *, lookup) {
+    lookup->cb(lookup->payment_hash, status, lookup->arg);
+    tor_free(lookup);
+  } SMARTLIST_FOREACH_END(lookup);
+  smartlist_clear(lookups);
+}
+
+/** Close every connection of <b>node</b>, cancel every lookup queued on
+ * them, and release all storage held by <b>node</b>. */
+STATIC void
+ln_rpc_node_free_(ln_rpc_node_t *node)
+{
+  if (!node)
+    return;
+
+  for (int i = 0; i < LN_RPC_N_CONNECTIONS; ++i) {
+    ln_rpc_conn_t *conn = &node->conns[i];
+    if (!conn->evcon)
+      continue;
+    /* libevent drops the queued requests without running their
+     * callbacks, so cancel the lookups ourselves. */
+    ln_rpc_lookups_finish(conn->lookups, LN_RPC_CANCELLED);
+    smartlist_free(conn->lookups);
+    evhttp_connection_free(conn->evcon);
+  }
+  tor_free(node->path);
+  if (node->credential)
+    memwipe(node->credential, 0, strlen(node->credential));
+  tor_free(node->credential);
+  tor_free(node);
+}
+
+/** Return true iff <b>a</b> and <b>b</b> talk to the same node in the same
+ * way. */
+static int
+ln_rpc_node_eq(const ln_rpc_node_t *a, const ln_rpc_node_t *b)
+{
+  return a->backend == b->backend && a->port == b->port &&
+    tor_addr_eq(&a->addr, &b->addr) && !strcmp(a->path, b->path) &&
+    !strcmp_opt(a->credential, b->credential);
+}
+
+/** Return the node we should talk to from <b>lines</b>: the first one
+ * marked default, or else the first one. Return NULL if there is none or
+ * it doesn't parse. */
+static ln_rpc_node_t *
+ln_rpc_node_choose(const config_line_t *lines)
+{
+  ln_rpc_node_t *chosen = NULL;
+  char *msg = NULL;
+
+  for (const config_line_t *cl = lines; cl; cl = cl->next) {
+    ln_rpc_node_t *node = ln_rpc_node_parse(cl->value, &msg);
+    if (!node) {
+      log_warn(LD_CONFIG, "%s", msg);
+      tor_free(msg);
+      continue;
+    }
+    if (!chosen || (node->is_default && !chosen->is_default)) {
+      ln_rpc_node_free(chosen);
+      chosen = node;
+    } else {
+      ln_rpc_node_free(node);
+    }
+  }
+  return chosen;
+}
+
+/** Check the PaymentLightningNodeConfig <b>lines</b>. Return 0 if each
+ * one parses, names a type we can talk to, and at most one is the default,
+ * or -1 and set *<b>msg</b>. */
+int
+ln_rpc_node_config_validate(const config_line_t *lines, char **msg)
+{
+  int n_default = 0;
+
+  for (const config_line_t *cl = lines; cl; cl = cl->next) {
+    ln_rpc_node_t *node = ln_rpc_node_parse(cl->value, msg);
+    if (!node)
+      return -1;
+    n_default += node->is_default;
+    ln_rpc_node_free(node);
+  }
+  if (n_default > 1) {
+    tor_asprintf(msg, "Only one PaymentLightningNodeConfig can be the "
+                 "default.");
+    return -1;
+  }
+  return 0;
+}
+
+/** Called when the options change: start talking to the node that
+ * <b>lines</b> chooses, if it is not the one we talk to already. Lookups
+ * in flight to the old node are cancelled; queued ones go to the new node,
+ * or fail if there is none. */
+void
+ln_rpc_set_node_config(const config_line_t *lines)
+{
+  ln_rpc_node_t *node = ln_rpc_node_choose(lines);
+
+  if (node && the_node && ln_rpc_node_eq(node, the_node)) {
+    ln_rpc_node_free(node);
+    return;
+  }
+  ln_rpc_node_free(the_node);
+  the_node = node;
+  if (the_node) {
+    log_notice(LD_CONFIG, "Checking payments with the %s Lightning node "
+               "at %s.", backends[the_node->backend].type,
+               fmt_addrport(&the_node->addr, the_node->port));
+  } else if (pending_lookups) {
+    ln_rpc_lookups_finish(pending_lookups, LN_RPC_FAILED);
+  }
+}
+
+/** Return true iff we have a Lightning node to check payments with. */
+int
+ln_rpc_is_configured(void)
+{
+  return the_node != NULL;
+}
+
+/** Return the lowercase hex of the DIGEST256_LEN-byte
+ * <b>payment_hash</b> in <b>hex</b>. */
+static void
+ln_rpc_hash_hex(char *hex, size_t hex_len, const uint8_t *payment_hash)
+{
+  base16_encode(hex, hex_len, (const char *) payment_hash, DIGEST256_LEN);
+  tor_strlower(hex);
+}
+
+/** Return a new string holding the URI that asks <b>node</b> about the
+ * payment with hash <b>payment_hash</b>. */
+STATIC char *
+ln_rpc_request_uri(const ln_rpc_node_t *node, const uint8_t *payment_hash)
+{
+  char hex[HEX_DIGEST256_LEN + 1];
+  char *uri = NULL;
+
+  ln_rpc_hash_hex(hex, sizeof(hex), payment_hash);
+  switch (node->backend) {
+    case LN_RPC_PHOENIXD:
+      tor_asprintf(&uri, "%s/payments/incoming/%s", node->path, hex);
+      break;
+    case LN_RPC_CLN:
+      tor_asprintf(&uri, "%s/v1/listinvoices", node->path);
+      break;
+    case LN_RPC_LND:
+    default:
+      tor_asprintf(&uri, "%s/v1/invoice/%s", node->path, hex);
+      break;
+  }
+  return uri;
+}
+
+/** Return a new string holding the body of the request that asks
+ * <b>node</b> about the payment with hash <b>payment_hash</b>, or NULL if
+ * the request is a GET. */
+STATIC char *
+ln_rpc_request_body(const ln_rpc_node_t *node, const uint8_t *payment_hash)
+{
+  char hex[HEX_DIGEST256_LEN + 1];
+  char *body = NULL;
+
+  if (node->backend != LN_RPC_CLN)
+    return NULL;
+  ln_rpc_hash_hex(hex, sizeof(hex), payment_hash);
+  tor_asprintf(&body, "{\"payment_hash\":\"%s\"}", hex);
+  return body;
+}
+
+/** Return the first character at or after <b>p</b> that is not JSON
+ * whitespace. */
+static const char *
+json_skip_ws(const char *p, const char *end)
+{
+  while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r'))
+    ++p;
+  return p;
+}
+
+/** Return the end of the JSON string that starts at <b>p</b>, or NULL if
+ * there isn't one. */
+static const char *
+json_skip_string(const char *p, const char *end)
+{
+  if (!p || p >= end || *p != '"')
+    return NULL;
+  for (++p; p < end; ++p) {
+    if (*p == '\\')
+      ++p;
+    else if (*p == '"')
+      return p + 1;
+  }
+  return NULL;
+}
+
+/** Return the end of the JSON value that starts at <b>p</b>, after any
+ * whitespace, or NULL if it is malformed or nested more than
+ * JSON_MAX_DEPTH deep. Numbers and literals are only checked loosely. */
+static const char *
+json_skip_value(const char *p, const char *end, int depth)
+{
+  p = json_skip_ws(p, end);
+  if (p >= end)
+    return NULL;
+
+  if (*p == '"')
+    return json_skip_string(p, end);
+
+  if (*p == '{' || *p == '[') {
+    const int is_object = *p == '{';
+    const char close = is_object ? '}' : ']';
+    if (depth >= JSON_MAX_DEPTH)
+      return NULL;
+    p = json_skip_ws(p + 1, end);
+    if (p < end && *p == close)
+      return p + 1;
+    for (;;) {
+      if (is_object) {
+        p = json_skip_string(json_skip_ws(p, end), end);
+        if (!p)
+          return NULL;
+        p = json_skip_ws(p, end);
+        if (p >= end || *p != ':')
+          return NULL;
+        ++p;
+      }
+      p = json_skip_value(p, end, depth + 1);
+      if (!p)
+        return NULL;
+      p = json_skip_ws(p, end);
+      if (p >= end)
+        return NULL;
+      if (*p == close)
+        return p + 1;
+      if (*p != ',')
+        return NULL;
+      ++p;
+    }
+  }
+
+  {
+    const char *start = p;
+    while (p < end && (TOR_ISALNUM(*p) || *p == '-' || *p == '+' ||
+                       *p == '.'))
+      ++p;
+    return p > start ? p : NULL;
+  }
+}
+
+/** If <b>p</b> starts a JSON object, return the start of the value of its
+ * member <b>key</b>. Return NULL if it has no such member or is
+ * malformed. Keys are compared without unescaping. */
+static const char *
+json_object_get(const char *p, const char *end, const char *key)
+{
+  const size_t keylen = strlen(key);
+
+  p = json_skip_ws(p, end);
+  if (p >= end || *p != '{')
+    return NULL;
+  p = json_skip_ws(p + 1, end);
+  if (p < end && *p == '}')
+    return NULL;
+  for (;;) {
+    const char *k = json_skip_ws(p, end);
+    const char *kend = json_skip_string(k, end);
+    if (!kend)
+      return NULL;
+    p = json_skip_ws(kend, end);
+    if (p >= end || *p != ':')
+      return NULL;
+    p = json_skip_ws(p + 1, end);
+    if ((size_t) (kend - k - 2) == keylen && fast_memeq(k + 1, key, keylen))
+      return p;
+    p = json_skip_value(p, end, 1);
+    if (!p)
+      return NULL;
+    p = json_skip_ws(p, end);
+    if (p >= end || *p != ',')
+      return NULL;
+    ++p;
+  }
+}
+
+/** Return true iff the JSON value at <b>p</b> is the literal <b>lit</b>. */
+static int
+json_is_literal(const char *p, const char *end, const char *lit)
+{
+  const size_t len = strlen(lit);
+  return p && (size_t) (end - p) >= len && fast_memeq(p, lit, len) &&
+    (p + len == end || !TOR_ISALNUM(p[len]));
+}
+
+/** If <b>p</b> starts a JSON array, return the start of its first
+ * element, or NULL if it is empty or malformed. */
+static const char *
+json_array_first(const char *p, const char *end)
+{
+  p = json_skip_ws(p, end);
+  if (p >= end || *p != '[')
+    return NULL;
+  p = json_skip_ws(p + 1, end);
+  if (p >= end || *p == ']')
+    return NULL;
+  return p;
+}
+
+/** Return the outcome of a lookup that a node of kind <b>backend</b>
+ * answered with HTTP status <b>code</b> and the <b>len</b>-byte
+ * <b>body</b>. */
+STATIC ln_rpc_status_t
+ln_rpc_parse_reply(ln_rpc_backend_t backend, int code, const char *body,
+                   size_t len)
+{
+  const char *p = body, *end = body + len;
+  const char *value;
+
+  /* The node has never heard of the payment. */
+  if (code == HTTP_NOTFOUND && backend != LN_RPC_CLN)
+    return LN_RPC_UNPAID;
+  /* clnrest answers a POST with 201. */
+  if (code != HTTP_OK && !(backend == LN_RPC_CLN && code == 201))
+    return LN_RPC_FAILED;
+  if (!body || !json_skip_value(p, end, 0))
+    return LN_RPC_FAILED;
+
+  switch (backend) {
+    case LN_RPC_PHOENIXD:
+      value = json_object_get(p, end, "isPaid");
+      if (json_is_literal(value, end, "true"))
+        return LN_RPC_PAID;
+      if (json_is_literal(value, end, "false"))
+        return LN_RPC_UNPAID;
+      return LN_RPC_FAILED;
+    case LN_RPC_CLN:
+      value = json_object_get(p, end, "invoices");
+      if (!value || value >= end || *value != '[')
+        return LN_RPC_FAILED;
+      value = json_array_first(value, end);
+      if (!value)
+        return LN_RPC_UNPAID;
+      value = json_object_get(value, end, "status");
+      if (!value || !json_skip_string(value, end))
+        return LN_RPC_FAILED;
+      return json_is_literal(value, end, "\"paid\"") ?
+        LN_RPC_PAID : LN_RPC_UNPAID;
+    case LN_RPC_LND:
+    default:
+      value = json_object_get(p, end, "state");
+      if (!value || !json_skip_string(value, end))
+        return LN_RPC_FAILED;
+      return json_is_literal(value, end, "\"SETTLED\"") ?
+        LN_RPC_PAID : LN_RPC_UNPAID;
+  }
+}
+
+/** Send the oldest pending lookup on <b>conn</b>. */
+static void
+ln_rpc_send_lookup(ln_rpc_conn_t *conn)
+{
+  ln_rpc_lookup_t *lookup = smartlist_get(pending_lookups, 0);
+  struct evhttp_request *req;
+  struct evkeyvalq *headers;
+  char *body, *uri, *host;
+
+  smartlist_del_keeporder(pending_lookups, 0);
+  lookup->conn = conn;
+
+  req = evhttp_request_new(ln_rpc_lookup_done, lookup);
+  headers = evhttp_request_get_output_headers(req);
+  host = tor_strdup(fmt_addrport(&the_node->addr, the_node->port));
+  evhttp_add_header(headers, "Host", host);
+  if (the_node->credential)
+    evhttp_add_header(headers,
+                      backends[the_node->backend].credential_header,
+                      the_node->credential);
+  body = ln_rpc_request_body(the_node, lookup->payment_hash);
+  if (body) {
+    evhttp_add_header(headers, "Content-Type", "application/json");
+    evbuffer_add(evhttp_request_get_output_buffer(req), body, strlen(body));
+  }
+  uri = ln_rpc_request_uri(the_node, lookup->payment_hash);
+
+  smartlist_add(conn->lookups, lookup);
+  if (evhttp_make_request(conn->evcon, req,
+                          body ? EVHTTP_REQ_POST : EVHTTP_REQ_GET,
+                          uri) < 0) {
+    /* libevent could not start connecting, and won't run the callback. */
+    smartlist_remove_keeporder(conn->lookups, lookup);
+    lookup->cb(lookup->payment_hash, LN_RPC_FAILED, lookup->arg);
+    tor_free(lookup);
+  }
+  tor_free(body);
+  tor_free(uri);
+  tor_free(host);
+}
+
+/** Return the connection to the node with the fewest lookups in flight,
+ * opening it if needed, or NULL if every connection is full. */
+static ln_rpc_conn_t *
+ln_rpc_choose_conn(void)
+{
+  ln_rpc_conn_t *best = NULL;
+
+  for (int i = 0; i < LN_RPC_N_CONNECTIONS; ++i) {
+    ln_rpc_conn_t *conn = &the_node->conns[i];
+    if (!conn->evcon) {
+      conn->evcon = evhttp_connection_base_new(tor_libevent_get_base(), NULL,
+                                               fmt_addr(&the_node->addr),
+                                               the_node->port);
+      if (!conn->evcon)
+        continue;
+      evhttp_connection_set_timeout(conn->evcon, LN_RPC_TIMEOUT);
+      evhttp_connection_set_max_body_size(conn->evcon,
+                                          LN_RPC_MAX_REPLY_SIZE);
+      conn->lookups = smartlist_new();
+    }
+    if (!best || smartlist_len(conn->lookups) < smartlist_len(best->lookups))
+      best = conn;
+  }
+  if (!best || smartlist_len(best->lookups) >= LN_RPC_MAX_IN_FLIGHT)
+    return NULL;
+  return best;
+}
+
+/** Send as many pending lookups to the node as the connections will
+ * take. */
+static void
+ln_rpc_flush(mainloop_event_t *ev, void *arg)
+{
+  ln_rpc_conn_t *conn;
+  (void) ev;
+  (void) arg;
+
+  if (!pending_lookups)
+    return;
+  if (!the_node) {
+    ln_rpc_lookups_finish(pending_lookups, LN_RPC_FAILED);
+    return;
+  }
+  while (smartlist_len(pending_lookups) && (conn = ln_rpc_choose_conn()))
+    ln_rpc_send_lookup(conn);
+}
+
+/** Make sure the pending lookups are sent at the end of this loop turn. */
+static void
+ln_rpc_schedule_flush(void)
+{
+  if (!flush_event)
+    flush_event = mainloop_event_new(ln_rpc_flush, NULL);
+  mainloop_event_activate(flush_event);
+}
+
+/** Called by libevent when the node has answered the lookup <b>arg</b>, or
+ * when the request failed. */
+static void
+ln_rpc_lookup_done(struct evhttp_request *req, void *arg)
+{
+  static ratelim_t fail_limit = RATELIM_INIT(300);
+  ln_rpc_lookup_t *lookup = arg;
+  const int code = req ? evhttp_request_get_response_code(req) : 0;
+  ln_rpc_status_t status;
+  const char *body = NULL;
+  size_t len = 0;
+
+  smartlist_remove_keeporder(lookup->conn->lookups, lookup);
+
+  if (req) {
+    struct evbuffer *buf = evhttp_request_get_input_buffer(req);
+    len = evbuffer_get_length(buf);
+    body = (const char *) evbuffer_pullup(buf, -1);
+  }
+  status = ln_rpc_parse_reply(the_node->backend, code, body, len);
+  if (status == LN_RPC_FAILED) {
+    log_fn_ratelim(&fail_limit, LOG_WARN, LD_NET,
+                   "Lightning node did not answer a payment lookup "
+                   "(HTTP status %d).", code);
+  }
+
+  lookup->cb(lookup->payment_hash, status, lookup->arg);
+  tor_free(lookup);
+
+  /* A connection has room again. */
+  if (pending_lookups && smartlist_len(pending_lookups))
+    ln_rpc_schedule_flush();
+}
+
+/** Ask the node whether it has received the payment with hash
+ * <b>payment_hash</b> (DIGEST256_LEN bytes). <b>cb</b> is called with
+ * <b>arg</b> and the outcome from the main loop, never from this call. */
+void
+ln_rpc_lookup_payment(const uint8_t *payment_hash, ln_rpc_lookup_cb_t cb,
+                      void *arg)
+{
+  ln_rpc_lookup_t *lookup = tor_malloc_zero(sizeof(*lookup));
+
+  memcpy(lookup->payment_hash, payment_hash, DIGEST256_LEN);
+  lookup->cb = cb;
+  lookup->arg = arg;
+  if (!pending_lookups)
+    pending_lookups = smartlist_new();
+  smartlist_add(pending_lookups, lookup);
+  ln_rpc_schedule_flush();
+}
+
+/** Return the number of lookups not yet answered, sent or not. */
+int
+ln_rpc_n_pending(void)
+{
+  int n = pending_lookups ? smartlist_len(pending_lookups) : 0;
+
+  if (the_node) {
+    for (int i = 0; i < LN_RPC_N_CONNECTIONS; ++i) {
+      if (the_node->conns[i].evcon)
+        n += smartlist_len(the_node->conns[i].lookups);
+    }
+  }
+  return n;
+}
+
+/** Cancel every lookup, close the connections to the node, and release
+ * all storage. */
+void
+ln_rpc_free_all(void)
+{
+  ln_rpc_node_free(the_node);
+  if (pending_lookups) {
+    ln_rpc_lookups_finish(pending_lookups, LN_RPC_CANCELLED);
+    smartlist_free(pending_lookups);
+  }
+  mainloop_event_free(flush_event);
+}
@@ -0,0 +1,114 @@
+/**
+ * @file ln_rpc.h
+ * @brief Header for the asynchronous Lightning node RPC client
+ **/
+
+#ifndef LN_RPC_H
+#define LN_RPC_H
+
+#include "core/or/or.h"
+
+struct config_line_t;
+
+/** Persistent HTTP connections we keep open to the node. */
+#define LN_RPC_N_CONNECTIONS 4
+/** Most lookups we queue on one connection before holding the rest
+ * back. */
+#define LN_RPC_MAX_IN_FLIGHT 16
+/** Seconds we wait for the node to answer a lookup. */
+#define LN_RPC_TIMEOUT 10
+/** Largest reply body we accept from the node. */
+#define LN_RPC_MAX_REPLY_SIZE (1024 * 1024)
+
+/** Outcome of one payment lookup. */
+typedef enum ln_rpc_status_t {
+  /** The node has received the payment. */
+  LN_RPC_PAID = 0,
+  /** The node has not received the payment. */
+  LN_RPC_UNPAID = 1,
+  /** We could not get an answer from the node. */
+  LN_RPC_FAILED = 2,
+  /** The client was reconfigured or shut down before the node answered.
+   * The callback should only release its argument. */
+  LN_RPC_CANCELLED = 3,
+} ln_rpc_status_t;
+
+/** Called with the outcome of the lookup of <b>payment_hash</b>. */
+typedef void (*ln_rpc_lookup_cb_t)(const uint8_t *payment_hash,
+                                   ln_rpc_status_t status, void *arg);
+
+int ln_rpc_node_config_validate(const struct config_line_t *lines,
+                                char **msg);
+void ln_rpc_set_node_config(const struct config_line_t *lines);
+int ln_rpc_is_configured(void);
+void ln_rpc_lookup_payment(const uint8_t *payment_hash,
+                           ln_rpc_lookup_cb_t cb, void *arg);
+int ln_rpc_n_pending(void);
+void ln_rpc_free_all(void);
+
+#ifdef LN_RPC_PRIVATE
+
+struct evhttp_connection;
+
+/** The Lightning node implementations we know how to ask about a
+ * payment. */
+typedef enum ln_rpc_backend_t {
+  /** phoenixd, through its HTTP API. */
+  LN_RPC_PHOENIXD = 0,
+  /** Core Lightning, through its clnrest plugin. */
+  LN_RPC_CLN = 1,
+  /** LND, through its REST proxy (run with no-rest-tls). */
+  LN_RPC_LND = 2,
+} ln_rpc_backend_t;
+#define LN_RPC_N_BACKENDS 3
+
+/** A payment lookup waiting for, or waiting on, the node. */
+typedef struct ln_rpc_lookup_t {
+  uint8_t payment_hash[DIGEST256_LEN];
+  ln_rpc_lookup_cb_t cb;
+  void *arg;
+  /** The connection the lookup is queued on, or NULL if it is not sent
+   * yet. */
+  struct ln_rpc_conn_t *conn;
+} ln_rpc_lookup_t;
+
+/** One persistent HTTP connection to the node. */
+typedef struct ln_rpc_conn_t {
+  struct evhttp_connection *evcon;
+  /** The lookups queued on evcon, oldest first. */
+  smartlist_t *lookups;
+} ln_rpc_conn_t;
+
+/** A Lightning node, as given by one PaymentLightningNodeConfig line. */
+typedef struct ln_rpc_node_t {
+  /** The node implementation, as given by "type=". */
+  ln_rpc_backend_t backend;
+  /** Address and port of the node's HTTP API. */
+  tor_addr_t addr;
+  uint16_t port;
+  /** Path the API is mounted under: empty, or starting with "/" and not
+   * ending with one. */
+  char *path;
+  /** Value of the backend's credential header, or NULL if we send
+   * none. */
+  char *credential;
+  /** True iff the line said "default=true". */
+  unsigned int is_default : 1;
+  ln_rpc_conn_t conns[LN_RPC_N_CONNECTIONS];
+} ln_rpc_node_t;
+
+STATIC ln_rpc_node_t *ln_rpc_node_parse(const char *line, char **msg);
+STATIC void ln_rpc_node_free_(ln_rpc_node_t *node);
+#define ln_rpc_node_free(n) \
+  FREE_AND_NULL(ln_rpc_node_t, ln_rpc_node_free_, (n))
+STATIC char *ln_rpc_request_uri(const ln_rpc_node_t *node,
+                                const uint8_t *payment_hash);
+STATIC char *ln_rpc_request_body(const ln_rpc_node_t *node,
+                                 const uint8_t *payment_hash);
+STATIC ln_rpc_status_t ln_rpc_parse_reply(ln_rpc_backend_t backend,
+                                          int code, const char *body,
+                                          size_t len);
+
+#endif /* defined(LN_RPC_PRIVATE) */
+
+#endif /* !defined(LN_RPC_H) */
@@ -0,0 +1,223 @@
+/**
+ * @file paid_circ_pool.c
+ * @brief Client-side pool of prebuilt paid circuits
+ *
+ * A paid circuit can only be built with payment material for each of its
+ * hops, which tor cannot make up on its own. The controller therefore
+ * hands us circuit specs -- a path and the payment material for each hop --
+ * ahead of time (POOLPAIDCIRCUITS), and we keep up to PaymentCircuitPoolSize
+ * of them built and unused. Pooled circuits are ordinary general-purpose
+ * circuits, so a new stream attaches to one as soon as it is open instead
+ * of waiting for a three-hop paid build.
+ *
+ * The pool is refilled once a second from circuit_build_needed_circs(), and
+ * right away when the controller adds specs. A pooled circuit leaves the
+ * pool when a stream is first attached to it, when it is made unusable for
+ * new streams, or when it closes; a counter follows it in and out so that
+ * nothing has to walk the circuit list.
+ **/
+
+#include "core/or/or.h"
+#include "app/config/config.h"
+#include "core/or/circuitbuild.h"
+#include "core/or/circuitlist.h"
+#include "core/or/circuituse.h"
+#include "core/or/extendinfo.h"
+#include "feature/payment/paid_circ_pool.h"
+#include "feature/payment/relay_payments.h"
+
+#include "app/config/or_options_st.h"
+#include "core/or/cpath_build_state_st.h"
+#include "core/or/origin_circuit_st.h"
+
+/** Circuit specs waiting to be launched, oldest first. */
+static smartlist_t *pending_specs = NULL;
+/** Number of circuits with is_pooled_paid set. */
+static int n_pooled_circuits = 0;
+
+/** Return a new, empty circuit spec. */
+paid_circ_spec_t *
+paid_circ_spec_new(void)
+{
+  paid_circ_spec_t *spec = tor_malloc_zero(sizeof(*spec));
+  spec->payments = relay_payments_new();
+  return spec;
+}
+
+/** Release all storage held by <b>spec</b>. */
+void
+paid_circ_spec_free_(paid_circ_spec_t *spec)
+{
+  if (!spec)
+    return;
+  relay_payments_free(spec->payments);
+  tor_free(spec);
+}
+
+/** Launch a new general-purpose paid circuit along <b>spec</b>, taking its
+ * payments. Return the circuit, or NULL and set *<b>msg_out</b> if it could
+ * not be launched. */
+MOCK_IMPL(origin_circuit_t *,
+paid_circ_spec_launch,(paid_circ_spec_t *spec, const char **msg_out))
+{
+  origin_circuit_t *circ;
+  int err_reason;
+
+  circ = origin_circuit_init(CIRCUIT_PURPOSE_C_GENERAL, 0);
+  circ->first_hop_from_controller = 1;
+  circ->any_hop_from_controller = 1;
+  circ->relay_payments = spec->payments;
+  spec->payments = NULL;
+
+  for (int i = 0; i < spec->n_hops; ++i) {
+    extend_info_t *info = extend_info_from_node(spec->hops[i], i == 0, true);
+    if (!info) {
+      circuit_mark_for_close(TO_CIRCUIT(circ), END_CIRC_REASON_CONNECTFAILED);
+      *msg_out = "Missing descriptor or valid address";
+      return NULL;
+    }
+    circuit_append_new_exit(circ, info);
+    extend_info_free(info);
+  }
+  if (circ->build_state->desired_path_len > 1)
+    circ->build_state->onehop_tunnel = 0;
+
+  if ((err_reason = circuit_handle_first_hop(circ)) < 0) {
+    circuit_mark_for_close(TO_CIRCUIT(circ), -err_reason);
+    *msg_out = "Couldn't start circuit";
+    return NULL;
+  }
+  return circ;
+}
+
+/** Queue every spec in <b>specs</b> for the pool, taking ownership of them,
+ * and clear <b>specs</b>. Return -1 and take nothing if that would queue
+ * more than PAID_CIRC_POOL_MAX_SPECS; otherwise return 0. */
+int
+paid_circ_pool_add_specs(smartlist_t *specs)
+{
+  if (!pending_specs)
+    pending_specs = smartlist_new();
+  if (smartlist_len(pending_specs) + smartlist_len(specs) >
+      PAID_CIRC_POOL_MAX_SPECS)
+    return -1;
+
+  smartlist_add_all(pending_specs, specs);
+  smartlist_clear(specs);
+  paid_circ_pool_refill();
+  return 0;
+}
+
+/** Check the pool's options in <b>options</b>. Return 0 if they are
+ * fine, or -1 and set *<b>msg</b>. */
+int
+paid_circ_pool_options_validate(const or_options_t *options, char **msg)
+{
+  if (options->PaymentCircuitPoolSize > PAID_CIRC_POOL_MAX_SIZE) {
+    tor_asprintf(msg, "PaymentCircuitPoolSize must be at most %d.",
+                 PAID_CIRC_POOL_MAX_SIZE);
+    return -1;
+  }
+  return 0;
+}
+
+/** Return the number of specs waiting to be launched. */
+int
+paid_circ_pool_n_specs(void)
+{
+  return pending_specs ? smartlist_len(pending_specs) : 0;
+}
+
+/** Return the number of pooled circuits that are open or being built and
+ * that no stream has used yet. */
+int
+paid_circ_pool_n_circuits(void)
+{
+  return n_pooled_circuits;
+}
+
+/** Take <b>circ</b> out of the pool if it is in it. Called when a stream is
+ * attached to it, when it can no longer take new streams, and when it is
+ * closed or freed. */
+void
+paid_circ_pool_circuit_left(origin_circuit_t *circ)
+{
+  if (!circ->is_pooled_paid)
+    return;
+  circ->is_pooled_paid = 0;
+  if (BUG(n_pooled_circuits <= 0))
+    return;
+  --n_pooled_circuits;
+}
+
+#ifdef TOR_UNIT_TESTS
+/** Return the number of pooled circuits by walking the circuit list, for
+ * checking paid_circ_pool_n_circuits(). */
+int
+paid_circ_pool_count_circuits(void)
+{
+  int n = 0;
+
+  SMARTLIST_FOREACH_BEGIN(circuit_get_global_list(), const circuit_t *,
+                          circ) {
+    if (!CIRCUIT_IS_ORIGIN(circ) || circ->marked_for_close)
+      continue;
+    const origin_circuit_t *ocirc = CONST_TO_ORIGIN_CIRCUIT(circ);
+    if (ocirc->is_pooled_paid && !ocirc->unusable_for_new_conns)
+      ++n;
+  } SMARTLIST_FOREACH_END(circ);
+
+  return n;
+}
+#endif /* defined(TOR_UNIT_TESTS) */
+
+/** Launch pooled circuits from the waiting specs until the pool holds
+ * PaymentCircuitPoolSize circuits, trying at most
+ * PAID_CIRC_POOL_LAUNCH_BATCH specs. Return the number of circuits
+ * launched. */
+int
+paid_circ_pool_refill(void)
+{
+  const int want = get_options()->PaymentCircuitPoolSize;
+  int have, n_tried = 0, n_launched = 0;
+
+  if (want <= 0 || paid_circ_pool_n_specs() == 0)
+    return 0;
+
+  have = paid_circ_pool_n_circuits();
+  while (have < want && smartlist_len(pending_specs) > 0 &&
+         n_tried < PAID_CIRC_POOL_LAUNCH_BATCH) {
+    paid_circ_spec_t *spec = smartlist_get(pending_specs, 0);
+    const char *why = NULL;
+    origin_circuit_t *circ;
+
+    smartlist_del_keeporder(pending_specs, 0);
+    ++n_tried;
+    /* The material is spent even if the launch fails: the relays may have
+     * seen its handshake payment hash already. */
+    circ = paid_circ_spec_launch(spec, &why);
+    paid_circ_spec_free(spec);
+    if (!circ) {
+      log_info(LD_CIRC, "Couldn't launch a pooled paid circuit: %s", why);
+      continue;
+    }
+    circ->is_pooled_paid = 1;
+    ++n_pooled_circuits;
+    circuit_event_status(circ, CIRC_EVENT_LAUNCHED, 0);
+    ++have;
+    ++n_launched;
+  }
+
+  return n_launched;
+}
+
+/** Forget every waiting spec. Pooled circuits are left alone. */
+void
+paid_circ_pool_free_all(void)
+{
+  if (!pending_specs)
+    return;
+  SMARTLIST_FOREACH(pending_specs, paid_circ_spec_t *, spec,
+                    paid_circ_spec_free(spec));
+  smartlist_free(pending_specs);
+}
@@ -0,0 +1,54 @@
+/**
+ * @file paid_circ_pool.h
+ * @brief Header for the client-side pool of prebuilt paid circuits
+ **/
+
+#ifndef PAID_CIRC_POOL_H
+#define PAID_CIRC_POOL_H
+
+#include "core/or/or.h"
+#include "feature/payment/relay_payments.h"
+#include "feature/payment/relay_payments_st.h"
+
+/** Most circuit specs the pool keeps waiting for a launch. */
+#define PAID_CIRC_POOL_MAX_SPECS 1024
+/** Largest allowed PaymentCircuitPoolSize. */
+#define PAID_CIRC_POOL_MAX_SIZE 64
+/** Most pooled circuits launched at once, so that a large refill does not
+ * stall the main loop. */
+#define PAID_CIRC_POOL_LAUNCH_BATCH 8
+
+/** A paid circuit to build: its path and the payment material for each
+ * hop, as supplied by the controller. */
+typedef struct paid_circ_spec_t {
+  /** The hops of the circuit, in order. */
+  const struct node_t *hops[RELAY_PAYMENTS_MAX_HOPS];
+  int n_hops;
+  /** Payment material for the hops; handed to the circuit at launch. */
+  relay_payments_t *payments;
+  /** Global identifier of the circuit once it is launched. */
+  uint32_t global_id;
+  /** Why the circuit could not be launched, or NULL. */
+  const char *failure;
+} paid_circ_spec_t;
+
+paid_circ_spec_t *paid_circ_spec_new(void);
+void paid_circ_spec_free_(paid_circ_spec_t *spec);
+#define paid_circ_spec_free(spec) \
+  FREE_AND_NULL(paid_circ_spec_t, paid_circ_spec_free_, (spec))
+MOCK_DECL(origin_circuit_t *, paid_circ_spec_launch,
+          (paid_circ_spec_t *spec, const char **msg_out));
+
+int paid_circ_pool_options_validate(const or_options_t *options, char **msg);
+int paid_circ_pool_add_specs(smartlist_t *specs);
+int paid_circ_pool_n_specs(void);
+int paid_circ_pool_n_circuits(void);
+void paid_circ_pool_circuit_left(origin_circuit_t *circ);
+int paid_circ_pool_refill(void);
+void paid_circ_pool_free_all(void);
+
+#ifdef TOR_UNIT_TESTS
+int paid_circ_pool_count_circuits(void);
+#endif
+
+#endif /* !defined(PAID_CIRC_POOL_H) */
@@ -0,0 +1,370 @@
+/**
+ * @file paid_path.c
+ * @brief Fee-aware paid path selection
+ *
+ * Relays advertise their payment terms in their router descriptors, which
+ * microdescriptors don't carry: a client only sees them if it fetches full
+ * descriptors. UseMicrodescriptors auto does so whenever PaymentCircuitMaxFee
+ * is set; a client that forces UseMicrodescriptors 1 gets no paths. This
+ * module
+ * picks paths for paid circuits that are weighted by bandwidth, like
+ * ordinary paths, but whose total fee stays within a budget
+ * (PaymentCircuitMaxFee). The controller asks for paths with GETINFO
+ * "payment/paths/<n>" and then builds them with EXTENDPAIDCIRCUITS, since
+ * only it can make the payment material.
+ *
+ * Computing bandwidth weights walks the whole nodelist, so we do it once per
+ * position (guard, middle, exit) whenever the directory information
+ * changes, not once per pick. Each table holds the allowed relays sorted by
+ * fee, with a running sum of their weights. The relays within a fee cap are
+ * then a prefix of the table, found by binary search, and a weighted pick
+ * among them is a second binary search over the running sums: each hop
+ * costs O(log n).
+ *
+ * A path is built exit first, then guard, then middles. Each hop may spend
+ * whatever is left of the budget after setting aside the cheapest fee of
+ * every hop still to choose, so the budget alone never rules out a path.
+ * Hops that repeat a relay, a family or a /16 are redrawn, and choosing can
+ * still fail when every affordable relay for a hop clashes with the others.
+ *
+ * Unlike choose_array_element_by_weight(), the search here is not constant
+ * time: the chosen path goes straight to the controller anyway.
+ **/
+
+#define PAID_PATH_PRIVATE
+
+#include "core/or/or.h"
+#include "app/config/config.h"
+#include "feature/nodelist/microdesc.h"
+#include "feature/nodelist/node_select.h"
+#include "feature/nodelist/nodelist.h"
+#include "feature/payment/paid_path.h"
+#include "feature/payment/payment_rounds.h"
+#include "feature/payment/relay_payments_st.h"
+#include "lib/crypt_ops/crypto_rand.h"
+
+#include "feature/nodelist/node_st.h"
+#include "feature/nodelist/routerinfo_st.h"
+
+/** One table per paid_path_position_t, or NULL before the first use. */
+static paid_path_table_t *tables[PAID_PATH_N_POSITIONS];
+/** True iff the directory information changed since the tables were
+ * built. */
+static int tables_dirty = 1;
+
+/** Return the fee, in msats, that <b>node</b> asks for carrying one
+ * circuit: its handshake fee plus its rate for every paid round. As on the
+ * relay side, a relay that sets no round count runs PAYMENT_ROUNDS_MAX
+ * rounds, the first round is free, and a relay without a PaymentInterval
+ * runs no rounds at all. */
+uint64_t
+paid_path_node_fee(const node_t *node)
+{
+  const routerinfo_t *ri = node->ri;
+  int rounds;
+  uint64_t fee;
+
+  if (!ri)
+    return 0;
+
+  fee = ri->PaymentHandshakeFee > 0 ? (uint64_t) ri->PaymentHandshakeFee : 0;
+  if (ri->PaymentInterval <= 0 || ri->PaymentRateMsats <= 0)
+    return fee;
+
+  rounds = ri->PaymentInvervalRounds;
+  if (rounds <= 0 || rounds > PAYMENT_ROUNDS_MAX)
+    rounds = PAYMENT_ROUNDS_MAX;
+  return fee + (uint64_t) ri->PaymentRateMsats * (rounds - 1);
+}
+
+/** Return true iff <b>node</b> may take position <b>pos</b> in a paid
+ * path. We need its router descriptor, since that is where its payment
+ * terms are. */
+static int
+paid_path_node_allowed(const node_t *node, paid_path_position_t pos)
+{
+  if (!node->ri || !node->rs || !node->is_running || !node->is_valid ||
+      node_is_me(node))
+    return 0;
+
+  switch (pos) {
+    case PAID_PATH_GUARD:
+      return node->is_possible_guard;
+    case PAID_PATH_EXIT:
+      return node->is_exit && !node->is_bad_exit;
+    case PAID_PATH_MIDDLE:
+    default:
+      return 1;
+  }
+}
+
+/** Helper for qsort: order table entries by fee, then by identity. */
+static int
+paid_path_entry_compare(const void *a_, const void *b_)
+{
+  const paid_path_entry_t *a = a_, *b = b_;
+  if (a->fee != b->fee)
+    return a->fee < b->fee ? -1 : 1;
+  return fast_memcmp(a->identity, b->identity, DIGEST_LEN);
+}
+
+/** Return a new table of the nodes in <b>nodes</b> that may take position
+ * <b>pos</b>. */
+STATIC paid_path_table_t *
+paid_path_table_new(const smartlist_t *nodes, paid_path_position_t pos)
+{
+  static const bandwidth_weight_rule_t rules[PAID_PATH_N_POSITIONS] = {
+    [PAID_PATH_GUARD] = WEIGHT_FOR_GUARD,
+    [PAID_PATH_MIDDLE] = WEIGHT_FOR_MID,
+    [PAID_PATH_EXIT] = WEIGHT_FOR_EXIT,
+  };
+  paid_path_table_t *table = tor_malloc_zero(sizeof(*table));
+  smartlist_t *allowed = smartlist_new();
+  uint64_t *weights = NULL;
+  uint64_t total = 0;
+  int n;
+
+  SMARTLIST_FOREACH(nodes, const node_t *, node,
+                    if (paid_path_node_allowed(node, pos))
+                      smartlist_add(allowed, (void *) node));
+  n = smartlist_len(allowed);
+  if (n == 0 || !(weights = node_sl_get_bandwidth_weights(allowed,
+                                                          rules[pos])))
+    goto done;
+
+  /* Sort by fee first; the weights only become running sums afterwards. */
+  table->entries = tor_calloc(n, sizeof(paid_path_entry_t));
+  for (int i = 0; i < n; ++i) {
+    const node_t *node = smartlist_get(allowed, i);
+    paid_path_entry_t *ent = &table->entries[i];
+    ent->fee = paid_path_node_fee(node);
+    ent->cum_weight = weights[i];
+    memcpy(ent->identity, node->identity, DIGEST_LEN);
+  }
+  qsort(table->entries, n, sizeof(paid_path_entry_t),
+        paid_path_entry_compare);
+  for (int i = 0; i < n; ++i) {
+    total += table->entries[i].cum_weight;
+    table->entries[i].cum_weight = total;
+  }
+  table->n_entries = n;
+
+ done:
+  tor_free(weights);
+  smartlist_free(allowed);
+  return table;
+}
+
+/** Release all storage held by <b>table</b>. */
+STATIC void
+paid_path_table_free_(paid_path_table_t *table)
+{
+  if (!table)
+    return;
+  tor_free(table->entries);
+  tor_free(table);
+}
+
+/** Return the number of entries in <b>table</b> whose fee is at most
+ * <b>max_fee</b>. They are the first entries of the table. */
+STATIC int
+paid_path_table_n_within(const paid_path_table_t *table, uint64_t max_fee)
+{
+  int lo = 0, hi = table->n_entries;
+
+  while (lo < hi) {
+    const int mid = lo + (hi - lo) / 2;
+    if (table->entries[mid].fee <= max_fee)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+/** Choose an entry of <b>table</b> whose fee is at most <b>max_fee</b>,
+ * with probability proportional to its bandwidth weight, and return its
+ * index. If all of those entries have no weight, choose one uniformly.
+ * Return -1 if no entry is cheap enough. */
+STATIC int
+paid_path_table_pick(const paid_path_table_t *table, uint64_t max_fee)
+{
+  const int n = paid_path_table_n_within(table, max_fee);
+  uint64_t total, r;
+  int lo = 0, hi;
+
+  if (n == 0)
+    return -1;
+  total = table->entries[n - 1].cum_weight;
+  if (total == 0)
+    return crypto_rand_int(n);
+
+  /* Find the first entry whose running sum is above r. */
+  r = crypto_rand_uint64(total);
+  hi = n - 1;
+  while (lo < hi) {
+    const int mid = lo + (hi - lo) / 2;
+    if (table->entries[mid].cum_weight > r)
+      hi = mid;
+    else
+      lo = mid + 1;
+  }
+  return lo;
+}
+
+/** Return the table for position <b>pos</b>, rebuilding every table first
+ * if the directory information changed. */
+STATIC const paid_path_table_t *
+paid_path_get_table(paid_path_position_t pos)
+{
+  if (tables_dirty) {
+    static int warned_no_descriptors = 0;
+    const smartlist_t *nodes = nodelist_get_list();
+    if (!we_fetch_router_descriptors(get_options()) &&
+        !warned_no_descriptors) {
+      log_warn(LD_CONFIG, "Paid paths need relays' payment terms, which are "
+               "only in router descriptors, but UseMicrodescriptors is 1. "
+               "Set it to auto or 0 to choose paid paths.");
+      warned_no_descriptors = 1;
+    }
+    for (int i = 0; i < PAID_PATH_N_POSITIONS; ++i) {
+      paid_path_table_free(tables[i]);
+      tables[i] = paid_path_table_new(nodes, i);
+    }
+    log_info(LD_CIRC, "Rebuilt paid path tables: %d guards, %d middles, "
+             "%d exits.", tables[PAID_PATH_GUARD]->n_entries,
+             tables[PAID_PATH_MIDDLE]->n_entries,
+             tables[PAID_PATH_EXIT]->n_entries);
+    tables_dirty = 0;
+  }
+  return tables[pos];
+}
+
+/** Return the position of hop <b>hop</b> in a path of <b>n_hops</b>. */
+static paid_path_position_t
+paid_path_hop_position(int hop, int n_hops)
+{
+  if (hop == 0)
+    return PAID_PATH_GUARD;
+  if (hop == n_hops - 1)
+    return PAID_PATH_EXIT;
+  return PAID_PATH_MIDDLE;
+}
+
+/** Return true iff <b>node</b> is, shares a /16 (IPv4) or /32 (IPv6) with,
+ * or is in the family of, any node in the first <b>n</b> entries of
+ * <b>hops</b>. As in normal path selection, the network check only applies
+ * with EnforceDistinctSubnets. NULL entries are skipped. */
+static int
+paid_path_clashes(const node_t *node, const node_t **hops, int n)
+{
+  const int distinct_subnets = get_options()->EnforceDistinctSubnets;
+  for (int i = 0; i < n; ++i) {
+    if (!hops[i])
+      continue;
+    if (hops[i] == node)
+      return 1;
+    if (distinct_subnets && nodes_in_same_network(hops[i], node))
+      return 1;
+    if (nodes_in_same_family(hops[i], node))
+      return 1;
+  }
+  return 0;
+}
+
+/** Return the node of entry <b>idx</b> of <b>table</b> if it can join the
+ * <b>n_hops</b> relays in <b>hops</b>, or NULL if it is down or clashes
+ * with one of them. */
+static const node_t *
+paid_path_entry_node(const paid_path_table_t *table, int idx,
+                     const node_t **hops, int n_hops)
+{
+  const node_t *node = node_get_by_id(table->entries[idx].identity);
+  if (!node || !node->is_running || paid_path_clashes(node, hops, n_hops))
+    return NULL;
+  return node;
+}
+
+/** Choose a path of <b>n_hops</b> relays for a paid circuit, weighted by
+ * bandwidth, whose total fee is at most <b>max_fee</b> msats (0 means no
+ * limit). On success, append the nodes to <b>path_out</b> in order, set
+ * *<b>fee_out</b> to the total fee, and return 0. Return -1 if no such path
+ * could be found. */
+int
+paid_path_choose(int n_hops, uint64_t max_fee, smartlist_t *path_out,
+                 uint64_t *fee_out)
+{
+  const node_t *hops[RELAY_PAYMENTS_MAX_HOPS] = { NULL };
+  uint64_t min_fee[RELAY_PAYMENTS_MAX_HOPS];
+  uint64_t reserved = 0, spent = 0;
+
+  if (n_hops < 2 || n_hops > RELAY_PAYMENTS_MAX_HOPS)
+    return -1;
+  if (max_fee == 0)
+    max_fee = UINT64_MAX;
+
+  for (int i = 0; i < n_hops; ++i) {
+    const paid_path_table_t *table =
+      paid_path_get_table(paid_path_hop_position(i, n_hops));
+    if (table->n_entries == 0)
+      return -1;
+    min_fee[i] = table->entries[0].fee;
+    if (min_fee[i] > max_fee - reserved)
+      return -1;
+    reserved += min_fee[i];
+  }
+
+  for (int k = 0; k < n_hops; ++k) {
+    /* Exit first, then guard, then the middles in order. */
+    const int i = k == 0 ? n_hops - 1 : k - 1;
+    const paid_path_table_t *table =
+      paid_path_get_table(paid_path_hop_position(i, n_hops));
+    uint64_t cap;
+    int idx = -1;
+
+    reserved -= min_fee[i];
+    cap = max_fee - spent - reserved;
+    for (int tries = 0; !hops[i] && tries < PAID_PATH_MAX_TRIES; ++tries) {
+      idx = paid_path_table_pick(table, cap);
+      if (idx < 0)
+        break;
+      hops[i] = paid_path_entry_node(table, idx, hops, n_hops);
+    }
+    if (!hops[i] && idx >= 0) {
+      /* The weighted draws kept landing on relays we can't use, which
+       * happens when the heaviest ones are already in the path. Scan the
+       * affordable relays cheapest first, with the same relay, family and
+       * subnet checks; if every one of them clashes, we fail. */
+      const int n = paid_path_table_n_within(table, cap);
+      for (int j = 0; !hops[i] && j < n; ++j) {
+        idx = j;
+        hops[i] = paid_path_entry_node(table, idx, hops, n_hops);
+      }
+    }
+    if (!hops[i])
+      return -1;
+    spent += table->entries[idx].fee;
+  }
+
+  for (int i = 0; i < n_hops; ++i)
+    smartlist_add(path_out, (void *) hops[i]);
+  *fee_out = spent;
+  return 0;
+}
+
+/** Called when the directory information changes: rebuild the tables
+ * before the next pick. */
+void
+paid_path_tables_mark_dirty(void)
+{
+  tables_dirty = 1;
+}
+
+/** Release every table. */
+void
+paid_path_free_all(void)
+{
+  for (int i = 0; i < PAID_PATH_N_POSITIONS; ++i)
+    paid_path_table_free(tables[i]);
+  tables_dirty = 1;
+}
@@ -0,0 +1,65 @@
+/**
+ * @file paid_path.h
+ * @brief Header for fee-aware paid path selection
+ **/
+
+#ifndef PAID_PATH_H
+#define PAID_PATH_H
+
+#include "core/or/or.h"
+
+/** Most paths one "payment/paths/" query may ask for. */
+#define PAID_PATH_MAX_PATHS 64
+/** How many times we redraw a hop that clashes with the rest of the path
+ * before giving up on it. */
+#define PAID_PATH_MAX_TRIES 16
+
+/** The positions a hop can take in a paid path. Each has its own table. */
+typedef enum paid_path_position_t {
+  PAID_PATH_GUARD = 0,
+  PAID_PATH_MIDDLE = 1,
+  PAID_PATH_EXIT = 2,
+} paid_path_position_t;
+#define PAID_PATH_N_POSITIONS 3
+
+uint64_t paid_path_node_fee(const node_t *node);
+int paid_path_choose(int n_hops, uint64_t max_fee, smartlist_t *path_out,
+                     uint64_t *fee_out);
+void paid_path_tables_mark_dirty(void);
+void paid_path_free_all(void);
+
+#ifdef PAID_PATH_PRIVATE
+
+/** One candidate relay in a paid path table. */
+typedef struct paid_path_entry_t {
+  /** Fee for using the relay as one hop, in msats. */
+  uint64_t fee;
+  /** Sum of the bandwidth weights of this entry and every entry before it
+   * in the table. */
+  uint64_t cum_weight;
+  /** Identity of the relay. We look the node up again when we pick it, so
+   * a stale table can never hand out a freed node. */
+  char identity[DIGEST_LEN];
+} paid_path_entry_t;
+
+/** The relays that may take one position, sorted by fee, with a prefix
+ * sum of their bandwidth weights. */
+typedef struct paid_path_table_t {
+  int n_entries;
+  paid_path_entry_t *entries;
+} paid_path_table_t;
+
+STATIC paid_path_table_t *paid_path_table_new(const smartlist_t *nodes,
+                                              paid_path_position_t pos);
+STATIC void paid_path_table_free_(paid_path_table_t *table);
+#define paid_path_table_free(t) \
+  FREE_AND_NULL(paid_path_table_t, paid_path_table_free_, (t))
+STATIC int paid_path_table_n_within(const paid_path_table_t *table,
+                                    uint64_t max_fee);
+STATIC int paid_path_table_pick(const paid_path_table_t *table,
+                                uint64_t max_fee);
+STATIC const paid_path_table_t *paid_path_get_table(paid_path_position_t pos);
+
+#endif /* defined(PAID_PATH_PRIVATE) */
+
+#endif /* !defined(PAID_PATH_H) */
@@ -0,0 +1,93 @@
+/**
+ * @file payment_index.c
+ * @brief Relay-side index from handshake payment hash to OR circuit
+ *
+ * When a client builds a paid circuit through us, the ntor_v3 handshake
+ * carries the hop's handshake payment hash. We remember which or_circuit_t
+ * that hash belongs to so that the payment daemon (via TEARDOWNCIRCUIT
+ * PaymentHash=...) can find the circuit without walking the global circuit
+ * list, and so that a second circuit presenting a hash that is still bound
+ * to a live circuit can be refused.
+ *
+ * Entries are removed from circuit_about_to_free(); a hash becomes
+ * available again as soon as the circuit that held it is gone.
+ **/
+
+#include "core/or/or.h"
+#include "core/or/circuit_st.h"
+#include "core/or/or_circuit_st.h"
+#include "feature/payment/payment_index.h"
+#include "lib/container/map.h"
+
+/** Map from 32-byte handshake payment hash to the or_circuit_t bound to
+ * it. */
+static digest256map_t *payment_circuit_map = NULL;
+
+/** Bind <b>payhash</b> (32 bytes) to <b>circ</b>. Return 0 on success, or
+ * -1 if the hash is already bound to another circuit that is not marked for
+ * close, or if <b>circ</b> is already bound to a hash. */
+int
+payment_index_bind(const uint8_t *payhash, or_circuit_t *circ)
+{
+  tor_assert(payhash);
+  tor_assert(circ);
+
+  if (circ->has_payment_hash)
+    return -1;
+
+  if (!payment_circuit_map)
+    payment_circuit_map = digest256map_new();
+
+  or_circuit_t *old = digest256map_get(payment_circuit_map, payhash);
+  if (old && !TO_CIRCUIT(old)->marked_for_close)
+    return -1;
+  if (old) {
+    /* The previous holder is on its way out; let the new circuit take the
+     * hash and make sure the old one won't remove our entry later. */
+    old->has_payment_hash = 0;
+  }
+
+  digest256map_set(payment_circuit_map, payhash, circ);
+  memcpy(circ->payment_hash, payhash, DIGEST256_LEN);
+  circ->has_payment_hash = 1;
+  return 0;
+}
+
+/** Return the circuit bound to <b>payhash</b>, or NULL if there is none.
+ * The returned circuit may be marked for close. */
+or_circuit_t *
+payment_index_get_circuit(const uint8_t *payhash)
+{
+  if (!payment_circuit_map)
+    return NULL;
+  return digest256map_get(payment_circuit_map, payhash);
+}
+
+/** Remove the binding for <b>circ</b>, if it has one. */
+void
+payment_index_unbind(or_circuit_t *circ)
+{
+  if (!circ || !circ->has_payment_hash)
+    return;
+
+  if (payment_circuit_map &&
+      digest256map_get(payment_circuit_map, circ->payment_hash) == circ) {
+    digest256map_remove(payment_circuit_map, circ->payment_hash);
+  }
+  circ->has_payment_hash = 0;
+}
+
+/** Return the number of payment hashes currently bound. */
+int
+payment_index_size(void)
+{
+  return payment_circuit_map ? digest256map_size(payment_circuit_map) : 0;
+}
+
+/** Release all storage held by the payment index. Circuits themselves are
+ * not touched. */
+void
+payment_index_free_all(void)
+{
+  digest256map_free(payment_circuit_map, NULL);
+}
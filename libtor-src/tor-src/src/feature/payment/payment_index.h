@@ -0,0 +1,17 @@
+/**
+ * @file payment_index.h
+ * @brief Header for the relay-side payment hash to circuit index
+ **/
+
+#ifndef PAYMENT_INDEX_H
+#define PAYMENT_INDEX_H
+
+#include "core/or/or.h"
+
+int payment_index_bind(const uint8_t *payhash, or_circuit_t *circ);
+or_circuit_t *payment_index_get_circuit(const uint8_t *payhash);
+void payment_index_unbind(or_circuit_t *circ);
+int payment_index_size(void);
+void payment_index_free_all(void);
+
+#endif /* !defined(PAYMENT_INDEX_H) */
@@ -0,0 +1,125 @@
+/**
+ * @file payment_intern.c
+ * @brief Shared, reference-counted store of descriptor payment strings
+ *
+ * Relays publish their payment details (a BOLT12 offer, a BIP353 name, an
+ * LNURL, a lightning address) in their descriptors. A client caches
+ * thousands of descriptors, and a relay's details rarely change from one
+ * descriptor to the next, so we keep a single copy of each distinct string
+ * here, keyed by its SHA-256 digest, as addr_policy_get_canonical_entry()
+ * does for address policies. Two routerinfos then hold the same details iff
+ * they hold the same pointers.
+ *
+ * Each routerinfo field owns one reference, taken with
+ * payment_intern_string() and dropped with payment_intern_release(); a
+ * string is freed with its last reference.
+ **/
+
+#include "core/or/or.h"
+#include "feature/payment/payment_intern.h"
+#include "ht.h"
+#include "lib/crypt_ops/crypto_digest.h"
+
+/** Node in the hashtable of interned strings. */
+typedef struct payment_intern_ent_t {
+  HT_ENTRY(payment_intern_ent_t) node;
+  /** SHA-256 digest of <b>str</b>. */
+  uint8_t digest[DIGEST256_LEN];
+  /** Number of references handed out for <b>str</b>. */
+  unsigned int refcnt;
+  /** The string itself, NUL-terminated. */
+  char str[FLEXIBLE_ARRAY_MEMBER];
+} payment_intern_ent_t;
+
+/** Every interned string, by digest. */
+static HT_HEAD(payment_intern_map, payment_intern_ent_t) intern_root =
+  HT_INITIALIZER();
+
+/** Return true iff a and b hold the same string. */
+static inline int
+payment_intern_eq(const payment_intern_ent_t *a,
+                  const payment_intern_ent_t *b)
+{
+  return tor_memeq(a->digest, b->digest, DIGEST256_LEN);
+}
+
+/** Return a hashcode for <b>ent</b>. */
+static inline unsigned int
+payment_intern_hash(const payment_intern_ent_t *ent)
+{
+  return (unsigned) siphash24g(ent->digest, sizeof(ent->digest));
+}
+
+HT_PROTOTYPE(payment_intern_map, payment_intern_ent_t, node,
+             payment_intern_hash, payment_intern_eq);
+HT_GENERATE2(payment_intern_map, payment_intern_ent_t, node,
+             payment_intern_hash, payment_intern_eq, 0.6,
+             tor_reallocarray_, tor_free_);
+
+/** Return the shared copy of <b>s</b>, making it if needed, and take a
+ * reference to it. The caller must release the reference with
+ * payment_intern_release(), and must not modify the string. */
+const char *
+payment_intern_string(const char *s)
+{
+  payment_intern_ent_t search, *found;
+  size_t len;
+
+  tor_assert(s);
+  len = strlen(s);
+  crypto_digest256((char *) search.digest, s, len, DIGEST_SHA256);
+  found = HT_FIND(payment_intern_map, &intern_root, &search);
+  if (!found) {
+    found = tor_malloc_zero(offsetof(payment_intern_ent_t, str) + len + 1);
+    memcpy(found->digest, search.digest, DIGEST256_LEN);
+    memcpy(found->str, s, len);
+    HT_INSERT(payment_intern_map, &intern_root, found);
+  }
+  ++found->refcnt;
+  return found->str;
+}
+
+/** Drop a reference to <b>s</b>, which must have come from
+ * payment_intern_string(), and free it if that was the last one. Does
+ * nothing if <b>s</b> is NULL. */
+void
+payment_intern_release(const char *s)
+{
+  payment_intern_ent_t *ent, *found;
+
+  if (!s)
+    return;
+  ent = SUBTYPE_P(s, payment_intern_ent_t, str);
+  tor_assert(ent->refcnt > 0);
+  if (--ent->refcnt > 0)
+    return;
+  found = HT_REMOVE(payment_intern_map, &intern_root, ent);
+  tor_assert(found == ent);
+  tor_free(ent);
+}
+
+/** Return the number of distinct strings currently interned. */
+int
+payment_intern_size(void)
+{
+  return (int) HT_SIZE(&intern_root);
+}
+
+/** Release all storage held by the intern table. Every routerinfo should
+ * already be gone. */
+void
+payment_intern_free_all(void)
+{
+  if (!HT_EMPTY(&intern_root)) {
+    payment_intern_ent_t **ent, **next, *victim;
+
+    log_warn(LD_MM, "Still had %d payment strings interned at shutdown.",
+             payment_intern_size());
+    for (ent = HT_START(payment_intern_map, &intern_root); ent; ent = next) {
+      victim = *ent;
+      next = HT_NEXT_RMV(payment_intern_map, &intern_root, ent);
+      tor_free(victim);
+    }
+  }
+  HT_CLEAR(payment_intern_map, &intern_root);
+}
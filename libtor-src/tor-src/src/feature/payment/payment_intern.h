@@ -0,0 +1,16 @@
+/**
+ * @file payment_intern.h
+ * @brief Header for the shared store of descriptor payment strings
+ **/
+
+#ifndef PAYMENT_INTERN_H
+#define PAYMENT_INTERN_H
+
+#include "core/or/or.h"
+
+const char *payment_intern_string(const char *s);
+void payment_intern_release(const char *s);
+int payment_intern_size(void);
+void payment_intern_free_all(void);
+
+#endif /* !defined(PAYMENT_INTERN_H) */
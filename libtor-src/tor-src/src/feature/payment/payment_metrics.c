@@ -0,0 +1,218 @@
+/**
+ * @file payment_metrics.c
+ * @brief El Tor payment metrics exposed through the MetricsPort
+ *
+ * Unlike the relay metrics, which are read from counters kept elsewhere
+ * when the MetricsPort is scraped, these are updated in place: a latency
+ * histogram can't be rebuilt from a counter. The store and every entry
+ * are made on first use, and each entry is remembered by key, so recording
+ * an event on the fast path is an array lookup and an add.
+ **/
+
+#define PAYMENT_METRICS_PRIVATE
+
+#include "orconfig.h"
+
+#include "core/or/or.h"
+#include "feature/payment/payment_metrics.h"
+#include "lib/cc/ctassert.h"
+#include "lib/metrics/metrics_store.h"
+
+/** Histogram buckets for payment round verification latency, in
+ * milliseconds. A Lightning payment usually settles in a few seconds. */
+static const int64_t verify_latency_buckets[] =
+{
+  100,    /* 0.1s */
+  500,    /* 0.5s */
+  1000,   /* 1s */
+  5000,   /* 5s */
+  10000,  /* 10s */
+  30000,  /* 30s */
+  60000   /* 60s */
+};
+
+/** Histogram buckets for paid circuit build time, in milliseconds. */
+static const int64_t circ_build_time_buckets[] =
+{
+  500,    /* 0.5s */
+  1000,   /* 1s */
+  2000,   /* 2s */
+  5000,   /* 5s */
+  10000,  /* 10s */
+  30000,  /* 30s */
+  60000   /* 60s */
+};
+
+/** The metadata of a payment metric. */
+typedef struct payment_metrics_entry_t {
+  /* Metric key used as a static array index. */
+  payment_metrics_key_t key;
+  /* Metric type. */
+  metrics_type_t type;
+  /* Metrics output name. */
+  const char *name;
+  /* Metrics output help comment. */
+  const char *help;
+  /* Label key and value, or NULL if the metric has no label. */
+  const char *label_key;
+  const char *label_value;
+  /* Histogram buckets, if any. */
+  const int64_t *buckets;
+  size_t bucket_count;
+} payment_metrics_entry_t;
+
+/** The base metrics, indexed by key. */
+static const payment_metrics_entry_t base_metrics[] =
+{
+  {
+    .key = PAYMENT_METRICS_CREATE_PAID,
+    .type = METRICS_TYPE_COUNTER,
+    .name = METRICS_NAME(payment_create_cells_total),
+    .help = "Total number of CREATE cells we handled, by whether they "
+            "carried payment hashes",
+    .label_key = "payment",
+    .label_value = "yes",
+  },
+  {
+    .key = PAYMENT_METRICS_CREATE_FREE,
+    .type = METRICS_TYPE_COUNTER,
+    .name = METRICS_NAME(payment_create_cells_total),
+    .help = "Total number of CREATE cells we handled, by whether they "
+            "carried payment hashes",
+    .label_key = "payment",
+    .label_value = "no",
+  },
+  {
+    .key = PAYMENT_METRICS_VERIFY_200,
+    .type = METRICS_TYPE_COUNTER,
+    .name = METRICS_NAME(payment_verifications_total),
+    .help = "Total number of round payment confirmations: 200 accepted, "
+            "402 refused",
+    .label_key = "status",
+    .label_value = "200",
+  },
+  {
+    .key = PAYMENT_METRICS_VERIFY_402,
+    .type = METRICS_TYPE_COUNTER,
+    .name = METRICS_NAME(payment_verifications_total),
+    .help = "Total number of round payment confirmations: 200 accepted, "
+            "402 refused",
+    .label_key = "status",
+    .label_value = "402",
+  },
+  {
+    .key = PAYMENT_METRICS_VERIFY_LATENCY,
+    .type = METRICS_TYPE_HISTOGRAM,
+    .name = METRICS_NAME(payment_verify_latency),
+    .help = "Time from the end of a payment round to the confirmation of "
+            "its payment, in milliseconds",
+    .buckets = verify_latency_buckets,
+    .bucket_count = ARRAY_LENGTH(verify_latency_buckets),
+  },
+  {
+    .key = PAYMENT_METRICS_UNPAID_CLOSED,
+    .type = METRICS_TYPE_COUNTER,
+    .name = METRICS_NAME(payment_unpaid_circuits_closed_total),
+    .help = "Total number of circuits closed for non-payment",
+  },
+  {
+    .key = PAYMENT_METRICS_QUOTA_REACHED,
+    .type = METRICS_TYPE_COUNTER,
+    .name = METRICS_NAME(payment_quota_reached_total),
+    .help = "Total number of payment rounds ended by the bandwidth quota",
+  },
+  {
+    .key = PAYMENT_METRICS_CIRC_BUILD_TIME,
+    .type = METRICS_TYPE_HISTOGRAM,
+    .name = METRICS_NAME(payment_circ_build_time),
+    .help = "Build time of our paid circuits, in milliseconds",
+    .buckets = circ_build_time_buckets,
+    .bucket_count = ARRAY_LENGTH(circ_build_time_buckets),
+  },
+};
+CTASSERT(ARRAY_LENGTH(base_metrics) == PAYMENT_METRICS_N_KEYS);
+
+/** The only and single store of all the payment metrics. */
+static metrics_store_t *the_store;
+/** The entry of each metric in the_store, by key. */
+static metrics_store_entry_t *entries[PAYMENT_METRICS_N_KEYS];
+/** The list that payment_metrics_get_stores() returns. */
+static smartlist_t *stores_list = NULL;
+
+/** Make the_store and all of its entries. */
+static void
+payment_metrics_init(void)
+{
+  the_store = metrics_store_new();
+  for (size_t i = 0; i < ARRAY_LENGTH(base_metrics); ++i) {
+    const payment_metrics_entry_t *bentry = &base_metrics[i];
+    tor_assert(bentry->key == i);
+    entries[i] = metrics_store_add(the_store, bentry->type, bentry->name,
+                                   bentry->help, bentry->bucket_count,
+                                   bentry->buckets);
+    if (bentry->label_key) {
+      metrics_store_entry_add_label(entries[i],
+                    metrics_format_label(bentry->label_key,
+                                         bentry->label_value));
+    }
+  }
+}
+
+/** Return the store entry for <b>key</b>. */
+static inline metrics_store_entry_t *
+payment_metrics_entry(payment_metrics_key_t key)
+{
+  if (PREDICT_UNLIKELY(!the_store))
+    payment_metrics_init();
+  return entries[key];
+}
+
+/** Add one to the counter <b>key</b>. */
+void
+payment_metrics_count(payment_metrics_key_t key)
+{
+  metrics_store_entry_update(payment_metrics_entry(key), 1);
+}
+
+/** Record the observation <b>obs</b> in the histogram <b>key</b>. */
+void
+payment_metrics_observe(payment_metrics_key_t key, int64_t obs)
+{
+  metrics_store_hist_entry_update(payment_metrics_entry(key), 1, obs);
+}
+
+#ifdef TOR_UNIT_TESTS
+/** Return the value of the counter <b>key</b>, or the number of
+ * observations in the histogram <b>key</b>. */
+STATIC int64_t
+payment_metrics_get_value(payment_metrics_key_t key)
+{
+  const metrics_store_entry_t *entry = payment_metrics_entry(key);
+  if (metrics_store_entry_is_histogram(entry))
+    return (int64_t) metrics_store_hist_entry_get_count(entry);
+  return metrics_store_entry_get_value(entry);
+}
+#endif /* defined(TOR_UNIT_TESTS) */
+
+/** Return a list of all the payment metrics stores. This is the
+ * get_metrics function of the payment subsystem. */
+const smartlist_t *
+payment_metrics_get_stores(void)
+{
+  if (!the_store)
+    payment_metrics_init();
+  if (!stores_list) {
+    stores_list = smartlist_new();
+    smartlist_add(stores_list, the_store);
+  }
+  return stores_list;
+}
+
+/** Release the store and forget every entry. */
+void
+payment_metrics_free_all(void)
+{
+  smartlist_free(stores_list);
+  metrics_store_free(the_store);
+  memset(entries, 0, sizeof(entries));
+}
@@ -0,0 +1,67 @@
+/**
+ * @file payment_metrics.h
+ * @brief Header for feature/payment/payment_metrics.c
+ **/
+
+#ifndef TOR_FEATURE_PAYMENT_PAYMENT_METRICS_H
+#define TOR_FEATURE_PAYMENT_PAYMENT_METRICS_H
+
+#include "lib/container/smartlist.h"
+#include "lib/metrics/metrics_common.h"
+
+/** Metrics key for each reported metric, and index in the base_metrics
+ * array. A metric with a label has one key per label value. */
+typedef enum {
+  /** CREATE cells that carried payment hashes. */
+  PAYMENT_METRICS_CREATE_PAID,
+  /** CREATE cells that carried none. */
+  PAYMENT_METRICS_CREATE_FREE,
+  /** Round payments the controller confirmed. */
+  PAYMENT_METRICS_VERIFY_200,
+  /** Round payment confirmations we refused. */
+  PAYMENT_METRICS_VERIFY_402,
+  /** Time from the end of a round to the confirmation of its payment. */
+  PAYMENT_METRICS_VERIFY_LATENCY,
+  /** Circuits closed because a round was not paid for. */
+  PAYMENT_METRICS_UNPAID_CLOSED,
+  /** Rounds ended early by PaymentBandwidthQuota. */
+  PAYMENT_METRICS_QUOTA_REACHED,
+  /** Build time of our own paid circuits. */
+  PAYMENT_METRICS_CIRC_BUILD_TIME,
+
+  PAYMENT_METRICS_N_KEYS
+} payment_metrics_key_t;
+
+void payment_metrics_count(payment_metrics_key_t key);
+void payment_metrics_observe(payment_metrics_key_t key, int64_t obs);
+const smartlist_t *payment_metrics_get_stores(void);
+void payment_metrics_free_all(void);
+
+/** Count a CREATE cell that was, or wasn't, <b>paid</b>. */
+#define payment_metrics_create_cell(paid)                               \
+  payment_metrics_count((paid) ? PAYMENT_METRICS_CREATE_PAID :          \
+                                 PAYMENT_METRICS_CREATE_FREE)
+/** Count a round payment confirmation that we accepted if <b>ok</b>, or
+ * refused otherwise. */
+#define payment_metrics_verification(ok)                                \
+  payment_metrics_count((ok) ? PAYMENT_METRICS_VERIFY_200 :             \
+                               PAYMENT_METRICS_VERIFY_402)
+/** Record that a round payment was confirmed <b>msec</b> after the round
+ * ended. */
+#define payment_metrics_verify_latency(msec)                            \
+  payment_metrics_observe(PAYMENT_METRICS_VERIFY_LATENCY, (msec))
+/** Count a circuit closed for non-payment. */
+#define payment_metrics_unpaid_closed()                                 \
+  payment_metrics_count(PAYMENT_METRICS_UNPAID_CLOSED)
+/** Count a round ended by the bandwidth quota. */
+#define payment_metrics_quota_reached()                                 \
+  payment_metrics_count(PAYMENT_METRICS_QUOTA_REACHED)
+/** Record that one of our paid circuits took <b>msec</b> to build. */
+#define payment_metrics_circ_build_time(msec)                           \
+  payment_metrics_observe(PAYMENT_METRICS_CIRC_BUILD_TIME, (msec))
+
+#if defined(PAYMENT_METRICS_PRIVATE) && defined(TOR_UNIT_TESTS)
+STATIC int64_t payment_metrics_get_value(payment_metrics_key_t key);
+#endif
+
+#endif /* !defined(TOR_FEATURE_PAYMENT_PAYMENT_METRICS_H) */
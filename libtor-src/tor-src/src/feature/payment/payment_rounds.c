@@ -0,0 +1,390 @@
+/**
+ * @file payment_rounds.c
+ * @brief Relay-side payment round scheduler
+ *
+ * A paid circuit runs for up to PaymentInvervalRounds rounds of
+ * PaymentInterval seconds each. The first round is free. The payment for
+ * round k (the k-th payment id hash the client sent) is requested when
+ * round k ends and must be confirmed by the controller, with
+ * PAYMENTRECEIVED, before round k+1 ends; otherwise the circuit is closed.
+ * The last round's payment is collected in one more, unpaid grace round;
+ * when that ends the circuit has used everything it paid for and is
+ * closed too.
+ *
+ * Every round has the same length, so a circuit whose round just started
+ * always ends after every circuit already waiting. (PaymentInterval can't
+ * be changed while tor runs, so this holds.) The circuits therefore
+ * sit in one FIFO queue ordered by deadline: starting a round is a tail
+ * insert, and only the head of the queue ever needs a timer. When that
+ * timer fires we walk the expired prefix of the queue, closing at most
+ * PAYMENT_ROUNDS_BATCH unpaid circuits before yielding to the main loop.
+ *
+ * If the relay sets PaymentBandwidthQuota, a round also ends early once the
+ * circuit has carried that many bytes of cells in it. relay.c counts cells
+ * against or_circuit_t.payment_cell_quota and calls
+ * payment_rounds_quota_reached() when the count runs out. The circuit's
+ * next round then starts at once, so it moves to the tail of the queue and
+ * the queue stays ordered.
+ *
+ * If the relay sets PaymentLightningNodeConfig, a circuit whose due payment
+ * the controller has not confirmed is not closed at once. We ask our
+ * Lightning node whether the round's payment id hash was paid (see
+ * ln_rpc.c), let the circuit run meanwhile, and close it only if the node
+ * says it wasn't or can't tell us.
+ **/
+
+#define PAYMENT_ROUNDS_PRIVATE
+
+#include "core/or/or.h"
+#include "app/config/config.h"
+#include "core/or/circuitlist.h"
+#include "core/or/circuit_st.h"
+#include "core/or/or_circuit_st.h"
+#include "feature/payment/ln_rpc.h"
+#include "feature/payment/payment_index.h"
+#include "feature/payment/payment_metrics.h"
+#include "feature/payment/payment_rounds.h"
+#include "lib/evloop/timers.h"
+#include "lib/time/compat_time.h"
+
+#include "app/config/or_options_st.h"
+
+/** Circuits with a payment round running, ordered by round deadline. */
+static TOR_TAILQ_HEAD(payment_round_queue_t, or_circuit_t) round_queue =
+  TOR_TAILQ_HEAD_INITIALIZER(round_queue);
+/** Number of circuits in round_queue. */
+static int n_round_circuits = 0;
+/** Timer that fires when the round at the head of round_queue ends. */
+static tor_timer_t *round_timer = NULL;
+
+/** Return the length of a payment round in msec, or 0 if this relay does
+ * not enforce payment rounds. */
+static uint64_t
+payment_round_interval_msec(void)
+{
+  return (uint64_t) get_options()->PaymentInterval * 1000;
+}
+
+/** Return the number of cells a paid circuit may carry per payment round,
+ * or 0 if this relay sets no bandwidth quota. */
+static uint32_t
+payment_round_cell_quota(void)
+{
+  const int quota = get_options()->PaymentBandwidthQuota;
+  if (quota <= 0)
+    return 0;
+  return CEIL_DIV((uint32_t) quota, CELL_PAYLOAD_SIZE);
+}
+
+/** Return the number of payment rounds a paid circuit runs for. */
+static int
+payment_rounds_per_circuit(void)
+{
+  int n = get_options()->PaymentInvervalRounds;
+  if (n <= 0 || n > PAYMENT_ROUNDS_MAX)
+    n = PAYMENT_ROUNDS_MAX;
+  return n;
+}
+
+static void payment_round_timer_cb(tor_timer_t *timer, void *arg,
+                                   const struct monotime_t *now);
+
+/** A payment round we asked our Lightning node about. The circuit may be
+ * gone by the time the node answers, so we find it again by its handshake
+ * payment hash. */
+typedef struct payment_round_check_t {
+  uint8_t handshake_hash[DIGEST256_LEN];
+  int round;
+} payment_round_check_t;
+
+/** Called with our Lightning node's answer about the payment for a
+ * round. */
+static void
+payment_round_check_done(const uint8_t *payment_hash, ln_rpc_status_t status,
+                         void *arg)
+{
+  payment_round_check_t *check = arg;
+  or_circuit_t *circ;
+  (void) payment_hash;
+
+  if (status == LN_RPC_CANCELLED)
+    goto done;
+  circ = payment_index_get_circuit(check->handshake_hash);
+  /* The controller may have confirmed the payment in the meantime. */
+  if (!circ || TO_CIRCUIT(circ)->marked_for_close ||
+      (circ->payment_rounds_paid & (1u << check->round)))
+    goto done;
+
+  if (status == LN_RPC_PAID) {
+    payment_metrics_verification(1);
+    payment_rounds_mark_paid(circ, check->round);
+  } else {
+    payment_metrics_verification(0);
+    log_info(LD_CIRC, "Lightning node %s the payment for round %d of "
+             "circuit %u. Closing.",
+             status == LN_RPC_UNPAID ? "has not seen" : "could not confirm",
+             check->round, (unsigned) circ->p_circ_id);
+    payment_metrics_unpaid_closed();
+    circuit_mark_for_close(TO_CIRCUIT(circ), END_CIRC_REASON_REQUESTED);
+  }
+
+ done:
+  tor_free(check);
+}
+
+/** Ask our Lightning node whether round <b>round</b> of <b>circ</b> was
+ * paid. Return 0 if we asked, or -1 if we can't. */
+static int
+payment_round_check(or_circuit_t *circ, int round)
+{
+  payment_round_check_t *check;
+
+  if (!ln_rpc_is_configured() || !circ->has_payment_hash ||
+      round < 2 || round - 1 > circ->n_payment_id_hashes)
+    return -1;
+
+  check = tor_malloc_zero(sizeof(*check));
+  memcpy(check->handshake_hash, circ->payment_hash, DIGEST256_LEN);
+  check->round = round;
+  ln_rpc_lookup_payment(circ->payment_id_hashes +
+                        (round - 2) * PAYMENT_HASH_LEN,
+                        payment_round_check_done, check);
+  return 0;
+}
+
+/** Arm the round timer for the head of the queue, or disarm it if the
+ * queue is empty. */
+static void
+payment_round_timer_reschedule(uint64_t now_msec)
+{
+  const or_circuit_t *head = TOR_TAILQ_FIRST(&round_queue);
+  struct timeval tv;
+  uint64_t delay;
+
+  if (!head) {
+    if (round_timer)
+      timer_disable(round_timer);
+    return;
+  }
+  if (!round_timer)
+    round_timer = timer_new(payment_round_timer_cb, NULL);
+
+  delay = head->payment_round_deadline_msec > now_msec ?
+    head->payment_round_deadline_msec - now_msec : 0;
+  tv.tv_sec = (time_t) (delay / 1000);
+  tv.tv_usec = (int) (delay % 1000) * 1000;
+  timer_schedule(round_timer, &tv);
+}
+
+/** Timer callback: run the rounds that have ended. */
+static void
+payment_round_timer_cb(tor_timer_t *timer, void *arg,
+                       const struct monotime_t *now)
+{
+  uint64_t now_msec = monotime_coarse_absolute_msec();
+  (void) timer;
+  (void) arg;
+  (void) now;
+
+  payment_rounds_run(now_msec, PAYMENT_ROUNDS_BATCH);
+  payment_round_timer_reschedule(now_msec);
+}
+
+/** End the current payment round of <b>circ</b>, which the caller has
+ * already taken off the queue. Close the circuit if its due payment has not
+ * been confirmed or if it has no rounds left; otherwise start its next
+ * round at <b>now_msec</b>. Return 1 if the circuit was closed, 0
+ * otherwise. */
+static int
+payment_round_end(or_circuit_t *circ, uint64_t now_msec)
+{
+  const uint64_t interval = payment_round_interval_msec();
+  const int ended = circ->payment_round;
+  const int due = ended - 1;
+
+  circ->payment_round = 0;
+  /* Out of the queue, nothing meters the circuit any more. */
+  circ->payment_cell_quota = 0;
+
+  if (TO_CIRCUIT(circ)->marked_for_close)
+    return 0;
+
+  /* Round 1 is free; the payment for any later round is due one round
+   * after it ends. Our Lightning node, if we have one, gets the last
+   * word. */
+  if (due >= 2 && !(circ->payment_rounds_paid & (1u << due)) &&
+      payment_round_check(circ, due) < 0) {
+    log_info(LD_CIRC, "Payment for round %d of circuit %u was not "
+             "received. Closing.", due, (unsigned) circ->p_circ_id);
+    payment_metrics_unpaid_closed();
+    circuit_mark_for_close(TO_CIRCUIT(circ), END_CIRC_REASON_REQUESTED);
+    return 1;
+  }
+
+  /* After the last round we wait one more round for its payment; once
+   * that is over, the circuit has nothing left to pay for. */
+  if (ended > payment_rounds_per_circuit()) {
+    log_info(LD_CIRC, "Circuit %u has run all its payment rounds. Closing.",
+             (unsigned) circ->p_circ_id);
+    circuit_mark_for_close(TO_CIRCUIT(circ), END_CIRC_REASON_FINISHED);
+    return 1;
+  }
+  if (interval == 0)
+    return 0;
+
+  circ->payment_round = ended + 1;
+  circ->payment_round_deadline_msec = now_msec + interval;
+  circ->payment_cells = 0;
+  circ->payment_cell_quota = payment_round_cell_quota();
+  TOR_TAILQ_INSERT_TAIL(&round_queue, circ, payment_round_entry);
+  ++n_round_circuits;
+  return 0;
+}
+
+/** End every payment round whose deadline is at or before
+ * <b>now_msec</b>: close circuits whose due payment has not been confirmed,
+ * and start the next round on the others. Stop after closing
+ * <b>max_closed</b> circuits. Return the number of circuits closed. */
+STATIC int
+payment_rounds_run(uint64_t now_msec, int max_closed)
+{
+  or_circuit_t *circ;
+  int n_closed = 0;
+
+  while (n_closed < max_closed &&
+         (circ = TOR_TAILQ_FIRST(&round_queue)) &&
+         circ->payment_round_deadline_msec <= now_msec) {
+    TOR_TAILQ_REMOVE(&round_queue, circ, payment_round_entry);
+    --n_round_circuits;
+    n_closed += payment_round_end(circ, now_msec);
+  }
+
+  return n_closed;
+}
+
+/** Called from relay.c when <b>circ</b> has used up its bandwidth quota
+ * for the current payment round: end the round now, as if its time had
+ * run out. Return 1 if the circuit was closed, 0 otherwise. */
+int
+payment_rounds_quota_reached(or_circuit_t *circ)
+{
+  if (!circ->payment_round) {
+    circ->payment_cell_quota = 0;
+    return 0;
+  }
+
+  payment_metrics_quota_reached();
+  /* If circ was the head of the queue, the timer fires early, finds
+   * nothing due, and is rearmed for the new head. */
+  TOR_TAILQ_REMOVE(&round_queue, circ, payment_round_entry);
+  --n_round_circuits;
+  return payment_round_end(circ, monotime_coarse_absolute_msec());
+}
+
+/** Start enforcing payment rounds on the paid circuit <b>circ</b>. Do
+ * nothing if this relay has no PaymentInterval or <b>circ</b> is already
+ * scheduled. */
+void
+payment_rounds_circuit_start(or_circuit_t *circ)
+{
+  const uint64_t interval = payment_round_interval_msec();
+  uint64_t now_msec;
+  int was_empty;
+
+  if (interval == 0 || circ->payment_round)
+    return;
+
+  now_msec = monotime_coarse_absolute_msec();
+  was_empty = TOR_TAILQ_EMPTY(&round_queue);
+
+  circ->payment_round = 1;
+  circ->payment_rounds_paid = 0;
+  circ->payment_round_deadline_msec = now_msec + interval;
+  circ->payment_cells = 0;
+  circ->payment_cell_quota = payment_round_cell_quota();
+  TOR_TAILQ_INSERT_TAIL(&round_queue, circ, payment_round_entry);
+  ++n_round_circuits;
+
+  /* Otherwise the timer is already armed for an earlier deadline. */
+  if (was_empty)
+    payment_round_timer_reschedule(now_msec);
+}
+
+/** Remember the <b>n_hashes</b> payment id hashes that the client of
+ * <b>circ</b> sent in <b>hashes</b>, one per round, so that we can look
+ * their payments up with our Lightning node. Round 1 is free, so its hash
+ * is not kept. Do nothing if we don't have a node. */
+void
+payment_rounds_set_id_hashes(or_circuit_t *circ, const uint8_t *hashes,
+                             int n_hashes)
+{
+  if (!ln_rpc_is_configured() || n_hashes <= 1)
+    return;
+
+  tor_free(circ->payment_id_hashes);
+  circ->payment_id_hashes =
+    tor_memdup(hashes + PAYMENT_HASH_LEN,
+               (size_t) (n_hashes - 1) * PAYMENT_HASH_LEN);
+  circ->n_payment_id_hashes = (uint8_t) (n_hashes - 1);
+}
+
+/** Stop enforcing payment rounds on <b>circ</b>. */
+void
+payment_rounds_circuit_stop(or_circuit_t *circ)
+{
+  if (!circ || !circ->payment_round)
+    return;
+
+  TOR_TAILQ_REMOVE(&round_queue, circ, payment_round_entry);
+  --n_round_circuits;
+  circ->payment_round = 0;
+  circ->payment_cell_quota = 0;
+}
+
+/** Record that the controller has confirmed the payment for round
+ * <b>round</b> of <b>circ</b>. Return 0 on success, -1 if <b>round</b> is
+ * not a paid round. */
+int
+payment_rounds_mark_paid(or_circuit_t *circ, int round)
+{
+  if (round < 2 || round > PAYMENT_ROUNDS_MAX)
+    return -1;
+  circ->payment_rounds_paid |= (uint16_t) (1u << round);
+
+  /* Every round has the same length, so the round that is due ended a
+   * whole number of rounds before the current one ends. A payment made
+   * before its round ended took no time. */
+  if (circ->payment_round > round) {
+    const uint64_t now_msec = monotime_coarse_absolute_msec();
+    const uint64_t ended = circ->payment_round_deadline_msec -
+      (uint64_t) (circ->payment_round - round) *
+      payment_round_interval_msec();
+    payment_metrics_verify_latency(now_msec > ended ?
+                                   (int64_t) (now_msec - ended) : 0);
+  } else if (circ->payment_round) {
+    payment_metrics_verify_latency(0);
+  }
+  return 0;
+}
+
+/** Return the number of circuits with a payment round running. */
+int
+payment_rounds_n_tracked(void)
+{
+  return n_round_circuits;
+}
+
+/** Forget every scheduled circuit and release the round timer. */
+void
+payment_rounds_free_all(void)
+{
+  or_circuit_t *circ;
+
+  while ((circ = TOR_TAILQ_FIRST(&round_queue))) {
+    TOR_TAILQ_REMOVE(&round_queue, circ, payment_round_entry);
+    circ->payment_round = 0;
+    circ->payment_cell_quota = 0;
+  }
+  n_round_circuits = 0;
+  timer_free(round_timer);
+}
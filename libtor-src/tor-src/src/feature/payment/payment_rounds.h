@@ -0,0 +1,31 @@
+/**
+ * @file payment_rounds.h
+ * @brief Header for the relay-side payment round scheduler
+ **/
+
+#ifndef PAYMENT_ROUNDS_H
+#define PAYMENT_ROUNDS_H
+
+#include "core/or/or.h"
+#include "feature/payment/payment_util.h"
+
+/** Most payment rounds a circuit can have: one per payment id hash. */
+#define PAYMENT_ROUNDS_MAX (PAYMENT_HASHES_PER_HOP - 2)
+
+/** Most circuits closed for non-payment in one timer callback. */
+#define PAYMENT_ROUNDS_BATCH 256
+
+void payment_rounds_circuit_start(or_circuit_t *circ);
+void payment_rounds_set_id_hashes(or_circuit_t *circ, const uint8_t *hashes,
+                                  int n_hashes);
+void payment_rounds_circuit_stop(or_circuit_t *circ);
+int payment_rounds_mark_paid(or_circuit_t *circ, int round);
+int payment_rounds_quota_reached(or_circuit_t *circ);
+int payment_rounds_n_tracked(void);
+void payment_rounds_free_all(void);
+
+#ifdef PAYMENT_ROUNDS_PRIVATE
+STATIC int payment_rounds_run(uint64_t now_msec, int max_closed);
+#endif
+
+#endif /* !defined(PAYMENT_ROUNDS_H) */
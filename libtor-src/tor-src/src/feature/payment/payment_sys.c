@@ -0,0 +1,67 @@
+/**
+ * @file payment_sys.c
+ * @brief Subsystem definitions for the El Tor payment module.
+ **/
+
+#include "orconfig.h"
+#include "core/or/or.h"
+
+#include "core/or/payhash_event.h"
+#include "feature/control/control_events.h"
+#include "feature/payment/ln_rpc.h"
+#include "feature/payment/paid_circ_pool.h"
+#include "feature/payment/paid_path.h"
+#include "feature/payment/payment_index.h"
+#include "feature/payment/payment_intern.h"
+#include "feature/payment/payment_metrics.h"
+#include "feature/payment/payment_rounds.h"
+#include "feature/payment/payment_sys.h"
+#include "feature/payment/teardown_journal.h"
+
+#include "lib/pubsub/pubsub.h"
+#include "lib/subsys/subsys.h"
+
+DECLARE_SUBSCRIBE(payhash_received, payment_payhash_received_rcvr);
+
+/** Tell the controller about the payment material of a paid circuit that
+ * we just accepted. */
+static void
+payment_payhash_received_rcvr(const msg_t *msg,
+                              const payhash_received_msg_t *arg)
+{
+  (void)msg;
+  control_event_payment_id_hash_received(arg->p_circ_id, arg->n_circ_id,
+                                         &arg->payhashes[0][0],
+                                         arg->n_payhashes);
+}
+
+static int
+subsys_payment_add_pubsub(pubsub_connector_t *connector)
+{
+  if (DISPATCH_ADD_SUB(connector, payhash, payhash_received))
+    return -1;
+  return 0;
+}
+
+static void
+subsys_payment_shutdown(void)
+{
+  ln_rpc_free_all();
+  paid_circ_pool_free_all();
+  paid_path_free_all();
+  payment_rounds_free_all();
+  payment_index_free_all();
+  payment_intern_free_all();
+  payment_metrics_free_all();
+  teardown_journal_free_all();
+}
+
+const struct subsys_fns_t sys_payment = {
+  .name = "payment",
+  SUBSYS_DECLARE_LOCATION(),
+  .supported = true,
+  .level = PAYMENT_SUBSYS_LEVEL,
+  .shutdown = subsys_payment_shutdown,
+  .add_pubsub = subsys_payment_add_pubsub,
+  .get_metrics = payment_metrics_get_stores,
+};
@@ -0,0 +1,16 @@
+/**
+ * @file payment_sys.h
+ * @brief Header for feature/payment/payment_sys.c
+ **/
+
+#ifndef TOR_FEATURE_PAYMENT_PAYMENT_SYS_H
+#define TOR_FEATURE_PAYMENT_PAYMENT_SYS_H
+
+extern const struct subsys_fns_t sys_payment;
+
+/**
+ * Subsystem level for the payment system.
+ **/
+#define PAYMENT_SUBSYS_LEVEL 57
+
+#endif /* !defined(TOR_FEATURE_PAYMENT_PAYMENT_SYS_H) */
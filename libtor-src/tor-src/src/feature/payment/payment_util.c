@@ -1,9 +1,9 @@
 // src/feature/payment/payment_util.c
 #include "orconfig.h"
-#include <openssl/sha.h>
 #include <string.h>
 #include <stdio.h>
 #include "app/config/config.h"
+#include "app/config/or_options_st.h"
 #include "lib/confmgt/confmgt.h"
 #include "lib/log/log.h"
 #include "feature/payment/payment_util.h"
@@ -11,426 +11,485 @@
 #include "feature/control/control_events.h"
 #include "core/or/origin_circuit_st.h"
 #include "core/or/crypt_path_st.h"
+#include "core/or/extend_info_st.h"
 #include "feature/payment/relay_payments.h"
+#include "feature/payment/relay_payments_st.h"
 #include "core/or/circuituse.h"
+#include "lib/crypt_ops/crypto_digest.h"
+#include "lib/crypt_ops/crypto_util.h"
+#include "lib/ctime/di_ops.h"
+#include "lib/encoding/binascii.h"
+#include "lib/string/util_string.h"
+
+#include "trunnel/extension.h"
+
+
+/** Check <b>n</b> (preimage, payment hash) pairs. <b>preimages</b> and
+ * <b>payhashes</b> each hold <b>n</b> PAYMENT_HASH_LEN-byte values back to
+ * back. If <b>ok_out</b> is not NULL, set ok_out[i] to 1 if the SHA-256 of
+ * preimage i is payment hash i, and to 0 otherwise. Return the number of
+ * pairs that matched. */
+size_t
+payment_util_verify_preimages(const uint8_t *preimages,
+                              const uint8_t *payhashes,
+                              size_t n, uint8_t *ok_out)
+{
+  uint8_t digest[DIGEST256_LEN];
+  size_t n_ok = 0;
+
+  for (size_t i = 0; i < n; ++i) {
+    const size_t off = i * PAYMENT_HASH_LEN;
+    int ok;
+    crypto_digest256((char *) digest, (const char *) preimages + off,
+                     PAYMENT_HASH_LEN, DIGEST_SHA256);
+    ok = tor_memeq(digest, payhashes + off, PAYMENT_HASH_LEN);
+    n_ok += ok;
+    if (ok_out)
+      ok_out[i] = ok;
+  }
 
+  memwipe(digest, 0, sizeof(digest));
+  return n_ok;
+}
 
-// Function to convert a hex string to a byte array
-void
-payment_util_hex_to_bytes(const char *hex, unsigned char *bytes,
-                          size_t bytes_len)
+/** As payment_util_verify_preimages(), but <b>preimages_hex</b> and
+ * <b>payhashes_hex</b> hold the values hex-encoded. Return -1 if either
+ * is not exactly <b>n</b> values of valid hex. */
+ssize_t
+payment_util_verify_preimages_hex(const char *preimages_hex,
+                                  const char *payhashes_hex,
+                                  size_t n, uint8_t *ok_out)
 {
-  for (size_t i = 0; i < bytes_len; ++i) {
-    sscanf(hex + 2 * i, "%2hhx", &bytes[i]);
-  }
+  const size_t len = n * PAYMENT_HASH_LEN;
+  uint8_t *buf;
+  ssize_t ret = -1;
+
+  if (n == 0 || n > SSIZE_MAX / PAYMENT_HASH_LEN / 2 ||
+      strlen(preimages_hex) != len * 2 || strlen(payhashes_hex) != len * 2)
+    return -1;
+
+  buf = tor_malloc(len * 2);
+  if (base16_decode((char *) buf, len, preimages_hex, len * 2) < 0 ||
+      base16_decode((char *) buf + len, len, payhashes_hex, len * 2) < 0)
+    goto done;
+
+  ret = payment_util_verify_preimages(buf, buf + len, n, ok_out);
+
+ done:
+  memwipe(buf, 0, len * 2);
+  tor_free(buf);
+  return ret;
 }
 
 // Function to verify if the preimage matches the given payment hash
 int
 payment_util_verify_preimage(const char *preimage_hex, const char *payhash_hex)
 {
-  unsigned char preimage[32];
-  unsigned char payhash[32];
-  unsigned char hash[SHA256_DIGEST_LENGTH];
-
-  // Convert hex strings to byte arrays
-  payment_util_hex_to_bytes(preimage_hex, preimage, 32);
-  payment_util_hex_to_bytes(payhash_hex, payhash, 32);
-
-  // Compute the SHA-256 hash of the preimage
-  SHA256(preimage, 32, hash);
+  return payment_util_verify_preimages_hex(preimage_hex, payhash_hex,
+                                           1, NULL) == 1;
+}
 
-  // Compare the computed hash with the provided payment hash
-  return memcmp(hash, payhash, SHA256_DIGEST_LENGTH) == 0;
+/** Offsets in or_options_t of ElTorPreimageHop1..N, indexed by hop - 1. */
+static const size_t preimage_hop_option_offsets[] = {
+  offsetof(or_options_t, ElTorPreimageHop1),
+  offsetof(or_options_t, ElTorPreimageHop2),
+  offsetof(or_options_t, ElTorPreimageHop3),
+  offsetof(or_options_t, ElTorPreimageHop4),
+  offsetof(or_options_t, ElTorPreimageHop5),
+  offsetof(or_options_t, ElTorPreimageHop6),
+  offsetof(or_options_t, ElTorPreimageHop7),
+  offsetof(or_options_t, ElTorPreimageHop8),
+};
+
+/** Offsets in or_options_t of ElTorPayHashHop1..N, indexed by hop - 1. */
+static const size_t payhash_hop_option_offsets[] = {
+  offsetof(or_options_t, ElTorPayHashHop1),
+  offsetof(or_options_t, ElTorPayHashHop2),
+  offsetof(or_options_t, ElTorPayHashHop3),
+  offsetof(or_options_t, ElTorPayHashHop4),
+  offsetof(or_options_t, ElTorPayHashHop5),
+  offsetof(or_options_t, ElTorPayHashHop6),
+  offsetof(or_options_t, ElTorPayHashHop7),
+  offsetof(or_options_t, ElTorPayHashHop8),
+};
+
+CTASSERT(ARRAY_LENGTH(preimage_hop_option_offsets) == PAYMENT_MAX_HOP_OPTIONS);
+CTASSERT(ARRAY_LENGTH(payhash_hop_option_offsets) == PAYMENT_MAX_HOP_OPTIONS);
+
+/** Return the string option at <b>offset</b> in <b>options</b>, or NULL if
+ * it is unset or "None". */
+static const char *
+hop_option_get(const or_options_t *options, size_t offset)
+{
+  const char *val = *(const char * const *)
+    ((const char *) options + offset);
+  if (!val || !strcmp(val, "None"))
+    return NULL;
+  return val;
 }
 
-// Function to get preimage and payhash from torrc and prefix them
-void
-payment_util_get_preimage_from_torrc(char *eltor_payhash, int hop_num)
+/** Return the configured ElTorPreimageHop<b>hop_num</b> of <b>options</b>,
+ * or NULL if <b>hop_num</b> is out of range or the option is unset. */
+const char *
+payment_util_get_hop_preimage_option(const or_options_t *options,
+                                     int hop_num)
 {
-  char eltor_preimage_raw[64 + 1] = {0}; // null terminator
-  char eltor_payhash_raw[64 + 1] = {0}; // null terminator
-
-  // read the torrc to get the updated preimage value
-  char *torrc_contents = load_torrc_from_disk(NULL, 0);
-  if (!torrc_contents) {
-    log_warn(LD_CONFIG, "Failed to read torrc file");
-    return;
-  }
+  if (hop_num < 1 || hop_num > PAYMENT_MAX_HOP_OPTIONS)
+    return NULL;
+  return hop_option_get(options, preimage_hop_option_offsets[hop_num - 1]);
+}
 
-  // 1. Get preimage
-  char preimage_key[32];
-  snprintf(preimage_key, sizeof(preimage_key), "ElTorPreimageHop%d", hop_num);
-  char *preimage_value = strstr(torrc_contents, preimage_key);
-  if (preimage_value) {
-    preimage_value += strlen(preimage_key);
-    while (*preimage_value == ' ') {
-      preimage_value++;
-    }
-    strncpy(eltor_preimage_raw, preimage_value, 64);
-    eltor_preimage_raw[64] = '\0'; // Ensure null termination
-    log_info(LD_CIRC, "ElTorPreimageHop%d: %s", hop_num, eltor_preimage_raw);
-  } else {
-    log_warn(LD_CONFIG, "Preimage key %s not found in torrc", preimage_key);
-  }
+/** Return the configured ElTorPayHashHop<b>hop_num</b> of <b>options</b>,
+ * or NULL if <b>hop_num</b> is out of range or the option is unset. */
+const char *
+payment_util_get_hop_payhash_option(const or_options_t *options,
+                                    int hop_num)
+{
+  if (hop_num < 1 || hop_num > PAYMENT_MAX_HOP_OPTIONS)
+    return NULL;
+  return hop_option_get(options, payhash_hop_option_offsets[hop_num - 1]);
+}
 
-  // 2. Get payhash
-  char payhash_key[32];
-  snprintf(payhash_key, sizeof(payhash_key), "ElTorPayHashHop%d", hop_num);
-  char *payhash_value = strstr(torrc_contents, payhash_key);
-  if (payhash_value) {
-    payhash_value += strlen(payhash_key);
-    while (*payhash_value == ' ') {
-      payhash_value++;
+/** Check the ElTorPreimageHop* and ElTorPayHashHop* options in
+ * <b>options</b>: each must be unset, "None", or 64 hex characters. Return
+ * 0 on success, or -1 and set *<b>msg</b> on failure. */
+int
+payment_util_options_validate(const or_options_t *options, char **msg)
+{
+  char buf[DIGEST256_LEN];
+
+  for (int hop = 1; hop <= PAYMENT_MAX_HOP_OPTIONS; ++hop) {
+    const char *vals[2] = {
+      payment_util_get_hop_preimage_option(options, hop),
+      payment_util_get_hop_payhash_option(options, hop),
+    };
+    for (int i = 0; i < 2; ++i) {
+      if (!vals[i])
+        continue;
+      if (strlen(vals[i]) != HEX_DIGEST256_LEN ||
+          base16_decode(buf, sizeof(buf), vals[i], HEX_DIGEST256_LEN)
+            != sizeof(buf)) {
+        tor_asprintf(msg, "%s%d must be 64 hexadecimal characters or None.",
+                     i == 0 ? "ElTorPreimageHop" : "ElTorPayHashHop", hop);
+        return -1;
+      }
     }
-    strncpy(eltor_payhash_raw, payhash_value, 64);
-    eltor_payhash_raw[64] = '\0'; // Ensure null termination
-    log_info(LD_CIRC, "ElTorPayHashHop%d: %s", hop_num, eltor_payhash_raw);
-  } else {
-    log_warn(LD_CONFIG, "PayHash key %s not found in torrc", payhash_key);
   }
-
-  // Free the allocated memory for torrc_contents
-  tor_free(torrc_contents);
-
-  // Prefix the Preimage string
-  // const char prefix[] = "eltor_preimage";
-  // snprintf(eltor_preimage, 64 + 14 + 1, "%s%s", prefix, eltor_preimage_raw);
-
-  // Prefix the PayHash string
-  const char prefixPayHash[] = "eltor_payhash";
-  snprintf(eltor_payhash, PAYMENT_PAYHASH_SIZE, "%s%s", prefixPayHash,
-           eltor_payhash_raw);
+  return 0;
 }
 
-void
-payment_util_get_payhash_from_circ(char *eltor_payhash, char *payhash,
-                                   int hop_num)
+/** Number of payment values that fit in a single extension field. */
+#define PAYHASHES_PER_FIELD (UINT8_MAX / PAYMENT_HASH_LEN)
+
+/** Add the <b>n_payhashes</b> PAYMENT_HASH_LEN-byte payment values at
+ * <b>payhashes</b> to <b>ext</b> as PAYMENT_EXT_TYPE_PAYHASH fields,
+ * each packing up to PAYHASHES_PER_FIELD values.
+ *
+ * Return 0 on success, or -1 if the values don't fit in <b>ext</b>. */
+static int
+payhash_ext_add_fields(trn_extension_t *ext, const uint8_t *payhashes,
+                       size_t n_payhashes)
 {
-  // Ensure the input buffers and circuit are valid
-  // tor_assert(eltor_preimage);
-  // tor_assert(eltor_payhash);
-  // tor_assert(preimage);
-  // tor_assert(payhash);
-
-  // if (!preimage) {
-  //   log_warn(LD_CONFIG, "Failed to read preimage");
-  //   return;
-  // }
-  if (!payhash) {
-    log_warn(LD_CONFIG, "Failed to read payhash");
-    return;
-  }
+  trn_extension_field_t *field = NULL;
 
-  // Define buffer sizes
-  const size_t raw_size =
-      2304; // handshake_fee_payment_hash+handshake_fee_preimage+10_payment_ids_concatinated
-  const size_t prefix_size = 13; // Length of "eltor_payhash"
-  const size_t total_size =
-      raw_size + prefix_size + 1; // +1 for null terminator
-
-  // 1. Parse Preimage
-  // char eltor_preimage_raw[raw_size + 1];
-  // memset(eltor_preimage_raw, 0, sizeof(eltor_preimage_raw)); // null
-  // terminator strncpy(eltor_preimage_raw, preimage, raw_size);
-  // eltor_preimage_raw[raw_size] = '\0'; // Ensure null termination
-
-  // 2. Parse Payhash
-  char eltor_payhash_raw[raw_size + 1];
-  memset(eltor_payhash_raw, 0, sizeof(eltor_payhash_raw)); // null terminator
-
-  // Calculate offset based on hop_num (1-based)
-  size_t offset = (hop_num - 1) * 768;
-  size_t payhash_len = strlen(payhash);
-  if (offset + 768 > payhash_len) {
-    log_warn(LD_CONFIG, "Invalid hop_num or payhash too short");
-    eltor_payhash_raw[0] = '\0';
-  } else {
-    strncpy(eltor_payhash_raw, payhash + offset, 768);
-    eltor_payhash_raw[768] = '\0'; // Ensure null termination
-    log_info(LD_CONFIG, "eltor_payhash_raw (hop %d): %s", hop_num,
-             eltor_payhash_raw);
+  if (n_payhashes == 0 || n_payhashes > UINT8_MAX) {
+    log_warn(LD_CIRC, "ELTOR: Malformed payment material (%zu values)",
+             n_payhashes);
+    return -1;
   }
 
-  // 3. Prefix the Preimage string
-  // const char prefix[] = "eltor_preimage";
-  // snprintf(eltor_preimage, total_size, "%s%s", prefix, eltor_preimage_raw);
+  for (size_t i = 0; i < n_payhashes; i += PAYHASHES_PER_FIELD) {
+    size_t n_in_field = MIN(PAYHASHES_PER_FIELD, n_payhashes - i);
+    if (trn_extension_get_num(ext) == UINT8_MAX)
+      return -1;
+    field = trn_extension_field_new();
+    trn_extension_field_set_field_type(field, PAYMENT_EXT_TYPE_PAYHASH);
+    trn_extension_field_set_field_len(field, n_in_field * PAYMENT_HASH_LEN);
+    trn_extension_field_setlen_field(field, n_in_field * PAYMENT_HASH_LEN);
+    /* A payhash field body is its values back to back. */
+    memcpy(trn_extension_field_getarray_field(field),
+           payhashes + i * PAYMENT_HASH_LEN, n_in_field * PAYMENT_HASH_LEN);
+    trn_extension_add_fields(ext, field);
+    trn_extension_set_num(ext, trn_extension_get_num(ext) + 1);
+  }
 
-  // 4. Prefix the PayHash string
-  const char prefixPayHash[] = "eltor_payhash";
-  snprintf(eltor_payhash, total_size, "%s%s", prefixPayHash,
-           eltor_payhash_raw);
+  return 0;
 }
 
-// Function to check if payment has been made
+/** Add the <b>n_payhashes</b> payment values at <b>payhashes</b> as payment
+ * fields to the extension-encoded message in *<b>msg_inout</b> (which may
+ * be empty), replacing it with a newly allocated re-encoded message.
+ *
+ * Return 0 on success, -1 on failure (in which case the message is left
+ * untouched). */
 int
-payment_util_has_paid(const char *contact_info, const uint8_t *payload,
-                      size_t payload_len)
+payment_util_payhash_ext_append(uint8_t **msg_inout, size_t *msg_len_inout,
+                                const uint8_t *payhashes, size_t n_payhashes)
 {
-  if (!contact_info) {
-    log_info(LD_APP,
-             "No BOLT 12 provided in ContactInfo. No payment required.");
-    return 1;
+  trn_extension_t *ext = NULL;
+  uint8_t *encoded = NULL;
+  ssize_t encoded_len;
+  int ret = -1;
+
+  tor_assert(msg_inout);
+  tor_assert(msg_len_inout);
+  tor_assert(payhashes);
+
+  if (*msg_len_inout > 0) {
+    if (trn_extension_parse(&ext, *msg_inout, *msg_len_inout) < 0)
+      goto end;
+  } else {
+    ext = trn_extension_new();
   }
 
-  // Check for preimage
-  const char *prefix = "eltor_preimage";
-  const char *prefixPayHash = "eltor_payhash";
-  size_t nlen = strlen(prefix);
-  size_t plen = strlen(prefixPayHash);
-  const void *found = tor_memmem(payload, payload_len, prefix, nlen);
-  const void *foundPayHash =
-      tor_memmem(payload, payload_len, prefixPayHash, plen);
-
-  if (found && foundPayHash) {
-    size_t index = (const uint8_t *)found - payload;
-    size_t indexPayHash = (const uint8_t *)foundPayHash - payload;
-    if (index + nlen + 64 <= payload_len &&
-        indexPayHash + plen + 64 <= payload_len) {
-      char preimage[64 + 1]; // null-terminated string
-      memcpy(preimage, payload + index + nlen, 64);
-      preimage[64] = '\0'; // Null-terminate the string
-      log_info(LD_APP, "ElTorRelay: %s, Preimage: %s", get_options()->Nickname,
-               preimage);
-
-      // Check for payhash
-      char payhash[64 + 1]; // null-terminated string
-      memcpy(payhash, payload + indexPayHash + plen, 64);
-      payhash[64] = '\0'; // Null-terminate the string
-      log_info(LD_APP, "ElTorRelay: %s, PayHash: %s", get_options()->Nickname,
-               payhash);
-
-      // Verify preimage against the payment hash
-      if (payment_util_verify_preimage(preimage, payhash)) {
-        log_info(LD_APP, "ElTor 200");
-        return 1;
-      } else {
-        log_info(LD_APP, "ElTor L402");
-      }
-    }
+  if (payhash_ext_add_fields(ext, payhashes, n_payhashes) < 0)
+    goto end;
+
+  encoded_len = trn_extension_encoded_len(ext);
+  if (BUG(encoded_len < 0))
+    goto end;
+  encoded = tor_malloc_zero(encoded_len);
+  if (BUG(trn_extension_encode(encoded, encoded_len, ext) < 0)) {
+    tor_free(encoded);
+    goto end;
   }
 
-  return 0;
+  tor_free(*msg_inout);
+  *msg_inout = encoded;
+  *msg_len_inout = encoded_len;
+  ret = 0;
+
+ end:
+  trn_extension_free(ext);
+  return ret;
 }
 
-// Function to check if a payment id hash was passed
-int
-payment_util_has_payment_id_hash(const uint8_t *payload, size_t payload_len)
+/** Encode the <b>n_payhashes</b> payment values at <b>payhashes</b> as an
+ * extension holding only payment fields into the <b>out_len</b> bytes at
+ * <b>out</b>.
+ *
+ * Return the number of bytes written, or -1 on failure. */
+ssize_t
+payment_util_payhash_ext_encode(uint8_t *out, size_t out_len,
+                                const uint8_t *payhashes, size_t n_payhashes)
 {
-  const char *prefixPayHash = "eltor_payhash";
-  size_t plen = strlen(prefixPayHash);
-
-  // Log relay nickname and circuit ID
-  log_notice(
-      LD_APP,
-      "ELTOR RELAY %s: Checking for payment hash in cell payload (len=%zu)",
-      get_options()->Nickname, payload_len);
-
-  // Search for the prefix in the payload
-  const void *foundPayHash =
-      tor_memmem(payload, payload_len, prefixPayHash, plen);
-  if (foundPayHash) {
-    size_t indexPayHash = (const uint8_t *)foundPayHash - payload;
-    log_notice(LD_APP,
-               "ELTOR RELAY %s: Found payhash at offset %zu in payload",
-               get_options()->Nickname, indexPayHash);
-
-    // Make sure we have enough room to get the hash
-    size_t remaining = payload_len - (indexPayHash + plen);
-    if (remaining < 1) {
-      log_warn(LD_APP, "ELTOR RELAY %s: Found prefix but no room for payhash",
-               get_options()->Nickname);
-      return 0;
-    }
-
-    // Extract a reasonable amount of the hash (up to 768 bytes)
-    size_t copy_len = MIN(768, remaining);
+  trn_extension_t *ext = trn_extension_new();
+  ssize_t ret = -1;
 
-    char payhash[769]; // 768 + null terminator
-    memcpy(payhash, (const char *)payload + indexPayHash + plen, copy_len);
-    payhash[copy_len] = '\0';
+  tor_assert(out);
+  tor_assert(payhashes);
 
-    log_notice(LD_APP,
-               "ELTOR RELAY %s: Successfully extracted payhash (length=%zu)",
-               get_options()->Nickname, strlen(payhash));
-    log_notice(LD_APP, "ELTOR RELAY %s: Payment hash first 50 chars: %.50s...",
-               get_options()->Nickname, payhash);
+  if (payhash_ext_add_fields(ext, payhashes, n_payhashes) < 0)
+    goto end;
 
-    // control_event_payment_id_hash_received(payhash, global_id);
-    return 1;
-  } else {
-    log_notice(LD_APP, "ELTOR RELAY %s: PayHash prefix not found in payload",
-               get_options()->Nickname);
-
-    // Add additional debugging to check for any string that looks like a
-    // payment hash
-    log_debug(LD_APP, "ELTOR RELAY %s: Full payload hex dump: %s",
-              get_options()->Nickname, hex_str(payload, payload_len));
-    return 0;
+  ret = trn_extension_encode(out, out_len, ext);
+  if (ret < 0) {
+    log_warn(LD_CIRC, "ELTOR: Payment material doesn't fit in %zu bytes",
+             out_len);
+    ret = -1;
   }
+
+ end:
+  trn_extension_free(ext);
+  return ret;
 }
 
-/**
- * Helper function to get the payment hash for a specific hop in a circuit.
+/** Parse the extension-encoded message of <b>msg_len</b> bytes at
+ * <b>msg</b> and copy up to <b>max_hashes</b> of the payment values it
+ * carries, in order, into the PAYMENT_HASH_LEN-byte slots of
+ * <b>hashes_out</b>. <b>hashes_out</b> may be NULL to only count them.
+ * Fields of other types are ignored.
  *
- * @param circ The origin circuit containing the payment hash
- * @param hop The crypt path for the hop we're extending to
- * @return Static buffer containing the payment hash for this hop, or NULL if
- * not found
- */
-int payment_util_get_hop_payhash(origin_circuit_t *circ, crypt_path_t *hop, char *out_buf, size_t out_len) {
-  if (!circ || !circ->payhashes || !hop)
-    return 0;
-
-  // Find the hop number
-  int hop_num = 0;
-  for (crypt_path_t *cur = circ->cpath; cur != NULL; cur = cur->next) {
-    hop_num++;
-    if (cur == hop) {
-      break;
+ * Return the number of payment values found, or -1 if the message or any
+ * payment field is malformed.
+ *
+ * WARNING: Called from CPU worker! Must not access any global state. */
+int
+payment_util_payhash_ext_parse(const uint8_t *msg, size_t msg_len,
+                               uint8_t *hashes_out, size_t max_hashes)
+{
+  trn_extension_t *ext = NULL;
+  int n_found = 0;
+
+  if (trn_extension_parse(&ext, msg, msg_len) < 0)
+    return -1;
+
+  for (size_t f = 0; f < trn_extension_get_num(ext); f++) {
+    const trn_extension_field_t *field = trn_extension_get_fields(ext, f);
+    const uint8_t *ptr = trn_extension_field_getconstarray_field(field);
+    size_t remaining = trn_extension_field_getlen_field(field);
+
+    if (trn_extension_field_get_field_type(field) !=
+        PAYMENT_EXT_TYPE_PAYHASH) {
+      continue;
+    }
+    /* A payhash field body is its values back to back. */
+    if (remaining == 0 || remaining % PAYMENT_HASH_LEN) {
+      n_found = -1;
+      goto end;
     }
-    if (cur->next == circ->cpath) {
-      break; // Full loop without finding hop
+    for (; remaining > 0; remaining -= PAYMENT_HASH_LEN) {
+      if (hashes_out && (size_t) n_found < max_hashes)
+        memcpy(hashes_out + n_found * PAYMENT_HASH_LEN, ptr,
+               PAYMENT_HASH_LEN);
+      ptr += PAYMENT_HASH_LEN;
+      ++n_found;
     }
   }
 
-  // No match found or invalid hop
-  if (hop_num <= 0) {
-    log_warn(LD_GENERAL, "ELTOR: Could not determine hop number");
-    return 0;
-  }
+ end:
+  trn_extension_free(ext);
+  return n_found;
+}
 
-  log_info(LD_GENERAL, "ELTOR: Extracting payment hash for hop %d", hop_num);
+/** Placeholder payment material sent to the first hop of hidden service
+ * circuits, which are not paid yet. */
+static const char hs_placeholder_material[] =
+  "d5ddf78f461c67569046f8291e789163b8e13c9cc737552133abfadddcf0f054"
+  "824601029cfe46aa978decd83e969c11bc17968a60ab96bf688e1352369105bb"
+  "3e098bc3a359fd663a4545990b6cad089a85708a2cd2b323be78d2fbd32112b6"
+  "ab64f093beee01533673dd75e27d4ad7626935ec0260be4efd40e2b51c80bf64"
+  "472912c110796f1d83b2292f3652de52429249e1fd2ef82b64f7df8ea7e745f9"
+  "3d7265a70203ade5868599e24316227464592b1fd68a5d48e7953abd5e7ea76c"
+  "93c90ad2db89593875ba121bb9177ca4d585a7c434013480c5d41669c5d75531"
+  "727f5c952c1117a4d4869c0c14fa9e0780401c0ae1582a3410f199a3a03eb1f3"
+  "a94073e0f0b47be9747b0619bb6c16cc225207e78c5bab155b90183a8e3477a0"
+  "7787dc4a27ff6abe69de62c80b0f23422cb540ed8947bc0987fe51310b864869"
+  "5fae894b3c2cf45549342cac1c12607a9329163511a92be780203d9acc2be484"
+  "589e63b904fb99a617852312844ef80b56d28ae253122e289c1080968e830192";
 
-  // Extract payment hash into a local buffer
-  char extracted_payhash[PAYMENT_PAYHASH_SIZE];
-  memset(extracted_payhash, 0, PAYMENT_PAYHASH_SIZE);
+/**
+ * Return the payment item that <b>circ</b> sends to <b>hop</b>, or NULL if
+ * it pays that hop nothing. Items are looked up by the hop's identity, so
+ * this works the same for the first hop and for hops added later.
+ */
+const relay_payment_item_t *
+payment_util_get_hop_payment(const origin_circuit_t *circ,
+                             const crypt_path_t *hop)
+{
+  static relay_payment_item_t hs_placeholder;
+  static int hs_placeholder_decoded = 0;
 
-  payment_util_get_payhash_from_circ(extracted_payhash,
-                                      circ->payhashes, hop_num);
+  if (!circ || !hop || !hop->extend_info)
+    return NULL;
 
-  if (strlen(extracted_payhash) > 0) {
-    log_info(LD_GENERAL,
-              "ELTOR: Found payment hash for hop %d (first 20 chars): %.20s...",
-              hop_num, extracted_payhash);
-    strlcpy(out_buf, extracted_payhash, out_len);
-    return 1;
-  } else {
-    log_info(LD_GENERAL, "ELTOR: No payment hash found for hop %d", hop_num);
-    return 0;
+  // TODO Skip payments for hidden services for now, just use dummy values
+  if (circuit_purpose_is_hidden_service(circ->base_.purpose)) {
+    if (hop != circ->cpath)
+      return NULL;
+    if (!hs_placeholder_decoded) {
+      if (BUG(payment_util_parse_payment_material(hs_placeholder_material,
+                                                  &hs_placeholder) < 0))
+        return NULL;
+      hs_placeholder_decoded = 1;
+    }
+    return &hs_placeholder;
   }
+
+  return relay_payments_find_by_fingerprint(
+                    circ->relay_payments,
+                    (const uint8_t *) hop->extend_info->identity_digest);
 }
 
 /**
- * Helper function to get the payment hash for the first hop in a circuit.
- * This is simpler than the general hop function since we always use hop_num
- * = 1.
+ * Decode the hex payment material of one hop into <b>item_out</b>: the
+ * handshake payment hash, the handshake preimage and up to
+ * RELAY_PAYMENT_ROUNDS payment id hashes, 64 hex characters each, optionally
+ * prefixed with PAYMENT_PAYHASH_PREFIX. The fingerprint of <b>item_out</b>
+ * is left alone.
  *
- * @param circ The origin circuit containing the payment hash
- * @return Static buffer containing the payment hash for the first hop, or NULL
- * if not found
+ * @return 0 on success, -1 if the material is malformed
  */
-const char *
-payment_util_get_first_hop_payhash(origin_circuit_t *circ)
+int
+payment_util_parse_payment_material(const char *material,
+                                    relay_payment_item_t *item_out)
 {
-  if (!circ) return NULL;
+  tor_assert(material);
+  return payment_util_parse_payment_material_len(material, strlen(material),
+                                                 item_out);
+}
 
-  uint8_t purpose = circ->base_.purpose;
-  if (circuit_purpose_is_hidden_service(purpose)) {
-    // TODO Skip payments for hidden services for now, just use dummy values
-    return "d5ddf78f461c67569046f8291e789163b8e13c9cc737552133abfadddcf0f054824601029cfe46aa978decd83e969c11bc17968a60ab96bf688e1352369105bb3e098bc3a359fd663a4545990b6cad089a85708a2cd2b323be78d2fbd32112b6ab64f093beee01533673dd75e27d4ad7626935ec0260be4efd40e2b51c80bf64472912c110796f1d83b2292f3652de52429249e1fd2ef82b64f7df8ea7e745f93d7265a70203ade5868599e24316227464592b1fd68a5d48e7953abd5e7ea76c93c90ad2db89593875ba121bb9177ca4d585a7c434013480c5d41669c5d75531727f5c952c1117a4d4869c0c14fa9e0780401c0ae1582a3410f199a3a03eb1f3a94073e0f0b47be9747b0619bb6c16cc225207e78c5bab155b90183a8e3477a07787dc4a27ff6abe69de62c80b0f23422cb540ed8947bc0987fe51310b8648695fae894b3c2cf45549342cac1c12607a9329163511a92be780203d9acc2be484589e63b904fb99a617852312844ef80b56d28ae253122e289c1080968e830192";
-  }
+/**
+ * As payment_util_parse_payment_material(), but decode the <b>len</b>
+ * characters at <b>material</b>, which need not be NUL-terminated.
+ */
+int
+payment_util_parse_payment_material_len(const char *material, size_t len,
+                                        relay_payment_item_t *item_out)
+{
+  const size_t hex_len = PAYMENT_HASH_LEN * 2;
+  const size_t prefix_len = strlen(PAYMENT_PAYHASH_PREFIX);
+  size_t n_values;
 
-  if (!circ->payhashes) return NULL;
-  static char extracted_payhash[PAYMENT_PAYHASH_SIZE];
-  memset(extracted_payhash, 0, sizeof(extracted_payhash));
+  tor_assert(material);
+  tor_assert(item_out);
 
-  // Extract the first hop's payment hash (hop_num = 1)
-  payment_util_get_payhash_from_circ(extracted_payhash, circ->payhashes, 1);
+  if (len >= prefix_len &&
+      fast_memeq(material, PAYMENT_PAYHASH_PREFIX, prefix_len)) {
+    material += prefix_len;
+    len -= prefix_len;
+  }
+  n_values = len / hex_len;
 
-  if (strlen(extracted_payhash) > 0) {
-    log_info(LD_CIRC, "ELTOR: Found first hop payment hash (length: %zu)",
-             strlen(extracted_payhash));
-    return extracted_payhash;
-  } else {
-    log_info(LD_CIRC, "ELTOR: No payment hash found for first hop");
-    return NULL;
+  if (len % hex_len || n_values < RELAY_PAYMENT_FIRST_ROUND ||
+      n_values > PAYMENT_HASHES_PER_HOP) {
+    log_warn(LD_CONTROL, "ELTOR: Invalid payment material (%zu hex chars)",
+             len);
+    return -1;
+  }
+
+  if (base16_decode((char *) item_out->material,
+                    sizeof(item_out->material), material, len) !=
+      (int) (n_values * PAYMENT_HASH_LEN)) {
+    log_warn(LD_CONTROL, "ELTOR: Payment material is not valid hex");
+    return -1;
   }
+  item_out->n_payhashes = (uint8_t) (n_values - RELAY_PAYMENT_FIRST_ROUND);
+
+  return 0;
 }
 
 /**
  * Parse a raw payment line into a structured relay_payment_item_t.
  * Format: "fingerprint handshake_payment_hash(64) + handshake_preimage(64) +
- * payhashes"
+ * payhashes", where fingerprint is a hex identity digest, optionally
+ * prefixed with "$".
  *
  * @param line The raw line to parse
- * @return A newly allocated relay_payment_item_t or NULL on error
+ * @param item_out The item to fill in
+ * @return 0 on success, -1 on error
  */
-relay_payment_item_t *
-payment_util_parse_payment_line(const char *line)
+int
+payment_util_parse_payment_line(const char *line,
+                                relay_payment_item_t *item_out)
 {
-  if (!line || !strlen(line))
-    return NULL;
+  const char *space;
 
-  relay_payment_item_t *item = relay_payment_item_new();
-  if (!item)
-    return NULL;
+  if (!line || !item_out)
+    return -1;
+
+  memset(item_out, 0, sizeof(*item_out));
 
   // Split line by space to get fingerprint and payload
-  char *space = strchr(line, ' ');
+  space = strchr(line, ' ');
   if (!space) {
     log_warn(LD_CONTROL,
              "ELTOR: Invalid payment line format (no space found)");
-    relay_payment_item_free(item);
-    return NULL;
-  }
-
-  // Extract fingerprint (part before space)
-  size_t fp_len = space - line;
-  item->fingerprint = tor_malloc_zero(fp_len + 1);
-  memcpy(item->fingerprint, line, fp_len);
-
-  // Get the payload after the space
-  const char *payload = space + 1;
-  size_t payload_len = strlen(payload);
-
-  // Check if payload is long enough
-  if (payload_len < 128) { // At least 64+64 chars for hash and preimage
-    log_warn(LD_CONTROL, "ELTOR: Invalid payment payload (too short: %zu)",
-             payload_len);
-    relay_payment_item_free(item);
-    return NULL;
+    return -1;
   }
 
-  // Extract handshake payment hash (first 64 chars)
-  item->handshake_payment_hash = tor_malloc_zero(65);
-  memcpy(item->handshake_payment_hash, payload, 64);
-
-  // Extract handshake preimage (next 64 chars)
-  item->handshake_preimage = tor_malloc_zero(65);
-  memcpy(item->handshake_preimage, payload + 64, 64);
-
-  // Extract payhashes (remaining chars)
-  size_t payhashes_len = payload_len - 128;
-  if (payhashes_len > 0) {
-    item->payhashes = tor_malloc_zero(payhashes_len + 1);
-    memcpy(item->payhashes, payload + 128, payhashes_len);
-  } else {
-    item->payhashes = tor_strdup("");
+  if (*line == '$')
+    ++line;
+  if (space - line != HEX_DIGEST_LEN ||
+      base16_decode((char *) item_out->fingerprint, DIGEST_LEN, line,
+                    HEX_DIGEST_LEN) != DIGEST_LEN) {
+    log_warn(LD_CONTROL, "ELTOR: Invalid fingerprint in payment line");
+    return -1;
   }
 
-  // Set wire_format as "eltor_payhash" + payload
-  const char *prefix = "eltor_payhash";
-  size_t prefix_len = strlen(prefix);
-  item->wire_format = tor_malloc_zero(prefix_len + payload_len + 1);
-  memcpy(item->wire_format, prefix, prefix_len);
-  memcpy(item->wire_format + prefix_len, payload, payload_len);
-
-  log_debug(
-      LD_CONTROL,
-      "ELTOR: Parsed payment line for %s (hash: %.10s..., preimage: %.10s...)",
-      item->fingerprint, item->handshake_payment_hash,
-      item->handshake_preimage);
+  if (payment_util_parse_payment_material(space + 1, item_out) < 0)
+    return -1;
 
-  return item;
+  log_relay_payment(item_out);
+  return 0;
 }
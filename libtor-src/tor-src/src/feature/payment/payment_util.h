@@ -5,22 +5,63 @@
 #define PAYMENT_PREIMAGE_SIZE (64 + 14 + 1) // Size of the preimage + prefix eltor_preimage + 1 (64 + 14 + 1)
 #define PAYMENT_PAYHASH_SIZE (768 + 13 + 1) // Size of the payhash + prefix eltor_payhash + 1 (64 + 13 + 1)
 
+/** Length of one raw value of a hop's payment material. */
+#define PAYMENT_HASH_LEN 32
+/** Number of raw values in a hop's payment material: the handshake payment
+ * hash, the handshake preimage and one payment id hash per payment round. */
+#define PAYMENT_HASHES_PER_HOP 12
+/** Extension field type carrying payment material, in the ntor_v3 client
+ * message and in an EXTEND2 cell. Its body is raw PAYMENT_HASH_LEN-byte
+ * values back to back: the handshake payment hash, the handshake preimage
+ * and then one payment id hash per round, over as many fields as needed. */
+#define PAYMENT_EXT_TYPE_PAYHASH 0xE1
+/** Prefix the controller puts in front of a hop's hex payment material. */
+#define PAYMENT_PAYHASH_PREFIX "eltor_payhash"
+/** Number of hops with ElTorPreimageHop%d / ElTorPayHashHop%d options. */
+#define PAYMENT_MAX_HOP_OPTIONS 8
+
 #include <stddef.h>
-#include "feature/payment/relay_payments.h"
+#include <sys/types.h>
+#include "lib/cc/torint.h"
 
 
 struct origin_circuit_t;
 struct crypt_path_t;
+struct relay_payment_item_t;
+struct or_options_t;
 
-void payment_util_hex_to_bytes(const char* hex, unsigned char* bytes, size_t bytes_len);
 int payment_util_verify_preimage(const char* preimage_hex, const char* payhash_hex);
-void payment_util_get_preimage_from_torrc(char *eltor_payhash, int hop_num);
-void payment_util_get_payhash_from_circ(char *eltor_payhash, char *payhash, int hop_num);
-int payment_util_has_paid(const char *contact_info, const uint8_t *payload, size_t payload_len);
-int payment_util_has_payment_id_hash(const uint8_t *payload, size_t payload_len);
-int payment_util_get_hop_payhash(struct origin_circuit_t *circ, struct crypt_path_t *hop, char *out_buf, size_t out_len);
-const char *payment_util_get_first_hop_payhash(struct origin_circuit_t *circ);
-
-relay_payment_item_t *payment_util_parse_payment_line(const char *line);
+size_t payment_util_verify_preimages(const uint8_t *preimages,
+                                     const uint8_t *payhashes,
+                                     size_t n, uint8_t *ok_out);
+ssize_t payment_util_verify_preimages_hex(const char *preimages_hex,
+                                          const char *payhashes_hex,
+                                          size_t n, uint8_t *ok_out);
+const char *payment_util_get_hop_preimage_option(
+                                  const struct or_options_t *options,
+                                  int hop_num);
+const char *payment_util_get_hop_payhash_option(
+                                  const struct or_options_t *options,
+                                  int hop_num);
+int payment_util_options_validate(const struct or_options_t *options,
+                                  char **msg);
+int payment_util_payhash_ext_append(uint8_t **msg_inout, size_t *msg_len_inout,
+                                    const uint8_t *payhashes,
+                                    size_t n_payhashes);
+ssize_t payment_util_payhash_ext_encode(uint8_t *out, size_t out_len,
+                                        const uint8_t *payhashes,
+                                        size_t n_payhashes);
+int payment_util_payhash_ext_parse(const uint8_t *msg, size_t msg_len,
+                                   uint8_t *hashes_out, size_t max_hashes);
+const struct relay_payment_item_t *payment_util_get_hop_payment(
+                                  const struct origin_circuit_t *circ,
+                                  const struct crypt_path_t *hop);
+
+int payment_util_parse_payment_material(const char *material,
+                                        struct relay_payment_item_t *item_out);
+int payment_util_parse_payment_material_len(const char *material, size_t len,
+                                        struct relay_payment_item_t *item_out);
+int payment_util_parse_payment_line(const char *line,
+                                    struct relay_payment_item_t *item_out);
 
 #endif // PAYMENTS_UTILS_H
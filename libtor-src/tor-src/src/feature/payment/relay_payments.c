@@ -1,41 +1,33 @@
 /**
  * @file relay_payments.c
  * @brief Implementation of ElTor relay payment functionality
+ *
+ * A client building a paid circuit keeps, for every hop, the raw payment
+ * material it sends that hop. The items of one circuit sit in a single
+ * array that grows by one item per hop, so a circuit holds no more than
+ * its hops need, and can be looked up by hop number or by relay
+ * fingerprint in constant time.
  **/
 
+#include "core/or/or.h"
 #include "feature/payment/relay_payments.h"
 #include "feature/payment/relay_payments_st.h"
-#include "lib/container/smartlist.h"
-#include "lib/malloc/malloc.h"
-#include "lib/log/log.h"
-#include "lib/string/util_string.h"
-#include "lib/string/printf.h"
-#include "lib/log/util_bug.h"
-
-/** Free all storage held by a relay payment item. */
-void
-relay_payment_item_free_(relay_payment_item_t *item)
+#include "lib/cc/ctassert.h"
+#include "lib/encoding/binascii.h"
+
+CTASSERT(RELAY_PAYMENTS_MAX_HOPS <= UINT8_MAX);
+CTASSERT(RELAY_PAYMENTS_INDEX_SIZE >= 2 * RELAY_PAYMENTS_MAX_HOPS);
+CTASSERT((RELAY_PAYMENTS_INDEX_SIZE & (RELAY_PAYMENTS_INDEX_SIZE - 1)) == 0);
+
+/** Return the index slot where probing for <b>fingerprint</b> starts.
+ * Fingerprints are SHA1 digests, so their first bytes are already
+ * uniformly distributed. */
+static inline unsigned
+fingerprint_slot(const uint8_t *fingerprint)
 {
-  if (!item)
-    return;
-
-  tor_free(item->fingerprint);
-  tor_free(item->handshake_payment_hash);
-  tor_free(item->handshake_preimage);
-  tor_free(item->payhashes);
-  tor_free(item->wire_format);
-
-  // Debug pattern - fill with unusual value before freeing
-  memset(item, 0x5E,
-         sizeof(relay_payment_item_t)); /* debug bad memory usage */
-
-  tor_free(item);
+  return fingerprint[0] & (RELAY_PAYMENTS_INDEX_SIZE - 1);
 }
 
-/** Free a relay_payment_item_t along with all of its members. */
-#define relay_payment_item_free(val) \
-  FREE_AND_NULL(relay_payment_item_t, relay_payment_item_free_, (val))
-
 /** Free all memory allocated for a relay_payments_t structure. */
 void
 relay_payments_free_(relay_payments_t *payments)
@@ -43,24 +35,8 @@ relay_payments_free_(relay_payments_t *payments)
   if (!payments)
     return;
 
-  // Free each item in the smartlist
-  SMARTLIST_FOREACH(payments, relay_payment_item_t *, item,
-                    relay_payment_item_free(item));
-  smartlist_free(payments);
-}
-
-/** Free a relay_payments_t along with all its items. */
-#define relay_payments_free(val) \
-  FREE_AND_NULL(relay_payments_t, relay_payments_free_, (val))
-
-/**
- * Create a new empty relay payment item
- */
-relay_payment_item_t *
-relay_payment_item_new(void)
-{
-  relay_payment_item_t *item = tor_malloc_zero(sizeof(relay_payment_item_t));
-  return item;
+  tor_free(payments->items);
+  tor_free(payments);
 }
 
 /**
@@ -69,49 +45,54 @@ relay_payment_item_new(void)
 relay_payments_t *
 relay_payments_new(void)
 {
-  return smartlist_new();
+  return tor_malloc_zero(sizeof(relay_payments_t));
 }
 
 /**
- * Add a payment item to a payments list
+ * Copy <b>item</b> into <b>payments</b> as its next hop. Return the stored
+ * copy, which stays valid until the next item is added, or NULL if
+ * <b>payments</b> already holds RELAY_PAYMENTS_MAX_HOPS items.
  */
-void
-relay_payments_add_item(relay_payments_t *payments, relay_payment_item_t *item)
+relay_payment_item_t *
+relay_payments_add_item(relay_payments_t *payments,
+                        const relay_payment_item_t *item)
 {
+  relay_payment_item_t *copy;
+  unsigned slot;
+
   tor_assert(payments);
   tor_assert(item);
-  smartlist_add(payments, item);
-}
 
-/**
- * Create a copy of a relay payment item
- */
-relay_payment_item_t *
-relay_payment_item_clone(const relay_payment_item_t *src)
-{
-  if (!src)
+  if (payments->n_items == RELAY_PAYMENTS_MAX_HOPS)
     return NULL;
 
-  relay_payment_item_t *copy = relay_payment_item_new();
-
-  if (src->fingerprint)
-    copy->fingerprint = tor_strdup(src->fingerprint);
-
-  if (src->handshake_payment_hash)
-    copy->handshake_payment_hash = tor_strdup(src->handshake_payment_hash);
-
-  if (src->handshake_preimage)
-    copy->handshake_preimage = tor_strdup(src->handshake_preimage);
-
-  if (src->payhashes)
-    copy->payhashes = tor_strdup(src->payhashes);
-
-  if (src->wire_format)
-    copy->wire_format = tor_strdup(src->wire_format);
+  payments->items = tor_reallocarray(payments->items,
+                                     payments->n_items + 1, sizeof(*item));
+  copy = &payments->items[payments->n_items++];
+  memcpy(copy, item, sizeof(*item));
+
+  /* The index is twice as large as the list can grow, so there is always
+   * an empty slot. A repeated fingerprint keeps its first hop. */
+  slot = fingerprint_slot(copy->fingerprint);
+  while (payments->by_fingerprint[slot]) {
+    const relay_payment_item_t *other =
+      &payments->items[payments->by_fingerprint[slot] - 1];
+    if (fast_memeq(other->fingerprint, copy->fingerprint, DIGEST_LEN))
+      return copy;
+    slot = (slot + 1) & (RELAY_PAYMENTS_INDEX_SIZE - 1);
+  }
+  payments->by_fingerprint[slot] = (uint8_t) payments->n_items;
 
   return copy;
 }
 
+/** Return the number of hops in <b>payments</b>. */
+int
+relay_payments_len(const relay_payments_t *payments)
+{
+  return payments ? payments->n_items : 0;
+}
+
 /**
  * Create a copy of an entire relay payments collection
  */
@@ -122,56 +103,77 @@ relay_payments_clone(const relay_payments_t *src)
     return NULL;
 
   relay_payments_t *copy = relay_payments_new();
-
-  SMARTLIST_FOREACH_BEGIN (src, const relay_payment_item_t *, item) {
-    relay_payment_item_t *item_copy = relay_payment_item_clone(item);
-    if (item_copy) {
-      relay_payments_add_item(copy, item_copy);
-    }
+  if (src->n_items) {
+    copy->items = tor_memdup(src->items,
+                             src->n_items * sizeof(*src->items));
+    copy->n_items = src->n_items;
+    memcpy(copy->by_fingerprint, src->by_fingerprint,
+           sizeof(copy->by_fingerprint));
   }
-  SMARTLIST_FOREACH_END(item);
 
   return copy;
 }
 
 /**
- * Find a relay payment item by its fingerprint
+ * Find a relay payment item by the DIGEST_LEN-byte identity digest
+ * <b>fingerprint</b> of its relay.
  *
  * @param payments The collection to search
- * @param fingerprint The fingerprint to search for
+ * @param fingerprint The identity digest to search for
  * @return The matching relay_payment_item_t or NULL if not found
  */
-relay_payment_item_t *
+const relay_payment_item_t *
 relay_payments_find_by_fingerprint(const relay_payments_t *payments,
-                                   const char *fingerprint)
+                                   const uint8_t *fingerprint)
 {
+  unsigned slot;
+
   if (!payments || !fingerprint)
     return NULL;
 
-  SMARTLIST_FOREACH_BEGIN (payments, relay_payment_item_t *, item) {
-    if (item->fingerprint && !strcasecmp(item->fingerprint, fingerprint)) {
+  slot = fingerprint_slot(fingerprint);
+  while (payments->by_fingerprint[slot]) {
+    const relay_payment_item_t *item =
+      &payments->items[payments->by_fingerprint[slot] - 1];
+    if (fast_memeq(item->fingerprint, fingerprint, DIGEST_LEN))
       return item;
-    }
+    slot = (slot + 1) & (RELAY_PAYMENTS_INDEX_SIZE - 1);
   }
-  SMARTLIST_FOREACH_END(item);
 
   return NULL;
 }
 
 /**
- * Find a relay payment item by its hop number (list index)
+ * Find a relay payment item by its hop number
  *
  * @param payments The collection to search
- * @param hop_num The index (hop number) to retrieve
- * @return The relay_payment_item_t at the given index, or NULL if out of bounds
+ * @param hop_num The hop number to retrieve, counting from 1
+ * @return The relay_payment_item_t of that hop, or NULL if out of bounds
  */
-relay_payment_item_t *
+const relay_payment_item_t *
 relay_payments_find_by_hop_num(const relay_payments_t *payments, int hop_num)
 {
-  if (!payments || hop_num < 1 || hop_num > smartlist_len(payments))
+  if (!payments || hop_num < 1 || hop_num > payments->n_items)
     return NULL;
 
-  return smartlist_get(payments, hop_num - 1);
+  return &payments->items[hop_num - 1];
+}
+
+/**
+ * Return the payment material of <b>item</b> as it goes on the wire: the
+ * handshake payment hash, the handshake preimage, then the payment id
+ * hashes, PAYMENT_HASH_LEN bytes each. Set *<b>n_out</b> to the number of
+ * values.
+ */
+const uint8_t *
+relay_payment_item_get_material(const relay_payment_item_t *item,
+                                size_t *n_out)
+{
+  tor_assert(item);
+  tor_assert(n_out);
+
+  *n_out = RELAY_PAYMENT_FIRST_ROUND + item->n_payhashes;
+  return item->material[0];
 }
 
 /**
@@ -183,13 +185,19 @@ relay_payment_item_is_valid(const relay_payment_item_t *item)
   if (!item)
     return 0;
 
-  if (!item->fingerprint || !strlen(item->fingerprint))
+  if (fast_mem_is_zero((const char *) item->fingerprint, DIGEST_LEN))
     return 0;
 
-  if (!item->handshake_payment_hash || !strlen(item->handshake_payment_hash))
+  if (fast_mem_is_zero(
+               (const char *) item->material[RELAY_PAYMENT_HANDSHAKE_HASH],
+               PAYMENT_HASH_LEN))
     return 0;
 
-  /* payhashes and wire_format can be NULL if not needed */
+  if (item->n_payhashes > RELAY_PAYMENT_ROUNDS)
+    return 0;
+
+  /* A hop may have no payment id hashes if it is only paid a handshake
+   * fee. */
 
   return 1;
 }
@@ -200,20 +208,20 @@ relay_payment_item_is_valid(const relay_payment_item_t *item)
 void
 log_relay_payment(const relay_payment_item_t *payment_item)
 {
-  log_debug(
-      LD_CONTROL,
-      "Parsed payment_item: fingerprint=%s, handshake_payment_hash=%s, "
-      "handshake_preimage=%s, payhashes=%s, wire_format=%s",
-      payment_item && payment_item->fingerprint ? payment_item->fingerprint
-                                                : "(null)",
-      payment_item && payment_item->handshake_payment_hash
-          ? payment_item->handshake_payment_hash
-          : "(null)",
-      payment_item && payment_item->handshake_preimage
-          ? payment_item->handshake_preimage
-          : "(null)",
-      payment_item && payment_item->payhashes ? payment_item->payhashes
-                                              : "(null)",
-      payment_item && payment_item->wire_format ? payment_item->wire_format
-                                                : "(null)");
+  char fp[HEX_DIGEST_LEN + 1];
+  char hash[HEX_DIGEST256_LEN + 1];
+
+  if (!payment_item) {
+    log_debug(LD_CONTROL, "Parsed payment_item: (null)");
+    return;
+  }
+
+  base16_encode(fp, sizeof(fp), (const char *) payment_item->fingerprint,
+                DIGEST_LEN);
+  base16_encode(hash, sizeof(hash),
+        (const char *) payment_item->material[RELAY_PAYMENT_HANDSHAKE_HASH],
+                PAYMENT_HASH_LEN);
+  log_debug(LD_CONTROL,
+            "Parsed payment_item: fingerprint=%s, handshake_payment_hash=%s, "
+            "payhashes=%u", fp, hash, (unsigned) payment_item->n_payhashes);
 }
@@ -1,20 +1,50 @@
 #ifndef RELAY_PAYMENTS_ST_H
 #define RELAY_PAYMENTS_ST_H
 
-#include <stdlib.h>
-#include <string.h>
-#include "lib/container/smartlist.h"
+#include "lib/cc/torint.h"
+#include "lib/defs/digest_sizes.h"
+#include "feature/payment/payment_util.h"
+#include "feature/payment/relay_payments.h"
 
+/** Most hops a paid circuit carries payment material for. */
+#define RELAY_PAYMENTS_MAX_HOPS 8
+/** Payment id hashes per hop: one for each payment round. */
+#define RELAY_PAYMENT_ROUNDS (PAYMENT_HASHES_PER_HOP - 2)
+/** Slots in the fingerprint index of a relay_payments_t. A power of two,
+ * at least twice RELAY_PAYMENTS_MAX_HOPS so that probing stays short. */
+#define RELAY_PAYMENTS_INDEX_SIZE 16
 
-typedef struct {
-  char *fingerprint;
-  char *handshake_payment_hash;
-  char *handshake_preimage;
-  char *payhashes;
-  char *wire_format;
-} relay_payment_item_t;
+/** Index in relay_payment_item_t.material of the hash of the handshake fee
+ * payment. */
+#define RELAY_PAYMENT_HANDSHAKE_HASH 0
+/** Index in relay_payment_item_t.material of the preimage of the handshake
+ * fee payment. */
+#define RELAY_PAYMENT_HANDSHAKE_PREIMAGE 1
+/** Index in relay_payment_item_t.material of the payment id hash of the
+ * first payment round; the other rounds follow. */
+#define RELAY_PAYMENT_FIRST_ROUND 2
 
-/* A list of relay payment items */
-typedef smartlist_t relay_payments_t;
+/** The payment material a client sends one hop of a paid circuit. */
+struct relay_payment_item_t {
+  /** Identity digest of the relay this hop pays. */
+  uint8_t fingerprint[DIGEST_LEN];
+  /** Number of payment id hashes in material, after the handshake hash and
+   * preimage. */
+  uint8_t n_payhashes;
+  /** The hop's payment material in wire order, indexed by the
+   * RELAY_PAYMENT_* constants above. */
+  uint8_t material[PAYMENT_HASHES_PER_HOP][PAYMENT_HASH_LEN];
+};
+
+/** The payment items of one paid circuit, in hop order. */
+struct relay_payments_t {
+  /** Number of items in <b>items</b>. */
+  int n_items;
+  /** The item of hop <b>i</b>+1, in one array of <b>n_items</b> entries. */
+  relay_payment_item_t *items;
+  /** Open-addressed index from fingerprint to hop number; 0 marks an empty
+   * slot. */
+  uint8_t by_fingerprint[RELAY_PAYMENTS_INDEX_SIZE];
+};
 
 #endif /* !defined(RELAY_PAYMENTS_ST_H) */
@@ -0,0 +1,190 @@
+/**
+ * @file teardown_journal.c
+ * @brief Buffered, append-only journal of circuit teardown requests
+ *
+ * TEARDOWNCIRCUIT records every circuit it is asked to tear down, one line
+ * per circuit, so that the payment daemon can settle up afterwards. A
+ * non-payment sweep can tear down thousands of circuits at once, so
+ * records are not written one by one. They collect in a buffer that is
+ * written out, with a single fsync, at most TEARDOWN_JOURNAL_FLUSH_INTERVAL
+ * seconds later, or as soon as TEARDOWN_JOURNAL_FLUSH_SIZE bytes are
+ * waiting.
+ *
+ * The journal is TEARDOWN_JOURNAL_FNAME in the DataDirectory. We keep it
+ * open between writes, and once it reaches TEARDOWN_JOURNAL_MAX_SIZE we
+ * move it aside to TEARDOWN_JOURNAL_FNAME ".1", replacing the previous
+ * one, and start a new file.
+ **/
+
+#define TEARDOWN_JOURNAL_PRIVATE
+
+#include "core/or/or.h"
+#include "app/config/config.h"
+#include "feature/payment/teardown_journal.h"
+#include "lib/buf/buffers.h"
+#include "lib/evloop/compat_libevent.h"
+#include "lib/fs/files.h"
+#include "lib/log/ratelim.h"
+#include "lib/net/buffers_net.h"
+
+#ifdef HAVE_SYS_STAT_H
+#include <sys/stat.h>
+#endif
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+/** Path of the journal, fixed when the first record is added: the
+ * options are gone by the time we write out the last records at
+ * shutdown. */
+static char *journal_fname = NULL;
+/** Records not yet written out. */
+static buf_t *journal_buf = NULL;
+/** The open journal file, or -1. */
+static int journal_fd = -1;
+/** Size of the open journal file. */
+static uint64_t journal_size = 0;
+/** Event that writes the records out. */
+static mainloop_event_t *flush_event = NULL;
+/** True iff flush_event is scheduled. */
+static int flush_scheduled = 0;
+/** Size at which we rotate the journal. Tests lower it. */
+STATIC uint64_t teardown_journal_max_size = TEARDOWN_JOURNAL_MAX_SIZE;
+
+/** Open the journal in the DataDirectory for appending. Return 0 on
+ * success, -1 on failure. */
+static int
+teardown_journal_open(void)
+{
+  struct stat st;
+
+  journal_fd = tor_open_cloexec(journal_fname, O_WRONLY|O_CREAT|O_APPEND,
+                                0600);
+  if (journal_fd < 0) {
+    log_warn(LD_FS, "Couldn't open circuit teardown journal %s: %s",
+             escaped(journal_fname), strerror(errno));
+    return -1;
+  }
+  journal_size = fstat(journal_fd, &st) == 0 ? (uint64_t) st.st_size : 0;
+  return 0;
+}
+
+/** Close the journal and move it aside, so that the next write starts a
+ * new one. */
+static void
+teardown_journal_rotate(void)
+{
+  char *old_fname = NULL;
+
+  close(journal_fd);
+  journal_fd = -1;
+  journal_size = 0;
+  tor_asprintf(&old_fname, "%s.1", journal_fname);
+  if (replace_file(journal_fname, old_fname) < 0) {
+    log_warn(LD_FS, "Couldn't rotate circuit teardown journal %s: %s",
+             escaped(journal_fname), strerror(errno));
+  }
+  tor_free(old_fname);
+}
+
+/** Write every buffered record to the journal and sync it to disk. Return
+ * 0 on success, or -1 if some records are still waiting. */
+int
+teardown_journal_flush(void)
+{
+  flush_scheduled = 0;
+  if (!journal_buf || buf_datalen(journal_buf) == 0)
+    return 0;
+  if (journal_fd < 0 && teardown_journal_open() < 0)
+    return -1;
+
+  while (buf_datalen(journal_buf)) {
+    int n = buf_flush_to_pipe(journal_buf, journal_fd,
+                              buf_datalen(journal_buf));
+    if (n <= 0) {
+      log_warn(LD_FS, "Couldn't write circuit teardown journal: %s",
+               strerror(errno));
+      close(journal_fd);
+      journal_fd = -1;
+      return -1;
+    }
+    journal_size += n;
+  }
+#ifdef HAVE_FSYNC
+  (void) fsync(journal_fd);
+#endif
+
+  if (journal_size >= teardown_journal_max_size)
+    teardown_journal_rotate();
+  return 0;
+}
+
+/** Callback for flush_event. */
+static void
+teardown_journal_flush_cb(mainloop_event_t *ev, void *arg)
+{
+  (void) ev;
+  (void) arg;
+  teardown_journal_flush();
+}
+
+/** Append <b>record</b>, a line without its newline, to the journal. It
+ * reaches the disk within TEARDOWN_JOURNAL_FLUSH_INTERVAL seconds. */
+void
+teardown_journal_add(const char *record)
+{
+  static ratelim_t drop_limit = RATELIM_INIT(300);
+
+  if (!journal_buf)
+    journal_buf = buf_new();
+  if (!journal_fname) {
+    journal_fname = options_get_datadir_fname(get_options(),
+                                              TEARDOWN_JOURNAL_FNAME);
+  }
+  if (buf_datalen(journal_buf) >= TEARDOWN_JOURNAL_MAX_BUFFERED) {
+    log_fn_ratelim(&drop_limit, LOG_WARN, LD_FS,
+                   "Circuit teardown journal can't keep up; dropping "
+                   "records.");
+    return;
+  }
+  buf_add_string(journal_buf, record);
+  buf_add(journal_buf, "\n", 1);
+
+  if (buf_datalen(journal_buf) >= TEARDOWN_JOURNAL_FLUSH_SIZE) {
+    teardown_journal_flush();
+  } else if (!flush_scheduled) {
+    const struct timeval tv = { TEARDOWN_JOURNAL_FLUSH_INTERVAL, 0 };
+    if (!flush_event)
+      flush_event = mainloop_event_new(teardown_journal_flush_cb, NULL);
+    mainloop_event_schedule(flush_event, &tv);
+    flush_scheduled = 1;
+  }
+}
+
+#ifdef TOR_UNIT_TESTS
+/** Return the number of bytes of records waiting to be written. */
+STATIC size_t
+teardown_journal_buffered(void)
+{
+  return journal_buf ? buf_datalen(journal_buf) : 0;
+}
+#endif /* defined(TOR_UNIT_TESTS) */
+
+/** Write out every waiting record, close the journal and release all
+ * storage. */
+void
+teardown_journal_free_all(void)
+{
+  teardown_journal_flush();
+  if (journal_fd >= 0)
+    close(journal_fd);
+  journal_fd = -1;
+  journal_size = 0;
+  buf_free(journal_buf);
+  tor_free(journal_fname);
+  mainloop_event_free(flush_event);
+  flush_scheduled = 0;
+}
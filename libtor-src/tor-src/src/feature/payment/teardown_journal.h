@@ -0,0 +1,33 @@
+/**
+ * @file teardown_journal.h
+ * @brief Header for the buffered circuit teardown journal
+ **/
+
+#ifndef TEARDOWN_JOURNAL_H
+#define TEARDOWN_JOURNAL_H
+
+#include "core/or/or.h"
+
+/** Name of the journal file in the DataDirectory. The previous journal is
+ * kept under this name with ".1" appended. */
+#define TEARDOWN_JOURNAL_FNAME "circuit_teardown.log"
+/** Seconds a record may wait in memory before we write it out. */
+#define TEARDOWN_JOURNAL_FLUSH_INTERVAL 1
+/** Bytes of records that make us write out at once. */
+#define TEARDOWN_JOURNAL_FLUSH_SIZE (64 * 1024)
+/** Size at which we start a new journal file. */
+#define TEARDOWN_JOURNAL_MAX_SIZE (16 * 1024 * 1024)
+/** Most bytes of records we hold in memory while we can't write them out;
+ * records beyond that are dropped. */
+#define TEARDOWN_JOURNAL_MAX_BUFFERED (4 * 1024 * 1024)
+
+void teardown_journal_add(const char *record);
+int teardown_journal_flush(void);
+void teardown_journal_free_all(void);
+
+#if defined(TEARDOWN_JOURNAL_PRIVATE) && defined(TOR_UNIT_TESTS)
+STATIC size_t teardown_journal_buffered(void);
+extern uint64_t teardown_journal_max_size;
+#endif
+
+#endif /* !defined(TEARDOWN_JOURNAL_H) */
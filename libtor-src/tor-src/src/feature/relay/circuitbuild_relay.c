@@ -46,6 +46,8 @@
 #include "feature/payment/payment_util.h" 
 #include "feature/control/control_events.h"
 
+#include "lib/trace/trace_ring.h"
+
 /* Before replying to an extend cell, check the state of the circuit
  * <b>circ</b>, and the configured tor mode.
  *
@@ -444,12 +446,8 @@ circuit_extend(struct cell_t *cell, struct circuit_t *circ)
   if (circuit_extend_state_valid_helper(circ) < 0)
     return -1;
 
-  log_notice(LD_CIRC, "ELTOR RELAY %s: Processing EXTEND cell (circuit ID: %u)", get_options()->Nickname, circ->n_circ_id);
-
   relay_header_unpack(&rh, cell->payload);
 
-  log_notice(LD_CIRC, "ELTOR RELAY %s: Unpacked relay header (cmd=%d, len=%d)", get_options()->Nickname, rh.command, (int)rh.length);
-
   if (extend_cell_parse(&ec, rh.command,
                         cell->payload+RELAY_HEADER_SIZE,
                         rh.length) < 0) {
@@ -458,17 +456,14 @@ circuit_extend(struct cell_t *cell, struct circuit_t *circ)
     return -1;
   }
 
-  log_notice(LD_CIRC, "ELTOR RELAY %s: Received extend cell payload (len=%d)", get_options()->Nickname, (int)sizeof(cell->payload));
+  trace_ring_add("relay_extend", ec.n_payhashes, ec.node_id, DIGEST_LEN);
 
-  // Check to to see if a payment id hash was passed
-  int has_payment_id_hash = payment_util_has_payment_id_hash(cell->payload, sizeof(cell->payload));
-  if (has_payment_id_hash == 0) {
-    log_notice(LD_CIRC, "ELTOR RELAY %s: No payment hash found in extend cell",
-              get_options()->Nickname);
+  /* Only extend paid circuits. */
+  if (ec.n_payhashes == 0) {
+    log_fn(LOG_PROTOCOL_WARN, LD_PROTOCOL,
+           "Client asked me to extend without payment material. "
+           "Closing circuit.");
     return -1;
-  } else {
-    log_notice(LD_CIRC, "ELTOR RELAY %s: Successfully found payment hash in extend cell",
-              get_options()->Nickname);
   }
 
   if (circuit_extend_add_ed25519_helper(&ec) < 0)
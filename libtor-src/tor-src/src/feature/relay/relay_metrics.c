@@ -58,6 +58,7 @@ static void fill_streams_values(void);
 static void fill_relay_circ_proto_violation(void);
 static void fill_relay_destroy_cell(void);
 static void fill_relay_drop_cell(void);
+static void fill_cell_pool_values(void);
 static void fill_relay_flags(void);
 static void fill_tcp_exhaustion_values(void);
 static void fill_traffic_values(void);
@@ -242,6 +243,13 @@ static const relay_metrics_entry_t base_metrics[] =
     .help = "Total number of DROP cell we received",
     .fill_fn = fill_relay_drop_cell,
   },
+  {
+    .key = RELAY_METRICS_CELL_POOL,
+    .type = METRICS_TYPE_GAUGE,
+    .name = METRICS_NAME(relay_cell_pool),
+    .help = "Usage of the slab pools cells are allocated from",
+    .fill_fn = fill_cell_pool_values,
+  },
 };
 static const size_t num_base_metrics = ARRAY_LENGTH(base_metrics);
 
@@ -1271,6 +1279,46 @@ fill_relay_circ_proto_violation(void)
   metrics_store_entry_update(sentry, circ_n_proto_violation);
 }
 
+/** Add the RELAY_METRICS_CELL_POOL values of the pool <b>name</b>, whose
+ * usage is <b>stats</b>. */
+static void
+fill_one_cell_pool_values(const char *name, const cell_pool_stats_t *stats)
+{
+  const relay_metrics_entry_t *rentry =
+    &base_metrics[RELAY_METRICS_CELL_POOL];
+  const struct {
+    const char *item;
+    size_t value;
+  } items[] = {
+    { "slabs", stats->n_slabs },
+    { "empty_slabs", stats->n_empty_slabs },
+    { "cells_used", stats->n_used },
+    { "cells_capacity", stats->n_capacity },
+    { "bytes", stats->n_bytes },
+  };
+
+  for (size_t i = 0; i < ARRAY_LENGTH(items); i++) {
+    metrics_store_entry_t *sentry = metrics_store_add(
+        the_store, rentry->type, rentry->name, rentry->help, 0, NULL);
+    metrics_store_entry_add_label(sentry,
+            metrics_format_label("pool", name));
+    metrics_store_entry_add_label(sentry,
+            metrics_format_label("item", items[i].item));
+    metrics_store_entry_update(sentry, (int64_t) items[i].value);
+  }
+}
+
+/** Fill function for the RELAY_METRICS_CELL_POOL metric. */
+static void
+fill_cell_pool_values(void)
+{
+  cell_pool_stats_t packed, destroy;
+
+  cell_pools_get_stats(&packed, &destroy);
+  fill_one_cell_pool_values("packed", &packed);
+  fill_one_cell_pool_values("destroy", &destroy);
+}
+
 /** Reset the global store and fill it with all the metrics from base_metrics
  * and their associated values.
  *
@@ -63,6 +63,8 @@ typedef enum {
   RELAY_METRICS_CIRC_PROTO_VIOLATION,
   /** Number of drop cell seen. */
   RELAY_METRICS_CIRC_DROP_CELL,
+  /** Usage of the packed and destroy cell pools. */
+  RELAY_METRICS_CELL_POOL,
 } relay_metrics_key_t;
 
 /** The metadata of a relay metric. */
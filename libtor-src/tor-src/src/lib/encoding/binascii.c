@@ -521,7 +521,7 @@ base16_decode(char *dest, size_t destlen, const char *src, size_t srclen)
   while (src<end) {
     v1 = hex_decode_digit(*src);
     v2 = hex_decode_digit(*(src+1));
-    if (v1<0||v2<0)
+    if ((v1|v2)<0)
       return -1;
     *(uint8_t*)dest = (v1<<4)|v2;
     ++dest;
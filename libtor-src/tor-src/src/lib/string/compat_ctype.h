@@ -36,32 +36,15 @@ extern const uint8_t TOR_TOLOWER_TABLE[];
 #define TOR_TOLOWER(c) (TOR_TOLOWER_TABLE[(uint8_t)c])
 #define TOR_TOUPPER(c) (TOR_TOUPPER_TABLE[(uint8_t)c])
 
+extern const int8_t TOR_HEX_DIGIT_TABLE[];
+
 static inline int hex_decode_digit(char c);
 
 /** Helper: given a hex digit, return its value, or -1 if it isn't hex. */
 static inline int
 hex_decode_digit(char c)
 {
-  switch (c) {
-    case '0': return 0;
-    case '1': return 1;
-    case '2': return 2;
-    case '3': return 3;
-    case '4': return 4;
-    case '5': return 5;
-    case '6': return 6;
-    case '7': return 7;
-    case '8': return 8;
-    case '9': return 9;
-    case 'A': case 'a': return 10;
-    case 'B': case 'b': return 11;
-    case 'C': case 'c': return 12;
-    case 'D': case 'd': return 13;
-    case 'E': case 'e': return 14;
-    case 'F': case 'f': return 15;
-    default:
-      return -1;
-  }
+  return TOR_HEX_DIGIT_TABLE[(uint8_t)c];
 }
 
 #endif /* !defined(TOR_COMPAT_CTYPE_H) */
@@ -0,0 +1,239 @@
+/* See LICENSE for licensing information */
+
+/**
+ * \file trace_ring.c
+ * \brief Always-available binary trace records, kept in memory.
+ *
+ * Unlike the tracepoints in events.h, which need a tracing build, this
+ * module can be switched on at runtime. Each thread that records an event
+ * gets its own ring of TRACE_RING_LEN fixed-size records, so writers never
+ * contend with each other: a record is written in place, without
+ * formatting, and the oldest record is overwritten once the ring is full.
+ *
+ * Readers (normally the main thread answering a controller) copy records
+ * out with trace_ring_snapshot(). Each slot carries a sequence number that
+ * is odd while the slot is being written, so a reader can tell when it
+ * raced with a writer and skip that slot instead of taking a lock.
+ **/
+
+#include "orconfig.h"
+#include "lib/trace/trace_ring.h"
+
+#include "lib/lock/compat_mutex.h"
+#include "lib/log/util_bug.h"
+#include "lib/malloc/malloc.h"
+#include "lib/thread/threads.h"
+#include "lib/time/compat_time.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/** One slot in a ring. */
+typedef struct trace_slot_t {
+#ifdef HAVE_WORKING_STDATOMIC
+  /** Even when the slot is stable, odd while it is being written, and 0 if
+   * it was never written. */
+  atomic_size_t seq;
+#else
+  size_t seq;
+#endif
+  trace_record_t rec;
+} trace_slot_t;
+
+/** The records written by one thread. */
+typedef struct trace_ring_t {
+  /** Next ring in the list of all rings. */
+  struct trace_ring_t *next;
+#ifndef HAVE_WORKING_STDATOMIC
+  /** Without atomics, writer and reader take turns on this lock. Only the
+   * owning thread ever writes, so it is uncontended outside of
+   * snapshots. */
+  tor_mutex_t lock;
+#endif
+  /** Number of the owning thread, for trace_record_t.thread. */
+  uint32_t thread;
+  /** Number of records ever written. Only the owning thread uses it. */
+  size_t n_written;
+  trace_slot_t slots[TRACE_RING_LEN];
+} trace_ring_t;
+
+int trace_ring_enabled_ = 0;
+
+/** True once ring_key and rings_lock are set up. */
+static int trace_ring_initialized = 0;
+/** The current thread's ring, or NULL if it has not recorded anything. */
+static tor_threadlocal_t ring_key;
+/** Protects the list of all rings. */
+static tor_mutex_t rings_lock;
+/** Every ring, most recently created first. */
+static trace_ring_t *all_rings = NULL;
+/** Number of rings created so far. */
+static uint32_t n_rings = 0;
+
+#ifdef HAVE_WORKING_STDATOMIC
+#define SLOT_SEQ_LOAD(slot) \
+  atomic_load_explicit(&(slot)->seq, memory_order_acquire)
+#define SLOT_SEQ_STORE(slot, v) \
+  atomic_store_explicit(&(slot)->seq, (v), memory_order_release)
+#define RING_LOCK(ring) STMT_NIL
+#define RING_UNLOCK(ring) STMT_NIL
+#else
+#define SLOT_SEQ_LOAD(slot) ((slot)->seq)
+#define SLOT_SEQ_STORE(slot, v) ((slot)->seq = (v))
+#define RING_LOCK(ring) tor_mutex_acquire(&(ring)->lock)
+#define RING_UNLOCK(ring) tor_mutex_release(&(ring)->lock)
+#endif /* defined(HAVE_WORKING_STDATOMIC) */
+
+/** Return the current thread's ring, creating it if necessary. */
+static trace_ring_t *
+trace_ring_get_mine(void)
+{
+  trace_ring_t *ring = tor_threadlocal_get(&ring_key);
+  if (PREDICT_LIKELY(ring))
+    return ring;
+
+  ring = tor_malloc_zero(sizeof(*ring));
+#ifndef HAVE_WORKING_STDATOMIC
+  tor_mutex_init_nonrecursive(&ring->lock);
+#endif
+  tor_mutex_acquire(&rings_lock);
+  ring->thread = n_rings++;
+  ring->next = all_rings;
+  all_rings = ring;
+  tor_mutex_release(&rings_lock);
+
+  tor_threadlocal_set(&ring_key, ring);
+  return ring;
+}
+
+/** Implementation of trace_ring_add(): append a record to the current
+ * thread's ring. */
+void
+trace_ring_add_(const char *event, uint64_t arg,
+                const void *data, size_t data_len)
+{
+  trace_ring_t *ring;
+  trace_slot_t *slot;
+  size_t seq;
+
+  if (!trace_ring_initialized)
+    return;
+
+  ring = trace_ring_get_mine();
+  slot = &ring->slots[ring->n_written++ & (TRACE_RING_LEN - 1)];
+  if (data_len > TRACE_RECORD_DATA_LEN)
+    data_len = TRACE_RECORD_DATA_LEN;
+
+  RING_LOCK(ring);
+  seq = SLOT_SEQ_LOAD(slot);
+  SLOT_SEQ_STORE(slot, seq + 1);
+#ifdef HAVE_WORKING_STDATOMIC
+  atomic_thread_fence(memory_order_release);
+#endif
+  slot->rec.usec = monotime_coarse_absolute_usec();
+  slot->rec.event = event;
+  slot->rec.arg = arg;
+  slot->rec.thread = ring->thread;
+  slot->rec.data_len = (uint8_t) data_len;
+  if (data_len)
+    memcpy(slot->rec.data, data, data_len);
+  SLOT_SEQ_STORE(slot, seq + 2);
+  RING_UNLOCK(ring);
+}
+
+/** Set up the trace rings. Called once, from the tracing subsystem, before
+ * any thread is started. */
+void
+trace_ring_init(void)
+{
+  if (trace_ring_initialized)
+    return;
+  tor_threadlocal_init(&ring_key);
+  tor_mutex_init_nonrecursive(&rings_lock);
+  trace_ring_initialized = 1;
+}
+
+/** Turn trace recording on or off. */
+void
+trace_ring_set_enabled(int enabled)
+{
+  trace_ring_enabled_ = !!enabled;
+}
+
+/** Helper for qsort: order records by time, then by thread. */
+static int
+trace_record_compare(const void *a_, const void *b_)
+{
+  const trace_record_t *a = a_, *b = b_;
+  if (a->usec != b->usec)
+    return a->usec < b->usec ? -1 : 1;
+  if (a->thread != b->thread)
+    return a->thread < b->thread ? -1 : 1;
+  return 0;
+}
+
+/** Return a newly allocated array holding a copy of every record in every
+ * thread's ring, oldest first, and set *<b>n_out</b> to its length. Records
+ * that are being written while we look are left out. */
+trace_record_t *
+trace_ring_snapshot(size_t *n_out)
+{
+  trace_record_t *out;
+  size_t n = 0;
+
+  tor_assert(n_out);
+  *n_out = 0;
+  if (!trace_ring_initialized)
+    return tor_malloc(sizeof(trace_record_t));
+
+  tor_mutex_acquire(&rings_lock);
+  out = tor_malloc(sizeof(trace_record_t) * TRACE_RING_LEN *
+                   (n_rings ? n_rings : 1));
+  for (trace_ring_t *ring = all_rings; ring; ring = ring->next) {
+    RING_LOCK(ring);
+    for (int i = 0; i < TRACE_RING_LEN; ++i) {
+      const trace_slot_t *slot = &ring->slots[i];
+      size_t seq = SLOT_SEQ_LOAD(slot);
+      if (seq == 0 || (seq & 1))
+        continue;
+      memcpy(&out[n], &slot->rec, sizeof(trace_record_t));
+#ifdef HAVE_WORKING_STDATOMIC
+      atomic_thread_fence(memory_order_acquire);
+#endif
+      if (SLOT_SEQ_LOAD(slot) == seq)
+        ++n;
+    }
+    RING_UNLOCK(ring);
+  }
+  tor_mutex_release(&rings_lock);
+
+  qsort(out, n, sizeof(trace_record_t), trace_record_compare);
+  *n_out = n;
+  return out;
+}
+
+/** Stop recording and release every ring. No other thread may record an
+ * event while this runs. */
+void
+trace_ring_free_all(void)
+{
+  trace_ring_t *ring, *next;
+
+  trace_ring_enabled_ = 0;
+  if (!trace_ring_initialized)
+    return;
+
+  for (ring = all_rings; ring; ring = next) {
+    next = ring->next;
+#ifndef HAVE_WORKING_STDATOMIC
+    tor_mutex_uninit(&ring->lock);
+#endif
+    tor_free(ring);
+  }
+  all_rings = NULL;
+  n_rings = 0;
+
+  tor_threadlocal_destroy(&ring_key);
+  tor_mutex_uninit(&rings_lock);
+  trace_ring_initialized = 0;
+}
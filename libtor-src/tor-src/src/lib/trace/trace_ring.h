@@ -0,0 +1,58 @@
+/* See LICENSE for licensing information */
+
+/**
+ * \file trace_ring.h
+ * \brief Header for trace_ring.c
+ **/
+
+#ifndef TOR_LIB_TRACE_TRACE_RING_H
+#define TOR_LIB_TRACE_TRACE_RING_H
+
+#include "orconfig.h"
+#include "lib/cc/compat_compiler.h"
+#include "lib/cc/torint.h"
+
+/** Number of records each thread's ring holds. Must be a power of two. */
+#define TRACE_RING_LEN 1024
+/** Most bytes of binary data a trace record can carry. */
+#define TRACE_RECORD_DATA_LEN 32
+
+/** One fixed-size trace record. */
+typedef struct trace_record_t {
+  /** When the record was written, in monotonic microseconds. */
+  uint64_t usec;
+  /** Name of the event. Always a string with static storage. */
+  const char *event;
+  /** Event-specific integer argument. */
+  uint64_t arg;
+  /** Small integer naming the thread that wrote the record: rings are
+   * numbered in the order their threads first wrote to them. */
+  uint32_t thread;
+  /** Number of bytes used in <b>data</b>. */
+  uint8_t data_len;
+  /** Event-specific binary data. */
+  uint8_t data[TRACE_RECORD_DATA_LEN];
+} trace_record_t;
+
+/** True iff trace records are being kept. Use trace_ring_set_enabled() to
+ * change it. */
+extern int trace_ring_enabled_;
+
+/** Record a trace event named <b>event</b> (a string literal), with the
+ * integer <b>arg</b> and up to TRACE_RECORD_DATA_LEN bytes of <b>data</b>.
+ * When tracing is off this is a single predictable branch, and the
+ * arguments are not evaluated. */
+#define trace_ring_add(event, arg, data, data_len)                      \
+  STMT_BEGIN                                                            \
+    if (PREDICT_UNLIKELY(trace_ring_enabled_))                          \
+      trace_ring_add_((event), (arg), (data), (data_len));              \
+  STMT_END
+
+void trace_ring_add_(const char *event, uint64_t arg,
+                     const void *data, size_t data_len);
+void trace_ring_init(void);
+void trace_ring_set_enabled(int enabled);
+trace_record_t *trace_ring_snapshot(size_t *n_out);
+void trace_ring_free_all(void);
+
+#endif /* !defined(TOR_LIB_TRACE_TRACE_RING_H) */
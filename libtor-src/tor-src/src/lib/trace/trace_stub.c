@@ -8,12 +8,32 @@
 
 #include "lib/subsys/subsys.h"
 
+#include "lib/trace/trace_ring.h"
 #include "lib/trace/trace_sys.h"
 
+/* The trace ring doesn't need the trace library, so it is set up even when
+ * the rest of tracing is compiled out. */
+
+static int
+subsys_tracing_initialize(void)
+{
+  trace_ring_init();
+  return 0;
+}
+
+static void
+subsys_tracing_shutdown(void)
+{
+  trace_ring_free_all();
+}
+
 const subsys_fns_t sys_tracing = {
   SUBSYS_DECLARE_LOCATION(),
 
   .name = "tracing",
-  .supported = false,
+  .supported = true,
   .level = TRACE_SUBSYS_LEVEL,
+
+  .initialize = subsys_tracing_initialize,
+  .shutdown = subsys_tracing_shutdown,
 };
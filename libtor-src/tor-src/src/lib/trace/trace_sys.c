@@ -9,12 +9,14 @@
 #include "lib/subsys/subsys.h"
 
 #include "lib/trace/trace.h"
+#include "lib/trace/trace_ring.h"
 #include "lib/trace/trace_sys.h"
 
 static int
 subsys_tracing_initialize(void)
 {
   tor_trace_init();
+  trace_ring_init();
   return 0;
 }
 
@@ -22,6 +24,7 @@ static void
 subsys_tracing_shutdown(void)
 {
   tor_trace_free_all();
+  trace_ring_free_all();
 }
 
 const subsys_fns_t sys_tracing = {
@@ -44,6 +44,14 @@
 #include "feature/dirparse/microdesc_parse.h"
 #include "feature/nodelist/microdesc.h"
 
+#include "core/crypto/onion_crypto.h"
+#include "core/crypto/onion_ntor_v3.h"
+#include "core/or/extend_info_st.h"
+#include "feature/payment/payment_index.h"
+#include "feature/payment/payment_util.h"
+#include "feature/payment/relay_payments.h"
+#include "feature/payment/relay_payments_st.h"
+
 #if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_PROCESS_CPUTIME_ID)
 static uint64_t nanostart;
 static inline uint64_t
@@ -95,6 +103,54 @@ perftime(void)
 #define MICROCOUNT(start,end,iters) \
   ( NANOCOUNT((start), (end), (iters)) / 1000.0 )
 
+#ifdef __GLIBC__
+/* Count heap allocations made by the code under test. glibc lets a program
+ * replace malloc() and friends and still reach its own implementation
+ * through the __libc_* entry points. */
+#define HAVE_ALLOC_COUNT
+extern void *__libc_malloc(size_t n);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *ptr, size_t n);
+static uint64_t n_allocs = 0;
+void *
+malloc(size_t n)
+{
+  ++n_allocs;
+  return __libc_malloc(n);
+}
+void *
+calloc(size_t n, size_t size)
+{
+  ++n_allocs;
+  return __libc_calloc(n, size);
+}
+void *
+realloc(void *ptr, size_t n)
+{
+  ++n_allocs;
+  return __libc_realloc(ptr, n);
+}
+#define ALLOC_COUNT() (n_allocs)
+#else /* !defined(__GLIBC__) */
+#define ALLOC_COUNT() ((uint64_t)0)
+#endif /* defined(__GLIBC__) */
+
+/** Print the time and heap allocations per operation of a benchmark loop
+ * that ran <b>iters</b> times. */
+static void
+print_per_op(const char *what, uint64_t start, uint64_t end,
+             uint64_t allocs, int iters)
+{
+#ifdef HAVE_ALLOC_COUNT
+  printf("%s: %.2f nsec/op, %.2f allocs/op\n", what,
+         NANOCOUNT(start, end, iters), ((double)allocs) / iters);
+#else
+  (void)allocs;
+  printf("%s: %.2f nsec/op, allocs/op n/a\n", what,
+         NANOCOUNT(start, end, iters));
+#endif /* defined(HAVE_ALLOC_COUNT) */
+}
+
 /** Run AES performance benchmarks. */
 static void
 bench_aes(void)
@@ -565,6 +621,29 @@ bench_digest(void)
         printf("ERROR: crypto_digest failed %d times.\n", failures);
     }
   }
+
+  /* The running SHA-1 digests of relay crypto take a cell payload at a time,
+   * and are saved and restored around each check of a recognized cell. */
+  crypto_digest_t *running = crypto_digest_new();
+  crypto_digest_checkpoint_t checkpoint;
+  reset_perftime();
+  start = perftime();
+  for (int j = 0; j < N; ++j) {
+    crypto_digest_add_bytes(running, buf, CELL_PAYLOAD_SIZE);
+    crypto_digest_get_digest(running, out, 4);
+  }
+  end = perftime();
+  printf("sha1 running digest of a cell: %.2f ns per cell\n",
+         NANOCOUNT(start,end,N));
+  start = perftime();
+  for (int j = 0; j < N; ++j) {
+    crypto_digest_checkpoint(&checkpoint, running);
+    crypto_digest_restore(running, &checkpoint);
+  }
+  end = perftime();
+  printf("sha1 running digest checkpoint and restore: %.2f ns per call\n",
+         NANOCOUNT(start,end,N));
+  crypto_digest_free(running);
 }
 
 static void
@@ -612,9 +691,51 @@ bench_cell_ops(void)
            NANOCOUNT(start,end,iters*CELL_PAYLOAD_SIZE));
   }
 
+  /* Outbound cells whose recognized field is zero, so that their digest is
+   * checked: first cells for us, then cells with a wrong digest. They are
+   * made by a client whose keys match ours. */
+  const int n_digest_cells = 1<<12;
+  cell_t *cells = tor_calloc(n_digest_cells, sizeof(cell_t));
+  int corrupt;
+  for (corrupt = 0; corrupt <= 1; ++corrupt) {
+    crypto_cipher_t *client_cipher = crypto_cipher_new(key1);
+    crypto_digest_t *client_digest = crypto_digest_new();
+    relay_crypto_clear(&or_circ->crypto);
+    or_circ->crypto.f_crypto = crypto_cipher_new(key1);
+    or_circ->crypto.b_crypto = crypto_cipher_new(key2);
+    or_circ->crypto.f_digest = crypto_digest_new();
+    or_circ->crypto.b_digest = crypto_digest_new();
+    for (i = 0; i < n_digest_cells; ++i) {
+      crypto_rand((char*)cells[i].payload, CELL_PAYLOAD_SIZE);
+      memset(cells[i].payload + 1, 0, 2);
+      memset(cells[i].payload + 5, 0, 4);
+      relay_set_digest(client_digest, &cells[i]);
+      cells[i].payload[5] ^= corrupt;
+      relay_crypt_one_payload(client_cipher, cells[i].payload);
+    }
+    int n_recognized = 0;
+    start = perftime();
+    for (i = 0; i < n_digest_cells; ++i) {
+      char recognized = 0;
+      crypt_path_t *layer_hint = NULL;
+      relay_decrypt_cell(TO_CIRCUIT(or_circ), &cells[i], CELL_DIRECTION_OUT,
+                         &layer_hint, &recognized);
+      n_recognized += recognized;
+    }
+    end = perftime();
+    printf("Outbound cells %s: %.2f ns per cell.\n",
+           corrupt ? "with a bad digest" : "for us",
+           NANOCOUNT(start,end,n_digest_cells));
+    if (n_recognized != (corrupt ? 0 : n_digest_cells))
+      printf("ERROR: %d cells recognized.\n", n_recognized);
+    crypto_cipher_free(client_cipher);
+    crypto_digest_free(client_digest);
+  }
+
   relay_crypto_clear(&or_circ->crypto);
   tor_free(or_circ);
   tor_free(cell);
+  tor_free(cells);
 }
 
 static void
@@ -739,6 +860,277 @@ bench_md_parse(void)
   printf("Microdesc parse: %f nsec\n", NANOCOUNT(start, end, N));
 }
 
+/** Fill <b>out</b> with a realistic EXTENDPAIDCIRCUIT payment line: a
+ * $-prefixed fingerprint and <b>n_values</b> payment values in hex. */
+static void
+make_payment_line(char *out, size_t out_len, int n_values)
+{
+  uint8_t fp[DIGEST_LEN];
+  uint8_t material[PAYMENT_HASHES_PER_HOP * PAYMENT_HASH_LEN];
+  size_t material_len = n_values * PAYMENT_HASH_LEN;
+
+  tor_assert(out_len >= 2 + HEX_DIGEST_LEN + material_len * 2 + 1);
+  crypto_rand((char *)fp, sizeof(fp));
+  crypto_rand((char *)material, material_len);
+  out[0] = '$';
+  base16_encode(out + 1, HEX_DIGEST_LEN + 1, (char *)fp, sizeof(fp));
+  out[1 + HEX_DIGEST_LEN] = ' ';
+  base16_encode(out + 2 + HEX_DIGEST_LEN, material_len * 2 + 1,
+                (char *)material, material_len);
+}
+
+static void
+bench_payment_parse(void)
+{
+  const int N = 100000;
+  const int n_values[] = { 2, 7, PAYMENT_HASHES_PER_HOP };
+  char line[2 + HEX_DIGEST_LEN +
+            PAYMENT_HASHES_PER_HOP * PAYMENT_HASH_LEN * 2 + 1];
+  relay_payment_item_t item;
+  uint64_t start, end, allocs;
+  unsigned i;
+  int j, failures;
+
+  reset_perftime();
+  for (i = 0; i < ARRAY_LENGTH(n_values); ++i) {
+    char what[64];
+    make_payment_line(line, sizeof(line), n_values[i]);
+    failures = 0;
+    allocs = ALLOC_COUNT();
+    start = perftime();
+    for (j = 0; j < N; ++j) {
+      if (payment_util_parse_payment_line(line, &item) < 0)
+        ++failures;
+    }
+    end = perftime();
+    allocs = ALLOC_COUNT() - allocs;
+    tor_snprintf(what, sizeof(what), "Parse line, %d values (%d bytes)",
+                 n_values[i], (int)strlen(line));
+    print_per_op(what, start, end, allocs, N);
+    if (failures)
+      printf("ERROR: payment_util_parse_payment_line failed %d times.\n",
+             failures);
+  }
+}
+
+static void
+bench_payment_verify(void)
+{
+  const int N = 100000;
+  enum { BATCH = 64 };
+  uint8_t preimages[BATCH * PAYMENT_HASH_LEN];
+  uint8_t payhashes[BATCH * PAYMENT_HASH_LEN];
+  uint8_t ok[BATCH];
+  char preimage_hex[PAYMENT_HASH_LEN * 2 + 1];
+  char payhash_hex[PAYMENT_HASH_LEN * 2 + 1];
+  uint64_t start, end, allocs;
+  int i, failures = 0;
+
+  crypto_rand((char *)preimages, sizeof(preimages));
+  for (i = 0; i < BATCH; ++i) {
+    crypto_digest256((char *)payhashes + i * PAYMENT_HASH_LEN,
+                     (char *)preimages + i * PAYMENT_HASH_LEN,
+                     PAYMENT_HASH_LEN, DIGEST_SHA256);
+  }
+  base16_encode(preimage_hex, sizeof(preimage_hex),
+                (char *)preimages, PAYMENT_HASH_LEN);
+  base16_encode(payhash_hex, sizeof(payhash_hex),
+                (char *)payhashes, PAYMENT_HASH_LEN);
+
+  reset_perftime();
+  allocs = ALLOC_COUNT();
+  start = perftime();
+  for (i = 0; i < N; ++i) {
+    if (!payment_util_verify_preimage(preimage_hex, payhash_hex))
+      ++failures;
+  }
+  end = perftime();
+  allocs = ALLOC_COUNT() - allocs;
+  print_per_op("Verify one preimage (hex)", start, end, allocs, N);
+
+  allocs = ALLOC_COUNT();
+  start = perftime();
+  for (i = 0; i < N / BATCH; ++i) {
+    if (payment_util_verify_preimages(preimages, payhashes, BATCH, ok)
+        != BATCH)
+      ++failures;
+  }
+  end = perftime();
+  allocs = ALLOC_COUNT() - allocs;
+  print_per_op("Verify preimages, batches of 64", start, end, allocs,
+               (N / BATCH) * BATCH);
+
+  if (failures)
+    printf("ERROR: preimage verification failed %d times.\n", failures);
+}
+
+static void
+bench_ntor3_payhash(void)
+{
+  const int N = 1000;
+  extend_info_t info;
+  server_onion_keys_t server_keys;
+  curve25519_keypair_t relay_onion_key, junk_keypair;
+  uint8_t payhashes[PAYMENT_HASHES_PER_HOP * PAYMENT_HASH_LEN];
+  uint8_t onionskin[CELL_PAYLOAD_SIZE];
+  uint8_t reply[CELL_PAYLOAD_SIZE];
+  uint8_t keys[100];
+  uint8_t rend_nonce[DIGEST_LEN];
+  circuit_params_t params_in, params_out;
+  uint64_t start, end, allocs;
+  int paid, i, failures = 0;
+
+  memset(&info, 0, sizeof(info));
+  memset(&server_keys, 0, sizeof(server_keys));
+  memset(&params_in, 0, sizeof(params_in));
+  info.exit_supports_congestion_control = 1;
+  curve25519_keypair_generate(&relay_onion_key, 0);
+  curve25519_keypair_generate(&junk_keypair, 0);
+  memcpy(&info.curve25519_onion_key, &relay_onion_key.pubkey,
+         sizeof(info.curve25519_onion_key));
+  crypto_rand((char *)info.ed_identity.pubkey,
+              sizeof(info.ed_identity.pubkey));
+  memcpy(&server_keys.my_ed_identity, &info.ed_identity,
+         sizeof(server_keys.my_ed_identity));
+  dimap_add_entry(&server_keys.curve25519_key_map,
+                  relay_onion_key.pubkey.public_key, &relay_onion_key);
+  server_keys.junk_keypair = &junk_keypair;
+  crypto_rand((char *)payhashes, sizeof(payhashes));
+
+  reset_perftime();
+  for (paid = 0; paid <= 1; ++paid) {
+    const size_t n_payhashes = paid ? PAYMENT_HASHES_PER_HOP : 0;
+    const char *label = paid ? "with payment extension" : "unpaid";
+    char what[64];
+    int skin_len = 0;
+
+    allocs = ALLOC_COUNT();
+    start = perftime();
+    for (i = 0; i < N; ++i) {
+      onion_handshake_state_t state;
+      memset(&state, 0, sizeof(state));
+      skin_len = onion_skin_create(ONION_HANDSHAKE_TYPE_NTOR_V3, &info,
+                                   &state, onionskin, sizeof(onionskin),
+                                   paid ? payhashes : NULL, n_payhashes);
+      if (skin_len < 0)
+        ++failures;
+      ntor3_handshake_state_free(state.u.ntor3);
+    }
+    end = perftime();
+    allocs = ALLOC_COUNT() - allocs;
+    tor_snprintf(what, sizeof(what), "Client create, %s (%d bytes)",
+                 label, skin_len);
+    print_per_op(what, start, end, allocs, N);
+
+    allocs = ALLOC_COUNT();
+    start = perftime();
+    for (i = 0; i < N; ++i) {
+      if (onion_skin_server_handshake(ONION_HANDSHAKE_TYPE_NTOR_V3,
+                                      onionskin, skin_len, &server_keys,
+                                      &params_in, reply, sizeof(reply),
+                                      keys, sizeof(keys), rend_nonce,
+                                      &params_out) < 0)
+        ++failures;
+    }
+    end = perftime();
+    allocs = ALLOC_COUNT() - allocs;
+    tor_snprintf(what, sizeof(what), "Server handshake, %s", label);
+    print_per_op(what, start, end, allocs, N);
+  }
+
+  if (failures)
+    printf("ERROR: ntor3 handshake failed %d times.\n", failures);
+  dimap_free(server_keys.curve25519_key_map, NULL);
+}
+
+static void
+bench_payment_lookup(void)
+{
+  const int N = 1000000;
+  const int n_hops[] = { 3, RELAY_PAYMENTS_MAX_HOPS };
+  enum { N_CIRCS = 4096 };
+  relay_payment_item_t item;
+  uint8_t fps[RELAY_PAYMENTS_MAX_HOPS][DIGEST_LEN];
+  uint8_t *circ_hashes;
+  or_circuit_t **circs;
+  uint64_t start, end, allocs;
+  unsigned h;
+  int i, misses = 0;
+
+  reset_perftime();
+  for (h = 0; h < ARRAY_LENGTH(n_hops); ++h) {
+    relay_payments_t *payments = relay_payments_new();
+    char what[64];
+
+    for (i = 0; i < n_hops[h]; ++i) {
+      memset(&item, 0, sizeof(item));
+      crypto_rand((char *)fps[i], DIGEST_LEN);
+      memcpy(item.fingerprint, fps[i], DIGEST_LEN);
+      item.n_payhashes = PAYMENT_HASHES_PER_HOP - 2;
+      relay_payments_add_item(payments, &item);
+    }
+
+    allocs = ALLOC_COUNT();
+    start = perftime();
+    for (i = 0; i < N; ++i) {
+      if (!relay_payments_find_by_fingerprint(payments, fps[i % n_hops[h]]))
+        ++misses;
+    }
+    end = perftime();
+    allocs = ALLOC_COUNT() - allocs;
+    tor_snprintf(what, sizeof(what), "Find by fingerprint, %d hops",
+                 n_hops[h]);
+    print_per_op(what, start, end, allocs, N);
+
+    allocs = ALLOC_COUNT();
+    start = perftime();
+    for (i = 0; i < N; ++i) {
+      if (!relay_payments_find_by_hop_num(payments, 1 + i % n_hops[h]))
+        ++misses;
+    }
+    end = perftime();
+    allocs = ALLOC_COUNT() - allocs;
+    tor_snprintf(what, sizeof(what), "Find by hop number, %d hops",
+                 n_hops[h]);
+    print_per_op(what, start, end, allocs, N);
+
+    relay_payments_free(payments);
+  }
+
+  /* Relay side: handshake payment hash to circuit. */
+  circ_hashes = tor_malloc(N_CIRCS * PAYMENT_HASH_LEN);
+  circs = tor_calloc(N_CIRCS, sizeof(or_circuit_t *));
+  crypto_rand((char *)circ_hashes, N_CIRCS * PAYMENT_HASH_LEN);
+  for (i = 0; i < N_CIRCS; ++i) {
+    circs[i] = tor_malloc_zero(sizeof(or_circuit_t));
+    circs[i]->base_.magic = OR_CIRCUIT_MAGIC;
+    circs[i]->base_.purpose = CIRCUIT_PURPOSE_OR;
+    payment_index_bind(circ_hashes + i * PAYMENT_HASH_LEN, circs[i]);
+  }
+
+  allocs = ALLOC_COUNT();
+  start = perftime();
+  for (i = 0; i < N; ++i) {
+    const uint8_t *hash = circ_hashes + (i % N_CIRCS) * PAYMENT_HASH_LEN;
+    if (!payment_index_get_circuit(hash))
+      ++misses;
+  }
+  end = perftime();
+  allocs = ALLOC_COUNT() - allocs;
+  print_per_op("Payment index lookup, 4096 circuits", start, end, allocs, N);
+
+  for (i = 0; i < N_CIRCS; ++i) {
+    payment_index_unbind(circs[i]);
+    tor_free(circs[i]);
+  }
+  payment_index_free_all();
+  tor_free(circs);
+  tor_free(circ_hashes);
+
+  if (misses)
+    printf("ERROR: payment lookup missed %d times.\n", misses);
+}
+
 typedef void (*bench_fn)(void);
 
 typedef struct benchmark_t {
@@ -769,6 +1161,10 @@ static struct benchmark_t benchmarks[] = {
 #endif
 
   ENT(md_parse),
+  ENT(payment_parse),
+  ENT(payment_verify),
+  ENT(ntor3_payhash),
+  ENT(payment_lookup),
   {NULL,NULL,0}
 };
 
@@ -879,6 +879,7 @@ struct testgroup_t testgroups[] = {
   { "tortls/openssl/", tortls_openssl_tests },
 #endif
   { "tortls/x509/", x509_tests },
+  { "trace_ring/", trace_ring_tests },
   { "util/", util_tests },
   { "util/format/", util_format_tests },
   { "util/handle/", handle_tests },
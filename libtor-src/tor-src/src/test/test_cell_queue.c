@@ -4,6 +4,7 @@
 #define CIRCUITLIST_PRIVATE
 #define RELAY_PRIVATE
 #include "core/or/or.h"
+#include "core/or/cell_pool.h"
 #include "core/or/circuitlist.h"
 #include "core/or/relay.h"
 #include "test/test.h"
@@ -139,9 +140,84 @@ test_circuit_n_cells(void *arg)
   circuit_free_(TO_CIRCUIT(origin_c));
 }
 
+static void
+test_cell_pool(void *arg)
+{
+  cell_pool_t *pool = cell_pool_new("Test", sizeof(packed_cell_t));
+  cell_pool_stats_t stats;
+  smartlist_t *objs = smartlist_new();
+  packed_cell_t *pc;
+  int per_slab, i;
+  (void) arg;
+
+  cell_pool_get_stats(pool, &stats);
+  tt_uint_op(stats.n_slabs, OP_EQ, 0);
+
+  pc = cell_pool_alloc(pool);
+  tt_assert(fast_mem_is_zero((char *) pc, sizeof(*pc)));
+  tt_uint_op(((uintptr_t) pc) % CELL_POOL_ALIGN, OP_EQ, 0);
+  smartlist_add(objs, pc);
+  cell_pool_get_stats(pool, &stats);
+  tt_uint_op(stats.n_slabs, OP_EQ, 1);
+  tt_uint_op(stats.n_used, OP_EQ, 1);
+  per_slab = (int) stats.n_capacity;
+  tt_int_op(per_slab, OP_GT, 1);
+
+  /* Fill the first slab, and spill one object into a second. */
+  for (i = 1; i <= per_slab; i++) {
+    pc = cell_pool_alloc(pool);
+    tt_uint_op(((uintptr_t) pc) % CELL_POOL_ALIGN, OP_EQ, 0);
+    memset(pc, 0xff, sizeof(*pc));
+    smartlist_add(objs, pc);
+  }
+  cell_pool_get_stats(pool, &stats);
+  tt_uint_op(stats.n_slabs, OP_EQ, 2);
+  tt_uint_op(stats.n_used, OP_EQ, per_slab + 1);
+  tt_uint_op(stats.n_capacity, OP_EQ, 2 * per_slab);
+
+  /* A released object is handed out again, zeroed. */
+  pc = smartlist_get(objs, 5);
+  cell_pool_release(pool, pc);
+  tt_ptr_op(cell_pool_alloc(pool), OP_EQ, pc);
+  tt_assert(fast_mem_is_zero((char *) pc, sizeof(*pc)));
+
+  /* Emptying both slabs keeps them for reuse until reclaimed. */
+  SMARTLIST_FOREACH(objs, void *, obj, cell_pool_release(pool, obj));
+  smartlist_clear(objs);
+  cell_pool_get_stats(pool, &stats);
+  tt_uint_op(stats.n_used, OP_EQ, 0);
+  tt_uint_op(stats.n_slabs, OP_EQ, 2);
+  tt_uint_op(stats.n_empty_slabs, OP_EQ, 2);
+
+  pc = cell_pool_alloc(pool);
+  cell_pool_get_stats(pool, &stats);
+  tt_uint_op(stats.n_slabs, OP_EQ, 2);
+  tt_uint_op(stats.n_empty_slabs, OP_EQ, 1);
+  tt_uint_op(cell_pool_reclaim(pool), OP_EQ, stats.n_bytes / 2);
+  cell_pool_get_stats(pool, &stats);
+  tt_uint_op(stats.n_slabs, OP_EQ, 1);
+  tt_uint_op(stats.n_empty_slabs, OP_EQ, 0);
+  cell_pool_release(pool, pc);
+
+  /* No more than CELL_POOL_MAX_EMPTY_SLABS empty slabs are kept. */
+  for (i = 0; i < (CELL_POOL_MAX_EMPTY_SLABS + 2) * per_slab; i++)
+    smartlist_add(objs, cell_pool_alloc(pool));
+  SMARTLIST_FOREACH(objs, void *, obj, cell_pool_release(pool, obj));
+  smartlist_clear(objs);
+  cell_pool_get_stats(pool, &stats);
+  tt_uint_op(stats.n_slabs, OP_EQ, CELL_POOL_MAX_EMPTY_SLABS);
+  tt_uint_op(stats.n_empty_slabs, OP_EQ, CELL_POOL_MAX_EMPTY_SLABS);
+
+ done:
+  SMARTLIST_FOREACH(objs, void *, obj, cell_pool_release(pool, obj));
+  smartlist_free(objs);
+  cell_pool_free(pool);
+}
+
 struct testcase_t cell_queue_tests[] = {
   { "basic", test_cq_manip, TT_FORK, NULL, NULL, },
   { "circ_n_cells", test_circuit_n_cells, TT_FORK, NULL, NULL },
+  { "cell_pool", test_cell_pool, 0, NULL, NULL },
   END_OF_TESTCASES
 };
 
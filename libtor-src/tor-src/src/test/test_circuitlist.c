@@ -402,6 +402,51 @@ test_pick_circid(void *arg)
   UNMOCK(channel_dump_statistics);
 }
 
+static void
+test_global_id_map(void *arg)
+{
+  origin_circuit_t *c1 = NULL, *c2 = NULL, *c3 = NULL;
+  uint32_t id1, id2;
+  (void) arg;
+
+  c1 = origin_circuit_new();
+  c2 = origin_circuit_new();
+  TO_CIRCUIT(c1)->purpose = TO_CIRCUIT(c2)->purpose =
+    CIRCUIT_PURPOSE_C_GENERAL;
+  id1 = c1->global_identifier;
+  id2 = c2->global_identifier;
+  tt_uint_op(id1, OP_NE, id2);
+  tt_ptr_op(circuit_get_by_global_id(id1), OP_EQ, c1);
+  tt_ptr_op(circuit_get_by_global_id(id2), OP_EQ, c2);
+  tt_ptr_op(circuit_get_by_global_id(0), OP_EQ, NULL);
+  tt_ptr_op(circuit_get_by_global_id(id2 + 1), OP_EQ, NULL);
+
+  /* Marked circuits are not returned. */
+  TO_CIRCUIT(c1)->marked_for_close = 1;
+  tt_ptr_op(circuit_get_by_global_id(id1), OP_EQ, NULL);
+  TO_CIRCUIT(c1)->marked_for_close = 0;
+
+  /* Freed circuits leave the map. */
+  circuit_free_(TO_CIRCUIT(c1));
+  c1 = NULL;
+  tt_ptr_op(circuit_get_by_global_id(id1), OP_EQ, NULL);
+  tt_ptr_op(circuit_get_by_global_id(id2), OP_EQ, c2);
+
+  /* New circuits get new identifiers. */
+  c3 = origin_circuit_new();
+  TO_CIRCUIT(c3)->purpose = CIRCUIT_PURPOSE_C_GENERAL;
+  tt_uint_op(c3->global_identifier, OP_NE, id1);
+  tt_ptr_op(circuit_get_by_global_id(c3->global_identifier), OP_EQ, c3);
+
+ done:
+  if (c1)
+    circuit_free_(TO_CIRCUIT(c1));
+  if (c2)
+    circuit_free_(TO_CIRCUIT(c2));
+  if (c3)
+    circuit_free_(TO_CIRCUIT(c3));
+}
+
 /** Test that the circuit pools of our HS circuitmap are isolated based on
  *  their token type. */
 static void
@@ -488,6 +533,7 @@ struct testcase_t circuitlist_tests[] = {
   { "maps", test_clist_maps, TT_FORK, NULL, NULL },
   { "rend_token_maps", test_rend_token_maps, TT_FORK, NULL, NULL },
   { "pick_circid", test_pick_circid, TT_FORK, NULL, NULL },
+  { "global_id_map", test_global_id_map, TT_FORK, NULL, NULL },
   { "hs_circuitmap_isolation", test_hs_circuitmap_isolation,
     TT_FORK, NULL, NULL },
   END_OF_TESTCASES
@@ -72,7 +72,7 @@ test_cmux_destroy_cell_queue(void *arg)
  done:
   free_fake_channel(ch);
   packed_cell_free(pc);
-  tor_free(dc);
+  destroy_cell_free(dc);
 
   UNMOCK(scheduler_release_channel);
 }
@@ -1,8 +1,12 @@
 /* Copyright (c) 2015-2021, The Tor Project, Inc. */
 /* See LICENSE for licensing information */
 
+#define CIRCUITLIST_PRIVATE
+#define CONFIG_PRIVATE
 #define CONTROL_CMD_PRIVATE
 #define CONTROL_GETINFO_PRIVATE
+#define CONTROL_LOGALLCIRCUITS_PRIVATE
+#define TEARDOWN_JOURNAL_PRIVATE
 #include "core/or/or.h"
 #include "app/config/config.h"
 #include "lib/crypt_ops/crypto_ed25519.h"
@@ -10,7 +14,9 @@
 #include "feature/control/control.h"
 #include "feature/control/control_cmd.h"
 #include "feature/control/control_getinfo.h"
+#include "feature/control/control_logallcircuits.h"
 #include "feature/control/control_proto.h"
+#include "core/or/circuitlist.h"
 #include "feature/client/entrynodes.h"
 #include "feature/dircache/cached_dir_st.h"
 #include "feature/dircache/dirserv.h"
@@ -24,12 +30,19 @@
 #include "lib/net/resolve.h"
 #include "lib/encoding/confline.h"
 #include "lib/encoding/kvline.h"
+#include "lib/encoding/binascii.h"
+#include "lib/fs/dir.h"
+#include "lib/fs/files.h"
+#include "feature/payment/payment_index.h"
+#include "feature/payment/teardown_journal.h"
 
 #include "feature/control/control_connection_st.h"
 #include "feature/control/control_cmd_args_st.h"
 #include "feature/dirclient/download_status_st.h"
 #include "feature/nodelist/microdesc_st.h"
 #include "feature/nodelist/node_st.h"
+#include "core/or/or_circuit_st.h"
+#include "core/or/origin_circuit_st.h"
 
 typedef struct {
   const char *input;
@@ -2041,6 +2054,321 @@ test_stats(void *arg)
   return;
 }
 
+static or_options_t *mock_options = NULL;
+
+static const or_options_t *
+mock_get_options(void)
+{
+  return mock_options;
+}
+
+/** Mark <b>circ</b> without scheduling the main loop's cleanup. */
+static void
+mock_circuit_mark_for_close_(circuit_t *circ, int reason, int line,
+                             const char *cfile)
+{
+  (void)line;
+  (void)cfile;
+  circ->marked_for_close = 1;
+  circ->marked_for_close_reason = reason;
+}
+
+/** Run <b>args</b> as <b>conn</b>'s current command, and return its reply
+ * lines joined by "|". */
+static char *
+run_control_command(control_connection_t *conn, const char *args)
+{
+  SMARTLIST_FOREACH(reply_strs, char *, cp, tor_free(cp));
+  smartlist_clear(reply_strs);
+  handle_control_command(conn, (uint32_t) strlen(args), (char *) args);
+  return smartlist_join_strings(reply_strs, "|", 0, NULL);
+}
+
+static void
+test_teardown_journal(void *arg)
+{
+  or_options_t *options = options_new();
+  char *fname = NULL, *old_fname = NULL, *contents = NULL;
+  (void)arg;
+
+  options->DataDirectory = tor_strdup(get_fname_rnd("teardown_journal"));
+  tt_int_op(check_private_dir(options->DataDirectory, CPD_CREATE, NULL),
+            OP_EQ, 0);
+  MOCK(get_options, mock_get_options);
+  mock_options = options;
+  fname = options_get_datadir_fname(options, TEARDOWN_JOURNAL_FNAME);
+  tor_asprintf(&old_fname, "%s.1", fname);
+
+  // Records wait in memory until the journal is flushed.
+  teardown_journal_add("TEARDOWN_REQUESTED|a");
+  teardown_journal_add("TEARDOWN_REQUESTED|b");
+  tt_int_op(teardown_journal_buffered(), OP_EQ, 42);
+  tt_int_op(file_status(fname), OP_EQ, FN_NOENT);
+  tt_int_op(teardown_journal_flush(), OP_EQ, 0);
+  tt_int_op(teardown_journal_buffered(), OP_EQ, 0);
+  contents = read_file_to_str(fname, 0, NULL);
+  tt_str_op(contents, OP_EQ,
+            "TEARDOWN_REQUESTED|a\nTEARDOWN_REQUESTED|b\n");
+  tor_free(contents);
+
+  // The journal is appended to, and moved aside once it is full.
+  teardown_journal_max_size = 60;
+  teardown_journal_add("TEARDOWN_REQUESTED|c");
+  tt_int_op(teardown_journal_flush(), OP_EQ, 0);
+  tt_int_op(file_status(fname), OP_EQ, FN_NOENT);
+  contents = read_file_to_str(old_fname, 0, NULL);
+  tt_str_op(contents, OP_EQ, "TEARDOWN_REQUESTED|a\nTEARDOWN_REQUESTED|b\n"
+            "TEARDOWN_REQUESTED|c\n");
+  tor_free(contents);
+
+  // Whatever is left is written out at shutdown, to a new file.
+  teardown_journal_add("TEARDOWN_REQUESTED|d");
+  teardown_journal_free_all();
+  contents = read_file_to_str(fname, 0, NULL);
+  tt_str_op(contents, OP_EQ, "TEARDOWN_REQUESTED|d\n");
+
+ done:
+  teardown_journal_free_all();
+  teardown_journal_max_size = TEARDOWN_JOURNAL_MAX_SIZE;
+  tor_free(contents);
+  tor_free(fname);
+  tor_free(old_fname);
+  UNMOCK(get_options);
+  or_options_free(options);
+  mock_options = NULL;
+}
+
+static void
+test_teardowncircuit(void *arg)
+{
+  or_circuit_t *circ1 = NULL, *circ2 = NULL, *circ3 = NULL;
+  origin_circuit_t *ocirc = NULL;
+  control_connection_t conn;
+  uint8_t payhash[DIGEST256_LEN];
+  char payhash_hex[HEX_DIGEST256_LEN + 1];
+  char *args = NULL, *reply = NULL;
+  (void)arg;
+
+  // Teardowns are journaled, so keep the journal out of the real datadir.
+  mock_options = options_new();
+  mock_options->DataDirectory = tor_strdup(get_fname_rnd("teardown"));
+  tt_int_op(check_private_dir(mock_options->DataDirectory, CPD_CREATE,
+                              NULL), OP_EQ, 0);
+  MOCK(get_options, mock_get_options);
+
+  memset(&conn, 0, sizeof(conn));
+  conn.current_cmd = tor_strdup("TEARDOWNCIRCUIT");
+  reply_strs = smartlist_new();
+  MOCK(control_write_reply, mock_control_write_reply_list);
+  MOCK(circuit_mark_for_close_, mock_circuit_mark_for_close_);
+
+  // Without a channel, OR circuits are found by walking the list.
+  circ1 = or_circuit_new(0, NULL);
+  circ1->p_circ_id = 101;
+  circ2 = or_circuit_new(0, NULL);
+  circ2->p_circ_id = 102;
+  circ3 = or_circuit_new(0, NULL);
+  circ3->p_circ_id = 103;
+  ocirc = origin_circuit_new();
+  TO_CIRCUIT(ocirc)->purpose = CIRCUIT_PURPOSE_C_GENERAL;
+  TO_CIRCUIT(ocirc)->state = CIRCUIT_STATE_OPEN;
+  memset(payhash, 0x42, sizeof(payhash));
+  base16_encode(payhash_hex, sizeof(payhash_hex), (char *) payhash,
+                sizeof(payhash));
+  tt_int_op(payment_index_bind(payhash, circ3), OP_EQ, 0);
+
+  // One circuit: the reply is as it always was.
+  reply = run_control_command(&conn, "101 test LogOnly");
+  tt_str_op(reply, OP_EQ, "250 OK Circuit 101 teardown logged for "
+            "processing");
+  tor_free(reply);
+  reply = run_control_command(&conn, "999");
+  tt_str_op(reply, OP_EQ, "552 Unknown circuit \"999\"");
+  tor_free(reply);
+
+  // A PeerIdentity we can't decode is refused, not ignored.
+  reply = run_control_command(&conn, "101 test PeerIdentity=ABCD");
+  tt_str_op(reply, OP_EQ, "552 Invalid PeerIdentity");
+  tor_free(reply);
+  reply = run_control_command(&conn, "101 test PeerIdentity="
+                              "ZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZ");
+  tt_str_op(reply, OP_EQ, "552 Invalid PeerIdentity");
+  tor_free(reply);
+  tt_assert(!TO_CIRCUIT(circ1)->marked_for_close);
+
+  // Many circuits: one line each, in order, and unknown ones don't fail.
+  tor_asprintf(&args, "%u,102,999,PaymentHash=%s,102,junk test",
+               ocirc->global_identifier, payhash_hex);
+  reply = run_control_command(&conn, args);
+  tor_free(args);
+  tor_asprintf(&args, "250-%u=DESTROYED|250-102=DESTROYED|250-999=UNKNOWN|"
+               "250-PaymentHash=%s=DESTROYED|250-102=INACTIVE|"
+               "250-junk=UNKNOWN|250 OK",
+               ocirc->global_identifier, payhash_hex);
+  tt_str_op(reply, OP_EQ, args);
+  tor_free(reply);
+  tt_assert(TO_CIRCUIT(ocirc)->marked_for_close);
+  tt_assert(TO_CIRCUIT(circ2)->marked_for_close);
+  tt_assert(TO_CIRCUIT(circ3)->marked_for_close);
+  tt_assert(!TO_CIRCUIT(circ1)->marked_for_close);
+
+ done:
+  teardown_journal_free_all();
+  UNMOCK(control_write_reply);
+  UNMOCK(circuit_mark_for_close_);
+  UNMOCK(get_options);
+  or_options_free(mock_options);
+  tor_free(args);
+  tor_free(reply);
+  tor_free(conn.current_cmd);
+  SMARTLIST_FOREACH(reply_strs, char *, cp, tor_free(cp));
+  smartlist_free(reply_strs);
+  circuit_free_all();
+}
+
+static void
+test_logallcircuits(void *arg)
+{
+  origin_circuit_t *c1 = NULL, *c2 = NULL, *c3 = NULL;
+  or_circuit_t *or_circ = NULL;
+  control_connection_t conn;
+  char *reply = NULL, *expected = NULL;
+  char or_line[512];
+  (void)arg;
+
+  memset(&conn, 0, sizeof(conn));
+  conn.current_cmd = tor_strdup("LOGALLCIRCUITS");
+  reply_strs = smartlist_new();
+  MOCK(control_write_reply, mock_control_write_reply_list);
+
+  // The OR circuit is on no channel, as when it is about to be freed.
+  c1 = origin_circuit_new();
+  c2 = origin_circuit_new();
+  or_circ = or_circuit_new(0, NULL);
+  c3 = origin_circuit_new();
+  TO_CIRCUIT(c1)->purpose = TO_CIRCUIT(c2)->purpose =
+    TO_CIRCUIT(c3)->purpose = CIRCUIT_PURPOSE_C_GENERAL;
+  TO_CIRCUIT(c1)->state = CIRCUIT_STATE_OPEN;
+  TO_CIRCUIT(or_circ)->purpose = CIRCUIT_PURPOSE_OR;
+  TO_CIRCUIT(or_circ)->state = CIRCUIT_STATE_OPEN;
+  memset(or_circ->payment_hash, 0x42, sizeof(or_circ->payment_hash));
+  or_circ->has_payment_hash = 1;
+  tor_snprintf(or_line, sizeof(or_line),
+      "250-OR_CIRCUIT Nickname=Unknown N_CircuitID=0 P_CircuitID=0 "
+      "State=OPEN Purpose=OR MarkedForClose=false GlobalListIdx=2 "
+      "P_ChanID=0 N_ChanID=0 PaymentHash=%s",
+      hex_str((const char *) or_circ->payment_hash, DIGEST256_LEN));
+
+  reply = run_control_command(&conn, "Summary");
+  tt_str_op(reply, OP_EQ,
+            "250-SUMMARY Nickname=Unknown Total=4 Origin=3 OR=1 "
+            "MarkedForClose=0|"
+            "250-STATE BUILDING=2 ONIONSKIN_PENDING=0 CHAN_WAIT=0 "
+            "GUARD_WAIT=0 OPEN=2 UNKNOWN=0|"
+            "250-PURPOSE OR=1 C_GENERAL=3|"
+            "250-PAYMENT Unpaid=0 Paid=1 InRounds=0 PaidOrigin=0|"
+            "250 OK");
+  tor_free(reply);
+
+  // Without a limit, every circuit is listed in one reply, but the
+  // circuits are written from the main loop.
+  reply = run_control_command(&conn, "");
+  tt_str_op(reply, OP_EQ,
+      "250-LOGALLCIRCUITS: Starting circuit enumeration for relay Unknown");
+  tor_free(reply);
+  tt_assert(control_logallcircuits_in_progress(&conn));
+  SMARTLIST_FOREACH(reply_strs, char *, cp, tor_free(cp));
+  smartlist_clear(reply_strs);
+  logallcircuits_write_cb(NULL, &conn);
+  reply = smartlist_join_strings(reply_strs, "|", 0, NULL);
+  tor_asprintf(&expected,
+      "250-ORIGIN_CIRCUIT Nickname=Unknown N_CircuitID=0 State=OPEN "
+      "Purpose=C_GENERAL MarkedForClose=false GlobalListIdx=0 N_ChanID=0 "
+      "GlobalIdentifier=%u|"
+      "250-ORIGIN_CIRCUIT Nickname=Unknown N_CircuitID=0 State=BUILDING "
+      "Purpose=C_GENERAL MarkedForClose=false GlobalListIdx=1 N_ChanID=0 "
+      "GlobalIdentifier=%u|"
+      "%s|"
+      "250-ORIGIN_CIRCUIT Nickname=Unknown N_CircuitID=0 State=BUILDING "
+      "Purpose=C_GENERAL MarkedForClose=false GlobalListIdx=3 N_ChanID=0 "
+      "GlobalIdentifier=%u|"
+      "250 LOGALLCIRCUITS: Enumerated 4 circuits for relay Unknown",
+      c1->global_identifier, c2->global_identifier, or_line,
+      c3->global_identifier);
+  tt_str_op(reply, OP_EQ, expected);
+  tor_free(reply);
+  tor_free(expected);
+  tt_ptr_op(conn.circuit_listing, OP_EQ, NULL);
+  tt_assert(!control_logallcircuits_in_progress(&conn));
+
+  // Nothing to continue yet.
+  reply = run_control_command(&conn, "Continue");
+  tt_str_op(reply, OP_EQ, "552 No circuit listing in progress");
+  tor_free(reply);
+  reply = run_control_command(&conn, "Limit=0");
+  tt_str_op(reply, OP_EQ, "552 Invalid Limit \"0\"");
+  tor_free(reply);
+
+  reply = run_control_command(&conn, "Limit=2");
+  tor_asprintf(&expected,
+      "250-LOGALLCIRCUITS: Starting circuit enumeration for relay Unknown|"
+      "250-ORIGIN_CIRCUIT Nickname=Unknown N_CircuitID=0 State=OPEN "
+      "Purpose=C_GENERAL MarkedForClose=false GlobalListIdx=0 N_ChanID=0 "
+      "GlobalIdentifier=%u|"
+      "250-ORIGIN_CIRCUIT Nickname=Unknown N_CircuitID=0 State=BUILDING "
+      "Purpose=C_GENERAL MarkedForClose=false GlobalListIdx=1 N_ChanID=0 "
+      "GlobalIdentifier=%u|"
+      "250 LOGALLCIRCUITS: Enumerated 2 circuits for relay Unknown "
+      "Remaining=2", c1->global_identifier, c2->global_identifier);
+  tt_str_op(reply, OP_EQ, expected);
+  tor_free(reply);
+  tor_free(expected);
+  tt_assert(conn.circuit_listing);
+
+  // Circuits freed between pages are skipped; the OR circuit is still
+  // found.
+  circuit_free_(TO_CIRCUIT(c3));
+  c3 = NULL;
+  reply = run_control_command(&conn, "Continue");
+  tor_asprintf(&expected,
+      "250-LOGALLCIRCUITS: Continuing circuit enumeration for relay Unknown|"
+      "%s|"
+      "250 LOGALLCIRCUITS: Enumerated 1 circuits for relay Unknown "
+      "Remaining=0", or_line);
+  tt_str_op(reply, OP_EQ, expected);
+  tor_free(reply);
+  tor_free(expected);
+  tt_ptr_op(conn.circuit_listing, OP_EQ, NULL);
+
+  // A long listing takes several turns.
+  for (int i = 0; i < LOGALLCIRCUITS_PER_TURN; ++i)
+    TO_CIRCUIT(origin_circuit_new())->purpose = CIRCUIT_PURPOSE_C_GENERAL;
+  reply = run_control_command(&conn, "");
+  tor_free(reply);
+  SMARTLIST_FOREACH(reply_strs, char *, cp, tor_free(cp));
+  smartlist_clear(reply_strs);
+  logallcircuits_write_cb(NULL, &conn);
+  tt_int_op(smartlist_len(reply_strs), OP_EQ, LOGALLCIRCUITS_PER_TURN);
+  tt_assert(control_logallcircuits_in_progress(&conn));
+  logallcircuits_write_cb(NULL, &conn);
+  tt_int_op(smartlist_len(reply_strs), OP_EQ, LOGALLCIRCUITS_PER_TURN + 4);
+  tor_asprintf(&expected, "250 LOGALLCIRCUITS: Enumerated %d circuits for "
+               "relay Unknown", LOGALLCIRCUITS_PER_TURN + 3);
+  tt_str_op(smartlist_get(reply_strs, LOGALLCIRCUITS_PER_TURN + 3), OP_EQ,
+            expected);
+  tt_ptr_op(conn.circuit_listing, OP_EQ, NULL);
+
+ done:
+  UNMOCK(control_write_reply);
+  tor_free(reply);
+  tor_free(expected);
+  tor_free(conn.current_cmd);
+  circuit_listing_free(conn.circuit_listing);
+  SMARTLIST_FOREACH(reply_strs, char *, cp, tor_free(cp));
+  smartlist_free(reply_strs);
+  circuit_free_all();
+}
+
 #ifndef COCCI
 #define PARSER_TEST(type)                                             \
   { "parse/" #type, test_controller_parse_cmd, 0, &passthrough_setup, \
@@ -2072,5 +2400,8 @@ struct testcase_t controller_tests[] = {
   { "control_reply", test_control_reply, 0, NULL, NULL },
   { "control_getconf", test_control_getconf, 0, NULL, NULL },
   { "stats", test_stats, 0, NULL, NULL },
+  { "teardown_journal", test_teardown_journal, TT_FORK, NULL, NULL },
+  { "teardowncircuit", test_teardowncircuit, TT_FORK, NULL, NULL },
+  { "logallcircuits", test_logallcircuits, TT_FORK, NULL, NULL },
   END_OF_TESTCASES
 };
@@ -14,6 +14,7 @@
 #include "core/or/circuitlist.h"
 #include "core/or/ocirc_event.h"
 #include "core/or/orconn_event.h"
+#include "core/or/payhash_event.h"
 #include "core/mainloop/connection.h"
 #include "feature/control/control_events.h"
 #include "feature/control/control_fmt.h"
@@ -732,6 +733,42 @@ test_cntev_format_stream(void *arg)
   connection_free_minimal(ENTRY_TO_CONN(ec));
 }
 
+static void
+test_cntev_payhash_received(void *arg)
+{
+  payhash_received_msg_t *msg;
+
+  (void)arg;
+  MOCK(queue_control_event_string, mock_queue_control_event_string);
+
+  /* Nobody is listening: nothing is formatted. */
+  control_testing_set_global_event_mask(EVENT_MASK_NONE_);
+  msg = tor_malloc_zero(sizeof(*msg));
+  msg->n_payhashes = 1;
+  payhash_received_publish(msg);
+  tt_ptr_op(saved_event_str, OP_EQ, NULL);
+
+  control_testing_set_global_event_mask(
+                       EVENT_MASK_(EVENT_PAYMENT_ID_HASH_RECEIVED));
+  msg = tor_malloc_zero(sizeof(*msg));
+  msg->p_circ_id = 7;
+  msg->n_circ_id = 9;
+  msg->n_payhashes = 2;
+  memset(msg->payhashes[0], 0xAB, PAYMENT_HASH_LEN);
+  memset(msg->payhashes[1], 0x01, PAYMENT_HASH_LEN);
+  payhash_received_publish(msg);
+  tt_str_op(saved_event_str, OP_EQ,
+            "650 EVENT_PAYMENT_ID_HASH_RECEIVED P_CIRC_ID=7 N_CIRC_ID=9 "
+            "PAYMENT_HASH="
+            "abababababababababababababababababababababababababababababababab"
+            "0101010101010101010101010101010101010101010101010101010101010101"
+            "\r\n");
+
+ done:
+  tor_free(saved_event_str);
+  UNMOCK(queue_control_event_string);
+}
+
 #define TEST(name, flags)                               \
   { #name, test_cntev_ ## name, flags, 0, NULL }
 
@@ -751,5 +788,6 @@ struct testcase_t controller_event_tests[] = {
   T_PUBSUB(orconn_state, TT_FORK),
   T_PUBSUB(orconn_state_pt, TT_FORK),
   T_PUBSUB(orconn_state_proxy, TT_FORK),
+  T_PUBSUB(payhash_received, TT_FORK),
   END_OF_TESTCASES
 };
@@ -517,6 +517,8 @@ helper_setup_pubsub(const struct testcase_t *testcase)
   dispatch_set_alert_fn(dispatcher, chan, alertfn_immediate, NULL);
   chan = get_channel_id("ocirc");
   dispatch_set_alert_fn(dispatcher, chan, alertfn_immediate, NULL);
+  chan = get_channel_id("payhash");
+  dispatch_set_alert_fn(dispatcher, chan, alertfn_immediate, NULL);
   return dispatcher;
 }
 
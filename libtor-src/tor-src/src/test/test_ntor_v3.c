@@ -96,8 +96,6 @@ test_ntor3_testvecs(void *arg)
                   relay_keypair_b.pubkey.public_key,
                   &relay_keypair_b);
 
-  uint64_t p_circ_id = 12345;
-  uint64_t n_circ_id = 67890;
   int r = onion_skin_ntor3_server_handshake_part1(
                     private_keys,
                     &client_keypair_x,
@@ -108,9 +106,7 @@ test_ntor3_testvecs(void *arg)
                     sizeof(verification),
                     &cm,
                     &cm_len,
-                    &relay_state,
-                    &p_circ_id,
-                    &n_circ_id);
+                    &relay_state);
   tt_int_op(r, OP_EQ, 0);
   tt_int_op(cm_len, OP_EQ, sizeof(client_message));
   tt_mem_op(cm, OP_EQ, client_message, cm_len);
@@ -218,20 +214,17 @@ run_full_handshake(circuit_params_t *serv_params_in,
   onionskin_len = onion_skin_create(ONION_HANDSHAKE_TYPE_NTOR_V3, &info,
                     &handshake_state, onionskin,
                     sizeof(onionskin),
-                    NULL); // TODO Pass payhash
+                    NULL, 0); // TODO Pass payhash
   tt_int_op(onionskin_len, OP_NE, -1);
 
   server_keys.junk_keypair = &handshake_state.u.ntor3->client_keypair;
 
-  uint64_t test_p_circ = 999;
-  uint64_t test_n_circ = 888;
   reply_len = onion_skin_server_handshake(ONION_HANDSHAKE_TYPE_NTOR_V3,
                               onionskin, onionskin_len,
                               &server_keys, serv_params_in,
                               serv_reply, sizeof(serv_reply),
                               serv_keys, sizeof(serv_keys),
-                              rend_nonce, serv_params_out, 
-                              &test_p_circ, &test_n_circ);
+                              rend_nonce, serv_params_out);
   tt_int_op(reply_len, OP_NE, -1);
 
   tt_int_op(onion_skin_client_handshake(ONION_HANDSHAKE_TYPE_NTOR_V3,
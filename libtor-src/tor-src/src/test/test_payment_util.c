@@ -1,3 +1,12 @@
+#define CIRCUITLIST_PRIVATE
+#define CONFIG_PRIVATE
+#define CONTROL_EXTENDPAIDCIRCUIT_PRIVATE
+#define CONTROL_GETINFO_PRIVATE
+#define LN_RPC_PRIVATE
+#define PAID_PATH_PRIVATE
+#define PAYMENT_METRICS_PRIVATE
+#define PAYMENT_ROUNDS_PRIVATE
+
 #include "orconfig.h"
 #include "core/or/or.h"
 #include "feature/payment/payment_util.h"
@@ -7,107 +16,1421 @@
 #include "core/or/origin_circuit_st.h"
 #include "core/or/crypt_path_st.h"
 #include "feature/payment/relay_payments.h"
+#include "feature/payment/relay_payments_st.h"
+#include "core/or/congestion_control_common.h"
+#include "lib/crypt_ops/crypto_digest.h"
+#include "lib/encoding/binascii.h"
+#include "core/or/circuitlist.h"
+#include "core/or/circuituse.h"
+#include "core/or/or_circuit_st.h"
+#include "feature/payment/payment_index.h"
+#include "feature/payment/payment_rounds.h"
+#include "lib/evloop/timers.h"
+#include "lib/time/compat_time.h"
+#include "app/config/config.h"
+#include "app/config/or_options_st.h"
+#include "feature/control/control_extendpaidcircuit.h"
+#include "feature/control/control_getinfo.h"
+#include "feature/payment/paid_circ_pool.h"
+#include "core/or/cpath_build_state_st.h"
+#include "feature/nodelist/microdesc.h"
+#include "feature/nodelist/nodelist.h"
+#include "feature/nodelist/node_st.h"
+#include "lib/trace/trace_ring.h"
+#include "feature/payment/paid_path.h"
+#include "feature/payment/payment_metrics.h"
+#include "lib/buf/buffers.h"
+#include "test/test_helpers.h"
+#include "lib/metrics/metrics_store.h"
+#include "feature/nodelist/routerinfo_st.h"
+#include "feature/nodelist/routerstatus_st.h"
+#include "feature/payment/payment_intern.h"
+#include "feature/payment/ln_rpc.h"
+#include "feature/payment/payment_index.h"
+#include "lib/encoding/confline.h"
+#include "lib/evloop/compat_libevent.h"
+#include "lib/net/address.h"
+
+#include <event2/buffer.h>
+#include <event2/event.h>
+#include <event2/http.h>
+
+static or_options_t *mocked_options = NULL;
+
+static const or_options_t *
+mock_get_options(void)
+{
+  return mocked_options;
+}
 
 // To test run:
 // ./src/test/test payment/relay_payments_basic --verbose
 
-// Add this test function before the PAYMENT_TESTS definition
 static void
 test_payment_util_relay_payments_basic(void *arg)
 {
   (void)arg;
+  relay_payments_t *payments = NULL, *cloned_payments = NULL;
+  relay_payment_item_t item1, item2, invalid_item;
+  const relay_payment_item_t *found;
+  const uint8_t *material;
+  size_t n_material;
+  uint8_t fp_missing[DIGEST_LEN];
+
+  memset(&item1, 0, sizeof(item1));
+  memset(&item2, 0, sizeof(item2));
+  memset(item1.fingerprint, 0xAA, DIGEST_LEN);
+  memset(item1.material[RELAY_PAYMENT_HANDSHAKE_HASH], 0x01,
+         PAYMENT_HASH_LEN);
+  memset(item1.material[RELAY_PAYMENT_HANDSHAKE_PREIMAGE], 0x02,
+         PAYMENT_HASH_LEN);
+  memset(item1.material[RELAY_PAYMENT_FIRST_ROUND], 0x03, PAYMENT_HASH_LEN);
+  memset(item1.material[RELAY_PAYMENT_FIRST_ROUND + 1], 0x04,
+         PAYMENT_HASH_LEN);
+  item1.n_payhashes = 2;
+  memset(item2.fingerprint, 0xBB, DIGEST_LEN);
+  memset(item2.material[RELAY_PAYMENT_HANDSHAKE_HASH], 0x11,
+         PAYMENT_HASH_LEN);
+  memset(fp_missing, 0xCC, DIGEST_LEN);
 
   // Create a relay_payments collection
-  relay_payments_t *payments = relay_payments_new();
+  payments = relay_payments_new();
   tt_assert(payments);
-  tt_int_op(smartlist_len(payments), OP_EQ, 0);
-
-  // Create and add first item
-  relay_payment_item_t *item1 = relay_payment_item_new();
-  tt_assert(item1);
-  item1->fingerprint = tor_strdup("AAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAA");
-  item1->handshake_payment_hash = tor_strdup("eltor_payhash_handshake1");
-  item1->handshake_preimage = tor_strdup("preimage_for_handshake1");
-  item1->payhashes = tor_strdup("payment_id_hash_r1+payment_id_hash_r2");
-  item1->wire_format =
-      tor_strdup("eltor_payhash_handshake1preimage_for_handshake1payment_id_"
-                 "hash_r1+payment_id_hash_r2");
-
-  relay_payments_add_item(payments, item1);
-  tt_int_op(smartlist_len(payments), OP_EQ, 1);
-
-  // Create and add second item
-  relay_payment_item_t *item2 = relay_payment_item_new();
-  tt_assert(item2);
-  item2->fingerprint = tor_strdup("BBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBB");
-  item2->handshake_payment_hash = tor_strdup("eltor_payhash_handshake2");
-  item2->handshake_preimage = tor_strdup("preimage_for_handshake2");
-  item2->payhashes = tor_strdup("payment_id_hash_r3+payment_id_hash_r4");
-  item2->wire_format =
-      tor_strdup("eltor_payhash_handshake2preimage_for_handshake2payment_id_"
-                 "hash_r3+payment_id_hash_r4");
-
-  relay_payments_add_item(payments, item2);
-  tt_int_op(smartlist_len(payments), OP_EQ, 2);
+  tt_int_op(relay_payments_len(payments), OP_EQ, 0);
+
+  // Items are copied in, in hop order
+  tt_assert(relay_payments_add_item(payments, &item1));
+  tt_assert(relay_payments_add_item(payments, &item2));
+  tt_int_op(relay_payments_len(payments), OP_EQ, 2);
 
   // Test finding by fingerprint
-  relay_payment_item_t *found = relay_payments_find_by_fingerprint(
-      payments, "AAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAA");
+  found = relay_payments_find_by_fingerprint(payments, item1.fingerprint);
   tt_assert(found);
-  tt_str_op(found->handshake_payment_hash, OP_EQ, "eltor_payhash_handshake1");
-
-  found = relay_payments_find_by_fingerprint(
-      payments, "BBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBB");
+  tt_mem_op(found->material, OP_EQ, item1.material, sizeof(item1.material));
+  found = relay_payments_find_by_fingerprint(payments, item2.fingerprint);
   tt_assert(found);
-  tt_str_op(found->handshake_payment_hash, OP_EQ, "eltor_payhash_handshake2");
-
-  // Test finding non-existent fingerprint
-  found = relay_payments_find_by_fingerprint(
-      payments, "CCCCCCCCCCCCCCCCCCCCCCCCCCCCCCCCCCCCCCCC");
-  tt_assert(!found);
-
-  // Test cloning an item
-  relay_payment_item_t *cloned_item = relay_payment_item_clone(item1);
-  tt_assert(cloned_item);
-  tt_str_op(cloned_item->fingerprint, OP_EQ, item1->fingerprint);
-  tt_ptr_op(cloned_item->fingerprint, OP_NE,
-            item1->fingerprint); // Different pointers
-  tt_str_op(cloned_item->handshake_payment_hash, OP_EQ,
-            item1->handshake_payment_hash);
-  tt_str_op(cloned_item->wire_format, OP_EQ, item1->wire_format);
+  tt_ptr_op(found, OP_EQ, relay_payments_find_by_hop_num(payments, 2));
+
+  // Test finding non-existent fingerprint and hop
+  tt_ptr_op(relay_payments_find_by_fingerprint(payments, fp_missing),
+            OP_EQ, NULL);
+  tt_ptr_op(relay_payments_find_by_hop_num(payments, 0), OP_EQ, NULL);
+  tt_ptr_op(relay_payments_find_by_hop_num(payments, 3), OP_EQ, NULL);
+
+  // The wire material is the handshake hash, the preimage and the rounds
+  material = relay_payment_item_get_material(
+                          relay_payments_find_by_hop_num(payments, 1),
+                          &n_material);
+  tt_uint_op(n_material, OP_EQ, 4);
+  tt_mem_op(material, OP_EQ, item1.material, 4 * PAYMENT_HASH_LEN);
 
   // Test cloning the whole collection
-  relay_payments_t *cloned_payments = relay_payments_clone(payments);
+  cloned_payments = relay_payments_clone(payments);
   tt_assert(cloned_payments);
-  tt_int_op(smartlist_len(cloned_payments), OP_EQ, smartlist_len(payments));
+  tt_int_op(relay_payments_len(cloned_payments), OP_EQ, 2);
+  found = relay_payments_find_by_fingerprint(cloned_payments,
+                                             item1.fingerprint);
+  tt_assert(found);
+  tt_ptr_op(found, OP_NE,
+            relay_payments_find_by_fingerprint(payments, item1.fingerprint));
+  tt_mem_op(found, OP_EQ, &item1, sizeof(item1));
 
-  // Verify cloned items have correct data
-  relay_payment_item_t *cloned_first = smartlist_get(cloned_payments, 0);
-  tt_assert(cloned_first);
-  tt_str_op(cloned_first->fingerprint, OP_EQ, item1->fingerprint);
+  // Fingerprints that share an index slot are both found
+  for (int i = 2; i < RELAY_PAYMENTS_MAX_HOPS; ++i) {
+    item2.fingerprint[DIGEST_LEN - 1] = (uint8_t) i;
+    tt_assert(relay_payments_add_item(payments, &item2));
+  }
+  tt_ptr_op(relay_payments_add_item(payments, &item2), OP_EQ, NULL);
+  for (int i = 2; i < RELAY_PAYMENTS_MAX_HOPS; ++i) {
+    item2.fingerprint[DIGEST_LEN - 1] = (uint8_t) i;
+    tt_ptr_op(relay_payments_find_by_fingerprint(payments, item2.fingerprint),
+              OP_EQ, relay_payments_find_by_hop_num(payments, i + 1));
+  }
 
   // Test validation
-  tt_int_op(relay_payment_item_is_valid(item1), OP_EQ, 1);
+  tt_int_op(relay_payment_item_is_valid(&item1), OP_EQ, 1);
 
   // Test invalid item
-  relay_payment_item_t *invalid_item = relay_payment_item_new();
-  tt_int_op(relay_payment_item_is_valid(invalid_item), OP_EQ, 0);
+  memset(&invalid_item, 0, sizeof(invalid_item));
+  tt_int_op(relay_payment_item_is_valid(&invalid_item), OP_EQ, 0);
 
   // Test with just fingerprint
-  invalid_item->fingerprint = tor_strdup("FINGERPRINT");
-  tt_int_op(relay_payment_item_is_valid(invalid_item), OP_EQ, 0);
+  memset(invalid_item.fingerprint, 0x42, DIGEST_LEN);
+  tt_int_op(relay_payment_item_is_valid(&invalid_item), OP_EQ, 0);
 
-  // Add required handshake_payment_hash to make valid
-  invalid_item->handshake_payment_hash = tor_strdup("HASH");
-  tt_int_op(relay_payment_item_is_valid(invalid_item), OP_EQ, 1);
+  // Add the required handshake payment hash to make it valid
+  memset(invalid_item.material[RELAY_PAYMENT_HANDSHAKE_HASH], 0x42,
+         PAYMENT_HASH_LEN);
+  tt_int_op(relay_payment_item_is_valid(&invalid_item), OP_EQ, 1);
 
 done:
-  relay_payment_item_free(invalid_item);
-  relay_payment_item_free(cloned_item);
   relay_payments_free(payments);
   relay_payments_free(cloned_payments);
 }
 
+static void
+test_payment_util_parse_payment_line(void *arg)
+{
+  (void)arg;
+  relay_payment_item_t item;
+  char *line = NULL;
+  char hex[PAYMENT_HASHES_PER_HOP * PAYMENT_HASH_LEN * 2 + 1];
+  uint8_t expected[PAYMENT_HASHES_PER_HOP * PAYMENT_HASH_LEN];
+  const char *fp = "$AAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAA";
+
+  for (size_t i = 0; i < sizeof(expected); i++)
+    expected[i] = (uint8_t) i;
+  base16_encode(hex, sizeof(hex), (const char *) expected, sizeof(expected));
+
+  tor_asprintf(&line, "%s %s", fp, hex);
+  tt_int_op(payment_util_parse_payment_line(line, &item), OP_EQ, 0);
+  tt_mem_op(item.fingerprint, OP_EQ,
+            "\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa"
+            "\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa", DIGEST_LEN);
+  tt_int_op(item.n_payhashes, OP_EQ, RELAY_PAYMENT_ROUNDS);
+  tt_mem_op(item.material, OP_EQ, expected, sizeof(expected));
+  tt_int_op(relay_payment_item_is_valid(&item), OP_EQ, 1);
+  tor_free(line);
+
+  // The hash and preimage alone are enough.
+  hex[2 * PAYMENT_HASH_LEN * 2] = '\0';
+  tor_asprintf(&line, "%s %s%s", fp + 1, PAYMENT_PAYHASH_PREFIX, hex);
+  tt_int_op(payment_util_parse_payment_line(line, &item), OP_EQ, 0);
+  tt_int_op(item.n_payhashes, OP_EQ, 0);
+  tor_free(line);
+
+  // Short material, bad hex and bad fingerprints are rejected.
+  hex[PAYMENT_HASH_LEN * 2] = '\0';
+  tor_asprintf(&line, "%s %s", fp, hex);
+  tt_int_op(payment_util_parse_payment_line(line, &item), OP_EQ, -1);
+  tor_free(line);
+  hex[PAYMENT_HASH_LEN * 2] = '0';
+  hex[5] = 'x';
+  tor_asprintf(&line, "%s %s", fp, hex);
+  tt_int_op(payment_util_parse_payment_line(line, &item), OP_EQ, -1);
+  tor_free(line);
+  hex[5] = '0';
+  tor_asprintf(&line, "nickname %s", hex);
+  tt_int_op(payment_util_parse_payment_line(line, &item), OP_EQ, -1);
+  tor_free(line);
+  tt_int_op(payment_util_parse_payment_line(hex, &item), OP_EQ, -1);
+
+ done:
+  tor_free(line);
+}
+
+static void
+test_payment_util_payhash_ext(void *arg)
+{
+  (void)arg;
+  uint8_t *msg = NULL;
+  size_t msg_len = 0;
+  uint8_t hashes[PAYMENT_HASHES_PER_HOP * PAYMENT_HASH_LEN];
+  uint8_t expected[PAYMENT_HASHES_PER_HOP * PAYMENT_HASH_LEN];
+  uint8_t encoded[RELAY_PAYLOAD_SIZE];
+
+  for (size_t i = 0; i < sizeof(expected); i++)
+    expected[i] = (uint8_t) i;
+
+  // Append to a congestion control request and keep it parseable.
+  tt_int_op(congestion_control_build_ext_request(&msg, &msg_len), OP_EQ, 0);
+  size_t cc_msg_len = msg_len;
+  tt_int_op(payment_util_payhash_ext_append(&msg, &msg_len, expected,
+                                            PAYMENT_HASHES_PER_HOP),
+            OP_EQ, 0);
+  tt_int_op(msg_len, OP_LT, cc_msg_len + sizeof(expected) + 16);
+  tt_int_op(congestion_control_parse_ext_request(msg, msg_len), OP_EQ,
+            congestion_control_enabled());
+  tt_int_op(payment_util_payhash_ext_parse(msg, msg_len, hashes,
+                                           PAYMENT_HASHES_PER_HOP),
+            OP_EQ, PAYMENT_HASHES_PER_HOP);
+  tt_mem_op(hashes, OP_EQ, expected, sizeof(expected));
+
+  // Only counting works too.
+  ssize_t encoded_len = payment_util_payhash_ext_encode(
+                             encoded, sizeof(encoded),
+                             expected, PAYMENT_HASHES_PER_HOP);
+  tt_int_op(encoded_len, OP_GT, 0);
+  tt_int_op(payment_util_payhash_ext_parse(encoded, encoded_len, NULL, 0),
+            OP_EQ, PAYMENT_HASHES_PER_HOP);
+  tt_int_op(payment_util_payhash_ext_parse(encoded, encoded_len, hashes, 1),
+            OP_EQ, PAYMENT_HASHES_PER_HOP);
+  tt_mem_op(hashes, OP_EQ, expected, PAYMENT_HASH_LEN);
+
+  // Truncated material and material that doesn't fit is rejected.
+  tt_int_op(payment_util_payhash_ext_parse(encoded, encoded_len - 1,
+                                           NULL, 0), OP_EQ, -1);
+  tt_int_op(payment_util_payhash_ext_encode(encoded, 64, expected,
+                                            PAYMENT_HASHES_PER_HOP),
+            OP_EQ, -1);
+  tt_int_op(payment_util_payhash_ext_encode(encoded, sizeof(encoded),
+                                            expected, 0), OP_EQ, -1);
+
+  // So is a field that doesn't hold a whole number of values.
+  memset(encoded, 0, sizeof(encoded));
+  encoded[0] = 1;
+  encoded[1] = PAYMENT_EXT_TYPE_PAYHASH;
+  encoded[2] = PAYMENT_HASH_LEN + 1;
+  tt_int_op(payment_util_payhash_ext_parse(encoded, 3 + PAYMENT_HASH_LEN + 1,
+                                           NULL, 0), OP_EQ, -1);
+  encoded[2] = 0;
+  tt_int_op(payment_util_payhash_ext_parse(encoded, 3, NULL, 0), OP_EQ, -1);
+  encoded[2] = PAYMENT_HASH_LEN;
+  tt_int_op(payment_util_payhash_ext_parse(encoded, 3 + PAYMENT_HASH_LEN,
+                                           NULL, 0), OP_EQ, 1);
+
+ done:
+  tor_free(msg);
+}
+
+static void
+test_payment_util_payment_index(void *arg)
+{
+  (void)arg;
+  or_circuit_t *circ1 = NULL, *circ2 = NULL;
+  uint8_t hash1[DIGEST256_LEN], hash2[DIGEST256_LEN];
+
+  memset(hash1, 0x11, sizeof(hash1));
+  memset(hash2, 0x22, sizeof(hash2));
+  circ1 = or_circuit_new(0, NULL);
+  circ2 = or_circuit_new(0, NULL);
+
+  tt_ptr_op(payment_index_get_circuit(hash1), OP_EQ, NULL);
+  tt_int_op(payment_index_bind(hash1, circ1), OP_EQ, 0);
+  tt_ptr_op(payment_index_get_circuit(hash1), OP_EQ, circ1);
+  tt_mem_op(circ1->payment_hash, OP_EQ, hash1, DIGEST256_LEN);
+
+  // A hash bound to a live circuit can't be bound again, and a circuit
+  // can only hold one hash.
+  tt_int_op(payment_index_bind(hash1, circ2), OP_EQ, -1);
+  tt_int_op(payment_index_bind(hash2, circ1), OP_EQ, -1);
+  tt_ptr_op(payment_index_get_circuit(hash1), OP_EQ, circ1);
+  tt_int_op(payment_index_size(), OP_EQ, 1);
+
+  // Once the holder is closing, the hash may be taken over, and unbinding
+  // the old holder doesn't disturb the new binding.
+  TO_CIRCUIT(circ1)->marked_for_close = 1;
+  tt_int_op(payment_index_bind(hash1, circ2), OP_EQ, 0);
+  tt_ptr_op(payment_index_get_circuit(hash1), OP_EQ, circ2);
+  payment_index_unbind(circ1);
+  tt_ptr_op(payment_index_get_circuit(hash1), OP_EQ, circ2);
+
+  // Freeing the circuit releases its hash.
+  circuit_free_(TO_CIRCUIT(circ2));
+  circ2 = NULL;
+  tt_ptr_op(payment_index_get_circuit(hash1), OP_EQ, NULL);
+  tt_int_op(payment_index_size(), OP_EQ, 0);
+
+ done:
+  if (circ1)
+    circuit_free_(TO_CIRCUIT(circ1));
+  if (circ2)
+    circuit_free_(TO_CIRCUIT(circ2));
+  payment_index_free_all();
+}
+
+static void
+test_payment_util_hop_options(void *arg)
+{
+  (void)arg;
+  or_options_t *options = options_new();
+  char *msg = NULL;
+  const char *hash1 =
+    "00112233445566778899aabbccddeeff00112233445566778899aabbccddeeff";
+
+  // Unset and "None" hops have nothing configured.
+  options->ElTorPayHashHop1 = tor_strdup("None");
+  tt_ptr_op(payment_util_get_hop_payhash_option(options, 1), OP_EQ, NULL);
+  tt_ptr_op(payment_util_get_hop_payhash_option(options, 2), OP_EQ, NULL);
+  tt_ptr_op(payment_util_get_hop_payhash_option(options, 0), OP_EQ, NULL);
+  tt_ptr_op(payment_util_get_hop_payhash_option(options,
+                                      PAYMENT_MAX_HOP_OPTIONS + 1),
+            OP_EQ, NULL);
+  tt_int_op(payment_util_options_validate(options, &msg), OP_EQ, 0);
+
+  // Each hop reads its own option.
+  options->ElTorPreimageHop3 = tor_strdup(hash1);
+  options->ElTorPayHashHop8 = tor_strdup(hash1);
+  tt_str_op(payment_util_get_hop_preimage_option(options, 3), OP_EQ, hash1);
+  tt_ptr_op(payment_util_get_hop_payhash_option(options, 3), OP_EQ, NULL);
+  tt_str_op(payment_util_get_hop_payhash_option(options, 8), OP_EQ, hash1);
+  tt_int_op(payment_util_options_validate(options, &msg), OP_EQ, 0);
+
+  // Malformed values are rejected at validation time.
+  tor_free(options->ElTorPayHashHop8);
+  options->ElTorPayHashHop8 = tor_strdup("abcd");
+  tt_int_op(payment_util_options_validate(options, &msg), OP_EQ, -1);
+  tt_str_op(msg, OP_EQ, "ElTorPayHashHop8 must be 64 hexadecimal "
+            "characters or None.");
+
+ done:
+  or_options_free(options);
+  tor_free(msg);
+}
+
+static void
+test_payment_util_verify_preimages(void *arg)
+{
+  (void)arg;
+  const size_t n = 10;
+  uint8_t preimages[10 * PAYMENT_HASH_LEN];
+  uint8_t payhashes[10 * PAYMENT_HASH_LEN];
+  uint8_t ok[10];
+  char *preimages_hex = NULL, *payhashes_hex = NULL;
+
+  for (size_t i = 0; i < n; ++i) {
+    memset(preimages + i * PAYMENT_HASH_LEN, (int) i, PAYMENT_HASH_LEN);
+    crypto_digest256((char *) payhashes + i * PAYMENT_HASH_LEN,
+                     (const char *) preimages + i * PAYMENT_HASH_LEN,
+                     PAYMENT_HASH_LEN, DIGEST_SHA256);
+  }
+
+  tt_uint_op(payment_util_verify_preimages(preimages, payhashes, n, ok),
+             OP_EQ, n);
+  payhashes[3 * PAYMENT_HASH_LEN + 7] ^= 1;
+  preimages[9 * PAYMENT_HASH_LEN] ^= 1;
+  tt_uint_op(payment_util_verify_preimages(preimages, payhashes, n, ok),
+             OP_EQ, n - 2);
+  tt_int_op(ok[0], OP_EQ, 1);
+  tt_int_op(ok[3], OP_EQ, 0);
+  tt_int_op(ok[8], OP_EQ, 1);
+  tt_int_op(ok[9], OP_EQ, 0);
+
+  // The hex variants agree with the binary one.
+  preimages_hex = tor_malloc(sizeof(preimages) * 2 + 1);
+  payhashes_hex = tor_malloc(sizeof(payhashes) * 2 + 1);
+  base16_encode(preimages_hex, sizeof(preimages) * 2 + 1,
+                (const char *) preimages, sizeof(preimages));
+  base16_encode(payhashes_hex, sizeof(payhashes) * 2 + 1,
+                (const char *) payhashes, sizeof(payhashes));
+  tor_strlower(payhashes_hex);
+  tt_int_op(payment_util_verify_preimages_hex(preimages_hex, payhashes_hex,
+                                              n, NULL), OP_EQ, n - 2);
+  tt_int_op(payment_util_verify_preimages_hex(preimages_hex, payhashes_hex,
+                                              n - 1, NULL), OP_EQ, -1);
+  payhashes_hex[64] = '\0';
+  preimages_hex[64] = '\0';
+  tt_int_op(payment_util_verify_preimage(preimages_hex, payhashes_hex),
+            OP_EQ, 1);
+  payhashes_hex[0] = 'x';
+  tt_int_op(payment_util_verify_preimages_hex(preimages_hex, payhashes_hex,
+                                              1, NULL), OP_EQ, -1);
+  tt_int_op(payment_util_verify_preimage(preimages_hex, payhashes_hex),
+            OP_EQ, 0);
+
+ done:
+  tor_free(preimages_hex);
+  tor_free(payhashes_hex);
+}
+
+static void
+test_payment_util_payment_rounds(void *arg)
+{
+  (void)arg;
+  or_options_t *options = options_new();
+  or_circuit_t *paid = NULL, *unpaid = NULL;
+  uint64_t now;
+
+  options->PaymentInterval = 60;
+  options->PaymentInvervalRounds = 3;
+  MOCK(get_options, mock_get_options);
+  mocked_options = options;
+  timers_initialize();
+
+  paid = or_circuit_new(1, NULL);
+  unpaid = or_circuit_new(2, NULL);
+  TO_CIRCUIT(paid)->purpose = CIRCUIT_PURPOSE_OR;
+  TO_CIRCUIT(unpaid)->purpose = CIRCUIT_PURPOSE_OR;
+  payment_rounds_circuit_start(paid);
+  payment_rounds_circuit_start(unpaid);
+  tt_int_op(payment_rounds_n_tracked(), OP_EQ, 2);
+  tt_int_op(paid->payment_round, OP_EQ, 1);
+
+  // Rounds 0 and 1 are not paid rounds.
+  tt_int_op(payment_rounds_mark_paid(paid, 1), OP_EQ, -1);
+  tt_int_op(payment_rounds_mark_paid(paid, PAYMENT_ROUNDS_MAX + 1),
+            OP_EQ, -1);
+
+  // Nothing happens before the first round ends, and the free first
+  // round never closes anything.
+  now = paid->payment_round_deadline_msec;
+  tt_int_op(payment_rounds_run(now - 1, PAYMENT_ROUNDS_BATCH), OP_EQ, 0);
+  tt_int_op(paid->payment_round, OP_EQ, 1);
+  tt_int_op(payment_rounds_run(now, PAYMENT_ROUNDS_BATCH), OP_EQ, 0);
+  tt_int_op(paid->payment_round, OP_EQ, 2);
+  tt_int_op(unpaid->payment_round, OP_EQ, 2);
+
+  // Round 2 ends: its payment is requested but not yet due.
+  now += 60 * 1000;
+  tt_int_op(payment_rounds_run(now, PAYMENT_ROUNDS_BATCH), OP_EQ, 0);
+  tt_int_op(payment_rounds_n_tracked(), OP_EQ, 2);
+
+  // Round 3 ends: the payment for round 2 is due.
+  tt_int_op(payment_rounds_mark_paid(paid, 2), OP_EQ, 0);
+  now += 60 * 1000;
+  tt_int_op(payment_rounds_run(now, PAYMENT_ROUNDS_BATCH), OP_EQ, 1);
+  tt_assert(TO_CIRCUIT(unpaid)->marked_for_close);
+  tt_assert(!TO_CIRCUIT(paid)->marked_for_close);
+  tt_int_op(unpaid->payment_round, OP_EQ, 0);
+  tt_int_op(paid->payment_round, OP_EQ, 4);
+
+  // The grace round after the last one collects the last payment. When it
+  // ends, the circuit has run all its rounds and is closed, even though
+  // everything was paid.
+  tt_int_op(payment_rounds_mark_paid(paid, 3), OP_EQ, 0);
+  now += 60 * 1000;
+  tt_int_op(payment_rounds_run(now - 1, PAYMENT_ROUNDS_BATCH), OP_EQ, 0);
+  tt_assert(!TO_CIRCUIT(paid)->marked_for_close);
+  tt_int_op(payment_rounds_run(now, PAYMENT_ROUNDS_BATCH), OP_EQ, 1);
+  tt_assert(TO_CIRCUIT(paid)->marked_for_close);
+  tt_int_op(TO_CIRCUIT(paid)->marked_for_close_reason, OP_EQ,
+            END_CIRC_REASON_FINISHED);
+  tt_int_op(payment_rounds_n_tracked(), OP_EQ, 0);
+
+  // Freeing a scheduled circuit takes it off the queue.
+  payment_rounds_circuit_start(paid);
+  tt_int_op(payment_rounds_n_tracked(), OP_EQ, 1);
+  circuit_free_(TO_CIRCUIT(paid));
+  paid = NULL;
+  tt_int_op(payment_rounds_n_tracked(), OP_EQ, 0);
+
+ done:
+  if (paid)
+    circuit_free_(TO_CIRCUIT(paid));
+  if (unpaid)
+    circuit_free_(TO_CIRCUIT(unpaid));
+  payment_rounds_free_all();
+  timers_shutdown();
+  UNMOCK(get_options);
+  or_options_free(options);
+}
+
+static void
+test_payment_util_payment_quota(void *arg)
+{
+  (void)arg;
+  or_options_t *options = options_new();
+  or_circuit_t *circ = NULL;
+  uint64_t deadline;
+
+  options->PaymentInterval = 60;
+  options->PaymentInvervalRounds = 2;
+  options->PaymentBandwidthQuota = 3 * CELL_PAYLOAD_SIZE - 1;
+  MOCK(get_options, mock_get_options);
+  mocked_options = options;
+  timers_initialize();
+
+  circ = or_circuit_new(1, NULL);
+  TO_CIRCUIT(circ)->purpose = CIRCUIT_PURPOSE_OR;
+  payment_rounds_circuit_start(circ);
+  tt_uint_op(circ->payment_cell_quota, OP_EQ, 3);
+  tt_uint_op(circ->payment_cells, OP_EQ, 0);
+  deadline = circ->payment_round_deadline_msec;
+
+  // Using up the quota of the free round starts round 2 early.
+  circ->payment_cells = 3;
+  tt_int_op(payment_rounds_quota_reached(circ), OP_EQ, 0);
+  tt_int_op(circ->payment_round, OP_EQ, 2);
+  tt_uint_op(circ->payment_cells, OP_EQ, 0);
+  tt_uint_op(circ->payment_round_deadline_msec, OP_GE, deadline);
+
+  // Round 2 ends on quota too; its payment is due at the end of round 3.
+  tt_int_op(payment_rounds_quota_reached(circ), OP_EQ, 0);
+  tt_int_op(circ->payment_round, OP_EQ, 3);
+
+  // Without the payment for round 2, running out again closes the circuit.
+  tt_int_op(payment_rounds_quota_reached(circ), OP_EQ, 1);
+  tt_assert(TO_CIRCUIT(circ)->marked_for_close);
+  tt_int_op(payment_rounds_n_tracked(), OP_EQ, 0);
+  tt_uint_op(circ->payment_cell_quota, OP_EQ, 0);
+
+  // A circuit that is not metered is never reported again.
+  tt_int_op(payment_rounds_quota_reached(circ), OP_EQ, 0);
+
+ done:
+  if (circ)
+    circuit_free_(TO_CIRCUIT(circ));
+  payment_rounds_free_all();
+  timers_shutdown();
+  UNMOCK(get_options);
+  or_options_free(options);
+}
+
+static void
+test_payment_util_payment_trace(void *arg)
+{
+  uint8_t hash[PAYMENT_HASH_LEN];
+  char *answer = NULL;
+  const char *errmsg = NULL;
+  (void)arg;
+
+  memset(hash, 0xab, sizeof(hash));
+  trace_ring_set_enabled(1);
+  trace_ring_add("first", 7, hash, sizeof(hash));
+  trace_ring_add("second", 8, NULL, 0);
+
+  tt_int_op(getinfo_helper_payment(NULL, "payment/trace", &answer, &errmsg),
+            OP_EQ, 0);
+  tt_assert(answer);
+  tt_assert(strstr(answer, " first 7 ABABABAB"));
+  tt_assert(!strcmpend(answer, " second 8"));
+
+ done:
+  tor_free(answer);
+  trace_ring_free_all();
+}
+
+/** Nodes known to mock_node_get_by_id(). */
+static node_t fake_nodes[2];
+
+static const node_t *
+mock_node_get_by_id(const char *identity_digest)
+{
+  for (unsigned i = 0; i < ARRAY_LENGTH(fake_nodes); ++i) {
+    if (tor_memeq(fake_nodes[i].identity, identity_digest, DIGEST_LEN))
+      return &fake_nodes[i];
+  }
+  return NULL;
+}
+
+static void
+test_payment_util_extendpaidcircuits_parse(void *arg)
+{
+  /* Two values of payment material, then one more round hash. */
+  const char *material =
+    "0101010101010101010101010101010101010101010101010101010101010101"
+    "0202020202020202020202020202020202020202020202020202020202020202";
+  const char *round =
+    "0303030303030303030303030303030303030303030303030303030303030303";
+  char fp[2][HEX_DIGEST_LEN + 1];
+  char *body = NULL, *msg = NULL;
+  smartlist_t *specs = NULL;
+  const paid_circ_spec_t *spec;
+  int code = 0;
+  (void)arg;
+
+  MOCK(node_get_by_id, mock_node_get_by_id);
+  for (unsigned i = 0; i < ARRAY_LENGTH(fake_nodes); ++i) {
+    memset(fake_nodes[i].identity, 0x11 * (i + 1), DIGEST_LEN);
+    /* Only tested for presence. */
+    fake_nodes[i].rs = (routerstatus_t *) &fake_nodes[i];
+    fake_nodes[i].md = (microdesc_t *) &fake_nodes[i];
+    base16_encode(fp[i], sizeof(fp[i]), fake_nodes[i].identity, DIGEST_LEN);
+  }
+
+  // Two circuits, separated by a blank line; CRLF and extra blanks are ok.
+  tor_asprintf(&body, "$%s %s%s\r\n%s  %s\n\n \n%s %s\n",
+               fp[0], material, round, fp[1], material, fp[1], material);
+  specs = extendpaidcircuits_parse(body, strlen(body), &code, &msg);
+  tt_assert(specs);
+  tt_int_op(smartlist_len(specs), OP_EQ, 2);
+  spec = smartlist_get(specs, 0);
+  tt_int_op(spec->n_hops, OP_EQ, 2);
+  tt_ptr_op(spec->hops[0], OP_EQ, &fake_nodes[0]);
+  tt_ptr_op(spec->hops[1], OP_EQ, &fake_nodes[1]);
+  tt_int_op(relay_payments_len(spec->payments), OP_EQ, 2);
+  tt_int_op(relay_payments_find_by_hop_num(spec->payments, 1)->n_payhashes,
+            OP_EQ, 1);
+  tt_int_op(relay_payments_find_by_hop_num(spec->payments, 2)->n_payhashes,
+            OP_EQ, 0);
+  spec = smartlist_get(specs, 1);
+  tt_int_op(spec->n_hops, OP_EQ, 1);
+  tt_ptr_op(spec->hops[0], OP_EQ, &fake_nodes[1]);
+  SMARTLIST_FOREACH(specs, paid_circ_spec_t *, sp, paid_circ_spec_free(sp));
+  smartlist_free(specs);
+  tor_free(body);
+
+  // The body need not be NUL-terminated.
+  tor_asprintf(&body, "%s %sXXXX", fp[0], material);
+  specs = extendpaidcircuits_parse(body, strlen(body) - 4, &code, &msg);
+  tt_assert(specs);
+  SMARTLIST_FOREACH(specs, paid_circ_spec_t *, sp, paid_circ_spec_free(sp));
+  smartlist_free(specs);
+  tor_free(body);
+
+  // Any bad spec rejects the whole command.
+  tor_asprintf(&body, "%s %s\n\n%s %s", fp[0], material, fp[1], round);
+  tt_ptr_op(extendpaidcircuits_parse(body, strlen(body), &code, &msg),
+            OP_EQ, NULL);
+  tt_int_op(code, OP_EQ, 512);
+  tt_assert(!strcmpstart(msg, "Invalid payment material for"));
+  tt_assert(!strcmpend(msg, " in circuit 2"));
+  tor_free(msg);
+  tor_free(body);
+
+  tor_asprintf(&body, "%s %s",
+               "9999999999999999999999999999999999999999", material);
+  tt_ptr_op(extendpaidcircuits_parse(body, strlen(body), &code, &msg),
+            OP_EQ, NULL);
+  tt_int_op(code, OP_EQ, 552);
+  tor_free(msg);
+  tor_free(body);
+
+  tt_ptr_op(extendpaidcircuits_parse("nickname x", 10, &code, &msg),
+            OP_EQ, NULL);
+  tt_int_op(code, OP_EQ, 512);
+  tor_free(msg);
+
+  tt_ptr_op(extendpaidcircuits_parse("\n \n", 3, &code, &msg), OP_EQ, NULL);
+  tt_int_op(code, OP_EQ, 512);
+  tt_str_op(msg, OP_EQ, "No circuit specifications provided");
+
+ done:
+  if (specs) {
+    SMARTLIST_FOREACH(specs, paid_circ_spec_t *, sp, paid_circ_spec_free(sp));
+    smartlist_free(specs);
+  }
+  tor_free(body);
+  tor_free(msg);
+  UNMOCK(node_get_by_id);
+}
+
+/** Circuits launched by mock_paid_circ_spec_launch(). */
+static smartlist_t *pool_launched = NULL;
+
+static origin_circuit_t *
+mock_paid_circ_spec_launch(paid_circ_spec_t *spec, const char **msg_out)
+{
+  origin_circuit_t *circ;
+  (void)spec;
+
+  if (spec->n_hops == 0) {
+    *msg_out = "No hops";
+    return NULL;
+  }
+  circ = origin_circuit_new();
+  TO_CIRCUIT(circ)->purpose = CIRCUIT_PURPOSE_C_GENERAL;
+  circ->build_state = tor_malloc_zero(sizeof(cpath_build_state_t));
+  smartlist_add(pool_launched, circ);
+  return circ;
+}
+
+/** Number of LAUNCHED events seen by mock_circuit_event_status(). */
+static int pool_n_launched_events = 0;
+
+static int
+mock_circuit_event_status(origin_circuit_t *circ, circuit_status_event_t tp,
+                          int reason_code)
+{
+  (void)circ;
+  (void)reason_code;
+  if (tp == CIRC_EVENT_LAUNCHED)
+    ++pool_n_launched_events;
+  return 0;
+}
+
+static void
+test_payment_util_paid_circ_pool(void *arg)
+{
+  or_options_t *options = options_new();
+  smartlist_t *specs = smartlist_new();
+  origin_circuit_t *pooled;
+  char *answer = NULL, *msg = NULL;
+  const char *errmsg = NULL;
+  (void)arg;
+
+  pool_launched = smartlist_new();
+  MOCK(get_options, mock_get_options);
+  MOCK(paid_circ_spec_launch, mock_paid_circ_spec_launch);
+  MOCK(circuit_event_status, mock_circuit_event_status);
+  mocked_options = options;
+  pool_n_launched_events = 0;
+
+  for (int i = 0; i < 5; ++i) {
+    paid_circ_spec_t *spec = paid_circ_spec_new();
+    spec->n_hops = 3;
+    smartlist_add(specs, spec);
+  }
+
+  // Without a pool size, specs wait and nothing is launched.
+  tt_int_op(paid_circ_pool_add_specs(specs), OP_EQ, 0);
+  tt_int_op(smartlist_len(specs), OP_EQ, 0);
+  tt_int_op(paid_circ_pool_n_specs(), OP_EQ, 5);
+  tt_int_op(smartlist_len(pool_launched), OP_EQ, 0);
+
+  // The pool fills up to its size, oldest spec first.
+  options->PaymentCircuitPoolSize = 2;
+  tt_int_op(paid_circ_pool_refill(), OP_EQ, 2);
+  tt_int_op(paid_circ_pool_n_circuits(), OP_EQ, 2);
+  tt_int_op(paid_circ_pool_count_circuits(), OP_EQ, 2);
+  tt_int_op(paid_circ_pool_n_specs(), OP_EQ, 3);
+  tt_int_op(paid_circ_pool_refill(), OP_EQ, 0);
+  tt_int_op(pool_n_launched_events, OP_EQ, 2);
+
+  tt_int_op(getinfo_helper_payment(NULL, "payment/pool", &answer, &errmsg),
+            OP_EQ, 0);
+  tt_str_op(answer, OP_EQ, "circuits=2 specs=3");
+  tor_free(answer);
+
+  // A circuit that can't take streams leaves the pool and is replaced.
+  mark_circuit_unusable_for_new_conns(smartlist_get(pool_launched, 0));
+  tt_int_op(paid_circ_pool_n_circuits(), OP_EQ, 1);
+  tt_int_op(paid_circ_pool_count_circuits(), OP_EQ, 1);
+  tt_int_op(paid_circ_pool_refill(), OP_EQ, 1);
+  tt_int_op(paid_circ_pool_n_specs(), OP_EQ, 2);
+
+  // So does one that closes, or is freed.
+  pooled = smartlist_get(pool_launched, 1);
+  circuit_mark_for_close(TO_CIRCUIT(pooled), END_CIRC_REASON_FINISHED);
+  tt_int_op(paid_circ_pool_n_circuits(), OP_EQ, 1);
+  tt_int_op(paid_circ_pool_count_circuits(), OP_EQ, 1);
+  pooled = smartlist_get(pool_launched, 2);
+  smartlist_del_keeporder(pool_launched, 2);
+  circuit_free_(TO_CIRCUIT(pooled));
+  tt_int_op(paid_circ_pool_n_circuits(), OP_EQ, 0);
+  tt_int_op(paid_circ_pool_count_circuits(), OP_EQ, 0);
+  tt_int_op(paid_circ_pool_refill(), OP_EQ, 2);
+  tt_int_op(paid_circ_pool_n_circuits(), OP_EQ, 2);
+  tt_int_op(paid_circ_pool_count_circuits(), OP_EQ, 2);
+
+  // A spec that fails to launch is used up.
+  options->PaymentCircuitPoolSize = 5;
+  smartlist_add(specs, paid_circ_spec_new());
+  tt_int_op(paid_circ_pool_add_specs(specs), OP_EQ, 0);
+  tt_int_op(paid_circ_pool_n_specs(), OP_EQ, 0);
+  tt_int_op(smartlist_len(pool_launched), OP_EQ, 4);
+  tt_int_op(pool_n_launched_events, OP_EQ, 5);
+  tt_int_op(paid_circ_pool_n_circuits(), OP_EQ, 2);
+  tt_int_op(paid_circ_pool_count_circuits(), OP_EQ, 2);
+
+  // The pool size is bounded.
+  options->PaymentCircuitPoolSize = PAID_CIRC_POOL_MAX_SIZE;
+  tt_int_op(paid_circ_pool_options_validate(options, &msg), OP_EQ, 0);
+  options->PaymentCircuitPoolSize = PAID_CIRC_POOL_MAX_SIZE + 1;
+  tt_int_op(paid_circ_pool_options_validate(options, &msg), OP_EQ, -1);
+  tt_str_op(msg, OP_EQ, "PaymentCircuitPoolSize must be at most 64.");
+
+  // The pool holds at most PAID_CIRC_POOL_MAX_SPECS specs.
+  options->PaymentCircuitPoolSize = 0;
+  for (int i = 0; i <= PAID_CIRC_POOL_MAX_SPECS; ++i)
+    smartlist_add(specs, paid_circ_spec_new());
+  tt_int_op(paid_circ_pool_add_specs(specs), OP_EQ, -1);
+  tt_int_op(paid_circ_pool_n_specs(), OP_EQ, 0);
+
+ done:
+  SMARTLIST_FOREACH(specs, paid_circ_spec_t *, sp, paid_circ_spec_free(sp));
+  smartlist_free(specs);
+  SMARTLIST_FOREACH(pool_launched, origin_circuit_t *, c,
+                    circuit_free_(TO_CIRCUIT(c)));
+  smartlist_free(pool_launched);
+  paid_circ_pool_free_all();
+  tor_free(answer);
+  tor_free(msg);
+  UNMOCK(paid_circ_spec_launch);
+  UNMOCK(circuit_event_status);
+  UNMOCK(get_options);
+  or_options_free(options);
+}
+
+/** Relays for the paid path test: 0 and 1 are guards, 4 and 5 exits. */
+static node_t path_nodes[6];
+static routerstatus_t path_rs[6];
+static routerinfo_t path_ri[6];
+static smartlist_t *path_node_list = NULL;
+
+static const smartlist_t *
+mock_nodelist_get_list(void)
+{
+  return path_node_list;
+}
+
+static const node_t *
+mock_path_node_get_by_id(const char *identity_digest)
+{
+  for (unsigned i = 0; i < ARRAY_LENGTH(path_nodes); ++i) {
+    if (tor_memeq(path_nodes[i].identity, identity_digest, DIGEST_LEN))
+      return &path_nodes[i];
+  }
+  return NULL;
+}
+
+static void
+test_payment_util_paid_path(void *arg)
+{
+  or_options_t *options = options_new();
+  smartlist_t *path = smartlist_new();
+  paid_path_table_t *table = NULL;
+  char *answer = NULL, *expected = NULL;
+  const char *errmsg = NULL;
+  uint64_t fee = 0;
+  (void)arg;
+
+  MOCK(get_options, mock_get_options);
+  MOCK(nodelist_get_list, mock_nodelist_get_list);
+  MOCK(node_get_by_id, mock_path_node_get_by_id);
+  mocked_options = options;
+
+  path_node_list = smartlist_new();
+  for (unsigned i = 0; i < ARRAY_LENGTH(path_nodes); ++i) {
+    node_t *node = &path_nodes[i];
+    memset(node->identity, 0x21 + i, DIGEST_LEN);
+    node->rs = &path_rs[i];
+    node->ri = &path_ri[i];
+    node->is_running = node->is_valid = 1;
+    node->is_possible_guard = i < 2;
+    node->is_exit = i >= 4;
+    path_rs[i].has_bandwidth = 1;
+    /* The cheap relay of each pair is the slow one. */
+    path_rs[i].bandwidth_kb = (i % 2) ? 10000 : 100;
+    path_ri[i].PaymentHandshakeFee = (i % 2) ? 1000 : 100;
+    smartlist_add(path_node_list, node);
+  }
+
+  // The fee covers the handshake and every paid round.
+  path_ri[5].PaymentInterval = 60;
+  path_ri[5].PaymentRateMsats = 10;
+  path_ri[5].PaymentInvervalRounds = 3;
+  tt_u64_op(paid_path_node_fee(&path_nodes[5]), OP_EQ, 1020);
+  path_ri[5].PaymentInvervalRounds = 0;
+  tt_u64_op(paid_path_node_fee(&path_nodes[5]), OP_EQ,
+            1000 + 10 * (PAYMENT_ROUNDS_MAX - 1));
+  path_ri[5].PaymentInterval = 0;
+  tt_u64_op(paid_path_node_fee(&path_nodes[5]), OP_EQ, 1000);
+
+  // Tables hold the allowed relays sorted by fee, with running weights.
+  table = paid_path_table_new(path_node_list, PAID_PATH_EXIT);
+  tt_int_op(table->n_entries, OP_EQ, 2);
+  tt_mem_op(table->entries[0].identity, OP_EQ, path_nodes[4].identity,
+            DIGEST_LEN);
+  tt_u64_op(table->entries[0].fee, OP_EQ, 100);
+  tt_u64_op(table->entries[1].fee, OP_EQ, 1000);
+  tt_u64_op(table->entries[0].cum_weight, OP_GT, 0);
+  tt_u64_op(table->entries[1].cum_weight, OP_GT,
+            table->entries[0].cum_weight);
+  tt_int_op(paid_path_table_n_within(table, 99), OP_EQ, 0);
+  tt_int_op(paid_path_table_n_within(table, 100), OP_EQ, 1);
+  tt_int_op(paid_path_table_n_within(table, UINT64_MAX), OP_EQ, 2);
+  tt_int_op(paid_path_table_pick(table, 99), OP_EQ, -1);
+  for (int i = 0; i < 20; ++i)
+    tt_int_op(paid_path_table_pick(table, 999), OP_EQ, 0);
+  paid_path_table_free(table);
+  table = paid_path_table_new(path_node_list, PAID_PATH_MIDDLE);
+  tt_int_op(table->n_entries, OP_EQ, 6);
+
+  // A tight budget leaves exactly one path.
+  paid_path_tables_mark_dirty();
+  tt_int_op(paid_path_choose(3, 300, path, &fee), OP_EQ, 0);
+  tt_u64_op(fee, OP_EQ, 300);
+  tt_ptr_op(smartlist_get(path, 0), OP_EQ, &path_nodes[0]);
+  tt_ptr_op(smartlist_get(path, 1), OP_EQ, &path_nodes[2]);
+  tt_ptr_op(smartlist_get(path, 2), OP_EQ, &path_nodes[4]);
+  smartlist_clear(path);
+  tt_int_op(paid_path_choose(3, 299, path, &fee), OP_EQ, -1);
+  tt_int_op(smartlist_len(path), OP_EQ, 0);
+
+  // Relays in the same /16 can't share a path when EnforceDistinctSubnets
+  // is set.
+  for (unsigned i = 0; i < ARRAY_LENGTH(path_ri); ++i) {
+    tor_addr_from_ipv4h(&path_ri[i].ipv4_addr, 0x0a000001 + (i << 16));
+    path_ri[i].ipv4_orport = 9001;
+  }
+  tor_addr_from_ipv4h(&path_ri[4].ipv4_addr, 0x0a020002);
+  options->EnforceDistinctSubnets = 1;
+  tt_int_op(paid_path_choose(3, 300, path, &fee), OP_EQ, -1);
+  tt_int_op(smartlist_len(path), OP_EQ, 0);
+  options->EnforceDistinctSubnets = 0;
+  tt_int_op(paid_path_choose(3, 300, path, &fee), OP_EQ, 0);
+  tt_ptr_op(smartlist_get(path, 2), OP_EQ, &path_nodes[4]);
+  smartlist_clear(path);
+  options->EnforceDistinctSubnets = 1;
+  tor_addr_from_ipv4h(&path_ri[4].ipv4_addr, 0x0a040001);
+
+  // Without a budget, hops are distinct and in the right positions.
+  for (int i = 0; i < 20; ++i) {
+    const node_t *g, *m, *e;
+    tt_int_op(paid_path_choose(3, 0, path, &fee), OP_EQ, 0);
+    g = smartlist_get(path, 0);
+    m = smartlist_get(path, 1);
+    e = smartlist_get(path, 2);
+    tt_assert(g->is_possible_guard);
+    tt_assert(e->is_exit);
+    tt_assert(g != m && m != e && g != e);
+    tt_u64_op(fee, OP_EQ, paid_path_node_fee(g) + paid_path_node_fee(m) +
+              paid_path_node_fee(e));
+    smartlist_clear(path);
+  }
+
+  // GETINFO hands out paths within PaymentCircuitMaxFee.
+  options->PaymentCircuitMaxFee = 300;
+  tt_int_op(getinfo_helper_payment(NULL, "payment/paths/2", &answer,
+                                   &errmsg), OP_EQ, 0);
+  tor_asprintf(&expected, "$%s,", hex_str(path_nodes[0].identity,
+                                          DIGEST_LEN));
+  tt_assert(!strcmpstart(answer, expected));
+  tt_assert(strstr(answer, " fee=300\n$"));
+  tor_free(answer);
+  tt_int_op(getinfo_helper_payment(NULL, "payment/paths/0", &answer,
+                                   &errmsg), OP_EQ, -1);
+  tt_ptr_op(answer, OP_EQ, NULL);
+  options->PaymentCircuitMaxFee = 299;
+  tt_int_op(getinfo_helper_payment(NULL, "payment/paths/1", &answer,
+                                   &errmsg), OP_EQ, -1);
+  tt_str_op(errmsg, OP_EQ, "No path within PaymentCircuitMaxFee");
+
+  // Payment terms are only in router descriptors: UseMicrodescriptors auto
+  // fetches those when PaymentCircuitMaxFee is set, and forcing
+  // microdescriptors leaves no paths.
+  options->UseMicrodescriptors = -1;
+  tt_int_op(we_use_microdescriptors_for_circuits(options), OP_EQ, 0);
+  options->UseMicrodescriptors = 1;
+  tt_int_op(we_use_microdescriptors_for_circuits(options), OP_EQ, 1);
+  tt_int_op(getinfo_helper_payment(NULL, "payment/paths/1", &answer,
+                                   &errmsg), OP_EQ, -1);
+  tt_assert(!strcmpstart(errmsg, "We fetch microdescriptors"));
+  options->UseMicrodescriptors = -1;
+  options->PaymentCircuitMaxFee = 0;
+  tt_int_op(we_use_microdescriptors_for_circuits(options), OP_EQ, 1);
+
+ done:
+  paid_path_table_free(table);
+  paid_path_free_all();
+  smartlist_free(path);
+  smartlist_free(path_node_list);
+  tor_free(answer);
+  tor_free(expected);
+  UNMOCK(node_get_by_id);
+  UNMOCK(nodelist_get_list);
+  UNMOCK(get_options);
+  or_options_free(options);
+}
+
+static void
+test_payment_util_payment_metrics(void *arg)
+{
+  or_options_t *options = options_new();
+  or_circuit_t *circ = NULL;
+  buf_t *buf = buf_new();
+  char *output = NULL;
+  size_t sz;
+  uint64_t now;
+  (void)arg;
+
+  options->PaymentInterval = 60;
+  options->PaymentInvervalRounds = 3;
+  MOCK(get_options, mock_get_options);
+  mocked_options = options;
+  timers_initialize();
+
+  payment_metrics_create_cell(1);
+  payment_metrics_create_cell(1);
+  payment_metrics_create_cell(0);
+  tt_i64_op(payment_metrics_get_value(PAYMENT_METRICS_CREATE_PAID), OP_EQ, 2);
+  tt_i64_op(payment_metrics_get_value(PAYMENT_METRICS_CREATE_FREE), OP_EQ, 1);
+
+  circ = or_circuit_new(1, NULL);
+  TO_CIRCUIT(circ)->purpose = CIRCUIT_PURPOSE_OR;
+  payment_rounds_circuit_start(circ);
+
+  // A payment made before its round ends is observed with no latency.
+  tt_int_op(payment_rounds_mark_paid(circ, 2), OP_EQ, 0);
+  tt_i64_op(payment_metrics_get_value(PAYMENT_METRICS_VERIFY_LATENCY),
+            OP_EQ, 1);
+
+  // Using up the quota is counted.
+  tt_int_op(payment_rounds_quota_reached(circ), OP_EQ, 0);
+  tt_i64_op(payment_metrics_get_value(PAYMENT_METRICS_QUOTA_REACHED),
+            OP_EQ, 1);
+
+  // Round 2 was paid for; round 3 was not.
+  now = circ->payment_round_deadline_msec;
+  tt_int_op(payment_rounds_run(now, PAYMENT_ROUNDS_BATCH), OP_EQ, 0);
+  tt_int_op(payment_rounds_run(now + 60 * 1000, PAYMENT_ROUNDS_BATCH),
+            OP_EQ, 0);
+  tt_i64_op(payment_metrics_get_value(PAYMENT_METRICS_UNPAID_CLOSED),
+            OP_EQ, 0);
+  tt_int_op(payment_rounds_run(now + 120 * 1000, PAYMENT_ROUNDS_BATCH),
+            OP_EQ, 1);
+  tt_i64_op(payment_metrics_get_value(PAYMENT_METRICS_UNPAID_CLOSED),
+            OP_EQ, 1);
+
+  payment_metrics_circ_build_time(1500);
+  tt_i64_op(payment_metrics_get_value(PAYMENT_METRICS_CIRC_BUILD_TIME),
+            OP_EQ, 1);
+
+  // Everything is exported through the payment subsystem's store.
+  tt_int_op(smartlist_len(payment_metrics_get_stores()), OP_EQ, 1);
+  metrics_store_get_output(METRICS_FORMAT_PROMETHEUS,
+                           smartlist_get(payment_metrics_get_stores(), 0),
+                           buf);
+  output = buf_get_contents(buf, &sz);
+  tt_assert(strstr(output,
+                   "tor_payment_create_cells_total{payment=\"yes\"} 2\n"));
+  tt_assert(strstr(output,
+                   "tor_payment_create_cells_total{payment=\"no\"} 1\n"));
+  tt_assert(strstr(output,
+                   "tor_payment_circ_build_time_bucket{le=\"2000.00\"} 1\n"));
+  tt_assert(strstr(output,
+                   "tor_payment_circ_build_time_bucket{le=\"1000.00\"} 0\n"));
+
+ done:
+  if (circ)
+    circuit_free_(TO_CIRCUIT(circ));
+  payment_rounds_free_all();
+  payment_metrics_free_all();
+  timers_shutdown();
+  buf_free(buf);
+  tor_free(output);
+  UNMOCK(get_options);
+  or_options_free(options);
+}
+
+static void
+test_payment_util_payment_intern(void *arg)
+{
+  char *copy = tor_strdup("lno1qgsqvgnwgcg35z6ee2h3yczraddm72xrfua9uve2r");
+  const char *a, *b, *c;
+  (void)arg;
+
+  // Equal strings share one copy, wherever they came from.
+  a = payment_intern_string("lno1qgsqvgnwgcg35z6ee2h3yczraddm72xrfua9uve2r");
+  b = payment_intern_string(copy);
+  c = payment_intern_string("elstor@example.com");
+  tt_ptr_op(a, OP_EQ, b);
+  tt_ptr_op(a, OP_NE, copy);
+  tt_ptr_op(a, OP_NE, c);
+  tt_str_op(a, OP_EQ, copy);
+  tt_int_op(payment_intern_size(), OP_EQ, 2);
+
+  // A string lives until its last reference is released.
+  payment_intern_release(a);
+  tt_int_op(payment_intern_size(), OP_EQ, 2);
+  tt_str_op(b, OP_EQ, copy);
+  payment_intern_release(b);
+  tt_int_op(payment_intern_size(), OP_EQ, 1);
+  payment_intern_release(NULL);
+
+  // A released string can be interned again.
+  a = payment_intern_string(copy);
+  tt_int_op(payment_intern_size(), OP_EQ, 2);
+  payment_intern_release(a);
+  payment_intern_release(c);
+  tt_int_op(payment_intern_size(), OP_EQ, 0);
+
+ done:
+  payment_intern_free_all();
+  tor_free(copy);
+}
+
+static void
+test_payment_util_ln_rpc_parse(void *arg)
+{
+  ln_rpc_node_t *node = NULL;
+  config_line_t *lines = NULL;
+  uint8_t hash[DIGEST256_LEN];
+  char *msg = NULL, *uri = NULL, *body = NULL;
+  const char *reply;
+  (void)arg;
+
+  memset(hash, 0xab, sizeof(hash));
+
+  // phoenixd: basic authentication with the http-password, and a GET.
+  node = ln_rpc_node_parse("type=phoenixd url=http://127.0.0.1:9740/ "
+                           "password=pw default=true", &msg);
+  tt_assert(node);
+  tt_int_op(node->backend, OP_EQ, LN_RPC_PHOENIXD);
+  tt_str_op(fmt_addr(&node->addr), OP_EQ, "127.0.0.1");
+  tt_int_op(node->port, OP_EQ, 9740);
+  tt_str_op(node->path, OP_EQ, "");
+  tt_str_op(node->credential, OP_EQ, "Basic OnB3");
+  tt_assert(node->is_default);
+  uri = ln_rpc_request_uri(node, hash);
+  tt_str_op(uri, OP_EQ, "/payments/incoming/abababababababababababababababab"
+            "abababababababababababababababab");
+  tt_ptr_op(ln_rpc_request_body(node, hash), OP_EQ, NULL);
+  tor_free(uri);
+  ln_rpc_node_free(node);
+
+  // cln: a rune, and a listinvoices POST under the url's path.
+  node = ln_rpc_node_parse("type=cln url=http://[::1]:3010/api rune=r1 "
+                           "password=unused", &msg);
+  tt_assert(node);
+  tt_int_op(node->backend, OP_EQ, LN_RPC_CLN);
+  tt_str_op(node->path, OP_EQ, "/api");
+  tt_str_op(node->credential, OP_EQ, "r1");
+  tt_assert(!node->is_default);
+  uri = ln_rpc_request_uri(node, hash);
+  tt_str_op(uri, OP_EQ, "/api/v1/listinvoices");
+  body = ln_rpc_request_body(node, hash);
+  tt_str_op(body, OP_EQ, "{\"payment_hash\":\"abababababababababababababab"
+            "abababababababababababababababababab\"}");
+  tor_free(uri);
+  tor_free(body);
+  ln_rpc_node_free(node);
+
+  // lnd: a hex macaroon, and a GET of the invoice.
+  node = ln_rpc_node_parse("type=LND url=http://127.0.0.1:8080 "
+                           "macaroon=0201ab", &msg);
+  tt_assert(node);
+  tt_int_op(node->backend, OP_EQ, LN_RPC_LND);
+  tt_str_op(node->credential, OP_EQ, "0201ab");
+  uri = ln_rpc_request_uri(node, hash);
+  tt_str_op(uri, OP_EQ, "/v1/invoice/abababababababababababababababab"
+            "abababababababababababababababab");
+  tt_ptr_op(ln_rpc_request_body(node, hash), OP_EQ, NULL);
+  tor_free(uri);
+  ln_rpc_node_free(node);
+
+  // We need a type we can talk to, http, an address rather than a
+  // hostname, a port, and a hex macaroon.
+  static const char *bad[] = {
+    "url=http://127.0.0.1:9740",
+    "type=jsonrpc url=http://127.0.0.1:9740",
+    "type=phoenixd",
+    "type=phoenixd url=https://127.0.0.1:9740",
+    "type=phoenixd url=http://localhost:9740",
+    "type=phoenixd url=http://127.0.0.1/rpc",
+    "type=phoenixd url=http://127.0.0.1:9740 default=maybe",
+    "type=lnd url=http://127.0.0.1:8080 macaroon=secret",
+  };
+  for (size_t i = 0; i < ARRAY_LENGTH(bad); ++i) {
+    tt_ptr_op(ln_rpc_node_parse(bad[i], &msg), OP_EQ, NULL);
+    tt_assert(msg);
+    tor_free(msg);
+  }
+
+  config_line_append(&lines, "PaymentLightningNodeConfig",
+                     "type=cln url=http://127.0.0.1:1 default=true");
+  config_line_append(&lines, "PaymentLightningNodeConfig",
+                     "type=lnd url=http://127.0.0.1:2");
+  tt_int_op(ln_rpc_node_config_validate(lines, &msg), OP_EQ, 0);
+  config_line_append(&lines, "PaymentLightningNodeConfig",
+                     "type=phoenixd url=http://127.0.0.1:3 default=true");
+  tt_int_op(ln_rpc_node_config_validate(lines, &msg), OP_EQ, -1);
+  tt_str_op(msg, OP_EQ,
+            "Only one PaymentLightningNodeConfig can be the default.");
+  tor_free(msg);
+
+#define REPLY(backend, code, s) \
+  ln_rpc_parse_reply((backend), (code), (s), strlen(s))
+
+  // phoenixd says whether the incoming payment is paid; strings can't
+  // fool us, and a payment it has never seen is unpaid.
+  tt_int_op(REPLY(LN_RPC_PHOENIXD, 200, "{\"isPaid\":true}"),
+            OP_EQ, LN_RPC_PAID);
+  reply = "{\"note\":\"\\\"isPaid\\\":true\",\n \"isPaid\" : false}";
+  tt_int_op(REPLY(LN_RPC_PHOENIXD, 200, reply), OP_EQ, LN_RPC_UNPAID);
+  tt_int_op(REPLY(LN_RPC_PHOENIXD, 404, ""), OP_EQ, LN_RPC_UNPAID);
+  tt_int_op(REPLY(LN_RPC_PHOENIXD, 500, "{\"isPaid\":true}"),
+            OP_EQ, LN_RPC_FAILED);
+  tt_int_op(REPLY(LN_RPC_PHOENIXD, 200, "{\"isPaid\":true"),
+            OP_EQ, LN_RPC_FAILED);
+  tt_int_op(REPLY(LN_RPC_PHOENIXD, 200, "{}"), OP_EQ, LN_RPC_FAILED);
+
+  // cln lists the matching invoices, if there are any.
+  reply = "{\"invoices\":[{\"label\":\"x\",\"status\":\"paid\"}]}";
+  tt_int_op(REPLY(LN_RPC_CLN, 201, reply), OP_EQ, LN_RPC_PAID);
+  tt_int_op(REPLY(LN_RPC_CLN, 200, reply), OP_EQ, LN_RPC_PAID);
+  tt_int_op(REPLY(LN_RPC_CLN, 404, reply), OP_EQ, LN_RPC_FAILED);
+  reply = "{\"invoices\":[{\"status\":\"expired\"}]}";
+  tt_int_op(REPLY(LN_RPC_CLN, 201, reply), OP_EQ, LN_RPC_UNPAID);
+  tt_int_op(REPLY(LN_RPC_CLN, 201, "{\"invoices\":[ ]}"),
+            OP_EQ, LN_RPC_UNPAID);
+  tt_int_op(REPLY(LN_RPC_CLN, 201, "{\"invoices\":{}}"),
+            OP_EQ, LN_RPC_FAILED);
+
+  // lnd gives the invoice's state.
+  tt_int_op(REPLY(LN_RPC_LND, 200, "{\"state\":\"SETTLED\"}"),
+            OP_EQ, LN_RPC_PAID);
+  tt_int_op(REPLY(LN_RPC_LND, 200, "{\"state\":\"OPEN\"}"),
+            OP_EQ, LN_RPC_UNPAID);
+  tt_int_op(REPLY(LN_RPC_LND, 404, ""), OP_EQ, LN_RPC_UNPAID);
+  tt_int_op(REPLY(LN_RPC_LND, 200, "{\"state\":1}"), OP_EQ, LN_RPC_FAILED);
+#undef REPLY
+
+ done:
+  ln_rpc_node_free(node);
+  tor_free(msg);
+  tor_free(uri);
+  tor_free(body);
+  config_free_lines(lines);
+}
+
+/** Number of HTTP requests the mock Lightning node has answered. */
+static int mock_node_n_requests = 0;
+/** Authorization header of the last request to the mock node. */
+static char *mock_node_authorization = NULL;
+
+/** Answer a lookup like phoenixd mounted under "/rpc", which has received
+ * every payment whose hash starts with 0xaa and has never seen those whose
+ * hash starts with 0xbb. */
+static void
+mock_node_handle_request(struct evhttp_request *req, void *arg)
+{
+  struct evbuffer *out = evbuffer_new();
+  const char *prefix = "/rpc/payments/incoming/";
+  const char *uri = evhttp_request_get_uri(req), *auth;
+  (void)arg;
+
+  ++mock_node_n_requests;
+  auth = evhttp_find_header(evhttp_request_get_input_headers(req),
+                            "Authorization");
+  tor_free(mock_node_authorization);
+  mock_node_authorization = auth ? tor_strdup(auth) : NULL;
+
+  if (evhttp_request_get_command(req) != EVHTTP_REQ_GET ||
+      strcmpstart(uri, prefix) ||
+      strlen(uri + strlen(prefix)) != HEX_DIGEST256_LEN) {
+    evhttp_send_error(req, HTTP_BADREQUEST, NULL);
+  } else if (!strcmpstart(uri + strlen(prefix), "bb")) {
+    evhttp_send_error(req, HTTP_NOTFOUND, NULL);
+  } else {
+    evbuffer_add_printf(out, "{\"paymentHash\":\"%s\",\"isPaid\":%s}",
+                        uri + strlen(prefix),
+                        strcmpstart(uri + strlen(prefix), "aa") ?
+                        "false" : "true");
+    evhttp_send_reply(req, HTTP_OK, "OK", out);
+  }
+  evbuffer_free(out);
+}
+
+/** Outcome of each lookup made by test_payment_util_ln_rpc_node, by the
+ * second byte of its hash. */
+static ln_rpc_status_t ln_rpc_test_status[256];
+static int ln_rpc_test_n_done = 0;
+
+static void
+ln_rpc_test_cb(const uint8_t *payment_hash, ln_rpc_status_t status,
+               void *arg)
+{
+  (void)arg;
+  ln_rpc_test_status[payment_hash[1]] = status;
+  ++ln_rpc_test_n_done;
+}
+
+/** Mark <b>circ</b> without scheduling the main loop's cleanup, which
+ * this test's event loop can't run. */
+static void
+mock_circuit_mark_for_close_(circuit_t *circ, int reason, int line,
+                             const char *cfile)
+{
+  (void)line;
+  (void)cfile;
+  circ->marked_for_close = 1;
+  circ->marked_for_close_reason = reason;
+}
+
+/** Run the event loop until no lookup is left, or for at most 1000
+ * iterations. */
+static void
+ln_rpc_test_run_loop(void)
+{
+  for (int i = 0; i < 1000 && ln_rpc_n_pending() > 0; ++i)
+    event_base_loop(tor_libevent_get_base(), EVLOOP_ONCE);
+}
+
+/** Lookups made at once by test_payment_util_ln_rpc_node. */
+#define N_LOOKUPS (LN_RPC_N_CONNECTIONS * LN_RPC_MAX_IN_FLIGHT + 6)
+
+static void
+test_payment_util_ln_rpc_node(void *arg)
+{
+  or_options_t *options = options_new();
+  struct evhttp *http = evhttp_new(tor_libevent_get_base());
+  struct evhttp_bound_socket *sock;
+  struct sockaddr_storage ss;
+  socklen_t ss_len = sizeof(ss);
+  config_line_t *lines = NULL;
+  or_circuit_t *paid = NULL, *unpaid = NULL;
+  uint8_t hash[DIGEST256_LEN], id_hashes[2][PAYMENT_HASH_LEN];
+  tor_addr_t addr;
+  uint16_t port;
+  char *value = NULL;
+  uint64_t now;
+  (void)arg;
+
+  options->PaymentInterval = 60;
+  options->PaymentInvervalRounds = 3;
+  MOCK(get_options, mock_get_options);
+  MOCK(circuit_mark_for_close_, mock_circuit_mark_for_close_);
+  mocked_options = options;
+  timers_initialize();
+
+  evhttp_set_gencb(http, mock_node_handle_request, NULL);
+  sock = evhttp_bind_socket_with_handle(http, "127.0.0.1", 0);
+  tt_assert(sock);
+  tt_int_op(getsockname(evhttp_bound_socket_get_fd(sock),
+                        (struct sockaddr *) &ss, &ss_len), OP_EQ, 0);
+  tt_int_op(tor_addr_from_sockaddr(&addr, (struct sockaddr *) &ss, &port),
+            OP_EQ, 0);
+  tor_asprintf(&value, "type=phoenixd url=http://127.0.0.1:%u/rpc "
+               "password=pw", port);
+  config_line_append(&lines, "PaymentLightningNodeConfig", value);
+  ln_rpc_set_node_config(lines);
+  tt_assert(ln_rpc_is_configured());
+
+  // More lookups than the connections take at once: none go out before
+  // the end of the loop turn, the rest wait for room, and each is one
+  // request.
+  for (int i = 0; i < N_LOOKUPS; ++i) {
+    memset(hash, 0, sizeof(hash));
+    hash[0] = (i % 3 == 0) ? 0xaa : (i % 3 == 1) ? 0xbb : 0;
+    hash[1] = (uint8_t) i;
+    ln_rpc_lookup_payment(hash, ln_rpc_test_cb, NULL);
+  }
+  tt_int_op(ln_rpc_test_n_done, OP_EQ, 0);
+  ln_rpc_test_run_loop();
+  tt_int_op(ln_rpc_test_n_done, OP_EQ, N_LOOKUPS);
+  tt_int_op(mock_node_n_requests, OP_EQ, N_LOOKUPS);
+  tt_str_op(mock_node_authorization, OP_EQ, "Basic OnB3");
+  for (int i = 0; i < N_LOOKUPS; ++i) {
+    tt_int_op(ln_rpc_test_status[i], OP_EQ,
+              i % 3 == 0 ? LN_RPC_PAID : LN_RPC_UNPAID);
+  }
+
+  // A round payment the controller didn't confirm is looked up with the
+  // node by its payment id hash.
+  paid = or_circuit_new(1, NULL);
+  unpaid = or_circuit_new(2, NULL);
+  TO_CIRCUIT(paid)->purpose = CIRCUIT_PURPOSE_OR;
+  TO_CIRCUIT(unpaid)->purpose = CIRCUIT_PURPOSE_OR;
+  memset(hash, 1, sizeof(hash));
+  tt_int_op(payment_index_bind(hash, paid), OP_EQ, 0);
+  memset(hash, 2, sizeof(hash));
+  tt_int_op(payment_index_bind(hash, unpaid), OP_EQ, 0);
+  memset(id_hashes, 0, sizeof(id_hashes));
+  payment_rounds_set_id_hashes(unpaid, id_hashes[0], 2);
+  id_hashes[1][0] = 0xaa;
+  payment_rounds_set_id_hashes(paid, id_hashes[0], 2);
+  // Round 1 is free: only the hash for round 2 is kept.
+  tt_int_op(paid->n_payment_id_hashes, OP_EQ, 1);
+  tt_mem_op(paid->payment_id_hashes, OP_EQ, id_hashes[1], PAYMENT_HASH_LEN);
+  payment_rounds_circuit_start(paid);
+  payment_rounds_circuit_start(unpaid);
+
+  // The circuits keep running while we wait for the node.
+  now = paid->payment_round_deadline_msec;
+  tt_int_op(payment_rounds_run(now, PAYMENT_ROUNDS_BATCH), OP_EQ, 0);
+  tt_int_op(payment_rounds_run(now + 60 * 1000, PAYMENT_ROUNDS_BATCH),
+            OP_EQ, 0);
+  tt_int_op(payment_rounds_run(now + 120 * 1000, PAYMENT_ROUNDS_BATCH),
+            OP_EQ, 0);
+  tt_int_op(ln_rpc_n_pending(), OP_EQ, 2);
+  tt_assert(!TO_CIRCUIT(unpaid)->marked_for_close);
+  ln_rpc_test_run_loop();
+  tt_int_op(ln_rpc_n_pending(), OP_EQ, 0);
+  tt_int_op(mock_node_n_requests, OP_EQ, N_LOOKUPS + 2);
+  tt_assert(TO_CIRCUIT(unpaid)->marked_for_close);
+  tt_assert(!TO_CIRCUIT(paid)->marked_for_close);
+  tt_int_op(paid->payment_rounds_paid, OP_EQ, 1u << 2);
+
+ done:
+  if (paid)
+    circuit_free_(TO_CIRCUIT(paid));
+  if (unpaid)
+    circuit_free_(TO_CIRCUIT(unpaid));
+  ln_rpc_free_all();
+  payment_rounds_free_all();
+  payment_index_free_all();
+  evhttp_free(http);
+  timers_shutdown();
+  tor_free(mock_node_authorization);
+  tor_free(value);
+  config_free_lines(lines);
+  UNMOCK(circuit_mark_for_close_);
+  UNMOCK(get_options);
+  or_options_free(options);
+}
+
 // TODO El Tor client and relay flows with new relay payments struct
 // 1. client_get_circ_payhashes_from_rpc(rpc)
 // 2. client_get_hop_payhashes_from_circ_payhashes(circ->payhash)
@@ -117,4 +1440,19 @@ done:
   {#name, test_payment_util_##name, TT_FORK, NULL, NULL}
 
 struct testcase_t payment_tests[] = {PAYMENT_TESTS(relay_payments_basic),
+                                     PAYMENT_TESTS(parse_payment_line),
+                                     PAYMENT_TESTS(payhash_ext),
+                                     PAYMENT_TESTS(payment_index),
+                                     PAYMENT_TESTS(hop_options),
+                                     PAYMENT_TESTS(verify_preimages),
+                                     PAYMENT_TESTS(payment_rounds),
+                                     PAYMENT_TESTS(payment_quota),
+                                     PAYMENT_TESTS(payment_trace),
+                                     PAYMENT_TESTS(extendpaidcircuits_parse),
+                                     PAYMENT_TESTS(paid_circ_pool),
+                                     PAYMENT_TESTS(paid_path),
+                                     PAYMENT_TESTS(payment_metrics),
+                                     PAYMENT_TESTS(payment_intern),
+                                     PAYMENT_TESTS(ln_rpc_parse),
+                                     PAYMENT_TESTS(ln_rpc_node),
                                      END_OF_TESTCASES};
@@ -6,6 +6,7 @@
  * \brief Test our smaller buffer-based protocol functions
  */
 
+#define BUFFERS_PRIVATE
 #include "core/or/or.h"
 #include "test/test.h"
 #include "lib/buf/buffers.h"
@@ -15,6 +16,7 @@
 #include "core/proto/proto_control0.h"
 #include "core/proto/proto_ext_or.h"
 
+#include "core/or/cell_st.h"
 #include "core/or/var_cell_st.h"
 
 static void
@@ -254,8 +256,56 @@ test_proto_line(void *arg)
   buf_free(buf);
 }
 
+static void
+test_proto_fixed_cell(void *arg)
+{
+  (void)arg;
+  char tmp[CELL_MAX_NETWORK_SIZE];
+  buf_t *buf = NULL;
+  cell_t cell;
+
+  buf = buf_new();
+
+  /* A cell with narrow circuit IDs, all in one chunk. */
+  memset(tmp, 0x5a, sizeof(tmp));
+  memcpy(tmp, "\x12\x34\x03", 3);
+  buf_add(buf, tmp, CELL_MAX_NETWORK_SIZE - 3);
+  tt_int_op(0, OP_EQ, fetch_cell_from_buf(buf, &cell, 0));
+  buf_add(buf, tmp + CELL_MAX_NETWORK_SIZE - 3, 1);
+  tt_int_op(1, OP_EQ, fetch_cell_from_buf(buf, &cell, 0));
+  tt_uint_op(cell.circ_id, OP_EQ, 0x1234);
+  tt_int_op(cell.command, OP_EQ, CELL_RELAY);
+  tt_mem_op(cell.payload, OP_EQ, tmp + 3, CELL_PAYLOAD_SIZE);
+  tt_int_op(buf_datalen(buf), OP_EQ, 0);
+
+  /* A cell with wide circuit IDs that spans two chunks, followed by one that
+   * sits in the second chunk. */
+  memcpy(tmp, "\x80\x00\x00\x07\x05", 5);
+  buf_add(buf, tmp, 300);
+  buf_add_chunk_with_capacity(buf, 4096, 1);
+  buf_add(buf, tmp + 300, CELL_MAX_NETWORK_SIZE - 300);
+  tmp[4] = CELL_DESTROY;
+  buf_add(buf, tmp, CELL_MAX_NETWORK_SIZE);
+  tt_ptr_op(buf->head->next, OP_NE, NULL);
+  tt_int_op(buf->head->datalen, OP_EQ, 300);
+
+  tt_int_op(1, OP_EQ, fetch_cell_from_buf(buf, &cell, 1));
+  tt_uint_op(cell.circ_id, OP_EQ, 0x80000007);
+  tt_int_op(cell.command, OP_EQ, CELL_CREATE_FAST);
+  tt_mem_op(cell.payload, OP_EQ, tmp + 5, CELL_PAYLOAD_SIZE);
+  tt_int_op(1, OP_EQ, fetch_cell_from_buf(buf, &cell, 1));
+  tt_uint_op(cell.circ_id, OP_EQ, 0x80000007);
+  tt_int_op(cell.command, OP_EQ, CELL_DESTROY);
+  tt_int_op(buf_datalen(buf), OP_EQ, 0);
+  tt_int_op(0, OP_EQ, fetch_cell_from_buf(buf, &cell, 1));
+
+ done:
+  buf_free(buf);
+}
+
 struct testcase_t proto_misc_tests[] = {
   { "var_cell", test_proto_var_cell, 0, NULL, NULL },
+  { "fixed_cell", test_proto_fixed_cell, 0, NULL, NULL },
   { "control0", test_proto_control0, 0, NULL, NULL },
   { "ext_or_cmd", test_proto_ext_or_cmd, TT_FORK, NULL, NULL },
   { "line", test_proto_line, 0, NULL, NULL },
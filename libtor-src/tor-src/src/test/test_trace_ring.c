@@ -0,0 +1,94 @@
+/* See LICENSE for licensing information */
+
+/**
+ * \file test_trace_ring.c
+ * \brief Tests for the in-memory trace records.
+ */
+
+#include "core/or/or.h"
+#include "test/test.h"
+
+#include "lib/trace/trace_ring.h"
+
+static void
+test_trace_ring_record(void *arg)
+{
+  uint8_t data[TRACE_RECORD_DATA_LEN + 8];
+  trace_record_t *recs = NULL;
+  size_t n = 0;
+  (void)arg;
+
+  memset(data, 0xab, sizeof(data));
+
+  // Nothing is recorded while tracing is off.
+  trace_ring_add("off", 1, NULL, 0);
+  recs = trace_ring_snapshot(&n);
+  tt_uint_op(n, OP_EQ, 0);
+  tor_free(recs);
+
+  trace_ring_set_enabled(1);
+  trace_ring_add("first", 7, data, 32);
+  trace_ring_add("second", 8, NULL, 0);
+  trace_ring_add("long", 9, data, sizeof(data));
+  recs = trace_ring_snapshot(&n);
+  tt_uint_op(n, OP_EQ, 3);
+  tt_str_op(recs[0].event, OP_EQ, "first");
+  tt_u64_op(recs[0].arg, OP_EQ, 7);
+  tt_uint_op(recs[0].data_len, OP_EQ, 32);
+  tt_mem_op(recs[0].data, OP_EQ, data, 32);
+  tt_str_op(recs[1].event, OP_EQ, "second");
+  tt_uint_op(recs[1].data_len, OP_EQ, 0);
+  // Data that doesn't fit is cut short.
+  tt_str_op(recs[2].event, OP_EQ, "long");
+  tt_uint_op(recs[2].data_len, OP_EQ, TRACE_RECORD_DATA_LEN);
+  tt_uint_op(recs[0].thread, OP_EQ, recs[2].thread);
+  tt_u64_op(recs[0].usec, OP_LE, recs[2].usec);
+
+ done:
+  tor_free(recs);
+  trace_ring_free_all();
+}
+
+static void
+test_trace_ring_wrap(void *arg)
+{
+  trace_record_t *recs = NULL;
+  size_t n = 0;
+  (void)arg;
+
+  trace_ring_set_enabled(1);
+
+  // The ring keeps the newest TRACE_RING_LEN records.
+  trace_ring_add("old", 0, NULL, 0);
+  for (int i = 0; i < TRACE_RING_LEN + 5; ++i)
+    trace_ring_add("wrap", i, NULL, 0);
+  recs = trace_ring_snapshot(&n);
+  tt_uint_op(n, OP_EQ, TRACE_RING_LEN);
+  for (size_t i = 0; i < n; ++i)
+    tt_str_op(recs[i].event, OP_EQ, "wrap");
+  tor_free(recs);
+
+  // Records survive turning tracing off, but no new ones are added.
+  trace_ring_set_enabled(0);
+  trace_ring_add("off", 1, NULL, 0);
+  recs = trace_ring_snapshot(&n);
+  tt_uint_op(n, OP_EQ, TRACE_RING_LEN);
+  tor_free(recs);
+
+  // Once freed, nothing is left and nothing is recorded.
+  trace_ring_free_all();
+  trace_ring_set_enabled(1);
+  trace_ring_add("freed", 1, NULL, 0);
+  recs = trace_ring_snapshot(&n);
+  tt_uint_op(n, OP_EQ, 0);
+
+ done:
+  tor_free(recs);
+  trace_ring_free_all();
+}
+
+struct testcase_t trace_ring_tests[] = {
+  { "record", test_trace_ring_record, TT_FORK, NULL, NULL },
+  { "wrap", test_trace_ring_wrap, TT_FORK, NULL, NULL },
+  END_OF_TESTCASES
+};
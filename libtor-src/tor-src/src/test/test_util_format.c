@@ -276,6 +276,16 @@ test_util_format_base16_decode(void *ignored)
   tt_int_op(res, OP_EQ, 7);
   tt_mem_op(real_dst, OP_EQ, expected, 7);
 
+  /* Every byte value decodes as a hex digit iff it is one. */
+  for (i=0;i<256;i++) {
+    int digit = -1;
+    if (TOR_ISDIGIT((char)i))
+      digit = i - '0';
+    else if (TOR_ISXDIGIT((char)i))
+      digit = TOR_TOLOWER(i) - 'a' + 10;
+    tt_int_op(hex_decode_digit((char)i), OP_EQ, digit);
+  }
+
  done:
   tor_free(src);
   tor_free(dst);